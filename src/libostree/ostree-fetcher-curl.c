@@ -98,9 +98,12 @@ struct FetcherRequest {
   guint64 max_size;
   OstreeFetcherRequestFlags flags;
   gboolean is_membuf;
+  guint64 range_start;
+  guint64 range_length; /* If nonzero, only fetch this byte range */
   GError *caught_write_error;
   OtTmpfile tmpf;
   GString *output_buf;
+  OstreeFetcherRequestTiming timing;
 
   CURL *easy;
   char error[CURL_ERROR_SIZE];
@@ -277,6 +280,26 @@ ensure_tmpfile (FetcherRequest *req, GError **error)
     }
   return TRUE;
 }
+/* Add the phases of the transfer that just finished on @easy to the
+ * request; one which moves on to another mirror sums all attempts.
+ */
+static void
+request_record_timing (FetcherRequest *req,
+                       CURL           *easy)
+{
+  double connect = 0, appconnect = 0, starttransfer = 0, total = 0;
+
+  curl_easy_getinfo (easy, CURLINFO_CONNECT_TIME, &connect);
+  curl_easy_getinfo (easy, CURLINFO_APPCONNECT_TIME, &appconnect);
+  curl_easy_getinfo (easy, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+  curl_easy_getinfo (easy, CURLINFO_TOTAL_TIME, &total);
+
+  req->timing.connect_usec += (guint64) (MAX (connect, appconnect) * G_USEC_PER_SEC);
+  req->timing.ttfb_usec += (guint64) (starttransfer * G_USEC_PER_SEC);
+  if (total > starttransfer)
+    req->timing.transfer_usec += (guint64) ((total - starttransfer) * G_USEC_PER_SEC);
+}
+
 /* Check for completed transfers, and remove their easy handles */
 static void
 check_multi_info (OstreeFetcher *fetcher)
@@ -307,6 +330,8 @@ check_multi_info (OstreeFetcher *fetcher)
       g_assert (is_file || g_str_has_prefix (eff_url, "http"));
 
       req = g_task_get_task_data (task);
+      /* Before returning the task, since that may invoke the callback */
+      request_record_timing (req, easy);
 
       if (req->caught_write_error)
         g_task_return_error (task, g_steal_pointer (&req->caught_write_error));
@@ -363,6 +388,17 @@ check_multi_info (OstreeFetcher *fetcher)
                   continued_request = TRUE;
                 }
             }
+          else if (req->range_length > 0 && !is_file && response != 206)
+            {
+              g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                       "Range request for %s was not honored", eff_url);
+            }
+          else if (req->range_length > 0 && req->output_buf->len != req->range_length)
+            {
+              g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                       "Range request returned %" G_GSIZE_FORMAT " bytes, expected %" G_GUINT64_FORMAT,
+                                       req->output_buf->len, req->range_length);
+            }
           else if (req->is_membuf)
             {
               GBytes *ret;
@@ -779,6 +815,13 @@ initiate_next_curl_request (FetcherRequest *req,
   /* wait for pipe connection to confirm */
   curl_easy_setopt (req->easy, CURLOPT_PIPEWAIT, 1L);
 #endif
+  if (req->range_length > 0)
+    {
+      g_autofree char *range = g_strdup_printf ("%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+                                                req->range_start,
+                                                req->range_start + req->range_length - 1);
+      curl_easy_setopt (req->easy, CURLOPT_RANGE, range);
+    }
   curl_easy_setopt (req->easy, CURLOPT_WRITEFUNCTION, write_cb);
   if (g_getenv ("OSTREE_DEBUG_HTTP"))
     curl_easy_setopt (req->easy, CURLOPT_VERBOSE, 1L);
@@ -807,6 +850,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                OstreeFetcherRequestFlags flags,
                                gboolean               is_membuf,
                                guint64                max_size,
+                               guint64                range_start,
+                               guint64                range_length,
                                int                    priority,
                                GCancellable          *cancellable,
                                GAsyncReadyCallback    callback,
@@ -839,6 +884,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   req->max_size = max_size;
   req->flags = flags;
   req->is_membuf = is_membuf;
+  req->range_start = range_start;
+  req->range_length = range_length;
   /* We'll allocate the tmpfile on demand, so we handle
    * file I/O errors just in the write func.
    */
@@ -873,7 +920,7 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     gpointer               user_data)
 {
   _ostree_fetcher_request_async (self, mirrorlist, filename, 0, FALSE,
-                                 max_size, priority, cancellable,
+                                 max_size, 0, 0, priority, cancellable,
                                  callback, user_data);
 }
 
@@ -916,7 +963,28 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    gpointer               user_data)
 {
   _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
-                                 max_size, priority, cancellable,
+                                 max_size, 0, 0, priority, cancellable,
+                                 callback, user_data);
+}
+
+void
+_ostree_fetcher_request_range_to_membuf (OstreeFetcher         *self,
+                                         GPtrArray             *mirrorlist,
+                                         const char            *filename,
+                                         guint64                offset,
+                                         guint64                length,
+                                         int                    priority,
+                                         GCancellable          *cancellable,
+                                         GAsyncReadyCallback    callback,
+                                         gpointer               user_data)
+{
+  g_return_if_fail (length > 0);
+
+  /* Capping max_size at the range length means a server which ignores
+   * the Range header and sends the whole file is cut off early.
+   */
+  _ostree_fetcher_request_async (self, mirrorlist, filename, 0, TRUE,
+                                 length, offset, length, priority, cancellable,
                                  callback, user_data);
 }
 
@@ -952,3 +1020,16 @@ _ostree_fetcher_bytes_transferred (OstreeFetcher       *self)
 {
   return self->bytes_transferred;
 }
+
+void
+_ostree_fetcher_request_get_timing (OstreeFetcher              *self,
+                                    GAsyncResult               *result,
+                                    OstreeFetcherRequestTiming *out_timing)
+{
+  FetcherRequest *req;
+
+  g_return_if_fail (g_task_is_valid (result, self));
+
+  req = g_task_get_task_data ((GTask*)result);
+  *out_timing = req->timing;
+}
@@ -100,6 +100,18 @@ typedef struct {
   guint64 max_size;
   guint64 current_size;
   guint64 content_length;
+
+  /* If range_length is nonzero, only fetch that byte range */
+  guint64 range_start;
+  guint64 range_length;
+
+  /* Monotonic times for the current attempt; earlier attempts against
+   * other mirrors have already been summed into timing.
+   */
+  gint64 start_time;
+  gint64 connect_start_time;
+  gint64 first_byte_time;
+  OstreeFetcherRequestTiming timing;
 } OstreeFetcherPendingURI;
 
 /* Used by session_thread_idle_add() */
@@ -391,6 +403,48 @@ session_thread_set_tls_database_cb (ThreadClosure *thread_closure,
 static void
 on_request_sent (GObject        *object, GAsyncResult   *result, gpointer        user_data);
 
+/* Only emitted when a new connection is made, not when one is reused */
+static void
+on_network_event (SoupMessage        *msg,
+                  GSocketClientEvent  event,
+                  GIOStream          *connection,
+                  gpointer            user_data)
+{
+  OstreeFetcherPendingURI *pending = user_data;
+
+  if (event == G_SOCKET_CLIENT_RESOLVING)
+    pending->connect_start_time = g_get_monotonic_time ();
+  else if (event == G_SOCKET_CLIENT_COMPLETE && pending->connect_start_time > 0)
+    {
+      pending->timing.connect_usec += g_get_monotonic_time () - pending->connect_start_time;
+      pending->connect_start_time = 0;
+    }
+}
+
+static void
+pending_uri_start_attempt (OstreeFetcherPendingURI *pending)
+{
+  pending->start_time = g_get_monotonic_time ();
+  pending->connect_start_time = 0;
+  pending->first_byte_time = 0;
+
+  if (SOUP_IS_REQUEST_HTTP (pending->request))
+    {
+      glnx_unref_object SoupMessage *msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
+      g_signal_connect (msg, "network-event", G_CALLBACK (on_network_event), pending);
+    }
+}
+
+static void
+pending_uri_end_attempt (OstreeFetcherPendingURI *pending)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 first_byte_time = pending->first_byte_time > 0 ? pending->first_byte_time : now;
+
+  pending->timing.ttfb_usec += first_byte_time - pending->start_time;
+  pending->timing.transfer_usec += now - first_byte_time;
+}
+
 static void
 start_pending_request (ThreadClosure *thread_closure,
                        GTask         *task)
@@ -405,6 +459,7 @@ start_pending_request (ThreadClosure *thread_closure,
   cancellable = g_task_get_cancellable (task);
 
   g_hash_table_add (thread_closure->outstanding, pending_uri_ref (pending));
+  pending_uri_start_attempt (pending);
   soup_request_send_async (pending->request,
                            cancellable,
                            on_request_sent,
@@ -470,6 +525,14 @@ session_thread_request_uri (ThreadClosure *thread_closure,
 
   if (pending->is_membuf)
     {
+      if (pending->range_length > 0 && SOUP_IS_REQUEST_HTTP (pending->request))
+        {
+          glnx_unref_object SoupMessage *msg = soup_request_http_get_message ((SoupRequestHTTP*) pending->request);
+          soup_message_headers_set_range (msg->request_headers, pending->range_start,
+                                          pending->range_start + pending->range_length - 1);
+        }
+
+      pending_uri_start_attempt (pending);
       soup_request_send_async (pending->request,
                                cancellable,
                                on_request_sent,
@@ -885,6 +948,14 @@ finish_stream (OstreeFetcherPendingURI *pending,
 
   pending->state = OSTREE_FETCHER_STATE_COMPLETE;
 
+  if (pending->range_length > 0 && pending->current_size != pending->range_length)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Range request returned %" G_GUINT64_FORMAT " bytes, expected %" G_GUINT64_FORMAT,
+                   pending->current_size, pending->range_length);
+      goto out;
+    }
+
   if (!pending->is_membuf)
     {
       if (stbuf.st_size < pending->content_length)
@@ -982,6 +1053,7 @@ on_stream_read (GObject        *object,
     {
       if (!finish_stream (pending, cancellable, &local_error))
         goto out;
+      pending_uri_end_attempt (pending);
       if (pending->is_membuf)
         {
           g_task_return_pointer (task,
@@ -1052,6 +1124,7 @@ on_request_sent (GObject        *object,
   GError *local_error = NULL;
   glnx_unref_object SoupMessage *msg = NULL;
 
+  pending->first_byte_time = g_get_monotonic_time ();
   pending->state = OSTREE_FETCHER_STATE_COMPLETE;
   pending->request_body = soup_request_send_finish ((SoupRequest*) object,
                                                    result, &local_error);
@@ -1068,6 +1141,7 @@ on_request_sent (GObject        *object,
         {
           // We already have the whole file, so just use it.
           pending->state = OSTREE_FETCHER_STATE_COMPLETE;
+          pending_uri_end_attempt (pending);
           (void) g_input_stream_close (pending->request_body, NULL, NULL);
           g_task_return_pointer (task,
                                  g_strdup (pending->out_tmpfile),
@@ -1080,6 +1154,7 @@ on_request_sent (GObject        *object,
           /* is there another mirror we can try? */
           if (pending->mirrorlist_idx + 1 < pending->mirrorlist->len)
             {
+              pending_uri_end_attempt (pending);
               pending->mirrorlist_idx++;
               create_pending_soup_request (pending, &local_error);
               if (local_error != NULL)
@@ -1137,6 +1212,19 @@ on_request_sent (GObject        *object,
         }
     }
 
+  /* We don't want to download a whole pack just to slice out a range
+   * of it; let the caller fall back to something else instead.
+   */
+  if (pending->range_length > 0 &&
+      !(msg && msg->status_code == SOUP_STATUS_PARTIAL_CONTENT))
+    {
+      g_autofree char *uristring
+        = soup_uri_to_string (soup_request_get_uri (pending->request), FALSE);
+      local_error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 "Range request for %s was not honored", uristring);
+      goto out;
+    }
+
   pending->state = OSTREE_FETCHER_STATE_DOWNLOADING;
   
   pending->content_length = soup_request_get_content_length (pending->request);
@@ -1199,6 +1287,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                OstreeFetcherRequestFlags flags,
                                gboolean               is_membuf,
                                guint64                max_size,
+                               guint64                range_start,
+                               guint64                range_length,
                                int                    priority,
                                GCancellable          *cancellable,
                                GAsyncReadyCallback    callback,
@@ -1220,6 +1310,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   pending->flags = flags;
   pending->max_size = max_size;
   pending->is_membuf = is_membuf;
+  pending->range_start = range_start;
+  pending->range_length = range_length;
 
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, _ostree_fetcher_request_async);
@@ -1245,7 +1337,7 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     gpointer               user_data)
 {
   _ostree_fetcher_request_async (self, mirrorlist, filename, 0, FALSE,
-                                 max_size, priority, cancellable,
+                                 max_size, 0, 0, priority, cancellable,
                                  callback, user_data);
 }
 
@@ -1288,7 +1380,30 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    gpointer               user_data)
 {
   _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
-                                 max_size, priority, cancellable,
+                                 max_size, 0, 0, priority, cancellable,
+                                 callback, user_data);
+}
+
+/* Fetch @length bytes at @offset of @filename into a memory buffer;
+ * complete with _ostree_fetcher_request_to_membuf_finish().  If the
+ * server doesn't support range requests, this fails with
+ * %G_IO_ERROR_NOT_SUPPORTED rather than downloading the whole file.
+ */
+void
+_ostree_fetcher_request_range_to_membuf (OstreeFetcher         *self,
+                                         GPtrArray             *mirrorlist,
+                                         const char            *filename,
+                                         guint64                offset,
+                                         guint64                length,
+                                         int                    priority,
+                                         GCancellable          *cancellable,
+                                         GAsyncReadyCallback    callback,
+                                         gpointer               user_data)
+{
+  g_return_if_fail (length > 0);
+
+  _ostree_fetcher_request_async (self, mirrorlist, filename, 0, TRUE,
+                                 length, offset, length, priority, cancellable,
                                  callback, user_data);
 }
 
@@ -1350,3 +1465,17 @@ _ostree_fetcher_bytes_transferred (OstreeFetcher       *self)
 
   return ret;
 }
+
+void
+_ostree_fetcher_request_get_timing (OstreeFetcher              *self,
+                                    GAsyncResult               *result,
+                                    OstreeFetcherRequestTiming *out_timing)
+{
+  OstreeFetcherPendingURI *pending;
+
+  g_return_if_fail (g_task_is_valid (result, self));
+
+  /* The session thread is done with the request once it has returned */
+  pending = g_task_get_task_data ((GTask*)result);
+  *out_timing = pending->timing;
+}
@@ -108,6 +108,20 @@ void _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
 
 guint64 _ostree_fetcher_bytes_transferred (OstreeFetcher       *self);
 
+/* Where the time of a completed request went, in microseconds.  Time
+ * to first byte is measured from starting the request, so it includes
+ * connecting; connect_usec is zero if an existing connection was reused.
+ */
+typedef struct {
+  guint64 connect_usec;
+  guint64 ttfb_usec;
+  guint64 transfer_usec;
+} OstreeFetcherRequestTiming;
+
+void _ostree_fetcher_request_get_timing (OstreeFetcher              *self,
+                                         GAsyncResult               *result,
+                                         OstreeFetcherRequestTiming *out_timing);
+
 void _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                          GPtrArray             *mirrorlist,
                                          const char            *filename,
@@ -141,6 +155,16 @@ gboolean _ostree_fetcher_request_to_membuf_finish (OstreeFetcher *self,
                                                    GBytes       **out_buf,
                                                    GError       **error);
 
+void _ostree_fetcher_request_range_to_membuf (OstreeFetcher         *self,
+                                              GPtrArray             *mirrorlist,
+                                              const char            *filename,
+                                              guint64                offset,
+                                              guint64                length,
+                                              int                    priority,
+                                              GCancellable          *cancellable,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data);
+
 
 G_END_DECLS
 
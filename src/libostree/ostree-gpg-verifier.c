@@ -30,6 +30,8 @@
 #include "otutil.h"
 
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <glib/gstdio.h>
 
 typedef struct {
@@ -41,6 +43,11 @@ struct OstreeGpgVerifier {
 
   GList *keyrings;
   GPtrArray *key_ascii_files;
+
+  /* See _ostree_gpg_verifier_set_home_cache_dir() */
+  char *home_cache_dir;
+  guint64 home_cache_expiry_secs;
+  char *keyring_fingerprint;
 };
 
 G_DEFINE_TYPE (OstreeGpgVerifier, _ostree_gpg_verifier, G_TYPE_OBJECT)
@@ -53,6 +60,8 @@ ostree_gpg_verifier_finalize (GObject *object)
   g_list_free_full (self->keyrings, g_object_unref);
   if (self->key_ascii_files)
     g_ptr_array_unref (self->key_ascii_files);
+  g_free (self->home_cache_dir);
+  g_free (self->keyring_fingerprint);
 
   G_OBJECT_CLASS (_ostree_gpg_verifier_parent_class)->finalize (object);
 }
@@ -86,41 +95,20 @@ verify_result_finalized_cb (gpointer data,
   (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_dir, NULL, NULL);
 }
 
-OstreeGpgVerifyResult *
-_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
-                                      GBytes             *signed_data,
-                                      GBytes             *signatures,
-                                      GCancellable       *cancellable,
-                                      GError            **error)
+/* Concatenate the keyring files into @pubring_stream, then import the
+ * ASCII-armored keys into the home directory @gpgme_ctx is using.
+ */
+static gboolean
+verifier_populate_home (OstreeGpgVerifier *self,
+                        gpgme_ctx_t        gpgme_ctx,
+                        GOutputStream     *pubring_stream,
+                        GCancellable      *cancellable,
+                        GError           **error)
 {
   gpgme_error_t gpg_error = 0;
-  ot_auto_gpgme_data gpgme_data_t data_buffer = NULL;
-  ot_auto_gpgme_data gpgme_data_t signature_buffer = NULL;
-  g_autofree char *tmp_dir = NULL;
-  g_autoptr(GOutputStream) target_stream = NULL;
-  OstreeGpgVerifyResult *result = NULL;
-  gboolean success = FALSE;
   GList *link;
   int armor;
 
-  /* GPGME has no API for using multiple keyrings (aka, gpg --keyring),
-   * so we concatenate all the keyring files into one pubring.gpg in a
-   * temporary directory, then tell GPGME to use that directory as the
-   * home directory. */
-
-  if (g_cancellable_set_error_if_cancelled (cancellable, error))
-    goto out;
-
-  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
-                           cancellable, error, NULL);
-  if (result == NULL)
-    goto out;
-
-  if (!ot_gpgme_ctx_tmp_home_dir (result->context,
-                                  &tmp_dir, &target_stream,
-                                  cancellable, error))
-    goto out;
-
   for (link = self->keyrings; link != NULL; link = link->next)
     {
       g_autoptr(GFileInputStream) source_stream = NULL;
@@ -139,23 +127,23 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
       else if (local_error != NULL)
         {
           g_propagate_error (error, local_error);
-          goto out;
+          return FALSE;
         }
 
-      bytes_written = g_output_stream_splice (target_stream,
+      bytes_written = g_output_stream_splice (pubring_stream,
                                               G_INPUT_STREAM (source_stream),
                                               G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
                                               cancellable, error);
       if (bytes_written < 0)
-        goto out;
+        return FALSE;
     }
 
-  if (!g_output_stream_close (target_stream, cancellable, error))
-    goto out;
+  if (!g_output_stream_close (pubring_stream, cancellable, error))
+    return FALSE;
 
   /* Save the previous armor value - we need it on for importing ASCII keys */
-  armor = gpgme_get_armor (result->context);
-  gpgme_set_armor (result->context, 1);
+  armor = gpgme_get_armor (gpgme_ctx);
+  gpgme_set_armor (gpgme_ctx, 1);
 
   /* Now, use the API to import ASCII-armored keys */
   if (self->key_ascii_files)
@@ -168,28 +156,290 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
 
           fd = openat (AT_FDCWD, path, O_RDONLY | O_CLOEXEC) ;
           if (fd < 0)
-            {
-              glnx_set_prefix_error_from_errno (error, "Opening %s", path);
-              goto out;
-            }
+            return glnx_throw_errno_prefix (error, "Opening %s", path);
 
           gpg_error = gpgme_data_new_from_fd (&kdata, fd);
           if (gpg_error != GPG_ERR_NO_ERROR)
             {
               ot_gpgme_error_to_gio_error (gpg_error, error);
-              goto out;
+              return FALSE;
             }
 
-          gpg_error = gpgme_op_import (result->context, kdata);
+          gpg_error = gpgme_op_import (gpgme_ctx, kdata);
           if (gpg_error != GPG_ERR_NO_ERROR)
             {
               ot_gpgme_error_to_gio_error (gpg_error, error);
+              return FALSE;
+            }
+        }
+    }
+
+  gpgme_set_armor (gpgme_ctx, armor);
+
+  return TRUE;
+}
+
+static void
+checksum_update_file_stamp (GChecksum   *checksum,
+                            char         kind,
+                            const char  *path)
+{
+  struct stat stbuf;
+  guint64 stamp[7] = { 0, };
+
+  g_checksum_update (checksum, (guint8*)&kind, 1);
+  g_checksum_update (checksum, (guint8*)path, strlen (path) + 1);
+
+  /* A missing file is recorded as all zeroes */
+  if (stat (path, &stbuf) == 0)
+    {
+      stamp[0] = stbuf.st_dev;
+      stamp[1] = stbuf.st_ino;
+      stamp[2] = stbuf.st_size;
+      stamp[3] = stbuf.st_mtim.tv_sec;
+      stamp[4] = stbuf.st_mtim.tv_nsec;
+      stamp[5] = stbuf.st_ctim.tv_sec;
+      stamp[6] = stbuf.st_ctim.tv_nsec;
+    }
+  g_checksum_update (checksum, (guint8*)stamp, sizeof (stamp));
+}
+
+/* Returns a checksum identifying the current contents of all keyrings
+ * and key files added to @self, based on their paths and stat data.
+ * It changes whenever any of them is replaced or modified, and is
+ * computed once per verifier.
+ */
+static const char *
+verifier_get_keyring_fingerprint (OstreeGpgVerifier *self)
+{
+  if (!self->keyring_fingerprint)
+    {
+      g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+      for (GList *link = self->keyrings; link != NULL; link = link->next)
+        checksum_update_file_stamp (checksum, 'k', gs_file_get_path_cached (link->data));
+      if (self->key_ascii_files)
+        {
+          for (guint i = 0; i < self->key_ascii_files->len; i++)
+            checksum_update_file_stamp (checksum, 'a', self->key_ascii_files->pdata[i]);
+        }
+
+      self->keyring_fingerprint = g_strdup (g_checksum_get_string (checksum));
+    }
+
+  return self->keyring_fingerprint;
+}
+
+/* Remove homes in the cache directory not used within the expiry time;
+ * this is best effort.
+ */
+static void
+verifier_prune_cached_homes (OstreeGpgVerifier *self)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  struct timespec now;
+
+  if (!glnx_dirfd_iterator_init_at (AT_FDCWD, self->home_cache_dir, FALSE, &dfd_iter, NULL))
+    return;
+  if (clock_gettime (CLOCK_REALTIME, &now) < 0)
+    return;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat stbuf;
+
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, NULL, NULL) || dent == NULL)
+        break;
+      if (dent->d_type != DT_DIR)
+        continue;
+      if (fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) < 0)
+        continue;
+      if (stbuf.st_mtime > now.tv_sec ||
+          (guint64)(now.tv_sec - stbuf.st_mtime) < self->home_cache_expiry_secs)
+        continue;
+
+      (void) glnx_shutil_rm_rf_at (dfd_iter.fd, dent->d_name, NULL, NULL);
+    }
+}
+
+/* Build a home directory for the current keyrings at @home, via a
+ * temporary directory which is renamed into place once complete.
+ */
+static gboolean
+verifier_build_cached_home (OstreeGpgVerifier *self,
+                            gpgme_ctx_t        gpgme_ctx,
+                            const char        *home,
+                            GCancellable      *cancellable,
+                            GError           **error)
+{
+  g_autofree char *tmp_home = NULL;
+  g_autofree char *pubring_path = NULL;
+  g_autoptr(GFile) pubring_file = NULL;
+  g_autoptr(GFileOutputStream) pubring_stream = NULL;
+  gpgme_error_t gpg_error;
+  gboolean ret = FALSE;
+
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, self->home_cache_dir, 0700, cancellable, error))
+    return FALSE;
+  verifier_prune_cached_homes (self);
+
+  tmp_home = g_build_filename (self->home_cache_dir, "tmp-XXXXXX", NULL);
+  if (!glnx_mkdtempat (AT_FDCWD, tmp_home, 0700, error))
+    return FALSE;
+
+  gpg_error = gpgme_ctx_set_engine_info (gpgme_ctx, GPGME_PROTOCOL_OpenPGP,
+                                         NULL, tmp_home);
+  if (gpg_error != GPG_ERR_NO_ERROR)
+    {
+      ot_gpgme_error_to_gio_error (gpg_error, error);
+      goto out;
+    }
+
+  pubring_path = g_build_filename (tmp_home, "pubring.gpg", NULL);
+  pubring_file = g_file_new_for_path (pubring_path);
+  pubring_stream = g_file_create (pubring_file, G_FILE_CREATE_NONE,
+                                  cancellable, error);
+  if (!pubring_stream)
+    goto out;
+
+  if (!verifier_populate_home (self, gpgme_ctx, (GOutputStream*)pubring_stream,
+                               cancellable, error))
+    goto out;
+
+  if (rename (tmp_home, home) == 0)
+    {
+      g_clear_pointer (&tmp_home, g_free);
+    }
+  else if (errno != EEXIST && errno != ENOTEMPTY)
+    {
+      /* EEXIST or ENOTEMPTY mean we lost a race with another process
+       * building the same home, which is fine. */
+      glnx_set_prefix_error_from_errno (error, "rename(%s)", home);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (tmp_home)
+    (void) glnx_shutil_rm_rf_at (AT_FDCWD, tmp_home, NULL, NULL);
+  return ret;
+}
+
+/* Point @gpgme_ctx at the cached home directory for the current
+ * keyrings, building it first if needed.  A home is never modified
+ * once in place, since its name depends on the keyring contents.
+ * Sets @out_home to %NULL if the existing home is not one we can
+ * trust, so the caller can fall back to a temporary one.
+ */
+static gboolean
+verifier_ensure_cached_home (OstreeGpgVerifier *self,
+                             gpgme_ctx_t        gpgme_ctx,
+                             char             **out_home,
+                             GCancellable      *cancellable,
+                             GError           **error)
+{
+  g_autofree char *home = g_build_filename (self->home_cache_dir,
+                                            verifier_get_keyring_fingerprint (self),
+                                            NULL);
+  gpgme_error_t gpg_error;
+  struct stat stbuf;
+
+  if (stat (home, &stbuf) < 0)
+    {
+      if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "stat(%s)", home);
+
+      if (!verifier_build_cached_home (self, gpgme_ctx, home, cancellable, error))
+        return FALSE;
+
+      if (stat (home, &stbuf) < 0)
+        return glnx_throw_errno_prefix (error, "stat(%s)", home);
+    }
+
+  if (!S_ISDIR (stbuf.st_mode) || stbuf.st_uid != geteuid () ||
+      (stbuf.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+    {
+      *out_home = NULL;
+      return TRUE;
+    }
+
+  /* Mark it as recently used */
+  (void) utimensat (AT_FDCWD, home, NULL, 0);
+
+  gpg_error = gpgme_ctx_set_engine_info (gpgme_ctx, GPGME_PROTOCOL_OpenPGP,
+                                         NULL, home);
+  if (gpg_error != GPG_ERR_NO_ERROR)
+    {
+      ot_gpgme_error_to_gio_error (gpg_error, error);
+      return FALSE;
+    }
+
+  *out_home = g_steal_pointer (&home);
+  return TRUE;
+}
+
+OstreeGpgVerifyResult *
+_ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
+                                      GBytes             *signed_data,
+                                      GBytes             *signatures,
+                                      GCancellable       *cancellable,
+                                      GError            **error)
+{
+  gpgme_error_t gpg_error = 0;
+  ot_auto_gpgme_data gpgme_data_t data_buffer = NULL;
+  ot_auto_gpgme_data gpgme_data_t signature_buffer = NULL;
+  g_autofree char *tmp_dir = NULL;
+  g_autofree char *cached_home = NULL;
+  g_autoptr(GOutputStream) target_stream = NULL;
+  OstreeGpgVerifyResult *result = NULL;
+  gboolean success = FALSE;
+
+  /* GPGME has no API for using multiple keyrings (aka, gpg --keyring),
+   * so we concatenate all the keyring files into one pubring.gpg in a
+   * home directory, then tell GPGME to use that directory as the
+   * home directory.  If we have a cache directory the home is kept
+   * there for as long as the keyrings don't change, otherwise a
+   * temporary one is created. */
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  result = g_initable_new (OSTREE_TYPE_GPG_VERIFY_RESULT,
+                           cancellable, error, NULL);
+  if (result == NULL)
+    goto out;
+
+  if (self->home_cache_dir)
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      /* The cache is only an optimization; e.g. we may not be able to
+       * write to it, so fall back to a temporary home on any error. */
+      if (!verifier_ensure_cached_home (self, result->context, &cached_home,
+                                        cancellable, &local_error))
+        {
+          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            {
+              g_propagate_error (error, g_steal_pointer (&local_error));
               goto out;
             }
+          g_debug ("Not using cached GPG home: %s", local_error->message);
+          g_clear_pointer (&cached_home, g_free);
         }
     }
 
-  gpgme_set_armor (result->context, armor);
+  if (!cached_home)
+    {
+      if (!ot_gpgme_ctx_tmp_home_dir (result->context,
+                                      &tmp_dir, &target_stream,
+                                      cancellable, error))
+        goto out;
+
+      if (!verifier_populate_home (self, result->context, target_stream,
+                                   cancellable, error))
+        goto out;
+    }
 
   /* Both the signed data and signature GBytes instances will outlive the
    * gpgme_data_t structs, so we can safely reuse the GBytes memory buffer
@@ -233,7 +483,7 @@ _ostree_gpg_verifier_check_signature (OstreeGpgVerifier  *self,
   success = TRUE;
 
 out:
-  if (success)
+  if (success && tmp_dir != NULL)
     {
       /* Keep the temporary directory around for the life of the result
        * object so its GPGME context remains valid.  It may yet have to
@@ -243,7 +493,7 @@ out:
                          verify_result_finalized_cb,
                          g_strdup (tmp_dir));
     }
-  else
+  else if (!success)
     {
       /* Destroy the result object on error. */
       g_clear_object (&result);
@@ -258,6 +508,24 @@ out:
   return result;
 }
 
+/*
+ * _ostree_gpg_verifier_set_home_cache_dir:
+ * @path: Directory to keep merged keyrings in
+ * @expiry_secs: Remove merged keyrings unused for this long
+ *
+ * Rather than building a temporary GPG home directory for every
+ * verification, keep one per distinct set of keyrings in @path.
+ */
+void
+_ostree_gpg_verifier_set_home_cache_dir (OstreeGpgVerifier *self,
+                                         const char        *path,
+                                         guint64            expiry_secs)
+{
+  g_free (self->home_cache_dir);
+  self->home_cache_dir = g_strdup (path);
+  self->home_cache_expiry_secs = expiry_secs;
+}
+
 void
 _ostree_gpg_verifier_add_keyring (OstreeGpgVerifier  *self,
                                   GFile              *path)
@@ -65,4 +65,8 @@ void _ostree_gpg_verifier_add_keyring (OstreeGpgVerifier *self,
 void _ostree_gpg_verifier_add_key_ascii_file (OstreeGpgVerifier *self,
                                               const char        *path);
 
+void _ostree_gpg_verifier_set_home_cache_dir (OstreeGpgVerifier *self,
+                                              const char        *path,
+                                              guint64            expiry_secs);
+
 G_END_DECLS
@@ -0,0 +1,255 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-metadata-cache.h"
+
+/* A size-bounded LRU cache of metadata variants.  Since objects are
+ * content-addressed, an entry never goes stale; the only way an entry
+ * becomes wrong is the object being deleted, which callers handle via
+ * _ostree_metadata_cache_remove().
+ */
+
+/* Rough per-entry overhead: the entry itself plus the hash table slot */
+#define ENTRY_OVERHEAD (sizeof (CacheEntry) + 4 * sizeof (gpointer))
+
+typedef struct {
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  guint8 objtype;
+} CacheKey;
+
+typedef struct {
+  CacheKey  key;
+  GVariant *variant;
+  gsize     size;
+  GList     link;  /* In the LRU queue; data points back to the entry */
+} CacheEntry;
+
+struct OstreeMetadataCache {
+  GMutex      lock;
+  GHashTable *entries;  /* CacheKey* -> CacheEntry* */
+  GQueue      lru;      /* Most recently used at the head */
+  guint64     max_size;
+  guint64     size;
+  guint64     hits;
+  guint64     misses;
+};
+
+static guint
+cache_key_hash (gconstpointer v)
+{
+  const CacheKey *key = v;
+  guint32 h;
+
+  /* The checksum is already uniformly distributed */
+  memcpy (&h, key->csum, sizeof (h));
+  return h ^ key->objtype;
+}
+
+static gboolean
+cache_key_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  const CacheKey *ka = a;
+  const CacheKey *kb = b;
+
+  return ka->objtype == kb->objtype &&
+    memcmp (ka->csum, kb->csum, sizeof (ka->csum)) == 0;
+}
+
+static void
+cache_key_init (CacheKey         *key,
+                OstreeObjectType  objtype,
+                const char       *checksum)
+{
+  ostree_checksum_inplace_to_bytes (checksum, key->csum);
+  key->objtype = objtype;
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_variant_unref (entry->variant);
+  g_free (entry);
+}
+
+/* Must be called with the lock held */
+static void
+cache_remove_entry (OstreeMetadataCache *cache,
+                    CacheEntry          *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->entries, &entry->key);
+}
+
+OstreeMetadataCache *
+_ostree_metadata_cache_new (guint64 max_size)
+{
+  OstreeMetadataCache *cache = g_new0 (OstreeMetadataCache, 1);
+
+  g_mutex_init (&cache->lock);
+  cache->entries = g_hash_table_new_full (cache_key_hash, cache_key_equal, NULL,
+                                          (GDestroyNotify)cache_entry_free);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+  return cache;
+}
+
+void
+_ostree_metadata_cache_free (OstreeMetadataCache *cache)
+{
+  g_hash_table_unref (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+/* Returns: (transfer full) (nullable): The cached variant */
+GVariant *
+_ostree_metadata_cache_lookup (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  CacheKey key;
+  CacheEntry *entry;
+  GVariant *ret = NULL;
+
+  cache_key_init (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  /* Disabled; don't count misses */
+  if (cache->max_size == 0)
+    {
+      g_mutex_unlock (&cache->lock);
+      return NULL;
+    }
+  entry = g_hash_table_lookup (cache->entries, &key);
+  if (entry)
+    {
+      g_queue_unlink (&cache->lru, &entry->link);
+      g_queue_push_head_link (&cache->lru, &entry->link);
+      ret = g_variant_ref (entry->variant);
+      cache->hits++;
+    }
+  else
+    cache->misses++;
+  g_mutex_unlock (&cache->lock);
+
+  return ret;
+}
+
+void
+_ostree_metadata_cache_insert (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum,
+                               GVariant            *variant)
+{
+  gsize size = g_variant_get_size (variant) + ENTRY_OVERHEAD;
+  CacheEntry *entry;
+
+  g_mutex_lock (&cache->lock);
+  /* Don't let a single huge object flush everything else */
+  if (size > cache->max_size / 4)
+    {
+      g_mutex_unlock (&cache->lock);
+      return;
+    }
+
+  entry = g_new0 (CacheEntry, 1);
+  cache_key_init (&entry->key, objtype, checksum);
+  entry->variant = g_variant_ref_sink (variant);
+  entry->size = size;
+  entry->link.data = entry;
+
+  {
+    CacheEntry *old = g_hash_table_lookup (cache->entries, &entry->key);
+    if (old)
+      cache_remove_entry (cache, old);
+  }
+  g_hash_table_insert (cache->entries, &entry->key, entry);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->size += size;
+
+  while (cache->size > cache->max_size)
+    {
+      GList *tail = g_queue_peek_tail_link (&cache->lru);
+      cache_remove_entry (cache, tail->data);
+    }
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_remove (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  CacheKey key;
+  CacheEntry *entry;
+
+  cache_key_init (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  entry = g_hash_table_lookup (cache->entries, &key);
+  if (entry)
+    cache_remove_entry (cache, entry);
+  g_mutex_unlock (&cache->lock);
+}
+
+/* Change the size bound, evicting entries as needed; 0 disables the
+ * cache.  Safe to call while other threads use the cache.
+ */
+void
+_ostree_metadata_cache_set_max_size (OstreeMetadataCache *cache,
+                                     guint64              max_size)
+{
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  while (cache->size > cache->max_size)
+    {
+      GList *tail = g_queue_peek_tail_link (&cache->lru);
+      cache_remove_entry (cache, tail->data);
+    }
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_clear (OstreeMetadataCache *cache)
+{
+  g_mutex_lock (&cache->lock);
+  g_hash_table_remove_all (cache->entries);
+  g_queue_init (&cache->lru);
+  cache->size = 0;
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_get_stats (OstreeMetadataCache      *cache,
+                                  OstreeMetadataCacheStats *out_stats)
+{
+  g_mutex_lock (&cache->lock);
+  out_stats->hits = cache->hits;
+  out_stats->misses = cache->misses;
+  out_stats->size = cache->size;
+  out_stats->n_entries = g_hash_table_size (cache->entries);
+  g_mutex_unlock (&cache->lock);
+}
@@ -0,0 +1,66 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include "ostree-core.h"
+
+G_BEGIN_DECLS
+
+/* The default upper bound on the memory used by a repository's
+ * metadata cache; see core.metadata-cache-size in ostree.repo-config(5).
+ */
+#define _OSTREE_METADATA_CACHE_DEFAULT_SIZE (8 * 1024 * 1024)
+
+typedef struct OstreeMetadataCache OstreeMetadataCache;
+
+typedef struct {
+  guint64 hits;
+  guint64 misses;
+  guint64 size;
+  guint   n_entries;
+} OstreeMetadataCacheStats;
+
+OstreeMetadataCache *_ostree_metadata_cache_new (guint64 max_size);
+
+void _ostree_metadata_cache_free (OstreeMetadataCache *cache);
+
+GVariant *_ostree_metadata_cache_lookup (OstreeMetadataCache *cache,
+                                         OstreeObjectType     objtype,
+                                         const char          *checksum);
+
+void _ostree_metadata_cache_insert (OstreeMetadataCache *cache,
+                                    OstreeObjectType     objtype,
+                                    const char          *checksum,
+                                    GVariant            *variant);
+
+void _ostree_metadata_cache_remove (OstreeMetadataCache *cache,
+                                    OstreeObjectType     objtype,
+                                    const char          *checksum);
+
+void _ostree_metadata_cache_set_max_size (OstreeMetadataCache *cache,
+                                          guint64              max_size);
+
+void _ostree_metadata_cache_clear (OstreeMetadataCache *cache);
+
+void _ostree_metadata_cache_get_stats (OstreeMetadataCache      *cache,
+                                       OstreeMetadataCacheStats *out_stats);
+
+G_END_DECLS
@@ -25,6 +25,7 @@
 #include "ostree-mutable-tree.h"
 #include "otutil.h"
 #include "ostree-core.h"
+#include "ostree-repo.h"
 
 /**
  * SECTION:ostree-mutable-tree
@@ -36,6 +37,13 @@
  * APIs to create an initiable #OstreeMutableTree from a physical
  * filesystem directory, but they may also be computed
  * programmatically.
+ *
+ * A tree may also be created from an existing dirtree object with
+ * ostree_mutable_tree_new_from_checksum().  Such a tree is "lazy": its
+ * contents are only loaded from the repository when it is first
+ * modified or inspected, and the directories below it are themselves
+ * lazy.  Unmodified subtrees keep their contents checksum, so writing
+ * them back with ostree_repo_write_mtree() is free.
  */
 
 /**
@@ -50,6 +58,14 @@ struct OstreeMutableTree
   char *contents_checksum;
   char *metadata_checksum;
 
+  /* If set, this tree is lazy: its contents are those of the dirtree
+   * @contents_checksum in @repo, and haven't been loaded into @files
+   * and @subdirs yet.
+   */
+  OstreeRepo *repo;
+  /* The error encountered loading a lazy tree, if any */
+  GError *cached_error;
+
   GHashTable *files;
   GHashTable *subdirs;
 };
@@ -65,6 +81,8 @@ ostree_mutable_tree_finalize (GObject *object)
 
   g_free (self->contents_checksum);
   g_free (self->metadata_checksum);
+  g_clear_object (&self->repo);
+  g_clear_error (&self->cached_error);
 
   g_hash_table_destroy (self->files);
   g_hash_table_destroy (self->subdirs);
@@ -89,6 +107,69 @@ ostree_mutable_tree_init (OstreeMutableTree *self)
                                          g_free, (GDestroyNotify)g_object_unref);
 }
 
+/* Load the contents of a lazy tree, see
+ * ostree_mutable_tree_new_from_checksum().  On failure, the error is
+ * also kept for ostree_mutable_tree_check_error().
+ */
+static gboolean
+_ostree_mutable_tree_make_whole (OstreeMutableTree *self,
+                                 GError           **error)
+{
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) files_v = NULL;
+  g_autoptr(GVariant) dirs_v = NULL;
+
+  if (self->cached_error)
+    {
+      if (error)
+        *error = g_error_copy (self->cached_error);
+      return FALSE;
+    }
+  if (!self->repo)
+    return TRUE;
+
+  g_assert (self->contents_checksum != NULL);
+
+  if (!ostree_repo_load_variant (self->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 self->contents_checksum, &dirtree, &self->cached_error))
+    {
+      if (error)
+        *error = g_error_copy (self->cached_error);
+      return FALSE;
+    }
+
+  files_v = g_variant_get_child_value (dirtree, 0);
+  for (gsize i = 0, n = g_variant_n_children (files_v); i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+
+      g_variant_get_child (files_v, i, "(&s@ay)", &name, &csum_v);
+      g_hash_table_replace (self->files, g_strdup (name),
+                            ostree_checksum_from_bytes_v (csum_v));
+    }
+
+  dirs_v = g_variant_get_child_value (dirtree, 1);
+  for (gsize i = 0, n = g_variant_n_children (dirs_v); i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) contents_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      char contents_checksum[OSTREE_SHA256_STRING_LEN+1];
+      char meta_checksum[OSTREE_SHA256_STRING_LEN+1];
+
+      g_variant_get_child (dirs_v, i, "(&s@ay@ay)", &name, &contents_csum_v, &meta_csum_v);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (contents_csum_v), contents_checksum);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (meta_csum_v), meta_checksum);
+      g_hash_table_replace (self->subdirs, g_strdup (name),
+                            ostree_mutable_tree_new_from_checksum (self->repo, contents_checksum,
+                                                                   meta_checksum));
+    }
+
+  g_clear_object (&self->repo);
+  return TRUE;
+}
+
 void
 ostree_mutable_tree_set_metadata_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
@@ -107,6 +188,10 @@ void
 ostree_mutable_tree_set_contents_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
 {
+  /* Changing the checksum of a lazy tree would lose its contents */
+  if (self->repo && g_strcmp0 (checksum, self->contents_checksum) != 0)
+    (void) _ostree_mutable_tree_make_whole (self, NULL);
+
   g_free (self->contents_checksum);
   self->contents_checksum = g_strdup (checksum);
 }
@@ -120,6 +205,10 @@ ostree_mutable_tree_get_contents_checksum (OstreeMutableTree *self)
   if (!self->contents_checksum)
     return NULL;
 
+  /* A lazy tree hasn't been modified */
+  if (self->repo)
+    return self->contents_checksum;
+
   /* Ensure the cache is valid; this implementation is a bit
    * lame in that we walk the whole tree every time this
    * getter is called; a better approach would be to invalidate
@@ -164,6 +253,9 @@ ostree_mutable_tree_replace_file (OstreeMutableTree *self,
   if (!ot_util_filename_validate (name, error))
     goto out;
 
+  if (!_ostree_mutable_tree_make_whole (self, error))
+    goto out;
+
   if (g_hash_table_lookup (self->subdirs, name))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -195,6 +287,9 @@ ostree_mutable_tree_ensure_dir (OstreeMutableTree *self,
   if (!ot_util_filename_validate (name, error))
     goto out;
 
+  if (!_ostree_mutable_tree_make_whole (self, error))
+    goto out;
+
   if (g_hash_table_lookup (self->files, name))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -226,7 +321,10 @@ ostree_mutable_tree_lookup (OstreeMutableTree   *self,
   gboolean ret = FALSE;
   glnx_unref_object OstreeMutableTree *ret_subdir = NULL;
   g_autofree char *ret_file_checksum = NULL;
-  
+
+  if (!_ostree_mutable_tree_make_whole (self, error))
+    goto out;
+
   ret_subdir = ot_gobject_refz (g_hash_table_lookup (self->subdirs, name));
   if (!ret_subdir)
     {
@@ -278,6 +376,9 @@ ostree_mutable_tree_ensure_parent_dirs (OstreeMutableTree  *self,
       OstreeMutableTree *next;
       const char *name = split_path->pdata[i];
 
+      if (!_ostree_mutable_tree_make_whole (subdir, error))
+        goto out;
+
       if (g_hash_table_lookup (subdir->files, name))
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -333,6 +434,9 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
     {
       OstreeMutableTree *subdir;
 
+      if (!_ostree_mutable_tree_make_whole (self, error))
+        return FALSE;
+
       subdir = g_hash_table_lookup (self->subdirs, split_path->pdata[start]);
       if (!subdir)
         return set_error_noent (error, (char*)split_path->pdata[start]);
@@ -345,11 +449,15 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
  * ostree_mutable_tree_get_subdirs:
  * @self:
  * 
+ * If @self is lazy, its contents are loaded first; use
+ * ostree_mutable_tree_check_error() to find out whether that failed.
+ *
  * Returns: (transfer none) (element-type utf8 OstreeMutableTree): All children directories
  */
 GHashTable *
 ostree_mutable_tree_get_subdirs (OstreeMutableTree *self)
 {
+  (void) _ostree_mutable_tree_make_whole (self, NULL);
   return self->subdirs;
 }
 
@@ -357,14 +465,78 @@ ostree_mutable_tree_get_subdirs (OstreeMutableTree *self)
  * ostree_mutable_tree_get_files:
  * @self:
  * 
+ * If @self is lazy, its contents are loaded first; use
+ * ostree_mutable_tree_check_error() to find out whether that failed.
+ *
  * Returns: (transfer none) (element-type utf8 utf8): All children files (the value is a checksum)
  */
 GHashTable *
 ostree_mutable_tree_get_files (OstreeMutableTree *self)
 {
+  (void) _ostree_mutable_tree_make_whole (self, NULL);
   return self->files;
 }
 
+/**
+ * ostree_mutable_tree_check_error:
+ * @self: Tree
+ * @error: a #GError
+ *
+ * Check whether loading the contents of a lazy tree failed in a
+ * function which can't return an error, such as
+ * ostree_mutable_tree_get_files().
+ *
+ * Returns: %FALSE if an error occurred, %TRUE otherwise
+ */
+gboolean
+ostree_mutable_tree_check_error (OstreeMutableTree  *self,
+                                 GError            **error)
+{
+  if (self->cached_error)
+    {
+      if (error)
+        *error = g_error_copy (self->cached_error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * ostree_mutable_tree_fill_empty_from_dirtree:
+ * @self: Tree
+ * @repo: Repository containing the dirtree
+ * @contents_checksum: Checksum of a dirtree object
+ * @metadata_checksum: Checksum of a dirmeta object
+ *
+ * If @self is empty, make it a lazy tree referencing the given
+ * existing dirtree, like ostree_mutable_tree_new_from_checksum().
+ *
+ * Returns: %TRUE if @self was empty and now references the dirtree,
+ * %FALSE if it already had contents and was left unchanged
+ */
+gboolean
+ostree_mutable_tree_fill_empty_from_dirtree (OstreeMutableTree *self,
+                                             OstreeRepo        *repo,
+                                             const char        *contents_checksum,
+                                             const char        *metadata_checksum)
+{
+  g_return_val_if_fail (repo != NULL, FALSE);
+  g_return_val_if_fail (contents_checksum != NULL, FALSE);
+  g_return_val_if_fail (metadata_checksum != NULL, FALSE);
+
+  if (self->repo || self->cached_error ||
+      g_hash_table_size (self->files) > 0 ||
+      g_hash_table_size (self->subdirs) > 0)
+    return FALSE;
+
+  g_free (self->contents_checksum);
+  self->contents_checksum = g_strdup (contents_checksum);
+  g_free (self->metadata_checksum);
+  self->metadata_checksum = g_strdup (metadata_checksum);
+  self->repo = g_object_ref (repo);
+  return TRUE;
+}
+
 /**
  * ostree_mutable_tree_new:
  *
@@ -375,3 +547,28 @@ ostree_mutable_tree_new (void)
 {
   return (OstreeMutableTree*)g_object_new (OSTREE_TYPE_MUTABLE_TREE, NULL);
 }
+
+/**
+ * ostree_mutable_tree_new_from_checksum:
+ * @repo: The repo which contains the objects refered by the checksums.
+ * @contents_checksum: dirtree checksum
+ * @metadata_checksum: dirmeta checksum
+ *
+ * Creates a new OstreeMutableTree with the contents taken from the given repo
+ * and checksums.  The data will be loaded from the repo lazily as needed, so
+ * only the directories which are modified are ever read, and the rest are
+ * written back with their existing checksums.
+ *
+ * Returns: (transfer full): A new tree
+ */
+OstreeMutableTree *
+ostree_mutable_tree_new_from_checksum (OstreeRepo *repo,
+                                       const char *contents_checksum,
+                                       const char *metadata_checksum)
+{
+  OstreeMutableTree *ret = ostree_mutable_tree_new ();
+
+  (void) ostree_mutable_tree_fill_empty_from_dirtree (ret, repo, contents_checksum,
+                                                      metadata_checksum);
+  return ret;
+}
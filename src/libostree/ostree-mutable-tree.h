@@ -51,6 +51,11 @@ GType   ostree_mutable_tree_get_type (void) G_GNUC_CONST;
 _OSTREE_PUBLIC
 OstreeMutableTree *ostree_mutable_tree_new (void);
 
+_OSTREE_PUBLIC
+OstreeMutableTree *ostree_mutable_tree_new_from_checksum (OstreeRepo *repo,
+                                                          const char *contents_checksum,
+                                                          const char *metadata_checksum);
+
 _OSTREE_PUBLIC
 void ostree_mutable_tree_set_metadata_checksum (OstreeMutableTree *self,
                                                 const char        *checksum);
@@ -104,4 +109,14 @@ GHashTable * ostree_mutable_tree_get_subdirs (OstreeMutableTree *self);
 _OSTREE_PUBLIC
 GHashTable * ostree_mutable_tree_get_files (OstreeMutableTree *self);
 
+_OSTREE_PUBLIC
+gboolean ostree_mutable_tree_check_error (OstreeMutableTree  *self,
+                                          GError            **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_mutable_tree_fill_empty_from_dirtree (OstreeMutableTree *self,
+                                                      OstreeRepo        *repo,
+                                                      const char        *contents_checksum,
+                                                      const char        *metadata_checksum);
+
 G_END_DECLS
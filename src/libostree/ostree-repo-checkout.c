@@ -38,6 +38,13 @@
 /* Per-checkout call state/caching */
 typedef struct {
   GString *selabel_path_buf;
+
+  /* Optional pristine hardlink checkout of another commit; unchanged
+   * files are linked from it rather than looked up in the repo.
+   */
+  int reference_root_dfd;
+  const char *const *reference_dirs;
+  guint n_reused;
 } CheckoutState;
 
 static void
@@ -577,6 +584,69 @@ checkout_one_file_at (OstreeRepo                        *repo,
   return TRUE;
 }
 
+/* Advance *@idx through the (name-sorted) entries of a dirtree
+ * array until reaching @name, and return its entry if present.
+ */
+static GVariant *
+dirtree_entries_find_sorted (GVariant    *entries,
+                             gsize       *idx,
+                             const char  *name)
+{
+  const gsize n = g_variant_n_children (entries);
+
+  while (*idx < n)
+    {
+      g_autoptr(GVariant) entry = g_variant_get_child_value (entries, *idx);
+      const char *entry_name;
+      g_variant_get_child (entry, 0, "&s", &entry_name);
+      const int c = strcmp (entry_name, name);
+      if (c > 0)
+        break;
+      (*idx)++;
+      if (c == 0)
+        return g_steal_pointer (&entry);
+    }
+
+  return NULL;
+}
+
+static gboolean
+strv_contains (const char *const *strv,
+               const char        *str)
+{
+  for (; *strv; strv++)
+    {
+      if (strcmp (*strv, str) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/* Hardlink @name from the reference checkout; *@out_linked is
+ * FALSE if it isn't usable, and the caller should do a regular checkout.
+ */
+static gboolean
+checkout_file_from_reference (int          reference_dfd,
+                              const char  *name,
+                              int          destination_dfd,
+                              gboolean    *out_linked,
+                              GError     **error)
+{
+  if (linkat (reference_dfd, name, destination_dfd, name, 0) == 0)
+    {
+      *out_linked = TRUE;
+      return TRUE;
+    }
+
+  if (errno == ENOENT || errno == EMLINK || errno == EXDEV || errno == EPERM)
+    {
+      *out_linked = FALSE;
+      return TRUE;
+    }
+
+  return glnx_throw_errno_prefix (error, "linkat(%s)", name);
+}
+
 /*
  * checkout_tree_at:
  * @self: Repo
@@ -587,6 +657,8 @@ checkout_one_file_at (OstreeRepo                        *repo,
  * @destination_name: Use this name for tree
  * @source: Source tree
  * @source_info: Source info
+ * @reference_dfd: Reference checkout of this directory, or -1
+ * @reference_dirtree_checksum: Dirtree the reference was checked out from
  * @cancellable: Cancellable
  * @error: Error
  *
@@ -601,6 +673,8 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
                           const char                        *destination_name,
                           const char                        *dirtree_checksum,
                           const char                        *dirmeta_checksum,
+                          int                                reference_dfd,
+                          const char                        *reference_dirtree_checksum,
                           GCancellable                      *cancellable,
                           GError                           **error)
 {
@@ -618,6 +692,23 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
                                  dirmeta_checksum, &dirmeta, error))
     return FALSE;
 
+  /* If the reference holds the same tree, every entry can be reused;
+   * otherwise we match entries by name against its dirtree.
+   */
+  const gboolean reference_identical = reference_dfd != -1 &&
+    strcmp (reference_dirtree_checksum, dirtree_checksum) == 0;
+  g_autoptr(GVariant) reference_dirtree = NULL;
+  if (reference_dfd != -1 && !reference_identical)
+    {
+      if (!ostree_repo_load_variant_if_exists (self, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                               reference_dirtree_checksum, &reference_dirtree,
+                                               error))
+        return FALSE;
+      /* The reference commit may be partial; just don't reuse anything here */
+      if (!reference_dirtree)
+        reference_dfd = -1;
+    }
+
   /* Parse OSTREE_OBJECT_TYPE_DIR_META */
   guint32 uid, gid, mode;
   g_variant_get (dirmeta, "(uuu@a(ayay))",
@@ -685,8 +776,15 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
     }
 
   GString *selabel_path_buf = state->selabel_path_buf;
+  /* Files are only reused below the toplevel reference_dirs */
+  const gboolean reuse_files = reference_dfd != -1 &&
+    !(state->reference_dirs && reference_dfd == state->reference_root_dfd);
+
   /* Process files in this subdir */
   { g_autoptr(GVariant) dir_file_contents = g_variant_get_child_value (dirtree, 0);
+    g_autoptr(GVariant) reference_files =
+      reference_dirtree ? g_variant_get_child_value (reference_dirtree, 0) : NULL;
+    gsize reference_idx = 0;
     GVariantIter viter;
     g_variant_iter_init (&viter, dir_file_contents);
     const char *fname;
@@ -697,14 +795,39 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
         if (selabel_path_buf)
           g_string_append (selabel_path_buf, fname);
 
-        char tmp_checksum[OSTREE_SHA256_STRING_LEN+1];
-        _ostree_checksum_inplace_from_bytes_v (contents_csum_v, tmp_checksum);
+        gboolean reused = FALSE;
+        if (reuse_files)
+          {
+            gboolean unchanged = reference_identical;
+            if (!unchanged && reference_files)
+              {
+                g_autoptr(GVariant) reference_entry =
+                  dirtree_entries_find_sorted (reference_files, &reference_idx, fname);
+                if (reference_entry)
+                  {
+                    g_autoptr(GVariant) reference_csum_v = g_variant_get_child_value (reference_entry, 1);
+                    unchanged = g_variant_equal (reference_csum_v, contents_csum_v);
+                  }
+              }
+            if (unchanged &&
+                !checkout_file_from_reference (reference_dfd, fname, destination_dfd,
+                                               &reused, error))
+              return FALSE;
+          }
 
-        if (!checkout_one_file_at (self, options, state,
-                                   tmp_checksum,
-                                   destination_dfd, fname,
-                                   cancellable, error))
-          return FALSE;
+        if (reused)
+          state->n_reused++;
+        else
+          {
+            char tmp_checksum[OSTREE_SHA256_STRING_LEN+1];
+            _ostree_checksum_inplace_from_bytes_v (contents_csum_v, tmp_checksum);
+
+            if (!checkout_one_file_at (self, options, state,
+                                       tmp_checksum,
+                                       destination_dfd, fname,
+                                       cancellable, error))
+              return FALSE;
+          }
 
         if (selabel_path_buf)
           g_string_truncate (selabel_path_buf, origlen);
@@ -714,6 +837,9 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
 
   /* Process subdirectories */
   { g_autoptr(GVariant) dir_subdirs = g_variant_get_child_value (dirtree, 1);
+    g_autoptr(GVariant) reference_subdirs =
+      reference_dirtree ? g_variant_get_child_value (reference_dirtree, 1) : NULL;
+    gsize reference_idx = 0;
     const char *dname;
     g_autoptr(GVariant) subdirtree_csum_v = NULL;
     g_autoptr(GVariant) subdirmeta_csum_v = NULL;
@@ -733,9 +859,46 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
         _ostree_checksum_inplace_from_bytes_v (subdirtree_csum_v, subdirtree_checksum);
         char subdirmeta_checksum[OSTREE_SHA256_STRING_LEN+1];
         _ostree_checksum_inplace_from_bytes_v (subdirmeta_csum_v, subdirmeta_checksum);
+
+        /* Find the same directory in the reference, if any */
+        char subreference_checksum[OSTREE_SHA256_STRING_LEN+1];
+        gboolean have_subreference = FALSE;
+        if (reference_dfd != -1 &&
+            !(state->reference_dirs && reference_dfd == state->reference_root_dfd &&
+              !strv_contains (state->reference_dirs, dname)))
+          {
+            if (reference_identical)
+              {
+                memcpy (subreference_checksum, subdirtree_checksum, sizeof (subreference_checksum));
+                have_subreference = TRUE;
+              }
+            else
+              {
+                g_autoptr(GVariant) reference_entry =
+                  dirtree_entries_find_sorted (reference_subdirs, &reference_idx, dname);
+                if (reference_entry)
+                  {
+                    g_autoptr(GVariant) reference_csum_v = g_variant_get_child_value (reference_entry, 1);
+                    _ostree_checksum_inplace_from_bytes_v (reference_csum_v, subreference_checksum);
+                    have_subreference = TRUE;
+                  }
+              }
+          }
+
+        glnx_fd_close int subreference_dfd = -1;
+        if (have_subreference)
+          {
+            subreference_dfd = openat (reference_dfd, dname,
+                                       O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+            if (subreference_dfd < 0 && errno != ENOENT && errno != ENOTDIR)
+              return glnx_throw_errno_prefix (error, "openat(%s)", dname);
+          }
+
         if (!checkout_tree_at_recurse (self, options, state,
                                        destination_dfd, dname,
                                        subdirtree_checksum, subdirmeta_checksum,
+                                       subreference_dfd,
+                                       subreference_dfd != -1 ? subreference_checksum : NULL,
                                        cancellable, error))
           return FALSE;
 
@@ -796,10 +959,28 @@ checkout_tree_at (OstreeRepo                        *self,
                   const char                        *destination_name,
                   OstreeRepoFile                    *source,
                   GFileInfo                         *source_info,
+                  int                                reference_dfd,
+                  const char                        *reference_dirtree_checksum,
+                  const char *const                 *reference_dirs,
                   GCancellable                      *cancellable,
                   GError                           **error)
 {
   g_auto(CheckoutState) state = { 0, };
+  state.reference_root_dfd = -1;
+  /* Linking from the reference is only equivalent to a regular
+   * hardlink checkout into an empty directory.
+   */
+  if (reference_dfd != -1 &&
+      !options->force_copy &&
+      !options->sepolicy &&
+      !options->process_whiteouts &&
+      !options->devino_to_csum_cache &&
+      options->overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_NONE)
+    {
+      state.reference_root_dfd = reference_dfd;
+      state.reference_dirs = reference_dirs;
+    }
+
   // If SELinux labeling is enabled, we need to keep track of the full path string
   if (options->sepolicy)
     {
@@ -842,19 +1023,21 @@ checkout_tree_at (OstreeRepo                        *self,
                                    cancellable, error);
     }
 
-  /* Cache any directory metadata we read during this operation;
-   * see commit b7afe91e21143d7abb0adde440683a52712aa246
-   */
-  g_auto(OstreeRepoMemoryCacheRef) memcache_ref;
-  _ostree_repo_memory_cache_ref_init (&memcache_ref, self);
-
   g_assert_cmpint (g_file_info_get_file_type (source_info), ==, G_FILE_TYPE_DIRECTORY);
   const char *dirtree_checksum = ostree_repo_file_tree_get_contents_checksum (source);
   const char *dirmeta_checksum = ostree_repo_file_tree_get_metadata_checksum (source);
-  return checkout_tree_at_recurse (self, options, &state, destination_parent_fd,
-                                   destination_name,
-                                   dirtree_checksum, dirmeta_checksum,
-                                   cancellable, error);
+  if (!checkout_tree_at_recurse (self, options, &state, destination_parent_fd,
+                                 destination_name,
+                                 dirtree_checksum, dirmeta_checksum,
+                                 state.reference_root_dfd,
+                                 state.reference_root_dfd != -1 ? reference_dirtree_checksum : NULL,
+                                 cancellable, error))
+    return FALSE;
+
+  if (state.reference_root_dfd != -1)
+    g_debug ("Linked %u files from reference checkout", state.n_reused);
+
+  return TRUE;
 }
 
 static void
@@ -906,6 +1089,7 @@ ostree_repo_checkout_tree (OstreeRepo               *self,
   return checkout_tree_at (self, &options,
                            AT_FDCWD, gs_file_get_path_cached (destination),
                            source, source_info,
+                           -1, NULL, NULL,
                            cancellable, error);
 }
 
@@ -982,6 +1166,37 @@ ostree_repo_checkout_at (OstreeRepo                        *self,
                          const char                        *commit,
                          GCancellable                      *cancellable,
                          GError                           **error)
+{
+  return _ostree_repo_checkout_at_with_reference (self, options, -1, NULL, NULL,
+                                                  destination_dfd, destination_path,
+                                                  commit, cancellable, error);
+}
+
+/*
+ * _ostree_repo_checkout_at_with_reference:
+ * @reference_dfd: Directory fd of an existing checkout, or -1
+ * @reference_commit: Commit that @reference_dfd was checked out from
+ * @reference_dirs: (allow-none): Toplevel directories to reuse; %NULL for all
+ *
+ * Like ostree_repo_checkout_at(), but files which are unchanged between
+ * @reference_commit and @commit are hardlinked from @reference_dfd
+ * rather than checked out of the repository, which skips loading each
+ * object.  The reference must be an unmodified hardlink checkout (in
+ * the directories given by @reference_dirs) from this repository; it is
+ * only used for a hardlink checkout of the whole commit into a new
+ * directory, and is ignored otherwise.
+ */
+gboolean
+_ostree_repo_checkout_at_with_reference (OstreeRepo                  *self,
+                                         OstreeRepoCheckoutAtOptions *options,
+                                         int                          reference_dfd,
+                                         const char                  *reference_commit,
+                                         const char *const           *reference_dirs,
+                                         int                          destination_dfd,
+                                         const char                  *destination_path,
+                                         const char                  *commit,
+                                         GCancellable                *cancellable,
+                                         GError                     **error)
 {
   OstreeRepoCheckoutAtOptions default_options = { 0, };
   OstreeRepoCheckoutAtOptions real_options;
@@ -1020,10 +1235,33 @@ ostree_repo_checkout_at (OstreeRepo                        *self,
   if (!target_info)
     return FALSE;
 
+  g_autofree char *reference_dirtree_checksum = NULL;
+  if (reference_dfd != -1 && strcmp (options->subpath, "/") == 0)
+    {
+      g_autoptr(GFile) reference_root = NULL;
+      g_autoptr(GError) local_error = NULL;
+
+      /* The reference is only an optimization; if e.g. its commit was
+       * pruned, do a regular checkout.
+       */
+      if (ostree_repo_read_commit (self, reference_commit, &reference_root, NULL,
+                                   cancellable, &local_error))
+        reference_dirtree_checksum =
+          g_strdup (ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)reference_root));
+      else
+        {
+          g_debug ("Not using reference commit %s: %s", reference_commit, local_error->message);
+          reference_dfd = -1;
+        }
+    }
+  else
+    reference_dfd = -1;
+
   if (!checkout_tree_at (self, options,
                          destination_dfd,
                          destination_path,
                          (OstreeRepoFile*)target_dir, target_info,
+                         reference_dfd, reference_dirtree_checksum, reference_dirs,
                          cancellable, error))
     return FALSE;
 
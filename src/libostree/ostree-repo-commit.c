@@ -1680,13 +1680,122 @@ ostree_repo_write_metadata_trusted (OstreeRepo         *self,
                                      cancellable, error);
 }
 
+/* The asynchronous write functions below run in a thread pool owned by
+ * the repo, rather than GIO's shared one.  Queued metadata is written
+ * before queued content, so e.g. a pull can continue scanning dirtrees
+ * while file objects are still waiting to be written; within a
+ * priority, writes run in the order they were queued.
+ */
+typedef enum {
+  WRITE_JOB_PRIORITY_METADATA,
+  WRITE_JOB_PRIORITY_CONTENT
+} WriteJobPriority;
+
+/* Must be the first member of the async data of each write */
 typedef struct {
   OstreeRepo *repo;
+  GCancellable *cancellable;
+  GSimpleAsyncResult *result; /* Not owned; the result owns us */
+  GSimpleAsyncThreadFunc func;
+  WriteJobPriority priority;
+  guint64 seq;
+  guint queue_depth;
+  gint64 queue_time;
+  gint64 start_time;
+  gint64 end_time;
+} WriteJob;
+
+static void
+write_job_clear (WriteJob *job)
+{
+  g_clear_object (&job->repo);
+  g_clear_object (&job->cancellable);
+}
+
+static gint
+write_job_compare (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  const WriteJob *job_a = a;
+  const WriteJob *job_b = b;
+
+  if (job_a->priority != job_b->priority)
+    return job_a->priority < job_b->priority ? -1 : 1;
+  if (job_a->seq != job_b->seq)
+    return job_a->seq < job_b->seq ? -1 : 1;
+  return 0;
+}
+
+static void
+write_job_in_thread (gpointer data,
+                     gpointer user_data)
+{
+  WriteJob *job = data;
+  g_autoptr(GSimpleAsyncResult) result = job->result;
+  GError *local_error = NULL;
+
+  job->start_time = g_get_monotonic_time ();
+  if (g_cancellable_set_error_if_cancelled (job->cancellable, &local_error))
+    g_simple_async_result_take_error (result, local_error);
+  else
+    job->func (result, (GObject*) job->repo, job->cancellable);
+  job->end_time = g_get_monotonic_time ();
+
+  g_simple_async_result_complete_in_idle (result);
+}
+
+/* Takes a reference to @job->result until the write completes */
+static void
+write_job_queue (OstreeRepo *self,
+                 WriteJob   *job)
+{
+  g_mutex_lock (&self->write_pool_lock);
+  if (!self->write_pool)
+    {
+      guint n_threads = self->write_threads;
+
+      /* Writes mostly wait on the disk, so use more threads than CPUs,
+       * but there's no point in exceeding what a pull keeps queued.
+       */
+      if (n_threads == 0)
+        n_threads = CLAMP (g_get_num_processors (), _OSTREE_WRITE_POOL_MIN_THREADS,
+                           _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS);
+
+      /* Creating a non-exclusive pool can't fail */
+      self->write_pool = g_thread_pool_new (write_job_in_thread, NULL,
+                                            n_threads, FALSE, NULL);
+      g_thread_pool_set_sort_function (self->write_pool, write_job_compare, NULL);
+    }
+
+  job->seq = self->write_pool_seq++;
+  job->queue_depth = g_thread_pool_unprocessed (self->write_pool);
+  job->queue_time = g_get_monotonic_time ();
+  g_object_ref (job->result);
+  /* Likewise, this only fails if no thread at all could be created */
+  (void) g_thread_pool_push (self->write_pool, job, NULL);
+  g_mutex_unlock (&self->write_pool_lock);
+}
+
+/* Where the time of a completed ostree_repo_write_metadata_async() or
+ * ostree_repo_write_content_async() went.
+ */
+void
+_ostree_repo_write_async_get_timing (GAsyncResult          *result,
+                                     OstreeRepoWriteTiming *out_timing)
+{
+  const WriteJob *job = g_simple_async_result_get_op_res_gpointer ((GSimpleAsyncResult*) result);
+
+  out_timing->queue_usec = MAX (job->start_time - job->queue_time, 0);
+  out_timing->write_usec = MAX (job->end_time - job->start_time, 0);
+  out_timing->queue_depth = job->queue_depth;
+}
+
+typedef struct {
+  WriteJob job;
   OstreeObjectType objtype;
   char *expected_checksum;
   GVariant *object;
-  GCancellable *cancellable;
-  GSimpleAsyncResult *result;
 
   guchar *result_csum;
 } WriteMetadataAsyncData;
@@ -1696,8 +1805,7 @@ write_metadata_async_data_free (gpointer user_data)
 {
   WriteMetadataAsyncData *data = user_data;
 
-  g_clear_object (&data->repo);
-  g_clear_object (&data->cancellable);
+  write_job_clear (&data->job);
   g_variant_unref (data->object);
   g_free (data->result_csum);
   g_free (data->expected_checksum);
@@ -1713,7 +1821,7 @@ write_metadata_thread (GSimpleAsyncResult  *res,
   WriteMetadataAsyncData *data;
 
   data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!ostree_repo_write_metadata (data->repo, data->objtype, data->expected_checksum,
+  if (!ostree_repo_write_metadata (data->job.repo, data->objtype, data->expected_checksum,
                                    data->object,
                                    &data->result_csum,
                                    cancellable, &error))
@@ -1744,21 +1852,26 @@ ostree_repo_write_metadata_async (OstreeRepo               *self,
 {
   WriteMetadataAsyncData *asyncdata;
 
+  g_autoptr(GSimpleAsyncResult) result = NULL;
+
   asyncdata = g_new0 (WriteMetadataAsyncData, 1);
-  asyncdata->repo = g_object_ref (self);
+  asyncdata->job.repo = g_object_ref (self);
+  asyncdata->job.cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  asyncdata->job.func = write_metadata_thread;
+  asyncdata->job.priority = WRITE_JOB_PRIORITY_METADATA;
   asyncdata->objtype = objtype;
   asyncdata->expected_checksum = g_strdup (expected_checksum);
   asyncdata->object = g_variant_ref (object);
-  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
 
-  asyncdata->result = g_simple_async_result_new ((GObject*) self,
-                                                 callback, user_data,
-                                                 ostree_repo_write_metadata_async);
+  result = g_simple_async_result_new ((GObject*) self,
+                                      callback, user_data,
+                                      ostree_repo_write_metadata_async);
+  g_simple_async_result_set_check_cancellable (result, cancellable);
+  asyncdata->job.result = result;
 
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
+  g_simple_async_result_set_op_res_gpointer (result, asyncdata,
                                              write_metadata_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, write_metadata_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+  write_job_queue (self, &asyncdata->job);
 }
 
 gboolean
@@ -1875,12 +1988,10 @@ ostree_repo_write_content (OstreeRepo       *self,
 }
 
 typedef struct {
-  OstreeRepo *repo;
+  WriteJob job;
   char *expected_checksum;
   GInputStream *object;
   guint64 file_object_length;
-  GCancellable *cancellable;
-  GSimpleAsyncResult *result;
 
   guchar *result_csum;
 } WriteContentAsyncData;
@@ -1890,8 +2001,7 @@ write_content_async_data_free (gpointer user_data)
 {
   WriteContentAsyncData *data = user_data;
 
-  g_clear_object (&data->repo);
-  g_clear_object (&data->cancellable);
+  write_job_clear (&data->job);
   g_clear_object (&data->object);
   g_free (data->result_csum);
   g_free (data->expected_checksum);
@@ -1907,7 +2017,7 @@ write_content_thread (GSimpleAsyncResult  *res,
   WriteContentAsyncData *data;
 
   data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!ostree_repo_write_content (data->repo, data->expected_checksum,
+  if (!ostree_repo_write_content (data->job.repo, data->expected_checksum,
                                   data->object, data->file_object_length,
                                   &data->result_csum,
                                   cancellable, &error))
@@ -1938,21 +2048,26 @@ ostree_repo_write_content_async (OstreeRepo               *self,
 {
   WriteContentAsyncData *asyncdata;
 
+  g_autoptr(GSimpleAsyncResult) result = NULL;
+
   asyncdata = g_new0 (WriteContentAsyncData, 1);
-  asyncdata->repo = g_object_ref (self);
+  asyncdata->job.repo = g_object_ref (self);
+  asyncdata->job.cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  asyncdata->job.func = write_content_thread;
+  asyncdata->job.priority = WRITE_JOB_PRIORITY_CONTENT;
   asyncdata->expected_checksum = g_strdup (expected_checksum);
   asyncdata->object = g_object_ref (object);
   asyncdata->file_object_length = length;
-  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
 
-  asyncdata->result = g_simple_async_result_new ((GObject*) self,
-                                                 callback, user_data,
-                                                 ostree_repo_write_content_async);
+  result = g_simple_async_result_new ((GObject*) self,
+                                      callback, user_data,
+                                      ostree_repo_write_content_async);
+  g_simple_async_result_set_check_cancellable (result, cancellable);
+  asyncdata->job.result = result;
 
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
+  g_simple_async_result_set_op_res_gpointer (result, asyncdata,
                                              write_content_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, write_content_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+  write_job_queue (self, &asyncdata->job);
 }
 
 /**
@@ -2194,81 +2309,165 @@ ostree_repo_write_commit_detached_metadata (OstreeRepo      *self,
   return TRUE;
 }
 
-static GVariant *
-create_tree_variant_from_hashes (GHashTable            *file_checksums,
-                                 GHashTable            *dir_contents_checksums,
-                                 GHashTable            *dir_metadata_checksums)
-{
-  GHashTableIter hash_iter;
-  gpointer key, value;
-  GVariantBuilder files_builder;
-  GVariantBuilder dirs_builder;
-  GSList *sorted_filenames = NULL;
-  GSList *iter;
-  GVariant *serialized_tree;
-
-  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
-  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+/* A directory entry to be serialized into a dirtree; for files, only
+ * @csum is used.
+ */
+typedef struct {
+  const char *name;
+  gsize name_len;
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  guchar meta_csum[OSTREE_SHA256_DIGEST_LEN];
+} DirtreeEntry;
 
-  g_hash_table_iter_init (&hash_iter, file_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      const char *name = key;
+static int
+compare_dirtree_entries (gconstpointer a,
+                         gconstpointer b)
+{
+  const DirtreeEntry *entry_a = a;
+  const DirtreeEntry *entry_b = b;
+  return strcmp (entry_a->name, entry_b->name);
+}
 
-      /* Should have been validated earlier, but be paranoid */
-      g_assert (ot_util_filename_validate (name, NULL));
+/* The following implement just enough of the GVariant serialization
+ * format to write the dirtree type (a(say)a(sayay)) directly into a
+ * single buffer, rather than allocating a GVariant per entry and per
+ * checksum.  See gvariant-serialiser.c in GLib.
+ */
 
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
-    }
+/* Total size of a container with a body of @body_size bytes and
+ * @n_offsets framing offsets, picking the smallest offset size.
+ */
+static gsize
+dirtree_container_size (gsize body_size,
+                        gsize n_offsets)
+{
+  if (body_size + 1 * n_offsets <= G_MAXUINT8)
+    return body_size + 1 * n_offsets;
+  if (body_size + 2 * n_offsets <= G_MAXUINT16)
+    return body_size + 2 * n_offsets;
+  if (body_size + 4 * n_offsets <= G_MAXUINT32)
+    return body_size + 4 * n_offsets;
+  return body_size + 8 * n_offsets;
+}
+
+static guint
+dirtree_offset_size (gsize container_size)
+{
+  if (container_size > G_MAXUINT32)
+    return 8;
+  else if (container_size > G_MAXUINT16)
+    return 4;
+  else if (container_size > G_MAXUINT8)
+    return 2;
+  else if (container_size > 0)
+    return 1;
+  return 0;
+}
+
+static guint8 *
+dirtree_write_offset (guint8 *p,
+                      gsize   value,
+                      guint   offset_size)
+{
+  for (guint i = 0; i < offset_size; i++)
+    p[i] = (value >> (i * 8)) & 0xFF;
+  return p + offset_size;
+}
+
+/* Size of a (say) or (sayay) entry; in both the string is the only
+ * non-final variable-sized member with a framing offset, and (sayay)
+ * additionally has one for the first checksum.
+ */
+static gsize
+dirtree_entry_size (const DirtreeEntry *entry,
+                    gboolean            is_dir)
+{
+  if (is_dir)
+    return dirtree_container_size (entry->name_len + 1 + 2 * OSTREE_SHA256_DIGEST_LEN, 2);
+  return dirtree_container_size (entry->name_len + 1 + OSTREE_SHA256_DIGEST_LEN, 1);
+}
 
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
+/* Size of an a(say) or a(sayay) array; each entry has a framing offset */
+static gsize
+dirtree_array_size (GArray   *entries,
+                    gboolean  is_dir)
+{
+  gsize body_size = 0;
 
-  for (iter = sorted_filenames; iter; iter = iter->next)
-    {
-      const char *name = iter->data;
-      const char *value;
+  if (entries->len == 0)
+    return 0;
 
-      value = g_hash_table_lookup (file_checksums, name);
-      g_variant_builder_add (&files_builder, "(s@ay)", name,
-                             ostree_checksum_to_bytes_v (value));
-    }
+  for (guint i = 0; i < entries->len; i++)
+    body_size += dirtree_entry_size (&g_array_index (entries, DirtreeEntry, i), is_dir);
+  return dirtree_container_size (body_size, entries->len);
+}
 
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+static guint8 *
+dirtree_write_entry (guint8             *p,
+                     const DirtreeEntry *entry,
+                     gboolean            is_dir)
+{
+  const gsize entry_size = dirtree_entry_size (entry, is_dir);
+  const guint offset_size = dirtree_offset_size (entry_size);
+  const gsize name_end = entry->name_len + 1;
 
-  g_hash_table_iter_init (&hash_iter, dir_metadata_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+  memcpy (p, entry->name, name_end);
+  p += name_end;
+  memcpy (p, entry->csum, OSTREE_SHA256_DIGEST_LEN);
+  p += OSTREE_SHA256_DIGEST_LEN;
+  if (is_dir)
     {
-      const char *name = key;
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+      memcpy (p, entry->meta_csum, OSTREE_SHA256_DIGEST_LEN);
+      p += OSTREE_SHA256_DIGEST_LEN;
+      /* Framing offsets of structures are stored in reverse order */
+      p = dirtree_write_offset (p, name_end + OSTREE_SHA256_DIGEST_LEN, offset_size);
     }
+  return dirtree_write_offset (p, name_end, offset_size);
+}
 
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
+static guint8 *
+dirtree_write_array (guint8   *p,
+                     GArray   *entries,
+                     gboolean  is_dir)
+{
+  const guint offset_size = dirtree_offset_size (dirtree_array_size (entries, is_dir));
+  guint8 *start = p;
+  g_autofree gsize *ends = g_new (gsize, entries->len);
 
-  for (iter = sorted_filenames; iter; iter = iter->next)
+  for (guint i = 0; i < entries->len; i++)
     {
-      const char *name = iter->data;
-      const char *content_checksum;
-      const char *meta_checksum;
-
-      content_checksum = g_hash_table_lookup (dir_contents_checksums, name);
-      meta_checksum = g_hash_table_lookup (dir_metadata_checksums, name);
-
-      g_variant_builder_add (&dirs_builder, "(s@ay@ay)",
-                             name,
-                             ostree_checksum_to_bytes_v (content_checksum),
-                             ostree_checksum_to_bytes_v (meta_checksum));
+      p = dirtree_write_entry (p, &g_array_index (entries, DirtreeEntry, i), is_dir);
+      ends[i] = p - start;
     }
+  for (guint i = 0; i < entries->len; i++)
+    p = dirtree_write_offset (p, ends[i], offset_size);
+  return p;
+}
+
+/* Build a dirtree object from @files and @dirs, which are sorted by
+ * name in place.
+ */
+static GVariant *
+create_tree_variant (GArray *files,
+                     GArray *dirs)
+{
+  g_array_sort (files, compare_dirtree_entries);
+  g_array_sort (dirs, compare_dirtree_entries);
 
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+  const gsize files_size = dirtree_array_size (files, FALSE);
+  const gsize dirs_size = dirtree_array_size (dirs, TRUE);
+  const gsize total_size = dirtree_container_size (files_size + dirs_size, 1);
+  guint8 *buf = g_malloc (total_size);
+  guint8 *p = buf;
 
-  serialized_tree = g_variant_new ("(@a(say)@a(sayay))",
-                                   g_variant_builder_end (&files_builder),
-                                   g_variant_builder_end (&dirs_builder));
-  g_variant_ref_sink (serialized_tree);
+  p = dirtree_write_array (p, files, FALSE);
+  p = dirtree_write_array (p, dirs, TRUE);
+  p = dirtree_write_offset (p, files_size, dirtree_offset_size (total_size));
+  g_assert_cmpuint (p - buf, ==, total_size);
 
-  return serialized_tree;
+  return g_variant_ref_sink (g_variant_new_from_data (OSTREE_TREE_GVARIANT_FORMAT,
+                                                      buf, total_size, FALSE,
+                                                      g_free, buf));
 }
 
 OstreeRepoCommitFilterResult
@@ -2649,6 +2848,16 @@ write_directory_to_mtree_internal (OstreeRepo                  *self,
       if (!ostree_repo_file_ensure_resolved (repo_dir, error))
         return FALSE;
 
+      /* If nothing else was merged into this directory yet, just
+       * reference the existing dirtree; it's only loaded if something
+       * is later changed below it.
+       */
+      if (ostree_repo_file_get_repo (repo_dir) == self &&
+          ostree_mutable_tree_fill_empty_from_dirtree (mtree, self,
+                                                       ostree_repo_file_tree_get_contents_checksum (repo_dir),
+                                                       ostree_repo_file_tree_get_metadata_checksum (repo_dir)))
+        return TRUE;
+
       ostree_mutable_tree_set_metadata_checksum (mtree, ostree_repo_file_tree_get_metadata_checksum (repo_dir));
 
       filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
@@ -2914,6 +3123,212 @@ ostree_repo_write_dfd_to_mtree (OstreeRepo                *self,
   return TRUE;
 }
 
+/* A directory of an #OstreeMutableTree which needs to be written for
+ * ostree_repo_write_mtree().  Directories are written bottom-up: a job
+ * becomes ready once all of its modified subdirectories are written,
+ * and independent jobs are written in parallel.
+ */
+typedef struct MtreeWriteJob MtreeWriteJob;
+struct MtreeWriteJob {
+  OstreeMutableTree *mtree;
+  MtreeWriteJob *parent;
+  guint parent_index;     /* Index of our entry in parent->dir_entries */
+  guint n_pending;        /* Subdirectories left to write; protected by lock */
+  GArray *file_entries;
+  GArray *dir_entries;    /* Entries of pending subdirectories are
+                           * filled in when they're written */
+};
+
+typedef struct {
+  OstreeRepo *repo;
+  GCancellable *cancellable;
+  GPtrArray *jobs;        /* Owns all jobs; the first one is the root */
+  GThreadPool *pool;      /* If NULL, jobs are written by the calling thread */
+  GQueue ready;           /* Jobs ready to be written, without a pool */
+
+  GMutex lock;
+  GCond cond;
+  guint n_outstanding;    /* Jobs pushed to the pool; protected by lock */
+  GError *error;          /* Protected by lock; first error wins */
+} MtreeWriteData;
+
+static void
+mtree_write_job_free (MtreeWriteJob *job)
+{
+  g_object_unref (job->mtree);
+  g_array_unref (job->file_entries);
+  g_array_unref (job->dir_entries);
+  g_free (job);
+}
+
+/* Create jobs for @mtree and its modified subdirectories; the ones
+ * that can be written right away are added to @leaves.  This runs
+ * before any job is started, so @n_pending needs no locking.
+ */
+static gboolean
+prepare_mtree_write_jobs (MtreeWriteData     *data,
+                          OstreeMutableTree  *mtree,
+                          MtreeWriteJob      *parent,
+                          guint               parent_index,
+                          GPtrArray          *leaves,
+                          GError            **error)
+{
+  GHashTable *subdirs = ostree_mutable_tree_get_subdirs (mtree);
+  GHashTable *files = ostree_mutable_tree_get_files (mtree);
+  MtreeWriteJob *job;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  if (!ostree_mutable_tree_check_error (mtree, error))
+    return FALSE;
+
+  job = g_new0 (MtreeWriteJob, 1);
+  job->mtree = g_object_ref (mtree);
+  job->parent = parent;
+  job->parent_index = parent_index;
+  job->dir_entries = g_array_sized_new (FALSE, FALSE, sizeof (DirtreeEntry),
+                                        g_hash_table_size (subdirs));
+  job->file_entries = g_array_sized_new (FALSE, FALSE, sizeof (DirtreeEntry),
+                                         g_hash_table_size (files));
+  g_ptr_array_add (data->jobs, job);
+
+  g_hash_table_iter_init (&hash_iter, subdirs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *name = key;
+      OstreeMutableTree *child_dir = value;
+      const char *child_metadata_checksum = ostree_mutable_tree_get_metadata_checksum (child_dir);
+      const char *child_contents_checksum;
+      DirtreeEntry entry = { name, strlen (name), };
+
+      if (!child_metadata_checksum)
+        return glnx_throw (error, "Can't commit an empty tree");
+      ostree_checksum_inplace_to_bytes (child_metadata_checksum, entry.meta_csum);
+
+      child_contents_checksum = ostree_mutable_tree_get_contents_checksum (child_dir);
+      if (child_contents_checksum)
+        ostree_checksum_inplace_to_bytes (child_contents_checksum, entry.csum);
+      g_array_append_val (job->dir_entries, entry);
+
+      if (!child_contents_checksum)
+        {
+          job->n_pending++;
+          if (!prepare_mtree_write_jobs (data, child_dir, job, job->dir_entries->len - 1,
+                                         leaves, error))
+            return FALSE;
+        }
+    }
+
+  g_hash_table_iter_init (&hash_iter, files);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *name = key;
+      DirtreeEntry entry = { name, strlen (name), };
+
+      /* Should have been validated earlier, but be paranoid */
+      g_assert (ot_util_filename_validate (name, NULL));
+
+      ostree_checksum_inplace_to_bytes (value, entry.csum);
+      g_array_append_val (job->file_entries, entry);
+    }
+
+  if (job->n_pending == 0)
+    g_ptr_array_add (leaves, job);
+
+  return TRUE;
+}
+
+/* Must be called with the lock held if there's a pool */
+static void
+queue_mtree_write_job (MtreeWriteData *data,
+                       MtreeWriteJob  *job)
+{
+  if (data->pool)
+    {
+      data->n_outstanding++;
+      /* Only fails for exclusive pools creating new threads */
+      (void) g_thread_pool_push (data->pool, job, NULL);
+    }
+  else
+    g_queue_push_tail (&data->ready, job);
+}
+
+static gboolean
+write_mtree_job (MtreeWriteData *data,
+                 MtreeWriteJob  *job,
+                 GError        **error)
+{
+  g_autoptr(GVariant) serialized_tree = NULL;
+  g_autofree guchar *contents_csum = NULL;
+  char contents_checksum_buf[OSTREE_SHA256_STRING_LEN+1];
+
+  serialized_tree = create_tree_variant (job->file_entries, job->dir_entries);
+
+  if (!ostree_repo_write_metadata (data->repo, OSTREE_OBJECT_TYPE_DIR_TREE, NULL,
+                                   serialized_tree, &contents_csum,
+                                   data->cancellable, error))
+    return FALSE;
+
+  ostree_checksum_inplace_from_bytes (contents_csum, contents_checksum_buf);
+  ostree_mutable_tree_set_contents_checksum (job->mtree, contents_checksum_buf);
+
+  /* Each child has its own entry in the parent, which isn't touched
+   * by anything else until all children are done.
+   */
+  if (job->parent)
+    memcpy (g_array_index (job->parent->dir_entries, DirtreeEntry, job->parent_index).csum,
+            contents_csum, OSTREE_SHA256_DIGEST_LEN);
+
+  return TRUE;
+}
+
+/* Record the result of @job, and queue its parent if it was the last
+ * pending subdirectory.
+ */
+static void
+mtree_write_job_done (MtreeWriteData *data,
+                      MtreeWriteJob  *job,
+                      GError         *local_error)
+{
+  if (data->pool)
+    g_mutex_lock (&data->lock);
+
+  if (local_error)
+    {
+      if (!data->error)
+        data->error = g_error_copy (local_error);
+    }
+  else if (job->parent && --job->parent->n_pending == 0 && !data->error)
+    queue_mtree_write_job (data, job->parent);
+
+  if (data->pool)
+    {
+      data->n_outstanding--;
+      g_cond_signal (&data->cond);
+      g_mutex_unlock (&data->lock);
+    }
+}
+
+static void
+write_mtree_job_in_thread (gpointer job_data,
+                           gpointer user_data)
+{
+  MtreeWriteJob *job = job_data;
+  MtreeWriteData *data = user_data;
+  g_autoptr(GError) local_error = NULL;
+  gboolean failed;
+
+  /* Don't bother writing anything more if another job failed */
+  g_mutex_lock (&data->lock);
+  failed = data->error != NULL;
+  g_mutex_unlock (&data->lock);
+
+  if (!failed)
+    (void) write_mtree_job (data, job, &local_error);
+
+  mtree_write_job_done (data, job, local_error);
+}
+
 /**
  * ostree_repo_write_mtree:
  * @self: Repo
@@ -2925,6 +3340,9 @@ ostree_repo_write_dfd_to_mtree (OstreeRepo                *self,
  * Write all metadata objects for @mtree to repo; the resulting
  * @out_file points to the %OSTREE_OBJECT_TYPE_DIR_TREE object that
  * the @mtree represented.
+ *
+ * Directories are written bottom-up, with independent subtrees written
+ * in parallel.
  */
 gboolean
 ostree_repo_write_mtree (OstreeRepo           *self,
@@ -2933,68 +3351,86 @@ ostree_repo_write_mtree (OstreeRepo           *self,
                          GCancellable         *cancellable,
                          GError              **error)
 {
+  gboolean ret = FALSE;
   const char *contents_checksum, *metadata_checksum;
-  g_autoptr(GFile) ret_file = NULL;
+  g_autoptr(GPtrArray) leaves = g_ptr_array_new ();
+  MtreeWriteData data = { 0, };
+
+  data.repo = self;
+  data.cancellable = cancellable;
+  data.jobs = g_ptr_array_new_with_free_func ((GDestroyNotify)mtree_write_job_free);
+  g_queue_init (&data.ready);
+  g_mutex_init (&data.lock);
+  g_cond_init (&data.cond);
 
   metadata_checksum = ostree_mutable_tree_get_metadata_checksum (mtree);
   if (!metadata_checksum)
-    return glnx_throw (error, "Can't commit an empty tree");
-
-  contents_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
-  if (contents_checksum)
     {
-      ret_file = G_FILE (_ostree_repo_file_new_root (self, contents_checksum, metadata_checksum));
+      glnx_throw (error, "Can't commit an empty tree");
+      goto out;
     }
-  else
+
+  contents_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
+  if (!contents_checksum)
     {
-      g_autoptr(GHashTable) dir_metadata_checksums = NULL;
-      g_autoptr(GHashTable) dir_contents_checksums = NULL;
-      g_autoptr(GVariant) serialized_tree = NULL;
-      g_autofree guchar *contents_csum = NULL;
-      char contents_checksum_buf[OSTREE_SHA256_STRING_LEN+1];
-
-      dir_contents_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-      dir_metadata_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-
-      GHashTableIter hash_iter;
-      gpointer key, value;
-      g_hash_table_iter_init (&hash_iter, ostree_mutable_tree_get_subdirs (mtree));
-      while (g_hash_table_iter_next (&hash_iter, &key, &value))
-        {
-          const char *name = key;
-          g_autoptr(GFile) child_file = NULL;
-          OstreeMutableTree *child_dir = value;
+      if (!prepare_mtree_write_jobs (&data, mtree, NULL, 0, leaves, error))
+        goto out;
 
-          if (!ostree_repo_write_mtree (self, child_dir, &child_file,
-                                        cancellable, error))
-            return FALSE;
+      if (data.jobs->len > 1 && g_get_num_processors () > 1)
+        {
+          data.pool = g_thread_pool_new (write_mtree_job_in_thread, &data,
+                                         MIN (data.jobs->len, g_get_num_processors ()),
+                                         FALSE, error);
+          if (!data.pool)
+            goto out;
+        }
 
-          g_hash_table_replace (dir_contents_checksums, g_strdup (name),
-                                g_strdup (ostree_repo_file_tree_get_contents_checksum (OSTREE_REPO_FILE (child_file))));
-          g_hash_table_replace (dir_metadata_checksums, g_strdup (name),
-                                g_strdup (ostree_repo_file_tree_get_metadata_checksum (OSTREE_REPO_FILE (child_file))));
+      if (data.pool)
+        g_mutex_lock (&data.lock);
+      for (guint i = 0; i < leaves->len; i++)
+        queue_mtree_write_job (&data, leaves->pdata[i]);
+      if (data.pool)
+        {
+          while (data.n_outstanding > 0)
+            g_cond_wait (&data.cond, &data.lock);
+          g_mutex_unlock (&data.lock);
         }
+      else
+        {
+          MtreeWriteJob *job;
 
-      serialized_tree = create_tree_variant_from_hashes (ostree_mutable_tree_get_files (mtree),
-                                                         dir_contents_checksums,
-                                                         dir_metadata_checksums);
+          while (!data.error && (job = g_queue_pop_head (&data.ready)) != NULL)
+            {
+              g_autoptr(GError) local_error = NULL;
 
-      if (!ostree_repo_write_metadata (self, OSTREE_OBJECT_TYPE_DIR_TREE, NULL,
-                                       serialized_tree, &contents_csum,
-                                       cancellable, error))
-        return FALSE;
+              (void) write_mtree_job (&data, job, &local_error);
+              mtree_write_job_done (&data, job, local_error);
+            }
+        }
 
-      ostree_checksum_inplace_from_bytes (contents_csum, contents_checksum_buf);
-      ostree_mutable_tree_set_contents_checksum (mtree, contents_checksum_buf);
+      if (data.error)
+        {
+          g_propagate_error (error, g_steal_pointer (&data.error));
+          goto out;
+        }
 
-      ret_file = G_FILE (_ostree_repo_file_new_root (self, contents_checksum_buf, metadata_checksum));
+      contents_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
+      g_assert (contents_checksum != NULL);
     }
 
   if (out_file)
-    *out_file = g_steal_pointer (&ret_file);
-  return TRUE;
+    *out_file = G_FILE (_ostree_repo_file_new_root (self, contents_checksum, metadata_checksum));
+
+  ret = TRUE;
+ out:
+  if (data.pool)
+    g_thread_pool_free (data.pool, FALSE, TRUE);
+  g_queue_clear (&data.ready);
+  g_ptr_array_unref (data.jobs);
+  g_clear_error (&data.error);
+  g_mutex_clear (&data.lock);
+  g_cond_clear (&data.cond);
+  return ret;
 }
 
 /**
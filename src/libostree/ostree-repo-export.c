@@ -0,0 +1,764 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gfiledescriptorbased.h>
+
+#include "ostree-core-private.h"
+#include "ostree-repo-private.h"
+#include "ostree-repo-file.h"
+#include "otutil.h"
+
+/* This is a direct writer for the GNU tar format, as produced by
+ * libarchive's gnutar writer.  It walks the dirtree objects rather
+ * than going through #OstreeRepoFile, and copies the content of
+ * objects stored as plain files (i.e. bare repos) straight to the
+ * output fd with copy_file_range()/sendfile().  Extended attributes are
+ * written as POSIX.1-2001 extended headers using the SCHILY.xattr
+ * keywords understood by GNU tar and libarchive.
+ */
+
+#define TAR_BLOCK_SIZE 512
+/* Pad the end of the archive to a full record, as tar(1) does */
+#define TAR_RECORD_SIZE (20 * TAR_BLOCK_SIZE)
+#define TAR_NAME_SIZE 100
+#define TAR_LONGLINK_NAME "././@LongLink"
+#define TAR_PAX_HEADER_NAME "././@PaxHeader"
+
+#define TAR_WRITER_BUFSIZE (64 * 1024)
+
+/* Content of objects not stored as plain files (e.g. archive-z2) up
+ * to this size is read into memory by the prefetch threads.
+ */
+#define EXPORT_PREFETCH_MAX_FILE_SIZE (1024 * 1024)
+/* Number of entries to prefetch ahead per thread */
+#define EXPORT_PREFETCH_ENTRIES_PER_JOB 16
+
+typedef struct {
+  int      fd;
+  guint8  *buf;
+  gsize    buf_len;
+  guint64  offset;
+} TarWriter;
+
+static gboolean
+tar_writer_flush (TarWriter  *w,
+                  GError    **error)
+{
+  if (w->buf_len == 0)
+    return TRUE;
+  if (glnx_loop_write (w->fd, w->buf, w->buf_len) < 0)
+    return glnx_throw_errno_prefix (error, "write");
+  w->buf_len = 0;
+  return TRUE;
+}
+
+static gboolean
+tar_writer_append (TarWriter     *w,
+                   const guint8  *data,
+                   gsize          len,
+                   GError       **error)
+{
+  if (w->buf_len + len > TAR_WRITER_BUFSIZE)
+    {
+      if (!tar_writer_flush (w, error))
+        return FALSE;
+    }
+
+  if (len >= TAR_WRITER_BUFSIZE)
+    {
+      if (glnx_loop_write (w->fd, data, len) < 0)
+        return glnx_throw_errno_prefix (error, "write");
+    }
+  else
+    {
+      memcpy (w->buf + w->buf_len, data, len);
+      w->buf_len += len;
+    }
+
+  w->offset += len;
+  return TRUE;
+}
+
+/* Pad with zeroes up to a multiple of @alignment */
+static gboolean
+tar_writer_pad (TarWriter  *w,
+                gsize       alignment,
+                GError    **error)
+{
+  static const guint8 zeroes[TAR_BLOCK_SIZE];
+  gsize remaining = (alignment - (w->offset % alignment)) % alignment;
+
+  while (remaining > 0)
+    {
+      gsize n = MIN (remaining, sizeof (zeroes));
+      if (!tar_writer_append (w, zeroes, n, error))
+        return FALSE;
+      remaining -= n;
+    }
+
+  return TRUE;
+}
+
+/* Numbers are octal, NUL terminated; GNU tar uses a base-256 encoding
+ * with the high bit set for values too large for that.
+ */
+static void
+tar_format_number (char     *field,
+                   gsize     width,
+                   guint64   value)
+{
+  if (value < ((guint64)1 << (3 * (width - 1))))
+    {
+      for (gsize i = width - 1; i > 0; i--)
+        {
+          field[i - 1] = '0' + (value & 7);
+          value >>= 3;
+        }
+      field[width - 1] = '\0';
+    }
+  else
+    {
+      for (gsize i = width; i > 1; i--)
+        {
+          field[i - 1] = value & 0xff;
+          value >>= 8;
+        }
+      field[0] = (char)0x80;
+    }
+}
+
+static gboolean
+tar_write_raw_header (TarWriter   *w,
+                      const char  *name,
+                      const char  *linkname,
+                      char         typeflag,
+                      guint32      mode,
+                      guint32      uid,
+                      guint32      gid,
+                      guint64      size,
+                      guint64      mtime,
+                      GError     **error)
+{
+  char header[TAR_BLOCK_SIZE] = { 0, };
+  guint checksum = 0;
+
+  strncpy (header, name, TAR_NAME_SIZE);
+  tar_format_number (header + 100, 8, mode & 07777);
+  tar_format_number (header + 108, 8, uid);
+  tar_format_number (header + 116, 8, gid);
+  tar_format_number (header + 124, 12, size);
+  tar_format_number (header + 136, 12, mtime);
+  header[156] = typeflag;
+  if (linkname)
+    strncpy (header + 157, linkname, TAR_NAME_SIZE);
+  memcpy (header + 257, "ustar  ", 8);
+
+  /* The checksum is computed with its own field set to spaces */
+  memset (header + 148, ' ', 8);
+  for (gsize i = 0; i < sizeof (header); i++)
+    checksum += (guint8)header[i];
+  tar_format_number (header + 148, 7, checksum);
+
+  return tar_writer_append (w, (guint8*)header, sizeof (header), error);
+}
+
+/* Names which don't fit in the header are written as a preceding
+ * GNU long name ('L') or long link ('K') pseudo-entry.
+ */
+static gboolean
+tar_write_longlink (TarWriter   *w,
+                    char         typeflag,
+                    const char  *value,
+                    GError     **error)
+{
+  gsize len = strlen (value) + 1;
+
+  if (!tar_write_raw_header (w, TAR_LONGLINK_NAME, NULL, typeflag,
+                             0644, 0, 0, len, 0, error))
+    return FALSE;
+  if (!tar_writer_append (w, (const guint8*)value, len, error))
+    return FALSE;
+  return tar_writer_pad (w, TAR_BLOCK_SIZE, error);
+}
+
+static guint
+count_decimal_digits (gsize value)
+{
+  guint digits = 1;
+
+  for (; value >= 10; value /= 10)
+    digits++;
+  return digits;
+}
+
+/* Append a pax extended header record "<len> <key>=<value>\n", where
+ * <len> is the length of the whole record including itself.
+ */
+static void
+tar_append_pax_record (GString      *buf,
+                       const char   *key,
+                       const guint8 *value,
+                       gsize         value_len)
+{
+  gsize len = strlen (key) + value_len + 3;  /* ' ', '=' and '\n' */
+  guint digits = count_decimal_digits (len);
+
+  /* Adding the length itself may carry into another digit */
+  len += digits;
+  if (count_decimal_digits (len) > digits)
+    len++;
+
+  g_string_append_printf (buf, "%" G_GSIZE_FORMAT " %s=", len, key);
+  g_string_append_len (buf, (const char*)value, value_len);
+  g_string_append_c (buf, '\n');
+}
+
+/* Extended attributes of type a(ayay) are written as a pax extended
+ * header ('x') applying to the entry that follows.
+ */
+static gboolean
+tar_write_xattrs (TarWriter   *w,
+                  GVariant    *xattrs,
+                  guint64      mtime,
+                  GError     **error)
+{
+  g_autoptr(GString) buf = NULL;
+  const guint n = xattrs ? g_variant_n_children (xattrs) : 0;
+
+  if (n == 0)
+    return TRUE;
+
+  buf = g_string_new ("");
+  for (guint i = 0; i < n; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) value = NULL;
+      g_autofree char *key = NULL;
+      const guint8 *value_data;
+      gsize value_len;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)", &name, &value);
+      value_data = g_variant_get_fixed_array (value, &value_len, 1);
+      key = g_strconcat ("SCHILY.xattr.", name, NULL);
+      tar_append_pax_record (buf, key, value_data, value_len);
+    }
+
+  if (!tar_write_raw_header (w, TAR_PAX_HEADER_NAME, NULL, 'x',
+                             0644, 0, 0, buf->len, mtime, error))
+    return FALSE;
+  if (!tar_writer_append (w, (const guint8*)buf->str, buf->len, error))
+    return FALSE;
+  return tar_writer_pad (w, TAR_BLOCK_SIZE, error);
+}
+
+static gboolean
+tar_write_header (TarWriter   *w,
+                  const char  *name,
+                  const char  *linkname,
+                  char         typeflag,
+                  guint32      mode,
+                  guint32      uid,
+                  guint32      gid,
+                  guint64      size,
+                  guint64      mtime,
+                  GError     **error)
+{
+  if (strlen (name) > TAR_NAME_SIZE &&
+      !tar_write_longlink (w, 'L', name, error))
+    return FALSE;
+  if (linkname && strlen (linkname) > TAR_NAME_SIZE &&
+      !tar_write_longlink (w, 'K', linkname, error))
+    return FALSE;
+
+  return tar_write_raw_header (w, name, linkname, typeflag,
+                               mode, uid, gid, size, mtime, error);
+}
+
+typedef struct {
+  char         *path;
+  char         *checksum;    /* Content checksum; NULL for directories */
+  guint32       uid;         /* Directories only */
+  guint32       gid;
+  guint32       mode;
+  GVariant     *xattrs;      /* Files: set when loaded */
+
+  /* Set by loading the object, possibly in a prefetch thread */
+  gboolean      loaded;
+  GInputStream *input;
+  GFileInfo    *file_info;
+  GBytes       *data;
+  GError       *error;
+} ExportEntry;
+
+static void
+export_entry_free (ExportEntry *entry)
+{
+  g_free (entry->path);
+  g_free (entry->checksum);
+  g_clear_pointer (&entry->xattrs, g_variant_unref);
+  g_clear_object (&entry->input);
+  g_clear_object (&entry->file_info);
+  g_clear_pointer (&entry->data, g_bytes_unref);
+  g_clear_error (&entry->error);
+  g_free (entry);
+}
+
+typedef struct {
+  OstreeRepo                     *repo;
+  OstreeRepoExportArchiveOptions *opts;
+  GCancellable                   *cancellable;
+  GPtrArray                      *entries;
+  GHashTable                     *dirmeta_xattrs;  /* meta checksum -> a(ayay) */
+
+  GThreadPool                    *pool;
+  guint                           n_queued;
+  GMutex                          lock;
+  GCond                           cond;
+  gboolean                        aborted;  /* Protected by lock */
+} ExportContext;
+
+static char *
+export_entry_path (ExportContext *ctx,
+                   const char    *relpath,
+                   gboolean       is_dir)
+{
+  const char *prefix = ctx->opts->path_prefix ? ctx->opts->path_prefix : "";
+  g_autofree char *path = g_strconcat (prefix, relpath, NULL);
+
+  if (!path[0])
+    {
+      g_free (path);
+      path = g_strdup (".");
+    }
+
+  /* Directories always have a trailing slash in GNU tar */
+  if (is_dir && !g_str_has_suffix (path, "/"))
+    return g_strconcat (path, "/", NULL);
+
+  return g_steal_pointer (&path);
+}
+
+static gboolean
+export_collect_entry (OstreeRepo                    *repo,
+                      const OstreeRepoWalkTreeEntry *walk_entry,
+                      gpointer                       user_data,
+                      GError                       **error)
+{
+  ExportContext *ctx = user_data;
+  ExportEntry *entry = g_new0 (ExportEntry, 1);
+  /* Walk paths are absolute; archive members are relative to the prefix */
+  const char *relpath = walk_entry->path + 1;
+
+  if (walk_entry->type == G_FILE_TYPE_DIRECTORY)
+    {
+      entry->path = export_entry_path (ctx, relpath, TRUE);
+      entry->uid = walk_entry->uid;
+      entry->gid = walk_entry->gid;
+      entry->mode = walk_entry->mode;
+
+      /* Directory metadata is shared widely, so load the xattrs of
+       * each dirmeta object once rather than having the walker query
+       * every file up front.
+       */
+      if (!ctx->opts->disable_xattrs)
+        {
+          GVariant *xattrs = g_hash_table_lookup (ctx->dirmeta_xattrs, walk_entry->meta_checksum);
+
+          if (!xattrs)
+            {
+              g_autoptr(GVariant) dirmeta = NULL;
+
+              if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_META,
+                                             walk_entry->meta_checksum, &dirmeta, error))
+                {
+                  export_entry_free (entry);
+                  return FALSE;
+                }
+              xattrs = g_variant_get_child_value (dirmeta, 3);
+              g_hash_table_insert (ctx->dirmeta_xattrs,
+                                   g_strdup (walk_entry->meta_checksum), xattrs);
+            }
+          entry->xattrs = g_variant_ref (xattrs);
+        }
+    }
+  else
+    {
+      entry->path = export_entry_path (ctx, relpath, FALSE);
+      entry->checksum = g_strdup (walk_entry->checksum);
+    }
+  g_ptr_array_add (ctx->entries, entry);
+
+  return TRUE;
+}
+
+static void
+export_load_entry (ExportContext *ctx,
+                   ExportEntry   *entry)
+{
+  g_autoptr(GInputStream) input = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GBytes) data = NULL;
+
+  if (!ostree_repo_load_file (ctx->repo, entry->checksum, &input, &file_info,
+                              ctx->opts->disable_xattrs ? NULL : &xattrs,
+                              ctx->cancellable, &local_error))
+    goto out;
+
+  /* Content not stored as a plain file (e.g. compressed in an archive-z2
+   * repo) is read here, so that the decompression happens in the
+   * prefetch threads.
+   */
+  if (input != NULL && ctx->pool != NULL &&
+      !G_IS_FILE_DESCRIPTOR_BASED (input) &&
+      g_file_info_get_size (file_info) <= EXPORT_PREFETCH_MAX_FILE_SIZE)
+    {
+      gsize size = g_file_info_get_size (file_info);
+      g_autofree guint8 *buf = g_malloc (size);
+      gsize bytes_read;
+
+      if (!g_input_stream_read_all (input, buf, size, &bytes_read,
+                                    ctx->cancellable, &local_error))
+        goto out;
+      if (bytes_read != size)
+        {
+          glnx_throw (&local_error, "Short read of object %s: expected %" G_GSIZE_FORMAT " bytes, got %" G_GSIZE_FORMAT,
+                      entry->checksum, size, bytes_read);
+          goto out;
+        }
+      data = g_bytes_new_take (g_steal_pointer (&buf), size);
+      g_clear_object (&input);
+    }
+
+ out:
+  if (ctx->pool)
+    g_mutex_lock (&ctx->lock);
+  entry->input = g_steal_pointer (&input);
+  entry->file_info = g_steal_pointer (&file_info);
+  entry->xattrs = g_steal_pointer (&xattrs);
+  entry->data = g_steal_pointer (&data);
+  entry->error = g_steal_pointer (&local_error);
+  entry->loaded = TRUE;
+  if (ctx->pool)
+    {
+      g_cond_broadcast (&ctx->cond);
+      g_mutex_unlock (&ctx->lock);
+    }
+}
+
+static void
+export_load_entry_in_thread (gpointer data,
+                             gpointer user_data)
+{
+  ExportEntry *entry = data;
+  ExportContext *ctx = user_data;
+  gboolean aborted;
+
+  g_mutex_lock (&ctx->lock);
+  aborted = ctx->aborted;
+  g_mutex_unlock (&ctx->lock);
+
+  if (!aborted)
+    export_load_entry (ctx, entry);
+}
+
+/* Queue loading entries up to the prefetch window past @index */
+static gboolean
+export_queue_prefetch (ExportContext *ctx,
+                       guint          index,
+                       GError       **error)
+{
+  guint window = ctx->opts->n_jobs * EXPORT_PREFETCH_ENTRIES_PER_JOB;
+  guint limit = MIN (index + window, ctx->entries->len);
+
+  for (; ctx->n_queued < limit; ctx->n_queued++)
+    {
+      ExportEntry *entry = ctx->entries->pdata[ctx->n_queued];
+
+      if (entry->checksum == NULL)
+        continue;
+      if (!g_thread_pool_push (ctx->pool, entry, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+export_wait_entry (ExportContext *ctx,
+                   ExportEntry   *entry,
+                   GError       **error)
+{
+  if (ctx->pool)
+    {
+      g_mutex_lock (&ctx->lock);
+      while (!entry->loaded)
+        g_cond_wait (&ctx->cond, &ctx->lock);
+      g_mutex_unlock (&ctx->lock);
+    }
+  else
+    export_load_entry (ctx, entry);
+
+  if (entry->error)
+    {
+      g_propagate_error (error, g_steal_pointer (&entry->error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+export_write_content (ExportContext *ctx,
+                      TarWriter     *w,
+                      ExportEntry   *entry,
+                      guint64        size,
+                      GError       **error)
+{
+  if (entry->data)
+    {
+      gsize len;
+      const guint8 *buf = g_bytes_get_data (entry->data, &len);
+
+      g_assert_cmpint (len, ==, size);
+      if (!tar_writer_append (w, buf, len, error))
+        return FALSE;
+    }
+  else if (G_IS_FILE_DESCRIPTOR_BASED (entry->input))
+    {
+      int infd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*) entry->input);
+      off_t start, end;
+
+      if (!tar_writer_flush (w, error))
+        return FALSE;
+
+      start = lseek (infd, 0, SEEK_CUR);
+      if (start < 0)
+        return glnx_throw_errno_prefix (error, "lseek");
+      if (glnx_regfile_copy_bytes (infd, w->fd, (off_t)size, FALSE) < 0)
+        return glnx_throw_errno_prefix (error, "regfile copy");
+      end = lseek (infd, 0, SEEK_CUR);
+      if (end < 0)
+        return glnx_throw_errno_prefix (error, "lseek");
+      /* A short copy would corrupt the rest of the archive */
+      if ((guint64)(end - start) != size)
+        return glnx_throw (error, "Short read of object %s: expected %" G_GUINT64_FORMAT " bytes, got %" G_GUINT64_FORMAT,
+                           entry->checksum, size, (guint64)(end - start));
+      w->offset += size;
+    }
+  else
+    {
+      guint8 buf[8192];
+      guint64 remaining = size;
+
+      while (remaining > 0)
+        {
+          gsize bytes_read;
+
+          if (!g_input_stream_read_all (entry->input, buf, MIN (remaining, sizeof (buf)),
+                                        &bytes_read, ctx->cancellable, error))
+            return FALSE;
+          if (bytes_read == 0)
+            return glnx_throw (error, "Short read of object %s", entry->checksum);
+          if (!tar_writer_append (w, buf, bytes_read, error))
+            return FALSE;
+          remaining -= bytes_read;
+        }
+    }
+
+  return tar_writer_pad (w, TAR_BLOCK_SIZE, error);
+}
+
+static gboolean
+export_write_entries (ExportContext *ctx,
+                      TarWriter     *w,
+                      GError       **error)
+{
+  guint64 mtime = ctx->opts->timestamp_secs;
+
+  for (guint i = 0; i < ctx->entries->len; i++)
+    {
+      ExportEntry *entry = ctx->entries->pdata[i];
+      GFileInfo *file_info;
+      guint32 mode, uid, gid;
+
+      if (g_cancellable_set_error_if_cancelled (ctx->cancellable, error))
+        return FALSE;
+
+      if (entry->checksum == NULL)
+        {
+          if (!tar_write_xattrs (w, entry->xattrs, mtime, error))
+            return FALSE;
+          if (!tar_write_header (w, entry->path, NULL, '5', entry->mode,
+                                 entry->uid, entry->gid, 0, mtime, error))
+            return FALSE;
+          continue;
+        }
+
+      if (ctx->pool && !export_queue_prefetch (ctx, i + 1, error))
+        return FALSE;
+      if (!export_wait_entry (ctx, entry, error))
+        return FALSE;
+
+      file_info = entry->file_info;
+      mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+      uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+      gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
+
+      if (!tar_write_xattrs (w, entry->xattrs, mtime, error))
+        return FALSE;
+
+      switch (g_file_info_get_file_type (file_info))
+        {
+        case G_FILE_TYPE_SYMBOLIC_LINK:
+          if (!tar_write_header (w, entry->path,
+                                 g_file_info_get_symlink_target (file_info),
+                                 '2', mode, uid, gid, 0, mtime, error))
+            return FALSE;
+          break;
+        case G_FILE_TYPE_REGULAR:
+          {
+            guint64 size = g_file_info_get_size (file_info);
+
+            if (!tar_write_header (w, entry->path, NULL, '0', mode, uid, gid,
+                                   size, mtime, error))
+              return FALSE;
+            if (!export_write_content (ctx, w, entry, size, error))
+              return glnx_prefix_error (error, "Writing %s", entry->path);
+          }
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+
+      /* Release the content now that it's written */
+      g_clear_object (&entry->input);
+      g_clear_object (&entry->file_info);
+      g_clear_pointer (&entry->xattrs, g_variant_unref);
+      g_clear_pointer (&entry->data, g_bytes_unref);
+    }
+
+  /* End of archive marker is two zero blocks */
+  if (!tar_writer_pad (w, TAR_BLOCK_SIZE, error))
+    return FALSE;
+  {
+    static const guint8 zeroes[2 * TAR_BLOCK_SIZE];
+    if (!tar_writer_append (w, zeroes, sizeof (zeroes), error))
+      return FALSE;
+  }
+  if (!tar_writer_pad (w, TAR_RECORD_SIZE, error))
+    return FALSE;
+
+  return tar_writer_flush (w, error);
+}
+
+/**
+ * ostree_repo_export_tree_to_fd:
+ * @self: An #OstreeRepo
+ * @opts: Options controlling conversion
+ * @root: An #OstreeRepoFile for the base directory
+ * @fd: File descriptor to write the tarball to
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Write the directory @root as an uncompressed GNU tar stream to @fd.
+ * This is the format of ostree_repo_export_tree_to_archive() with a
+ * gnutar archive, but doesn't depend on libarchive.  For content stored
+ * as plain files, the data is copied directly to @fd without going
+ * through userspace where possible.
+ *
+ * Unless the `disable_xattrs` member of @opts is set, extended
+ * attributes are written as pax extended headers, which GNU tar
+ * restores when extracting with `--xattrs`.
+ *
+ * If the `n_jobs` member of @opts is greater than one, that many threads
+ * are used to load and decompress file content ahead of writing it.
+ *
+ * Since: 2017.7
+ */
+gboolean
+ostree_repo_export_tree_to_fd (OstreeRepo                     *self,
+                               OstreeRepoExportArchiveOptions *opts,
+                               OstreeRepoFile                 *root,
+                               int                             fd,
+                               GCancellable                   *cancellable,
+                               GError                        **error)
+{
+  gboolean ret = FALSE;
+  ExportContext ctx = { 0, };
+  TarWriter w = { 0, };
+
+  if (!ostree_repo_file_ensure_resolved (root, error))
+    return FALSE;
+  if (g_file_query_file_type ((GFile*)root, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                              cancellable) != G_FILE_TYPE_DIRECTORY)
+    return glnx_throw (error, "Not a directory: %s", gs_file_get_path_cached ((GFile*)root));
+
+  ctx.repo = self;
+  ctx.opts = opts;
+  ctx.cancellable = cancellable;
+  ctx.entries = g_ptr_array_new_with_free_func ((GDestroyNotify)export_entry_free);
+  ctx.dirmeta_xattrs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)g_variant_unref);
+  g_mutex_init (&ctx.lock);
+  g_cond_init (&ctx.cond);
+
+  w.fd = fd;
+  w.buf = g_malloc (TAR_WRITER_BUFSIZE);
+
+  if (!ostree_repo_walk_tree (self,
+                              ostree_repo_file_tree_get_contents_checksum (root),
+                              ostree_repo_file_tree_get_metadata_checksum (root),
+                              -1, OSTREE_REPO_WALK_TREE_FLAGS_NONE,
+                              export_collect_entry, &ctx,
+                              cancellable, error))
+    goto out;
+
+  if (opts->n_jobs > 1)
+    {
+      ctx.pool = g_thread_pool_new (export_load_entry_in_thread, &ctx,
+                                    opts->n_jobs, FALSE, error);
+      if (!ctx.pool)
+        goto out;
+    }
+
+  if (!export_write_entries (&ctx, &w, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (ctx.pool)
+    {
+      /* Drop anything not yet started, and wait for the rest */
+      g_mutex_lock (&ctx.lock);
+      ctx.aborted = TRUE;
+      g_mutex_unlock (&ctx.lock);
+      g_thread_pool_free (ctx.pool, TRUE, TRUE);
+    }
+  g_ptr_array_unref (ctx.entries);
+  g_hash_table_unref (ctx.dirmeta_xattrs);
+  g_mutex_clear (&ctx.lock);
+  g_cond_clear (&ctx.cond);
+  g_free (w.buf);
+  return ret;
+}
@@ -235,6 +235,40 @@ mtree_ensure_dir_with_meta (OstreeRepo          *repo,
   return TRUE;
 }
 
+/* With the parallel import option, file contents are read into memory
+ * while walking the archive, and checksummed and written to the repo
+ * by a pool of threads while we keep reading.  The resulting checksums
+ * are added to the mtree in archive order once everything is written,
+ * before hardlinks are resolved, so the tree is the same as with a
+ * sequential import.
+ */
+
+/* Limit on the file contents held in memory waiting to be written */
+#define AIC_PIPELINE_MAX_BUFFERED (64 * 1024 * 1024)
+/* Larger files are streamed from the archive on the reading thread */
+#define AIC_PIPELINE_MAX_FILE_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+  OstreeMutableTree  *parent;
+  char               *name;
+  GFileInfo          *fi;
+  GVariant           *xattrs;
+  GBytes             *data;
+  char               *csum;     /* Set once written */
+} ArchiveImportJob;
+
+typedef struct {
+  OstreeRepo         *repo;
+  GCancellable       *cancellable;
+  GThreadPool        *pool;
+  GPtrArray          *jobs;     /* In archive order */
+
+  GMutex              lock;
+  GCond               cond;
+  guint64             buffered_bytes; /* Protected by lock */
+  GError             *error;    /* Protected by lock; first error wins */
+} ArchiveImportPipeline;
+
 typedef struct {
   OstreeRepo                     *repo;
   OstreeRepoImportArchiveOptions *opts;
@@ -243,6 +277,7 @@ typedef struct {
   struct archive_entry           *entry;
   GHashTable                     *deferred_hardlinks;
   OstreeRepoCommitModifier       *modifier;
+  ArchiveImportPipeline          *pipeline;  /* NULL unless parallel */
 } OstreeRepoArchiveImportContext;
 
 typedef struct {
@@ -500,6 +535,33 @@ aic_handle_dir (OstreeRepoArchiveImportContext *ctx,
                                      cancellable, error);
 }
 
+static gboolean
+aic_write_content (OstreeRepo         *repo,
+                   GInputStream       *input,
+                   GFileInfo          *fi,
+                   GVariant           *xattrs,
+                   char              **out_csum,
+                   GCancellable       *cancellable,
+                   GError            **error)
+{
+  g_autoptr(GInputStream) file_object_input = NULL;
+  guint64 length;
+
+  g_autofree guchar *csum_raw = NULL;
+
+  if (!ostree_raw_file_to_content_stream (input, fi, xattrs,
+                                          &file_object_input, &length,
+                                          cancellable, error))
+    return FALSE;
+
+  if (!ostree_repo_write_content (repo, NULL, file_object_input, length,
+                                  &csum_raw, cancellable, error))
+    return FALSE;
+
+  *out_csum = ostree_checksum_from_bytes (csum_raw);
+  return TRUE;
+}
+
 static gboolean
 aic_write_file (OstreeRepoArchiveImportContext *ctx,
                 GFileInfo          *fi,
@@ -509,24 +571,180 @@ aic_write_file (OstreeRepoArchiveImportContext *ctx,
                 GError            **error)
 {
   g_autoptr(GInputStream) archive_stream = NULL;
-  g_autoptr(GInputStream) file_object_input = NULL;
-  guint64 length;
-
-  g_autofree guchar *csum_raw = NULL;
 
   if (g_file_info_get_file_type (fi) == G_FILE_TYPE_REGULAR)
     archive_stream = _ostree_libarchive_input_stream_new (ctx->archive);
 
-  if (!ostree_raw_file_to_content_stream (archive_stream, fi, xattrs,
-                                          &file_object_input, &length,
-                                          cancellable, error))
-    return FALSE;
+  return aic_write_content (ctx->repo, archive_stream, fi, xattrs, out_csum,
+                            cancellable, error);
+}
 
-  if (!ostree_repo_write_content (ctx->repo, NULL, file_object_input, length,
-                                  &csum_raw, cancellable, error))
+static void
+archive_import_job_free (ArchiveImportJob *job)
+{
+  g_object_unref (job->parent);
+  g_free (job->name);
+  g_object_unref (job->fi);
+  g_clear_pointer (&job->xattrs, g_variant_unref);
+  g_clear_pointer (&job->data, g_bytes_unref);
+  g_free (job->csum);
+  g_free (job);
+}
+
+static void
+aic_write_job_in_thread (gpointer data,
+                         gpointer user_data)
+{
+  ArchiveImportJob *job = data;
+  ArchiveImportPipeline *pipeline = user_data;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GInputStream) input = NULL;
+  gsize size = job->data ? g_bytes_get_size (job->data) : 0;
+  gboolean failed;
+
+  /* Don't bother writing anything more if another job failed */
+  g_mutex_lock (&pipeline->lock);
+  failed = pipeline->error != NULL;
+  g_mutex_unlock (&pipeline->lock);
+
+  if (!failed)
+    {
+      if (job->data)
+        input = g_memory_input_stream_new_from_bytes (job->data);
+      (void) aic_write_content (pipeline->repo, input, job->fi, job->xattrs,
+                                &job->csum, pipeline->cancellable, &local_error);
+    }
+
+  g_clear_object (&input);
+  g_clear_pointer (&job->data, g_bytes_unref);
+
+  g_mutex_lock (&pipeline->lock);
+  if (local_error && !pipeline->error)
+    pipeline->error = g_steal_pointer (&local_error);
+  pipeline->buffered_bytes -= size;
+  g_cond_signal (&pipeline->cond);
+  g_mutex_unlock (&pipeline->lock);
+}
+
+static gboolean
+aic_pipeline_check_error (ArchiveImportPipeline *pipeline,
+                          GError               **error)
+{
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&pipeline->lock);
+  if (pipeline->error)
+    {
+      g_propagate_error (error, g_error_copy (pipeline->error));
+      ret = FALSE;
+    }
+  g_mutex_unlock (&pipeline->lock);
+  return ret;
+}
+
+/* Read the current entry's contents, waiting until they fit within
+ * the buffering limit.
+ */
+static GBytes *
+aic_pipeline_read_entry (OstreeRepoArchiveImportContext *ctx,
+                         gsize               size,
+                         GCancellable       *cancellable,
+                         GError            **error)
+{
+  ArchiveImportPipeline *pipeline = ctx->pipeline;
+  g_autoptr(GInputStream) archive_stream = NULL;
+  g_autofree guint8 *buf = NULL;
+  gsize bytes_read;
+
+  g_mutex_lock (&pipeline->lock);
+  while (pipeline->buffered_bytes > 0 &&
+         pipeline->buffered_bytes + size > AIC_PIPELINE_MAX_BUFFERED &&
+         pipeline->error == NULL)
+    g_cond_wait (&pipeline->cond, &pipeline->lock);
+  pipeline->buffered_bytes += size;
+  g_mutex_unlock (&pipeline->lock);
+
+  archive_stream = _ostree_libarchive_input_stream_new (ctx->archive);
+  buf = g_malloc (size);
+  if (!g_input_stream_read_all (archive_stream, buf, size, &bytes_read,
+                                cancellable, error))
+    goto fail;
+  if (bytes_read != size)
+    {
+      glnx_throw (error, "Short read from archive: expected %" G_GSIZE_FORMAT " bytes, got %" G_GSIZE_FORMAT,
+                  size, bytes_read);
+      goto fail;
+    }
+
+  return g_bytes_new_take (g_steal_pointer (&buf), size);
+
+ fail:
+  g_mutex_lock (&pipeline->lock);
+  pipeline->buffered_bytes -= size;
+  g_mutex_unlock (&pipeline->lock);
+  return NULL;
+}
+
+static gboolean
+aic_pipeline_queue_file (OstreeRepoArchiveImportContext *ctx,
+                         OstreeMutableTree  *parent,
+                         const char         *path,
+                         GFileInfo          *fi,
+                         GVariant           *xattrs,
+                         GCancellable       *cancellable,
+                         GError            **error)
+{
+  ArchiveImportPipeline *pipeline = ctx->pipeline;
+  ArchiveImportJob *job;
+  guint64 size = g_file_info_get_size (fi);
+
+  /* Stop reading early if a write failed */
+  if (!aic_pipeline_check_error (pipeline, error))
     return FALSE;
 
-  *out_csum = ostree_checksum_from_bytes (csum_raw);
+  job = g_new0 (ArchiveImportJob, 1);
+  job->parent = g_object_ref (parent);
+  job->name = g_strdup (glnx_basename (path));
+  job->fi = g_object_ref (fi);
+  job->xattrs = xattrs ? g_variant_ref (xattrs) : NULL;
+  g_ptr_array_add (pipeline->jobs, job);
+
+  if (g_file_info_get_file_type (fi) == G_FILE_TYPE_REGULAR)
+    {
+      if (size > AIC_PIPELINE_MAX_FILE_SIZE)
+        return aic_write_file (ctx, fi, xattrs, &job->csum, cancellable, error);
+
+      job->data = aic_pipeline_read_entry (ctx, size, cancellable, error);
+      if (!job->data)
+        return FALSE;
+    }
+
+  return g_thread_pool_push (pipeline->pool, job, error);
+}
+
+/* Wait for all queued writes, then add the files to the mtree */
+static gboolean
+aic_pipeline_finish (OstreeRepoArchiveImportContext *ctx,
+                     GError            **error)
+{
+  ArchiveImportPipeline *pipeline = ctx->pipeline;
+
+  g_thread_pool_free (g_steal_pointer (&pipeline->pool), FALSE, TRUE);
+  if (pipeline->error)
+    {
+      g_propagate_error (error, g_steal_pointer (&pipeline->error));
+      return FALSE;
+    }
+
+  for (guint i = 0; i < pipeline->jobs->len; i++)
+    {
+      ArchiveImportJob *job = pipeline->jobs->pdata[i];
+
+      g_assert (job->csum);
+      if (!ostree_mutable_tree_replace_file (job->parent, job->name, job->csum, error))
+        return FALSE;
+    }
+
   return TRUE;
 }
 
@@ -545,6 +763,9 @@ aic_import_file (OstreeRepoArchiveImportContext *ctx,
   if (!aic_get_xattrs (ctx, path, fi, &xattrs, cancellable, error))
     return FALSE;
 
+  if (ctx->pipeline)
+    return aic_pipeline_queue_file (ctx, parent, path, fi, xattrs, cancellable, error);
+
   if (!aic_write_file (ctx, fi, xattrs, &csum, cancellable, error))
     return FALSE;
 
@@ -829,6 +1050,7 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
   g_autoptr(GHashTable) deferred_hardlinks =
     g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                            deferred_hardlinks_list_free);
+  ArchiveImportPipeline pipeline = { 0, };
 
   OstreeRepoArchiveImportContext aictx = {
     .repo = self,
@@ -839,6 +1061,20 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
     .modifier = modifier
   };
 
+  if (opts->parallel)
+    {
+      pipeline.repo = self;
+      pipeline.cancellable = cancellable;
+      pipeline.jobs = g_ptr_array_new_with_free_func ((GDestroyNotify)archive_import_job_free);
+      g_mutex_init (&pipeline.lock);
+      g_cond_init (&pipeline.cond);
+      pipeline.pool = g_thread_pool_new (aic_write_job_in_thread, &pipeline,
+                                         g_get_num_processors (), FALSE, error);
+      if (!pipeline.pool)
+        goto out;
+      aictx.pipeline = &pipeline;
+    }
+
   while (TRUE)
     {
       int r = archive_read_next_header (a, &aictx.entry);
@@ -857,6 +1093,9 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
         goto out;
     }
 
+  if (aictx.pipeline && !aic_pipeline_finish (&aictx, error))
+    goto out;
+
   if (!aic_import_deferred_hardlinks (&aictx, cancellable, error))
     goto out;
 
@@ -880,6 +1119,16 @@ ostree_repo_import_archive_to_mtree (OstreeRepo                   *self,
 
   ret = TRUE;
  out:
+  if (aictx.pipeline)
+    {
+      /* On early failure, we still need to wait for queued writes */
+      if (pipeline.pool)
+        g_thread_pool_free (pipeline.pool, FALSE, TRUE);
+      g_ptr_array_unref (pipeline.jobs);
+      g_clear_error (&pipeline.error);
+      g_mutex_clear (&pipeline.lock);
+      g_cond_clear (&pipeline.cond);
+    }
   return ret;
 #else
   g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
@@ -0,0 +1,319 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-core-private.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+/* An object pack is a plain concatenation of the archive-z2 content
+ * objects (i.e. the exact bytes of the loose .filez files) reachable
+ * from a commit, in dirtree traversal order.  Clients which don't
+ * have a delta can then fetch runs of objects with HTTP Range
+ * requests rather than issuing one request per object.  The index
+ * maps each checksum to its location in the pack; see
+ * _OSTREE_OBJECT_PACK_INDEX_FORMAT.
+ */
+
+char *
+_ostree_get_relative_object_pack_path (const char *commit,
+                                       const char *suffix)
+{
+  return g_strconcat ("packs/", commit, ".", suffix, NULL);
+}
+
+static int
+compare_index_entries (gconstpointer a,
+                       gconstpointer b)
+{
+  GVariant *entry_a = *(GVariant**)a;
+  GVariant *entry_b = *(GVariant**)b;
+  g_autoptr(GVariant) csum_a = g_variant_get_child_value (entry_a, 0);
+  g_autoptr(GVariant) csum_b = g_variant_get_child_value (entry_b, 0);
+
+  return memcmp (ostree_checksum_bytes_peek (csum_a),
+                 ostree_checksum_bytes_peek (csum_b),
+                 OSTREE_SHA256_DIGEST_LEN);
+}
+
+/**
+ * _ostree_object_pack_index_lookup:
+ * @entries: The entries array of a pack index, of type `a(aytt)`
+ * @checksum: Content object checksum
+ * @out_offset: (out): Offset of the object in the pack
+ * @out_size: (out): Size of the object in the pack
+ *
+ * Binary search @entries for @checksum.  Returns %FALSE if the pack
+ * doesn't contain it (or the entry is malformed).
+ */
+gboolean
+_ostree_object_pack_index_lookup (GVariant   *entries,
+                                  const char *checksum,
+                                  guint64    *out_offset,
+                                  guint64    *out_size)
+{
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  gsize lo = 0;
+  gsize hi = g_variant_n_children (entries);
+
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      g_autoptr(GVariant) csum_v = NULL;
+      guint64 offset, size;
+      const guint8 *mid_csum;
+      int c;
+
+      g_variant_get_child (entries, mid, "(@aytt)", &csum_v, &offset, &size);
+      mid_csum = ostree_checksum_bytes_peek (csum_v);
+      if (mid_csum == NULL)
+        return FALSE;
+
+      c = memcmp (csum, mid_csum, OSTREE_SHA256_DIGEST_LEN);
+      if (c == 0)
+        {
+          *out_offset = GUINT64_FROM_BE (offset);
+          *out_size = GUINT64_FROM_BE (size);
+          return TRUE;
+        }
+      else if (c < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return FALSE;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  int pack_fd;
+  guint64 offset;
+  GHashTable *seen_files; /* Set<checksum> */
+  GHashTable *seen_dirs;  /* Set<checksum> */
+  GPtrArray *entries;     /* Array<GVariant> of (aytt) */
+} PackBuilder;
+
+static gboolean
+pack_add_file (PackBuilder   *builder,
+               const char    *checksum,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+  char loose_path[_OSTREE_LOOSE_PATH_MAX];
+
+  if (g_hash_table_contains (builder->seen_files, checksum))
+    return TRUE;
+  g_hash_table_add (builder->seen_files, g_strdup (checksum));
+
+  _ostree_loose_path (loose_path, checksum, OSTREE_OBJECT_TYPE_FILE,
+                      builder->repo->mode);
+  glnx_fd_close int obj_fd = openat (builder->repo->objects_dir_fd, loose_path,
+                                     O_RDONLY | O_CLOEXEC);
+  if (obj_fd < 0)
+    return glnx_throw_errno_prefix (error, "openat(%s)", loose_path);
+
+  struct stat stbuf;
+  if (!glnx_fstat (obj_fd, &stbuf, error))
+    return FALSE;
+
+  if (glnx_regfile_copy_bytes (obj_fd, builder->pack_fd, stbuf.st_size, TRUE) < 0)
+    return glnx_throw_errno_prefix (error, "Copying %s into pack", checksum);
+
+  g_ptr_array_add (builder->entries,
+                   g_variant_ref_sink (g_variant_new ("(@aytt)",
+                                                      ostree_checksum_to_bytes_v (checksum),
+                                                      GUINT64_TO_BE (builder->offset),
+                                                      GUINT64_TO_BE ((guint64) stbuf.st_size))));
+  builder->offset += stbuf.st_size;
+
+  return TRUE;
+}
+
+static gboolean
+pack_add_dirtree (PackBuilder   *builder,
+                  const char    *checksum,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) files = NULL;
+  g_autoptr(GVariant) dirs = NULL;
+
+  if (g_hash_table_contains (builder->seen_dirs, checksum))
+    return TRUE;
+  g_hash_table_add (builder->seen_dirs, g_strdup (checksum));
+
+  if (!ostree_repo_load_variant (builder->repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                 &dirtree, error))
+    return FALSE;
+
+  /* Files first, so that the contents of a directory are contiguous */
+  files = g_variant_get_child_value (dirtree, 0);
+  const guint n_files = g_variant_n_children (files);
+  for (guint i = 0; i < n_files; i++)
+    {
+      const char *filename;
+      g_autoptr(GVariant) csum_v = NULL;
+      char file_checksum[OSTREE_SHA256_STRING_LEN+1];
+
+      g_variant_get_child (files, i, "(&s@ay)", &filename, &csum_v);
+      if (!ot_util_filename_validate (filename, error))
+        return FALSE;
+      if (!ostree_validate_structureof_csum_v (csum_v, error))
+        return FALSE;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), file_checksum);
+
+      if (!pack_add_file (builder, file_checksum, cancellable, error))
+        return FALSE;
+    }
+
+  dirs = g_variant_get_child_value (dirtree, 1);
+  const guint n_dirs = g_variant_n_children (dirs);
+  for (guint i = 0; i < n_dirs; i++)
+    {
+      const char *dirname;
+      g_autoptr(GVariant) tree_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      char tree_checksum[OSTREE_SHA256_STRING_LEN+1];
+
+      g_variant_get_child (dirs, i, "(&s@ay@ay)", &dirname, &tree_csum_v, &meta_csum_v);
+      if (!ot_util_filename_validate (dirname, error))
+        return FALSE;
+      if (!ostree_validate_structureof_csum_v (tree_csum_v, error))
+        return FALSE;
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (tree_csum_v), tree_checksum);
+
+      if (!pack_add_dirtree (builder, tree_checksum, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_repo_generate_object_pack:
+ * @self: Repo
+ * @commit: Commit checksum
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Write `packs/COMMIT.pack` and `packs/COMMIT.index` into @self,
+ * containing every content object reachable from @commit.  If both
+ * files exist when the summary is regenerated, the pack is listed
+ * there, and pull will use HTTP range requests against it to fetch
+ * many small objects at once rather than issuing one request per
+ * object.
+ *
+ * Only repositories in %OSTREE_REPO_MODE_ARCHIVE_Z2 are supported,
+ * since the pack reuses the loose object serialization.  Any
+ * existing pack for @commit is replaced.
+ *
+ * Since: 2017.7
+ */
+gboolean
+ostree_repo_generate_object_pack (OstreeRepo    *self,
+                                  const char    *commit,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  g_autoptr(GVariant) commit_v = NULL;
+  g_autoptr(GVariant) root_tree_csum_v = NULL;
+  char root_tree_checksum[OSTREE_SHA256_STRING_LEN+1];
+
+  if (self->mode != OSTREE_REPO_MODE_ARCHIVE_Z2)
+    return glnx_throw (error, "Object packs are only supported for archive-z2 repositories");
+
+  if (!ostree_validate_checksum_string (commit, error))
+    return FALSE;
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, commit,
+                                 &commit_v, error))
+    return FALSE;
+
+  root_tree_csum_v = g_variant_get_child_value (commit_v, 6);
+  if (!ostree_validate_structureof_csum_v (root_tree_csum_v, error))
+    return FALSE;
+  ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (root_tree_csum_v),
+                                      root_tree_checksum);
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "packs", 0755, cancellable, error))
+    return FALSE;
+
+  g_auto(OtTmpfile) tmpf = { 0, };
+  if (!ot_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY | O_CLOEXEC,
+                                    &tmpf, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) seen_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) seen_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  PackBuilder builder = { self, tmpf.fd, 0, seen_files, seen_dirs, entries };
+
+  if (!pack_add_dirtree (&builder, root_tree_checksum, cancellable, error))
+    return FALSE;
+
+  if (fchmod (tmpf.fd, 0644) < 0)
+    return glnx_throw_errno_prefix (error, "fchmod");
+  if (!self->disable_fsync && fdatasync (tmpf.fd) < 0)
+    return glnx_throw_errno_prefix (error, "fdatasync");
+
+  g_autofree char *pack_path = _ostree_get_relative_object_pack_path (commit, "pack");
+  if (!ot_link_tmpfile_at (&tmpf, GLNX_LINK_TMPFILE_REPLACE,
+                           self->repo_dir_fd, pack_path, error))
+    return FALSE;
+
+  /* Sorted by checksum so that clients can binary search */
+  g_ptr_array_sort (entries, compare_index_entries);
+
+  g_autoptr(GVariant) index = NULL;
+  {
+    g_autoptr(GVariantBuilder) entries_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(aytt)"));
+    g_auto(GVariantDict) metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+
+    for (guint i = 0; i < entries->len; i++)
+      g_variant_builder_add_value (entries_builder, entries->pdata[i]);
+
+    g_variant_dict_init (&metadata_builder, NULL);
+    g_variant_dict_insert_value (&metadata_builder, "ostree.pack-size",
+                                 g_variant_new_uint64 (GUINT64_TO_BE (builder.offset)));
+
+    index = g_variant_ref_sink (g_variant_new ("(@a{sv}@a(aytt))",
+                                               g_variant_dict_end (&metadata_builder),
+                                               g_variant_builder_end (entries_builder)));
+  }
+
+  /* The index is written last; its presence is what makes the pack
+   * visible to regenerate_summary.
+   */
+  g_autofree char *index_path = _ostree_get_relative_object_pack_path (commit, "index");
+  if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, index_path,
+                                           g_variant_get_data (index),
+                                           g_variant_get_size (index),
+                                           cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
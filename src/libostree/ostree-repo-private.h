@@ -22,6 +22,7 @@
 
 #include "ostree-repo.h"
 #include "ostree-remote-private.h"
+#include "ostree-metadata-cache.h"
 #include "libglnx.h"
 
 G_BEGIN_DECLS
@@ -44,9 +45,39 @@ G_BEGIN_DECLS
  * */
 #define _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS 16
 
+/* The minimum size of the pool running asynchronous object writes, unless
+ * core.write-threads says otherwise; see ostree-repo-commit.c.
+ */
+#define _OSTREE_WRITE_POOL_MIN_THREADS 4
+
 /* Well-known keys for the additional metadata field in a summary file. */
 #define OSTREE_SUMMARY_LAST_MODIFIED "ostree.summary.last-modified"
 #define OSTREE_SUMMARY_EXPIRES "ostree.summary.expires"
+#define OSTREE_SUMMARY_OBJECT_PACKS "ostree.object-packs"
+
+/* Sharded summary, see ostree_repo_regenerate_summary().  The index is
+ * of type _OSTREE_SUMMARY_SHARD_INDEX_GVARIANT_FORMAT: the summary's
+ * additional metadata (minus static deltas), and the SHA256 of each
+ * shard, indexed by _ostree_summary_shard_for_ref().
+ */
+#define _OSTREE_SUMMARY_SHARDS_DIR "summaries"
+#define _OSTREE_SUMMARY_SHARD_INDEX "summaries/index"
+#define _OSTREE_SUMMARY_SHARD_INDEX_GVARIANT_FORMAT G_VARIANT_TYPE ("(a{sv}aay)")
+/* Client-side cache, relative to the repo cache dir */
+#define _OSTREE_SUMMARY_SHARD_CACHE_DIR "summary-shards"
+
+/* Cache of static delta superblock checksums used when regenerating
+ * the summary, relative to the repo cache dir.  Maps a delta name to
+ * (st_dev, st_ino, st_size, mtime in nanoseconds, checksum) of its
+ * superblock.
+ */
+#define _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE "delta-superblock-checksums"
+
+/* GPG home directories holding merged keyrings, relative to the repo
+ * cache dir; one per distinct set of keyrings, see ostree-gpg-verifier.c.
+ */
+#define _OSTREE_GPG_HOME_CACHE_DIR "gpg"
+#define _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE_FORMAT G_VARIANT_TYPE ("a{s(ttttay)}")
 
 /* Well-known keys for the additional metadata field in a commit in a ref entry
  * in a summary file. */
@@ -100,9 +131,15 @@ struct OstreeRepo {
   OstreeRepoTransactionStats txn_stats;
 
   GMutex cache_lock;
-  guint dirmeta_cache_refcount;
-  /* char * checksum → GVariant * for dirmeta objects, used in the checkout path */
-  GHashTable *dirmeta_cache;
+  /* Recently loaded dirtree, dirmeta and commit objects; lives as long
+   * as the repo, and is resized in place on config reload */
+  OstreeMetadataCache *metadata_cache;
+
+  GMutex write_pool_lock;
+  /* Runs the asynchronous object writes; created on first use */
+  GThreadPool *write_pool;
+  guint64 write_pool_seq;
+  guint write_threads; /* 0 means automatic */
 
   gboolean inited;
   gboolean writable;
@@ -128,7 +165,9 @@ struct OstreeRepo {
   OstreeRepoMode mode;
   gboolean enable_uncompressed_cache;
   gboolean generate_sizes;
+  gboolean gpg_cache;
   guint64 tmp_expiry_seconds;
+  guint summary_shards;
 
   OstreeRepo *parent_repo;
 };
@@ -139,23 +178,6 @@ typedef struct {
   char checksum[OSTREE_SHA256_STRING_LEN+1];
 } OstreeDevIno;
 
-/* A MemoryCacheRef is an in-memory cache of objects (currently just DIRMETA).  This can
- * be used when performing an operation that traverses a repository in someway.  Currently,
- * the primary use case is ostree_repo_checkout_at() avoiding lots of duplicate dirmeta
- * lookups.
- */
-typedef struct {
-  OstreeRepo *repo;
-} OstreeRepoMemoryCacheRef;
-
-
-void
-_ostree_repo_memory_cache_ref_init (OstreeRepoMemoryCacheRef *state,
-                                    OstreeRepo               *repo);
-
-void
-_ostree_repo_memory_cache_ref_destroy (OstreeRepoMemoryCacheRef *state);
-G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(OstreeRepoMemoryCacheRef, _ostree_repo_memory_cache_ref_destroy);
 
 #define OSTREE_REPO_TMPDIR_STAGING "staging-"
 #define OSTREE_REPO_TMPDIR_FETCHER "fetcher-"
@@ -170,6 +192,10 @@ _ostree_repo_allocate_tmpdir (int           tmpdir_dfd,
                               GCancellable *cancellable,
                               GError      **error);
 
+guint
+_ostree_summary_shard_for_ref (const char *ref,
+                               guint       n_shards);
+
 gboolean
 _ostree_repo_is_locked_tmpdir (const char *filename);
 
@@ -228,6 +254,42 @@ _ostree_repo_file_replace_contents (OstreeRepo    *self,
                                     GCancellable  *cancellable,
                                     GError       **error);
 
+/**
+ * _OSTREE_OBJECT_PACK_INDEX_FORMAT:
+ *
+ * a{sv}: metadata; "ostree.pack-size" is the total size of the pack (t, big endian)
+ * a(aytt): entries sorted by checksum: content object checksum,
+ *          offset into the pack (big endian), size (big endian)
+ *
+ * The pack itself is the concatenation of the archive-z2 serialized
+ * content objects.  Both live under `packs/`, named after the commit.
+ */
+#define _OSTREE_OBJECT_PACK_INDEX_FORMAT "(a{sv}a(aytt))"
+
+char *
+_ostree_get_relative_object_pack_path (const char *commit,
+                                       const char *suffix);
+
+gboolean
+_ostree_object_pack_index_lookup (GVariant   *entries,
+                                  const char *checksum,
+                                  guint64    *out_offset,
+                                  guint64    *out_size);
+
+/**
+ * _OSTREE_PACKED_REFS_FORMAT:
+ *
+ * a(say): refspecs sorted by name, and the commit checksum of each.
+ *
+ * Written by ostree_repo_pack_refs() to `_OSTREE_PACKED_REFS_PATH`, and
+ * kept up to date by later ref writes once it exists.  A loose ref
+ * file of the same name takes precedence over an entry here.
+ */
+#define _OSTREE_PACKED_REFS_FORMAT "a(say)"
+#define _OSTREE_PACKED_REFS_PATH "refs/packed"
+/* Held exclusively while rewriting `_OSTREE_PACKED_REFS_PATH` */
+#define _OSTREE_PACKED_REFS_LOCK_PATH "refs/packed.lock"
+
 gboolean      
 _ostree_repo_write_ref (OstreeRepo    *self,
                         const char    *remote,
@@ -294,6 +356,17 @@ _ostree_repo_commit_loose_final (OstreeRepo        *self,
                                  GCancellable      *cancellable,
                                  GError           **error);
 
+/* Where the time of an asynchronous object write went, in microseconds */
+typedef struct {
+  guint64 queue_usec;  /* Waiting for a free write thread */
+  guint64 write_usec;
+  guint   queue_depth; /* Writes still queued when this one was */
+} OstreeRepoWriteTiming;
+
+void
+_ostree_repo_write_async_get_timing (GAsyncResult          *result,
+                                     OstreeRepoWriteTiming *out_timing);
+
 typedef struct {
   int fd;
   char *temp_filename;
@@ -346,4 +419,16 @@ _ostree_repo_get_remote_inherited (OstreeRepo  *self,
                                    const char  *name,
                                    GError     **error);
 
+gboolean
+_ostree_repo_checkout_at_with_reference (OstreeRepo                  *self,
+                                         OstreeRepoCheckoutAtOptions *options,
+                                         int                          reference_dfd,
+                                         const char                  *reference_commit,
+                                         const char *const           *reference_dirs,
+                                         int                          destination_dfd,
+                                         const char                  *destination_path,
+                                         const char                  *commit,
+                                         GCancellable                *cancellable,
+                                         GError                     **error);
+
 G_END_DECLS
@@ -26,14 +26,42 @@
 #include "ostree-repo-private.h"
 #include "otutil.h"
 
+/* Unreachable loose objects are deleted in shards, one per objects/XX
+ * directory, by a pool of worker threads.  This mostly waits on the
+ * filesystem, so we use more workers than CPUs; it helps most on
+ * network storage.
+ */
+#define _OSTREE_PRUNE_N_SHARDS 256
+#define _OSTREE_PRUNE_MIN_WORKERS 4
+
+typedef struct {
+  guchar csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+} PruneObject;
+
+typedef struct {
+  char prefix[3];
+  GArray *objects; /* Array<PruneObject> */
+} PruneShard;
+
 typedef struct {
   OstreeRepo *repo;
+  OstreeRepoPruneFlags flags;
   GHashTable *reachable;
   guint n_reachable_meta;
   guint n_reachable_content;
   guint n_unreachable_meta;
   guint n_unreachable_content;
+  PruneShard shards[_OSTREE_PRUNE_N_SHARDS];
+  GPtrArray *unreachable_commits;
+
+  OstreeAsyncProgress *progress;
+  GCancellable *cancellable;
+  GMutex lock;
+  /* The rest is protected by lock once the workers are running */
+  guint n_deleted;
   guint64 freed_bytes;
+  GError *async_error;
 } OtPruneData;
 
 static gboolean
@@ -52,41 +80,214 @@ prune_commitpartial_file (OstreeRepo    *repo,
   return TRUE;
 }
 
+/* Called with data->lock held, or before the workers start */
+static void
+prune_update_progress_locked (OtPruneData *data)
+{
+  if (data->progress)
+    ostree_async_progress_set (data->progress,
+                               "pruned-objects", "u", data->n_deleted,
+                               "pruned-bytes", "t", data->freed_bytes,
+                               NULL);
+}
+
+/* Commits have side files and possibly a tombstone to write, so they
+ * go through ostree_repo_delete_object() on the calling thread.
+ */
+static gboolean
+prune_commit (OtPruneData   *data,
+              const char    *checksum,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+  guint64 storage_size = 0;
+
+  if (!prune_commitpartial_file (data->repo, checksum, cancellable, error))
+    return FALSE;
+
+  if (!ostree_repo_query_object_storage_size (data->repo, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                              &storage_size, cancellable, error))
+    return FALSE;
+
+  if (!ostree_repo_delete_object (data->repo, OSTREE_OBJECT_TYPE_COMMIT, checksum,
+                                  cancellable, error))
+    return FALSE;
+
+  data->n_deleted++;
+  data->freed_bytes += storage_size;
+  return TRUE;
+}
+
+static void
+prune_shard_add (OtPruneData                 *data,
+                 const OstreeRepoObjectEntry *entry)
+{
+  const char *checksum = entry->checksum;
+  OstreeObjectType objtype = entry->objtype;
+  /* The first byte of the checksum is the objects/XX directory */
+  PruneShard *shard = &data->shards[entry->csum[0]];
+  PruneObject obj;
+
+  memcpy (obj.csum, entry->csum, sizeof (obj.csum));
+  obj.objtype = objtype;
+  if (!shard->objects)
+    {
+      shard->prefix[0] = checksum[0];
+      shard->prefix[1] = checksum[1];
+      shard->objects = g_array_new (FALSE, FALSE, sizeof (PruneObject));
+    }
+  g_array_append_val (shard->objects, obj);
+
+  /* Workers don't touch the repo's shared state, so drop any cached
+   * copy of the object now.
+   */
+  if (data->repo->metadata_cache && OSTREE_OBJECT_TYPE_IS_META (objtype))
+    _ostree_metadata_cache_remove (data->repo->metadata_cache, objtype, checksum);
+}
+
+/* Delete the objects of @shard using a single directory fd; the size
+ * comes from a stat relative to it rather than resolving the full path.
+ */
+static gboolean
+prune_shard (OtPruneData  *data,
+             PruneShard   *shard,
+             guint        *out_n_deleted,
+             guint64      *out_freed_bytes,
+             GError      **error)
+{
+  glnx_fd_close int dfd = -1;
+
+  if (!glnx_opendirat (data->repo->objects_dir_fd, shard->prefix, FALSE, &dfd, error))
+    return FALSE;
+
+  for (guint i = 0; i < shard->objects->len; i++)
+    {
+      const PruneObject *obj = &g_array_index (shard->objects, PruneObject, i);
+      char checksum[OSTREE_SHA256_STRING_LEN+1];
+      char loose_path[_OSTREE_LOOSE_PATH_MAX];
+      /* Skip the "XX/" directory */
+      const char *name = loose_path + 3;
+      struct stat stbuf;
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+        return FALSE;
+
+      ostree_checksum_inplace_from_bytes (obj->csum, checksum);
+      _ostree_loose_path (loose_path, checksum, obj->objtype, data->repo->mode);
+
+      if (TEMP_FAILURE_RETRY (fstatat (dfd, name, &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+        return glnx_throw_errno_prefix (error, "Querying object %s.%s", checksum,
+                                        ostree_object_type_to_string (obj->objtype));
+
+      if (TEMP_FAILURE_RETRY (unlinkat (dfd, name, 0)) < 0)
+        return glnx_throw_errno_prefix (error, "Deleting object %s.%s", checksum,
+                                        ostree_object_type_to_string (obj->objtype));
+
+      (*out_n_deleted)++;
+      *out_freed_bytes += stbuf.st_size;
+    }
+
+  return TRUE;
+}
+
+static void
+prune_shard_in_thread (gpointer data,
+                       gpointer user_data)
+{
+  PruneShard *shard = data;
+  OtPruneData *prune_data = user_data;
+  g_autoptr(GError) local_error = NULL;
+  guint n_deleted = 0;
+  guint64 freed_bytes = 0;
+  gboolean aborted;
+
+  g_mutex_lock (&prune_data->lock);
+  aborted = prune_data->async_error != NULL;
+  g_mutex_unlock (&prune_data->lock);
+
+  if (!aborted)
+    (void) prune_shard (prune_data, shard, &n_deleted, &freed_bytes, &local_error);
+
+  /* Partial progress still counts; those objects are gone */
+  g_mutex_lock (&prune_data->lock);
+  prune_data->n_deleted += n_deleted;
+  prune_data->freed_bytes += freed_bytes;
+  if (local_error && !prune_data->async_error)
+    prune_data->async_error = g_steal_pointer (&local_error);
+  prune_update_progress_locked (prune_data);
+  g_mutex_unlock (&prune_data->lock);
+}
+
 static gboolean
-maybe_prune_loose_object (OtPruneData        *data,
-                          OstreeRepoPruneFlags    flags,
-                          const char         *checksum,
-                          OstreeObjectType    objtype,
-                          GCancellable       *cancellable,
-                          GError            **error)
+prune_delete_shards (OtPruneData   *data,
+                     GError       **error)
 {
+  GThreadPool *pool;
+  guint n_shards = 0;
+
+  for (guint i = 0; i < _OSTREE_PRUNE_N_SHARDS; i++)
+    {
+      if (data->shards[i].objects)
+        n_shards++;
+    }
+  if (n_shards == 0)
+    return TRUE;
+
+  pool = g_thread_pool_new (prune_shard_in_thread, data,
+                            MIN (n_shards, MAX (g_get_num_processors (), _OSTREE_PRUNE_MIN_WORKERS)),
+                            FALSE, error);
+  if (!pool)
+    return FALSE;
+
+  for (guint i = 0; i < _OSTREE_PRUNE_N_SHARDS; i++)
+    {
+      if (!data->shards[i].objects)
+        continue;
+      /* Can't fail for a pool with non-exclusive threads */
+      (void) g_thread_pool_push (pool, &data->shards[i], NULL);
+    }
+
+  /* Wait for all of them */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (data->async_error)
+    {
+      g_propagate_error (error, g_steal_pointer (&data->async_error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Called for each object during enumeration; nothing is deleted
+ * until it is done, so the directories aren't changed under it.
+ */
+static gboolean
+maybe_prune_loose_object (OstreeRepo                  *repo,
+                          const OstreeRepoObjectEntry *entry,
+                          gpointer                     user_data,
+                          GError                     **error)
+{
+  OtPruneData *data = user_data;
+  const char *checksum = entry->checksum;
+  OstreeObjectType objtype = entry->objtype;
   g_autoptr(GVariant) key = NULL;
 
+  if (!entry->is_loose)
+    return TRUE;
+
   key = ostree_object_name_serialize (checksum, objtype);
 
   if (!g_hash_table_lookup_extended (data->reachable, key, NULL, NULL))
     {
       g_debug ("Pruning unneeded object %s.%s", checksum,
                ostree_object_type_to_string (objtype));
-      if (!(flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
+      if (!(data->flags & OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE))
         {
-          guint64 storage_size = 0;
-
           if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
-            {
-              if (!prune_commitpartial_file (data->repo, checksum, cancellable, error))
-                return FALSE;
-            }
-
-          if (!ostree_repo_query_object_storage_size (data->repo, objtype, checksum,
-                                                      &storage_size, cancellable, error))
-            return FALSE;
-
-          if (!ostree_repo_delete_object (data->repo, objtype, checksum,
-                                          cancellable, error))
-            return FALSE;
-
-          data->freed_bytes += storage_size;
+            g_ptr_array_add (data->unreachable_commits, g_strdup (checksum));
+          else
+            prune_shard_add (data, entry);
         }
       if (OSTREE_OBJECT_TYPE_IS_META (objtype))
         data->n_unreachable_meta++;
@@ -224,7 +425,6 @@ ostree_repo_prune_static_deltas (OstreeRepo *self, const char *commit,
 
 static gboolean
 repo_prune_internal (OstreeRepo        *self,
-                     GHashTable        *objects,
                      OstreeRepoPruneOptions *options,
                      gint              *out_objects_total,
                      gint              *out_objects_pruned,
@@ -232,45 +432,70 @@ repo_prune_internal (OstreeRepo        *self,
                      GCancellable      *cancellable,
                      GError           **error)
 {
-  GHashTableIter hash_iter;
-  gpointer key, value;
+  gboolean ret = FALSE;
   OtPruneData data = { 0, };
 
   data.repo = self;
+  data.flags = options->flags;
   /* We unref this when we're done */
   g_autoptr(GHashTable) reachable_owned = g_hash_table_ref (options->reachable);
   data.reachable = reachable_owned;
+  data.progress = options->progress;
+  data.cancellable = cancellable;
+  data.unreachable_commits = g_ptr_array_new_with_free_func (g_free);
+  g_mutex_init (&data.lock);
 
-  g_hash_table_iter_init (&hash_iter, objects);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      GVariant *serialized_key = key;
-      GVariant *objdata = value;
-      const char *checksum;
-      OstreeObjectType objtype;
-      gboolean is_loose;
-
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-      g_variant_get_child (objdata, 0, "b", &is_loose);
+  if (!ostree_repo_foreach_object (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                   maybe_prune_loose_object, &data, cancellable, error))
+    goto out;
 
-      if (!is_loose)
-        continue;
+  if (data.progress)
+    ostree_async_progress_set_uint (data.progress, "unreachable-objects",
+                                    data.n_unreachable_meta + data.n_unreachable_content);
+  prune_update_progress_locked (&data);
 
-      if (!maybe_prune_loose_object (&data, options->flags, checksum, objtype,
-                                     cancellable, error))
-        return FALSE;
+  for (guint i = 0; i < data.unreachable_commits->len; i++)
+    {
+      if (!prune_commit (&data, data.unreachable_commits->pdata[i], cancellable, error))
+        goto out;
     }
+  prune_update_progress_locked (&data);
+
+  if (!prune_delete_shards (&data, error))
+    goto out;
 
   if (!ostree_repo_prune_static_deltas (self, NULL, cancellable, error))
-    return FALSE;
+    goto out;
 
   if (!_ostree_repo_prune_tmp (self, cancellable, error))
-    return FALSE;
+    goto out;
 
   *out_objects_total = (data.n_reachable_meta + data.n_unreachable_meta +
                         data.n_reachable_content + data.n_unreachable_content);
   *out_objects_pruned = (data.n_unreachable_meta + data.n_unreachable_content);
   *out_pruned_object_size_total = data.freed_bytes;
+  ret = TRUE;
+ out:
+  g_clear_pointer (&data.unreachable_commits, g_ptr_array_unref);
+  for (guint i = 0; i < _OSTREE_PRUNE_N_SHARDS; i++)
+    {
+      if (data.shards[i].objects)
+        g_array_unref (data.shards[i].objects);
+    }
+  g_mutex_clear (&data.lock);
+  return ret;
+}
+
+static gboolean
+collect_commit (OstreeRepo                  *repo,
+                const OstreeRepoObjectEntry *entry,
+                gpointer                     user_data,
+                GError                     **error)
+{
+  GPtrArray *commits = user_data;
+
+  if (entry->objtype == OSTREE_OBJECT_TYPE_COMMIT)
+    g_ptr_array_add (commits, g_strdup (entry->checksum));
   return TRUE;
 }
 
@@ -311,7 +536,6 @@ ostree_repo_prune (OstreeRepo        *self,
 {
   GHashTableIter hash_iter;
   gpointer key, value;
-  g_autoptr(GHashTable) objects = NULL;
   g_autoptr(GHashTable) all_refs = NULL;
   g_autoptr(GHashTable) reachable = NULL;
   gboolean refs_only = flags & OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY;
@@ -342,23 +566,17 @@ ostree_repo_prune (OstreeRepo        *self,
         }
     }
 
-  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
-                                 &objects, cancellable, error))
-    return FALSE;
-
   if (!refs_only)
     {
-      g_hash_table_iter_init (&hash_iter, objects);
-      while (g_hash_table_iter_next (&hash_iter, &key, &value))
-        {
-          GVariant *serialized_key = key;
-          const char *checksum;
-          OstreeObjectType objtype;
+      g_autoptr(GPtrArray) commits = g_ptr_array_new_with_free_func (g_free);
 
-          ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+      if (!ostree_repo_foreach_object (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                       collect_commit, commits, cancellable, error))
+        return FALSE;
 
-          if (objtype != OSTREE_OBJECT_TYPE_COMMIT)
-            continue;
+      for (guint i = 0; i < commits->len; i++)
+        {
+          const char *checksum = commits->pdata[i];
 
           g_debug ("Finding objects to keep for commit %s", checksum);
           if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
@@ -368,7 +586,7 @@ ostree_repo_prune (OstreeRepo        *self,
     }
 
   { OstreeRepoPruneOptions opts = { flags, reachable };
-    return repo_prune_internal (self, objects, &opts,
+    return repo_prune_internal (self, &opts,
                                 out_objects_total, out_objects_pruned,
                                 out_pruned_object_size_total, cancellable, error);
   }
@@ -395,6 +613,11 @@ ostree_repo_prune (OstreeRepo        *self,
  *
  * The %OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE flag may be specified to just determine
  * statistics on objects that would be deleted, without actually deleting them.
+ *
+ * Objects are deleted by several threads.  If @options has a progress
+ * object, its "unreachable-objects" (u) key is set once the unreachable
+ * objects are known, and "pruned-objects" (u) and "pruned-bytes" (t) are
+ * updated as they are deleted.
  */
 gboolean
 ostree_repo_prune_from_reachable (OstreeRepo        *self,
@@ -405,13 +628,7 @@ ostree_repo_prune_from_reachable (OstreeRepo        *self,
                                   GCancellable      *cancellable,
                                   GError           **error)
 {
-  g_autoptr(GHashTable) objects = NULL;
-
-  if (!ostree_repo_list_objects (self, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
-                                 &objects, cancellable, error))
-    return FALSE;
-
-  return repo_prune_internal (self, objects, options, out_objects_total,
+  return repo_prune_internal (self, options, out_objects_total,
                               out_objects_pruned, out_pruned_object_size_total,
                               cancellable, error);
 }
@@ -40,6 +40,45 @@
 #define OSTREE_REPO_PULL_CONTENT_PRIORITY  (OSTREE_FETCHER_DEFAULT_PRIORITY)
 #define OSTREE_REPO_PULL_METADATA_PRIORITY (OSTREE_REPO_PULL_CONTENT_PRIORITY - 100)
 
+/* Request latencies are bucketed by powers of two of milliseconds:
+ * bucket 0 counts those under 1ms, bucket i those in [2^(i-1), 2^i) ms,
+ * and the last bucket everything slower.
+ */
+#define PULL_TIMING_N_BUCKETS 16
+
+typedef struct {
+  guint64 count;
+  guint64 total_usec;
+  guint64 max_usec;
+  guint64 buckets[PULL_TIMING_N_BUCKETS];
+} PullTimingHistogram;
+
+typedef enum {
+  PULL_REQUEST_METADATA,
+  PULL_REQUEST_CONTENT,
+  PULL_REQUEST_DELTAPART,
+  PULL_REQUEST_PACK_RANGE,
+  PULL_N_REQUEST_KINDS
+} PullRequestKind;
+
+static const char *const pull_request_kind_names[PULL_N_REQUEST_KINDS] = {
+  "metadata", "content", "delta-part", "pack-range"
+};
+
+typedef enum {
+  PULL_TIMING_QUEUE,     /* Waiting for a free fetcher slot */
+  PULL_TIMING_CONNECT,   /* Only requests which made a new connection */
+  PULL_TIMING_TTFB,
+  PULL_TIMING_TRANSFER,
+  PULL_TIMING_WRITE_QUEUE, /* Waiting for a free repo write thread */
+  PULL_TIMING_WRITE,     /* Parsing, verifying and committing the result */
+  PULL_N_TIMINGS
+} PullTiming;
+
+static const char *const pull_timing_names[PULL_N_TIMINGS] = {
+  "queue", "connect", "ttfb", "transfer", "write-queue", "write"
+};
+
 typedef struct {
   OstreeRepo   *repo;
   int           tmpdir_dfd;
@@ -87,17 +126,23 @@ typedef struct {
   GHashTable       *pending_fetch_metadata; /* Map<ObjectName,FetchObjectData> */
   GHashTable       *pending_fetch_content; /* Map<checksum,FetchObjectData> */
   GHashTable       *pending_fetch_deltaparts; /* Set<FetchStaticDeltaData> */
+  GPtrArray        *object_packs; /* Array<ObjectPack> */
+  GQueue            pending_pack_ranges; /* Queue<PackRangeFetchData> */
+  GSource          *pack_flush_src;
   guint             n_outstanding_metadata_fetches;
   guint             n_outstanding_metadata_write_requests;
   guint             n_outstanding_content_fetches;
   guint             n_outstanding_content_write_requests;
   guint             n_outstanding_deltapart_fetches;
   guint             n_outstanding_deltapart_write_requests;
+  guint             n_outstanding_pack_fetches;
+  guint             n_pending_pack_objects; /* Batched for a pack, not yet being fetched */
   guint             n_total_deltaparts;
   guint             n_total_delta_fallbacks;
   guint64           fetched_deltapart_size; /* How much of the delta we have now */
   guint64           total_deltapart_size;
   guint64           total_deltapart_usize;
+  OstreeDeltaExecuteStats delta_execute_stats; /* Summed over executed parts */
   gint              n_requested_metadata;
   gint              n_requested_content;
   guint             n_fetched_deltaparts;
@@ -107,6 +152,8 @@ typedef struct {
 
   int               maxdepth;
   guint64           start_time;
+  PullTimingHistogram timings[PULL_N_REQUEST_KINDS][PULL_N_TIMINGS];
+  guint             max_write_queue_depth;
 
   gboolean          is_mirror;
   gboolean          is_commit_only;
@@ -137,6 +184,9 @@ typedef struct {
    * whether to fetch the primary object after fetching its
    * detached metadata (no need if it's already stored). */
   gboolean     object_is_stored;
+
+  gint64       enqueue_time;
+  gint64       write_start_time; /* Zero if not fetched by us */
 } FetchObjectData;
 
 typedef struct {
@@ -147,6 +197,8 @@ typedef struct {
   char *to_revision;
   guint i;
   guint64 size;
+  gint64 enqueue_time;
+  gint64 write_start_time;
 } FetchStaticDeltaData;
 
 typedef struct {
@@ -156,7 +208,43 @@ typedef struct {
   guint recursion_depth; /* NB: not used anymore, though might be nice to print */
 } ScanObjectQueueData;
 
+/* A remote object pack; see ostree_repo_generate_object_pack() */
+typedef struct {
+  char *commit;
+  char *path;          /* Relative path of the pack file */
+  GVariant *entries;   /* a(aytt) from the index, sorted by checksum */
+  GPtrArray *pending;  /* Array<PackObjectFetch>, not yet part of a range */
+  gboolean disabled;   /* A range request failed; use loose objects */
+} ObjectPack;
+
+typedef struct {
+  FetchObjectData *fetch; /* NULL once written or handed back to loose fetching */
+  guint64 offset;
+  guint64 size;
+} PackObjectFetch;
+
+/* A single Range request covering a run of objects in a pack */
+typedef struct {
+  OtPullData *pull_data;
+  ObjectPack *pack;
+  guint64 start;
+  guint64 length;
+  GPtrArray *objects; /* Array<PackObjectFetch>, sorted by offset */
+  gint64 enqueue_time;
+} PackRangeFetchData;
+
+/* Objects closer together than this in a pack are fetched in the same
+ * request, even though we download the unneeded bytes in between.
+ */
+#define _OSTREE_PACK_RANGE_MAX_GAP (16 * 1024)
+/* And we cap the size of a single range (which is held in memory);
+ * objects larger than this are always fetched loose.
+ */
+#define _OSTREE_PACK_RANGE_MAX_LENGTH (8 * 1024 * 1024)
+
 static void start_fetch (OtPullData *pull_data, FetchObjectData *fetch);
+static void start_fetch_pack_range (OtPullData *pull_data,
+                                    PackRangeFetchData *range);
 static void start_fetch_deltapart (OtPullData *pull_data,
                                    FetchStaticDeltaData *fetch);
 static gboolean fetcher_queue_is_full (OtPullData *pull_data);
@@ -180,6 +268,105 @@ static gboolean scan_one_metadata_object_c (OtPullData         *pull_data,
                                             GCancellable       *cancellable,
                                             GError            **error);
 
+static void
+pull_timing_add (OtPullData      *pull_data,
+                 PullRequestKind  kind,
+                 PullTiming       timing,
+                 gint64           usec)
+{
+  PullTimingHistogram *hist = &pull_data->timings[kind][timing];
+  guint64 msec;
+  guint bucket = 0;
+
+  /* The monotonic clock can't go backwards, but be paranoid */
+  if (usec < 0)
+    usec = 0;
+
+  for (msec = usec / 1000; msec > 0 && bucket < PULL_TIMING_N_BUCKETS - 1; msec >>= 1)
+    bucket++;
+
+  hist->count++;
+  hist->total_usec += usec;
+  hist->max_usec = MAX (hist->max_usec, (guint64) usec);
+  hist->buckets[bucket]++;
+}
+
+/* Record where the time of a successfully completed fetch went */
+static void
+pull_timing_add_request (OtPullData      *pull_data,
+                         PullRequestKind  kind,
+                         GAsyncResult    *result)
+{
+  OstreeFetcherRequestTiming timing;
+
+  _ostree_fetcher_request_get_timing (pull_data->fetcher, result, &timing);
+  if (timing.connect_usec > 0)
+    pull_timing_add (pull_data, kind, PULL_TIMING_CONNECT, timing.connect_usec);
+  pull_timing_add (pull_data, kind, PULL_TIMING_TTFB, timing.ttfb_usec);
+  pull_timing_add (pull_data, kind, PULL_TIMING_TRANSFER, timing.transfer_usec);
+}
+
+/* Record how long an asynchronous write waited for the repo's write pool */
+static void
+pull_timing_add_write (OtPullData      *pull_data,
+                       PullRequestKind  kind,
+                       GAsyncResult    *result)
+{
+  OstreeRepoWriteTiming timing;
+
+  _ostree_repo_write_async_get_timing (result, &timing);
+  pull_timing_add (pull_data, kind, PULL_TIMING_WRITE_QUEUE, timing.queue_usec);
+  pull_data->max_write_queue_depth = MAX (pull_data->max_write_queue_depth,
+                                          timing.queue_depth);
+}
+
+/* a{sa{sv}}: request kind -> timing -> a{sv} of count, total-usec,
+ * max-usec and buckets (at).  Empty histograms are left out.
+ */
+static GVariant *
+pull_timings_to_variant (OtPullData *pull_data)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+  for (guint i = 0; i < PULL_N_REQUEST_KINDS; i++)
+    {
+      g_auto(GVariantBuilder) kind_builder = OT_VARIANT_BUILDER_INITIALIZER;
+      gboolean have_any = FALSE;
+
+      g_variant_builder_init (&kind_builder, G_VARIANT_TYPE ("a{sv}"));
+      for (guint j = 0; j < PULL_N_TIMINGS; j++)
+        {
+          const PullTimingHistogram *hist = &pull_data->timings[i][j];
+          g_auto(GVariantBuilder) hist_builder = OT_VARIANT_BUILDER_INITIALIZER;
+
+          if (hist->count == 0)
+            continue;
+          have_any = TRUE;
+
+          g_variant_builder_init (&hist_builder, G_VARIANT_TYPE ("a{sv}"));
+          g_variant_builder_add (&hist_builder, "{sv}", "count",
+                                 g_variant_new_uint64 (hist->count));
+          g_variant_builder_add (&hist_builder, "{sv}", "total-usec",
+                                 g_variant_new_uint64 (hist->total_usec));
+          g_variant_builder_add (&hist_builder, "{sv}", "max-usec",
+                                 g_variant_new_uint64 (hist->max_usec));
+          g_variant_builder_add (&hist_builder, "{sv}", "buckets",
+                                 g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                            hist->buckets, PULL_TIMING_N_BUCKETS,
+                                                            sizeof (guint64)));
+          g_variant_builder_add (&kind_builder, "{s@v}", pull_timing_names[j],
+                                 g_variant_new_variant (g_variant_builder_end (&hist_builder)));
+        }
+
+      if (have_any)
+        g_variant_builder_add (&builder, "{s@a{sv}}", pull_request_kind_names[i],
+                               g_variant_builder_end (&kind_builder));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
 static gboolean
 update_progress (gpointer user_data)
 {
@@ -206,7 +393,8 @@ update_progress (gpointer user_data)
     pull_data->n_outstanding_deltapart_write_requests;
   outstanding_fetches = pull_data->n_outstanding_content_fetches +
     pull_data->n_outstanding_metadata_fetches +
-    pull_data->n_outstanding_deltapart_fetches;
+    pull_data->n_outstanding_deltapart_fetches +
+    pull_data->n_outstanding_pack_fetches;
   bytes_transferred = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
   fetched = pull_data->n_fetched_metadata + pull_data->n_fetched_content;
   requested = pull_data->n_requested_metadata + pull_data->n_requested_content;
@@ -242,6 +430,9 @@ update_progress (gpointer user_data)
                              /* We fetch metadata before content.  These allow us to report metadata fetch progress specifically. */
                              "outstanding-metadata-fetches", "u", pull_data->n_outstanding_metadata_fetches,
                              "metadata-fetched", "u", pull_data->n_fetched_metadata,
+                             /* Where the time of each request went */
+                             "timings", "@a{sa{sv}}", pull_timings_to_variant (pull_data),
+                             "max-write-queue-depth", "u", pull_data->max_write_queue_depth,
                              /* Overall status. */
                              "status", "s", "",
                              NULL);
@@ -258,7 +449,9 @@ pull_termination_condition (OtPullData          *pull_data)
 {
   gboolean current_fetch_idle = (pull_data->n_outstanding_metadata_fetches == 0 &&
                                  pull_data->n_outstanding_content_fetches == 0 &&
-                                 pull_data->n_outstanding_deltapart_fetches == 0);
+                                 pull_data->n_outstanding_deltapart_fetches == 0 &&
+                                 pull_data->n_outstanding_pack_fetches == 0 &&
+                                 pull_data->n_pending_pack_objects == 0);
   gboolean current_write_idle = (pull_data->n_outstanding_metadata_write_requests == 0 &&
                                  pull_data->n_outstanding_content_write_requests == 0 &&
                                  pull_data->n_outstanding_deltapart_write_requests == 0 );
@@ -339,6 +532,11 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
           start_fetch_deltapart (pull_data, fetch);
         }
 
+      /* Pack ranges carry many content objects each, so prefer them */
+      while (!fetcher_queue_is_full (pull_data) &&
+             !g_queue_is_empty (&pull_data->pending_pack_ranges))
+        start_fetch_pack_range (pull_data, g_queue_pop_head (&pull_data->pending_pack_ranges));
+
       /* Next, fill the queue with content */
       g_hash_table_iter_init (&hiter, pull_data->pending_fetch_content);
       while (!fetcher_queue_is_full (pull_data) &&
@@ -370,7 +568,8 @@ fetcher_queue_is_full (OtPullData *pull_data)
   const gboolean fetch_full =
       ((pull_data->n_outstanding_metadata_fetches +
         pull_data->n_outstanding_content_fetches +
-        pull_data->n_outstanding_deltapart_fetches) ==
+        pull_data->n_outstanding_deltapart_fetches +
+        pull_data->n_outstanding_pack_fetches) ==
          _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS);
   const gboolean deltas_full =
       (pull_data->n_outstanding_deltapart_fetches ==
@@ -810,6 +1009,7 @@ content_fetch_on_write_complete (GObject        *object,
   g_autofree char *checksum = NULL;
   g_autofree char *checksum_obj = NULL;
 
+  pull_timing_add_write (pull_data, PULL_REQUEST_CONTENT, result);
   if (!ostree_repo_write_content_finish ((OstreeRepo*)object, result,
                                          &csum, error))
     goto out;
@@ -830,6 +1030,9 @@ content_fetch_on_write_complete (GObject        *object,
       goto out;
     }
 
+  if (fetch_data->write_start_time > 0)
+    pull_timing_add (pull_data, PULL_REQUEST_CONTENT, PULL_TIMING_WRITE,
+                     g_get_monotonic_time () - fetch_data->write_start_time);
   pull_data->n_fetched_content++;
   /* Was this a delta fallback? */
   if (g_hash_table_remove (pull_data->requested_fallback_content, expected_checksum))
@@ -865,6 +1068,9 @@ content_fetch_on_complete (GObject        *object,
   if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &temp_path, error))
     goto out;
 
+  pull_timing_add_request (pull_data, PULL_REQUEST_CONTENT, result);
+  fetch_data->write_start_time = g_get_monotonic_time ();
+
   ostree_object_name_deserialize (fetch_data->object, &checksum, &objtype);
   g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
 
@@ -891,6 +1097,8 @@ content_fetch_on_complete (GObject        *object,
                                                 cancellable, error))
             goto out;
         }
+      pull_timing_add (pull_data, PULL_REQUEST_CONTENT, PULL_TIMING_WRITE,
+                       g_get_monotonic_time () - fetch_data->write_start_time);
       pull_data->n_fetched_content++;
     }
   else
@@ -939,6 +1147,412 @@ content_fetch_on_complete (GObject        *object,
     fetch_object_data_free (fetch_data);
 }
 
+static void
+pack_object_fetch_free (PackObjectFetch *obj)
+{
+  if (obj->fetch)
+    fetch_object_data_free (obj->fetch);
+  g_free (obj);
+}
+
+static void
+object_pack_free (ObjectPack *pack)
+{
+  g_free (pack->commit);
+  g_free (pack->path);
+  g_variant_unref (pack->entries);
+  g_ptr_array_foreach (pack->pending, (GFunc) pack_object_fetch_free, NULL);
+  g_ptr_array_unref (pack->pending);
+  g_free (pack);
+}
+
+static void
+pack_range_fetch_data_free (PackRangeFetchData *range)
+{
+  g_ptr_array_unref (range->objects);
+  g_free (range);
+}
+
+/* Hand objects back to the regular per-object fetch path, e.g. because
+ * the server doesn't support range requests.
+ */
+static void
+fallback_pack_objects_to_loose (OtPullData *pull_data,
+                                GPtrArray  *objects)
+{
+  for (guint i = 0; i < objects->len; i++)
+    {
+      PackObjectFetch *obj = objects->pdata[i];
+      FetchObjectData *fetch = g_steal_pointer (&obj->fetch);
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      if (!fetch)
+        continue;
+
+      ostree_object_name_deserialize (fetch->object, &checksum, &objtype);
+      if (fetcher_queue_is_full (pull_data))
+        g_hash_table_insert (pull_data->pending_fetch_content, g_strdup (checksum), fetch);
+      else
+        start_fetch (pull_data, fetch);
+    }
+}
+
+/* Parse and write one content object sliced out of a pack range; on
+ * success, ownership of @fetch passes to the write operation.
+ */
+static gboolean
+write_pack_object (OtPullData      *pull_data,
+                   FetchObjectData *fetch,
+                   GBytes          *bytes,
+                   GCancellable    *cancellable,
+                   GError         **error)
+{
+  const char *checksum;
+  OstreeObjectType objtype;
+  guint64 length;
+  g_autoptr(GInputStream) memin = g_memory_input_stream_new_from_bytes (bytes);
+  g_autoptr(GInputStream) file_in = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autoptr(GInputStream) object_input = NULL;
+
+  ostree_object_name_deserialize (fetch->object, &checksum, &objtype);
+  g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
+
+  fetch->write_start_time = g_get_monotonic_time ();
+  if (!ostree_content_stream_parse (TRUE, memin, g_bytes_get_size (bytes), FALSE,
+                                    &file_in, &file_info, &xattrs,
+                                    cancellable, error))
+    return glnx_prefix_error (error, "Parsing %s from pack: ", checksum);
+
+  if (!validate_bareuseronly_mode (pull_data,
+                                   checksum,
+                                   g_file_info_get_attribute_uint32 (file_info, "unix::mode"),
+                                   error))
+    return FALSE;
+
+  if (!ostree_raw_file_to_content_stream (file_in, file_info, xattrs,
+                                          &object_input, &length,
+                                          cancellable, error))
+    return FALSE;
+
+  /* Note the checksum is verified in content_fetch_on_write_complete() */
+  pull_data->n_outstanding_content_write_requests++;
+  ostree_repo_write_content_async (pull_data->repo, checksum,
+                                   object_input, length,
+                                   cancellable,
+                                   content_fetch_on_write_complete, fetch);
+  return TRUE;
+}
+
+static void
+pack_range_fetch_on_complete (GObject        *object,
+                              GAsyncResult   *result,
+                              gpointer        user_data)
+{
+  OstreeFetcher *fetcher = (OstreeFetcher *)object;
+  PackRangeFetchData *range = user_data;
+  OtPullData *pull_data = range->pull_data;
+  g_autoptr(GError) local_error = NULL;
+  GError **error = &local_error;
+  g_autoptr(GBytes) buf = NULL;
+
+  pull_data->n_outstanding_pack_fetches--;
+
+  if (!_ostree_fetcher_request_to_membuf_finish (fetcher, result, &buf, error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        goto out;
+
+      /* Most likely the server doesn't do range requests; just stop
+       * using this pack.  Anything really wrong with the remote will
+       * show up again fetching the loose objects.
+       */
+      g_debug ("disabling object pack %s: %s", range->pack->commit, local_error->message);
+      range->pack->disabled = TRUE;
+      g_clear_error (&local_error);
+      fallback_pack_objects_to_loose (pull_data, range->objects);
+      goto out;
+    }
+
+  g_debug ("fetch of %u objects from pack %s complete",
+           range->objects->len, range->pack->commit);
+  pull_timing_add_request (pull_data, PULL_REQUEST_PACK_RANGE, result);
+
+  g_assert_cmpint (g_bytes_get_size (buf), ==, range->length);
+  for (guint i = 0; i < range->objects->len; i++)
+    {
+      PackObjectFetch *obj = range->objects->pdata[i];
+      g_autoptr(GBytes) obj_bytes = g_bytes_new_from_bytes (buf, obj->offset - range->start,
+                                                            obj->size);
+
+      if (!write_pack_object (pull_data, obj->fetch, obj_bytes,
+                              pull_data->cancellable, error))
+        goto out;
+      obj->fetch = NULL; /* Transferred to the write */
+    }
+
+ out:
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+  pack_range_fetch_data_free (range);
+}
+
+static void
+start_fetch_pack_range (OtPullData         *pull_data,
+                        PackRangeFetchData *range)
+{
+  pull_data->n_pending_pack_objects -= range->objects->len;
+
+  /* Another range from this pack failed while we were queued */
+  if (range->pack->disabled)
+    {
+      fallback_pack_objects_to_loose (pull_data, range->objects);
+      pack_range_fetch_data_free (range);
+      return;
+    }
+
+  g_debug ("starting fetch of %u objects from pack %s (%" G_GUINT64_FORMAT " bytes at %" G_GUINT64_FORMAT ")",
+           range->objects->len, range->pack->commit, range->length, range->start);
+  pull_timing_add (pull_data, PULL_REQUEST_PACK_RANGE, PULL_TIMING_QUEUE,
+                   g_get_monotonic_time () - range->enqueue_time);
+
+  pull_data->n_outstanding_pack_fetches++;
+  _ostree_fetcher_request_range_to_membuf (pull_data->fetcher,
+                                           pull_data->content_mirrorlist,
+                                           range->pack->path,
+                                           range->start, range->length,
+                                           OSTREE_REPO_PULL_CONTENT_PRIORITY,
+                                           pull_data->cancellable,
+                                           pack_range_fetch_on_complete, range);
+}
+
+static int
+compare_pack_object_offsets (gconstpointer a,
+                             gconstpointer b)
+{
+  const PackObjectFetch *obj_a = *(const PackObjectFetch**)a;
+  const PackObjectFetch *obj_b = *(const PackObjectFetch**)b;
+
+  if (obj_a->offset < obj_b->offset)
+    return -1;
+  else if (obj_a->offset > obj_b->offset)
+    return 1;
+  return 0;
+}
+
+/* Split the objects batched for @pack into runs, each of which
+ * becomes one range request.
+ */
+static void
+queue_pack_ranges (OtPullData *pull_data,
+                   ObjectPack *pack)
+{
+  PackRangeFetchData *range = NULL;
+
+  g_ptr_array_sort (pack->pending, compare_pack_object_offsets);
+
+  for (guint i = 0; i < pack->pending->len; i++)
+    {
+      PackObjectFetch *obj = pack->pending->pdata[i];
+
+      if (range != NULL &&
+          obj->offset >= range->start + range->length &&
+          obj->offset - (range->start + range->length) <= _OSTREE_PACK_RANGE_MAX_GAP &&
+          obj->offset + obj->size - range->start <= _OSTREE_PACK_RANGE_MAX_LENGTH)
+        {
+          range->length = obj->offset + obj->size - range->start;
+        }
+      else
+        {
+          if (range != NULL)
+            g_queue_push_tail (&pull_data->pending_pack_ranges, range);
+          range = g_new0 (PackRangeFetchData, 1);
+          range->pull_data = pull_data;
+          range->pack = pack;
+          range->start = obj->offset;
+          range->length = obj->size;
+          range->objects = g_ptr_array_new_with_free_func ((GDestroyNotify) pack_object_fetch_free);
+          range->enqueue_time = g_get_monotonic_time ();
+        }
+
+      g_ptr_array_add (range->objects, obj);
+    }
+
+  if (range != NULL)
+    g_queue_push_tail (&pull_data->pending_pack_ranges, range);
+
+  /* Ownership moved to the ranges */
+  g_ptr_array_set_size (pack->pending, 0);
+}
+
+/* Content requests arrive one at a time as dirtrees are scanned; we
+ * collect them until the scan queue has drained so that neighbouring
+ * objects can share a request.
+ */
+static gboolean
+flush_pack_fetches (gpointer user_data)
+{
+  OtPullData *pull_data = user_data;
+  g_autoptr(GError) local_error = NULL;
+
+  g_clear_pointer (&pull_data->pack_flush_src, (GDestroyNotify) g_source_destroy);
+
+  for (guint i = 0; i < pull_data->object_packs->len; i++)
+    {
+      ObjectPack *pack = pull_data->object_packs->pdata[i];
+      if (pack->pending->len > 0)
+        queue_pack_ranges (pull_data, pack);
+    }
+
+  /* This starts as many of the queued ranges as we have room for */
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ensure_pack_flush_queued (OtPullData *pull_data)
+{
+  GSource *idle_src;
+
+  if (pull_data->pack_flush_src)
+    return;
+
+  idle_src = g_idle_source_new ();
+  /* Lower priority than the scanning idle_worker() */
+  g_source_set_priority (idle_src, G_PRIORITY_LOW);
+  g_source_set_callback (idle_src, flush_pack_fetches, pull_data, NULL);
+  g_source_attach (idle_src, pull_data->main_context);
+  g_source_unref (idle_src);
+  pull_data->pack_flush_src = idle_src;
+}
+
+/* If one of the remote's object packs contains @checksum, batch @fetch
+ * up to be fetched from it, taking ownership.
+ */
+static gboolean
+enqueue_pack_object_fetch (OtPullData      *pull_data,
+                           const char      *checksum,
+                           FetchObjectData *fetch)
+{
+  if (pull_data->object_packs == NULL)
+    return FALSE;
+
+  for (guint i = 0; i < pull_data->object_packs->len; i++)
+    {
+      ObjectPack *pack = pull_data->object_packs->pdata[i];
+      guint64 offset, size;
+      PackObjectFetch *obj;
+
+      if (pack->disabled)
+        continue;
+      if (!_ostree_object_pack_index_lookup (pack->entries, checksum, &offset, &size))
+        continue;
+      /* Large objects are better streamed to disk individually */
+      if (size == 0 || size > _OSTREE_PACK_RANGE_MAX_LENGTH || offset > G_MAXUINT64 - size)
+        return FALSE;
+
+      obj = g_new0 (PackObjectFetch, 1);
+      obj->fetch = fetch;
+      obj->offset = offset;
+      obj->size = size;
+      g_ptr_array_add (pack->pending, obj);
+      pull_data->n_pending_pack_objects++;
+      ensure_pack_flush_queued (pull_data);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Does the summary have a delta we'd likely use to get to @to_revision? */
+static gboolean
+summary_has_delta_to (OtPullData *pull_data,
+                      const char *to_revision)
+{
+  GHashTableIter hiter;
+  gpointer key;
+
+  g_hash_table_iter_init (&hiter, pull_data->summary_deltas_checksums);
+  while (g_hash_table_iter_next (&hiter, &key, NULL))
+    {
+      g_autofree char *from = NULL;
+      g_autofree char *to = NULL;
+
+      if (!_ostree_parse_delta_name (key, &from, &to, NULL))
+        continue;
+      if (g_str_equal (to, to_revision))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Fetch the index of the object pack for @commit, if the summary lists
+ * one.  This must be done before the fetcher is switched to the async
+ * main context.
+ */
+static gboolean
+load_object_pack_index (OtPullData    *pull_data,
+                        const char    *commit,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_autoptr(GVariant) additional_metadata = g_variant_get_child_value (pull_data->summary, 1);
+  g_autofree const char **packs = NULL;
+  g_autofree char *index_path = NULL;
+  g_autoptr(GBytes) index_bytes = NULL;
+  g_autoptr(GVariant) index = NULL;
+  gboolean have_pack = FALSE;
+  ObjectPack *pack;
+
+  if (!g_variant_lookup (additional_metadata, OSTREE_SUMMARY_OBJECT_PACKS, "^a&s", &packs))
+    return TRUE;
+  for (const char **iter = packs; *iter && !have_pack; iter++)
+    have_pack = g_str_equal (*iter, commit);
+  if (!have_pack)
+    return TRUE;
+
+  if (!pull_data->disable_static_deltas && summary_has_delta_to (pull_data, commit))
+    return TRUE;
+
+  for (guint i = 0; i < pull_data->object_packs->len; i++)
+    {
+      pack = pull_data->object_packs->pdata[i];
+      if (g_str_equal (pack->commit, commit))
+        return TRUE;
+    }
+
+  index_path = _ostree_get_relative_object_pack_path (commit, "index");
+  if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                   pull_data->content_mirrorlist,
+                                                   index_path, FALSE, TRUE,
+                                                   &index_bytes,
+                                                   OSTREE_MAX_METADATA_SIZE,
+                                                   cancellable, error))
+    return FALSE;
+
+  /* Summary is stale; not a problem, we just fetch loose objects */
+  if (index_bytes == NULL)
+    return TRUE;
+
+  index = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (_OSTREE_OBJECT_PACK_INDEX_FORMAT),
+                                                        index_bytes, FALSE));
+
+  pack = g_new0 (ObjectPack, 1);
+  pack->commit = g_strdup (commit);
+  pack->path = _ostree_get_relative_object_pack_path (commit, "pack");
+  pack->entries = g_variant_get_child_value (index, 1);
+  pack->pending = g_ptr_array_new ();
+  g_ptr_array_add (pull_data->object_packs, pack);
+
+  g_debug ("using object pack %s with %" G_GSIZE_FORMAT " objects", commit,
+           g_variant_n_children (pack->entries));
+
+  return TRUE;
+}
+
 static void
 on_metadata_written (GObject           *object,
                      GAsyncResult      *result,
@@ -954,6 +1568,7 @@ on_metadata_written (GObject           *object,
   g_autofree guchar *csum = NULL;
   g_autofree char *stringified_object = NULL;
 
+  pull_timing_add_write (pull_data, PULL_REQUEST_METADATA, result);
   if (!ostree_repo_write_metadata_finish ((OstreeRepo*)object, result, 
                                           &csum, error))
     goto out;
@@ -974,6 +1589,10 @@ on_metadata_written (GObject           *object,
       goto out;
     }
 
+  if (fetch_data->write_start_time > 0)
+    pull_timing_add (pull_data, PULL_REQUEST_METADATA, PULL_TIMING_WRITE,
+                     g_get_monotonic_time () - fetch_data->write_start_time);
+
   queue_scan_one_metadata_object_c (pull_data, csum, objtype, fetch_data->path, 0);
 
  out:
@@ -1045,6 +1664,9 @@ meta_fetch_on_complete (GObject           *object,
       goto out;
     }
 
+  pull_timing_add_request (pull_data, PULL_REQUEST_METADATA, result);
+  fetch_data->write_start_time = g_get_monotonic_time ();
+
   /* Tombstone commits are always empty, so skip all processing here */
   if (objtype == OSTREE_OBJECT_TYPE_TOMBSTONE_COMMIT)
     goto out;
@@ -1130,9 +1752,14 @@ on_static_delta_written (GObject           *object,
 
   g_debug ("execute static delta part %s complete", fetch_data->expected_checksum);
 
-  if (!_ostree_static_delta_part_execute_finish (pull_data->repo, result, error))
+  if (!_ostree_static_delta_part_execute_finish (pull_data->repo, result,
+                                                 &pull_data->delta_execute_stats,
+                                                 error))
     goto out;
 
+  pull_timing_add (pull_data, PULL_REQUEST_DELTAPART, PULL_TIMING_WRITE,
+                   g_get_monotonic_time () - fetch_data->write_start_time);
+
  out:
   g_assert (pull_data->n_outstanding_deltapart_write_requests > 0);
   pull_data->n_outstanding_deltapart_write_requests--;
@@ -1151,7 +1778,6 @@ static_deltapart_fetch_on_complete (GObject           *object,
   OtPullData *pull_data = fetch_data->pull_data;
   g_autofree char *temp_path = NULL;
   g_autoptr(GInputStream) in = NULL;
-  g_autoptr(GVariant) part = NULL;
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
   glnx_fd_close int fd = -1;
@@ -1162,6 +1788,9 @@ static_deltapart_fetch_on_complete (GObject           *object,
   if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &temp_path, error))
     goto out;
 
+  pull_timing_add_request (pull_data, PULL_REQUEST_DELTAPART, result);
+  fetch_data->write_start_time = g_get_monotonic_time ();
+
   fd = openat (_ostree_fetcher_get_dfd (fetcher), temp_path, O_RDONLY | O_CLOEXEC);
   if (fd == -1)
     {
@@ -1176,19 +1805,20 @@ static_deltapart_fetch_on_complete (GObject           *object,
       goto out;
     }
 
-  in = g_unix_input_stream_new (fd, FALSE);
+  /* The stream owns the fd now; it's closed once the part is unpacked */
+  in = g_unix_input_stream_new (glnx_steal_fd (&fd), TRUE);
 
-  /* TODO - make async */
-  if (!_ostree_static_delta_part_open (in, NULL, 0, fetch_data->expected_checksum,
-                                       &part, pull_data->cancellable, error))
-    goto out;
-
-  _ostree_static_delta_part_execute_async (pull_data->repo,
-                                           fetch_data->objects,
-                                           part,
-                                           pull_data->cancellable,
-                                           on_static_delta_written,
-                                           fetch_data);
+  /* Verifying and decompressing the part happens in the worker thread, so
+   * that it overlaps with the download of the remaining parts rather than
+   * blocking the main loop.
+   */
+  _ostree_static_delta_part_open_and_execute_async (pull_data->repo,
+                                                    fetch_data->objects,
+                                                    in, 0,
+                                                    fetch_data->expected_checksum,
+                                                    pull_data->cancellable,
+                                                    on_static_delta_written,
+                                                    fetch_data);
   pull_data->n_outstanding_deltapart_write_requests++;
   free_fetch_data = FALSE;
 
@@ -1532,12 +2162,16 @@ enqueue_one_object_request (OtPullData        *pull_data,
   fetch_data->path = g_strdup (path);
   fetch_data->is_detached_meta = is_detached_meta;
   fetch_data->object_is_stored = object_is_stored;
+  fetch_data->enqueue_time = g_get_monotonic_time ();
 
   if (is_meta)
     pull_data->n_requested_metadata++;
   else
     pull_data->n_requested_content++;
 
+  if (!is_meta && enqueue_pack_object_fetch (pull_data, checksum, fetch_data))
+    return;
+
   /* Are too many requests are in flight? */
   if (fetcher_queue_is_full (pull_data))
     {
@@ -1586,6 +2220,9 @@ start_fetch (OtPullData *pull_data,
   else
     pull_data->n_outstanding_content_fetches++;
 
+  pull_timing_add (pull_data, is_meta ? PULL_REQUEST_METADATA : PULL_REQUEST_CONTENT,
+                   PULL_TIMING_QUEUE, g_get_monotonic_time () - fetch->enqueue_time);
+
   /* Override the path if we're trying to fetch the .commitmeta file first */
   if (fetch->is_detached_meta)
     {
@@ -1729,6 +2366,8 @@ start_fetch_deltapart (OtPullData *pull_data,
                        FetchStaticDeltaData *fetch)
 {
   g_autofree char *deltapart_path = _ostree_get_relative_static_delta_part_path (fetch->from_revision, fetch->to_revision, fetch->i);
+  pull_timing_add (pull_data, PULL_REQUEST_DELTAPART, PULL_TIMING_QUEUE,
+                   g_get_monotonic_time () - fetch->enqueue_time);
   pull_data->n_outstanding_deltapart_fetches++;
   g_assert_cmpint (pull_data->n_outstanding_deltapart_fetches, <=, _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS);
   _ostree_fetcher_request_to_tmpfile (pull_data->fetcher,
@@ -1898,6 +2537,7 @@ process_one_static_delta (OtPullData   *pull_data,
       fetch_data->expected_checksum = ostree_checksum_from_bytes_v (csum_v);
       fetch_data->size = size;
       fetch_data->i = i;
+      fetch_data->enqueue_time = g_get_monotonic_time ();
 
       if (inline_part_bytes != NULL)
         {
@@ -1905,6 +2545,7 @@ process_one_static_delta (OtPullData   *pull_data,
           g_autoptr(GVariant) inline_delta_part = NULL;
 
           /* For inline parts we are relying on per-commit GPG, so don't bother checksumming. */
+          fetch_data->write_start_time = g_get_monotonic_time ();
           if (!_ostree_static_delta_part_open (memin, inline_part_bytes,
                                                OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM,
                                                NULL, &inline_delta_part,
@@ -2769,6 +3410,265 @@ initiate_request (OtPullData *pull_data,
  * ------------------------------------------------------------------------------------------
  */
 
+static gboolean
+summary_shard_matches (GBytes     *bytes,
+                       const char *checksum)
+{
+  g_autofree char *actual = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+  return g_str_equal (actual, checksum);
+}
+
+/* Fetch one summary shard, named by its checksum, preferring our cache
+ * of shards for this remote.  If the server doesn't have it (anymore),
+ * or has different contents, *out_bytes is set to %NULL; the summary
+ * may have been regenerated since we fetched the index.
+ */
+static gboolean
+fetch_summary_shard (OtPullData    *pull_data,
+                     const char    *checksum,
+                     GBytes       **out_bytes,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  OstreeRepo *self = pull_data->repo;
+  const gboolean use_cache = self->cache_dir_fd != -1 && pull_data->remote_name != NULL;
+  g_autofree char *cache_dir = use_cache ?
+    g_build_filename (_OSTREE_SUMMARY_SHARD_CACHE_DIR, pull_data->remote_name, NULL) : NULL;
+  g_autofree char *cache_path = use_cache ? g_build_filename (cache_dir, checksum, NULL) : NULL;
+  g_autoptr(GBytes) bytes = NULL;
+
+  if (use_cache)
+    {
+      glnx_fd_close int fd = -1;
+
+      if (!ot_openat_ignore_enoent (self->cache_dir_fd, cache_path, &fd, error))
+        return FALSE;
+      if (fd != -1)
+        {
+          bytes = glnx_fd_readall_bytes (fd, cancellable, error);
+          if (!bytes)
+            return FALSE;
+          if (!summary_shard_matches (bytes, checksum))
+            g_clear_pointer (&bytes, g_bytes_unref);
+        }
+    }
+
+  if (!bytes)
+    {
+      g_autofree char *shard_path = g_strconcat (_OSTREE_SUMMARY_SHARDS_DIR, "/", checksum, ".shard", NULL);
+
+      if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                       pull_data->meta_mirrorlist,
+                                                       shard_path, FALSE, TRUE,
+                                                       &bytes,
+                                                       OSTREE_MAX_METADATA_SIZE,
+                                                       cancellable, error))
+        return FALSE;
+      if (!bytes)
+        {
+          g_debug ("summary shard %s not found", checksum);
+          *out_bytes = NULL;
+          return TRUE;
+        }
+
+      if (!summary_shard_matches (bytes, checksum))
+        {
+          g_debug ("summary shard %s has unexpected contents", checksum);
+          *out_bytes = NULL;
+          return TRUE;
+        }
+
+      /* Caching is best effort, like for the summary */
+      if (use_cache)
+        {
+          g_autoptr(GError) local_error = NULL;
+
+          if (!glnx_shutil_mkdir_p_at (self->cache_dir_fd, cache_dir, 0775, cancellable, &local_error) ||
+              !glnx_file_replace_contents_at (self->cache_dir_fd, cache_path,
+                                              g_bytes_get_data (bytes, NULL),
+                                              g_bytes_get_size (bytes),
+                                              self->disable_fsync ? GLNX_FILE_REPLACE_NODATASYNC : GLNX_FILE_REPLACE_DATASYNC_NEW,
+                                              cancellable, &local_error))
+            g_debug ("Failed to cache summary shard %s: %s", checksum, local_error->message);
+        }
+    }
+
+  *out_bytes = g_steal_pointer (&bytes);
+  return TRUE;
+}
+
+/* Drop cached shards which the remote's index no longer references */
+static void
+prune_summary_shard_cache (OtPullData *pull_data,
+                           GHashTable *live_shards)
+{
+  OstreeRepo *self = pull_data->repo;
+  g_autofree char *cache_dir = NULL;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+  if (self->cache_dir_fd == -1 || pull_data->remote_name == NULL)
+    return;
+
+  cache_dir = g_build_filename (_OSTREE_SUMMARY_SHARD_CACHE_DIR, pull_data->remote_name, NULL);
+  if (!glnx_dirfd_iterator_init_at (self->cache_dir_fd, cache_dir, FALSE, &dfd_iter, NULL))
+    return;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, NULL, NULL) || dent == NULL)
+        break;
+      if (g_hash_table_contains (live_shards, dent->d_name))
+        continue;
+      (void) unlinkat (dfd_iter.fd, dent->d_name, 0);
+    }
+}
+
+static int
+compare_summary_ref_entries (gconstpointer a,
+                             gconstpointer b)
+{
+  GVariant *entry_a = *(GVariant**)a;
+  GVariant *entry_b = *(GVariant**)b;
+  const char *ref_a, *ref_b;
+
+  g_variant_get_child (entry_a, 0, "&s", &ref_a);
+  g_variant_get_child (entry_b, 0, "&s", &ref_b);
+  return strcmp (ref_a, ref_b);
+}
+
+/* If the remote publishes a sharded summary, fetch just the shards
+ * covering @refs_to_fetch and assemble them into pull_data->summary,
+ * which then looks like a summary listing only those refs.  If there's
+ * no index, or a shard it lists is gone or changed (the summary was
+ * regenerated while we were fetching), pull_data->summary is left unset
+ * and we fall back to the classic summary.
+ */
+static gboolean
+fetch_sharded_summary (OtPullData    *pull_data,
+                       char         **refs_to_fetch,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  g_autoptr(GBytes) index_bytes = NULL;
+  g_autoptr(GVariant) index = NULL;
+  g_autoptr(GVariant) shard_csums = NULL;
+  g_autoptr(GHashTable) live_shards = NULL;
+  g_autoptr(GHashTable) fetched_shards = NULL;
+  g_autoptr(GPtrArray) ref_entries = NULL;
+  g_auto(GVariantDict) metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_auto(GVariantDict) deltas_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  gboolean have_deltas = FALSE;
+  guint n_shards;
+
+  if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
+                                                   pull_data->meta_mirrorlist,
+                                                   _OSTREE_SUMMARY_SHARD_INDEX, FALSE, TRUE,
+                                                   &index_bytes,
+                                                   OSTREE_MAX_METADATA_SIZE,
+                                                   cancellable, error))
+    return FALSE;
+  if (!index_bytes)
+    return TRUE;
+
+  index = g_variant_ref_sink (g_variant_new_from_bytes (_OSTREE_SUMMARY_SHARD_INDEX_GVARIANT_FORMAT,
+                                                        index_bytes, FALSE));
+  shard_csums = g_variant_get_child_value (index, 1);
+  n_shards = g_variant_n_children (shard_csums);
+  if (n_shards == 0)
+    return glnx_throw (error, "Invalid summary index: no shards");
+
+  live_shards = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (guint i = 0; i < n_shards; i++)
+    {
+      g_autoptr(GVariant) csum_v = g_variant_get_child_value (shard_csums, i);
+      if (!validate_variant_is_csum (csum_v, error))
+        return glnx_prefix_error (error, "Invalid summary index: ");
+      g_hash_table_add (live_shards, ostree_checksum_from_bytes_v (csum_v));
+    }
+
+  fetched_shards = g_hash_table_new (NULL, NULL);
+  ref_entries = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  g_variant_dict_init (&deltas_builder, NULL);
+
+  for (char **iter = refs_to_fetch; *iter; iter++)
+    {
+      const char *ref = *iter;
+      guint shard_idx;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_autofree char *shard_checksum = NULL;
+      g_autoptr(GBytes) shard_bytes = NULL;
+      g_autoptr(GVariant) shard = NULL;
+      g_autoptr(GVariant) shard_refs = NULL;
+      g_autoptr(GVariant) shard_metadata = NULL;
+      g_autoptr(GVariant) shard_deltas = NULL;
+
+      /* Commits are fetched directly */
+      if (ostree_validate_checksum_string (ref, NULL))
+        continue;
+
+      shard_idx = _ostree_summary_shard_for_ref (ref, n_shards);
+      if (g_hash_table_contains (fetched_shards, GUINT_TO_POINTER (shard_idx)))
+        continue;
+      g_hash_table_add (fetched_shards, GUINT_TO_POINTER (shard_idx));
+
+      csum_v = g_variant_get_child_value (shard_csums, shard_idx);
+      shard_checksum = ostree_checksum_from_bytes_v (csum_v);
+      if (!fetch_summary_shard (pull_data, shard_checksum, &shard_bytes, cancellable, error))
+        return FALSE;
+      if (!shard_bytes)
+        {
+          g_debug ("summary shard %u is out of date, using the full summary", shard_idx);
+          return TRUE;
+        }
+
+      g_debug ("using summary shard %u (%s) for %s", shard_idx, shard_checksum, ref);
+
+      shard = g_variant_ref_sink (g_variant_new_from_bytes (OSTREE_SUMMARY_GVARIANT_FORMAT,
+                                                            shard_bytes, FALSE));
+      shard_refs = g_variant_get_child_value (shard, 0);
+      for (gsize i = 0, n = g_variant_n_children (shard_refs); i < n; i++)
+        g_ptr_array_add (ref_entries, g_variant_get_child_value (shard_refs, i));
+
+      shard_metadata = g_variant_get_child_value (shard, 1);
+      shard_deltas = g_variant_lookup_value (shard_metadata, OSTREE_SUMMARY_STATIC_DELTAS, G_VARIANT_TYPE ("a{sv}"));
+      for (gsize i = 0, n = shard_deltas ? g_variant_n_children (shard_deltas) : 0; i < n; i++)
+        {
+          const char *delta;
+          g_autoptr(GVariant) delta_csum_v = NULL;
+
+          g_variant_get_child (shard_deltas, i, "{&s@v}", &delta, &delta_csum_v);
+          g_variant_dict_insert_value (&deltas_builder, delta, delta_csum_v);
+          have_deltas = TRUE;
+        }
+    }
+
+  /* Refs are looked up with a binary search */
+  g_ptr_array_sort (ref_entries, compare_summary_ref_entries);
+
+  {
+    g_autoptr(GVariant) index_metadata = g_variant_get_child_value (index, 0);
+    g_autoptr(GVariantBuilder) refs_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))"));
+
+    for (guint i = 0; i < ref_entries->len; i++)
+      g_variant_builder_add_value (refs_builder, ref_entries->pdata[i]);
+
+    g_variant_dict_init (&metadata_builder, index_metadata);
+    if (have_deltas)
+      g_variant_dict_insert_value (&metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS,
+                                   g_variant_dict_end (&deltas_builder));
+
+    pull_data->summary = g_variant_ref_sink (g_variant_new ("(@a(s(taya{sv}))@a{sv})",
+                                                            g_variant_builder_end (refs_builder),
+                                                            g_variant_dict_end (&metadata_builder)));
+  }
+
+  prune_summary_shard_cache (pull_data, live_shards);
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_pull_with_options:
  * @self: Repo
@@ -2918,6 +3818,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
                                                              (GDestroyNotify)g_variant_unref,
                                                              (GDestroyNotify)fetch_object_data_free);
   pull_data->pending_fetch_deltaparts = g_hash_table_new_full (NULL, NULL, (GDestroyNotify)fetch_static_delta_data_free, NULL);
+  pull_data->object_packs = g_ptr_array_new_with_free_func ((GDestroyNotify)object_pack_free);
 
   if (dir_to_pull != NULL || dirs_to_pull != NULL)
     {
@@ -3183,8 +4084,19 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
     g_autoptr(GVariant) deltas = NULL;
     g_autoptr(GVariant) additional_metadata = NULL;
     gboolean summary_from_cache = FALSE;
+    gboolean summary_from_shards = FALSE;
 
-    if (!pull_data->summary_data_sig)
+    /* Shards aren't signed, and mirroring wants everything */
+    if (!pull_data->summary && refs_to_fetch != NULL &&
+        !pull_data->is_mirror && !pull_data->gpg_verify_summary &&
+        !pull_data->remote_repo_local)
+      {
+        if (!fetch_sharded_summary (pull_data, refs_to_fetch, cancellable, error))
+          goto out;
+        summary_from_shards = pull_data->summary != NULL;
+      }
+
+    if (!pull_data->summary_data_sig && !summary_from_shards)
       {
         if (!_ostree_fetcher_mirrored_request_to_membuf (pull_data->fetcher,
                                                          pull_data->meta_mirrorlist,
@@ -3226,7 +4138,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         goto out;
       }
 
-    if (!bytes_summary && pull_data->require_static_deltas)
+    if (!bytes_summary && !summary_from_shards && pull_data->require_static_deltas)
       {
         g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                      "Fetch configured to require static deltas, but no summary found");
@@ -3412,6 +4324,27 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
         }
     }
 
+  /* Look for object packs covering the commits we're fetching; we need
+   * to do this while we can still make synchronous requests.
+   */
+  if (pull_data->summary && !pull_data->remote_repo_local &&
+      !pull_data->is_commit_only && !pull_data->dry_run)
+    {
+      g_hash_table_iter_init (&hash_iter, commits_to_fetch);
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        {
+          if (!load_object_pack_index (pull_data, key, cancellable, error))
+            goto out;
+        }
+
+      g_hash_table_iter_init (&hash_iter, requested_refs_to_fetch);
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        {
+          if (!load_object_pack_index (pull_data, value, cancellable, error))
+            goto out;
+        }
+    }
+
   /* Create the state directory here - it's new with the commitpartial code,
    * and may not exist in older repositories.
    */
@@ -3546,6 +4479,19 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
 
   end_time = g_get_monotonic_time ();
 
+  /* Make the final timings visible, even if nothing was transferred */
+  if (pull_data->progress)
+    ostree_async_progress_set_variant (pull_data->progress, "timings",
+                                       pull_timings_to_variant (pull_data));
+
+  if (pull_data->n_fetched_deltaparts > 0)
+    {
+      const guint *n_ops = pull_data->delta_execute_stats.n_ops_executed;
+      g_debug ("delta ops executed: openspliceclose=%u open=%u write=%u setread=%u "
+               "unsetread=%u close=%u bspatch=%u",
+               n_ops[0], n_ops[1], n_ops[2], n_ops[3], n_ops[4], n_ops[5], n_ops[6]);
+    }
+
   bytes_transferred = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
   if (bytes_transferred > 0 && pull_data->progress)
     {
@@ -3639,6 +4585,10 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   g_clear_pointer (&pull_data->pending_fetch_content, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_deltaparts, (GDestroyNotify) g_hash_table_unref);
+  g_queue_foreach (&pull_data->pending_pack_ranges, (GFunc) pack_range_fetch_data_free, NULL);
+  g_queue_clear (&pull_data->pending_pack_ranges);
+  g_clear_pointer (&pull_data->pack_flush_src, (GDestroyNotify) g_source_destroy);
+  g_clear_pointer (&pull_data->object_packs, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&pull_data->idle_src, (GDestroyNotify) g_source_destroy);
   g_clear_pointer (&pull_data->dirs, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&remote_config, (GDestroyNotify) g_key_file_unref);
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <sys/file.h>
+
 #include "ostree-repo-private.h"
 #include "otutil.h"
 #include "ot-fs-utils.h"
@@ -128,6 +130,225 @@ write_checksum_file_at (OstreeRepo   *self,
   return TRUE;
 }
 
+/* Map the packed refs file, if the repository has one; otherwise
+ * @out_packed is set to %NULL.
+ */
+static gboolean
+packed_refs_load (OstreeRepo  *self,
+                  GVariant   **out_packed,
+                  GError     **error)
+{
+  return ot_util_variant_map_at (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                 G_VARIANT_TYPE (_OSTREE_PACKED_REFS_FORMAT),
+                                 OT_VARIANT_MAP_ALLOW_NOENT, out_packed, error);
+}
+
+/* @out_refspec points into @packed; @out_rev must hold a hex checksum */
+static gboolean
+packed_refs_get_entry (GVariant     *packed,
+                       gsize         i,
+                       const char  **out_refspec,
+                       char         *out_rev,
+                       GError      **error)
+{
+  g_autoptr(GVariant) csum_v = NULL;
+
+  g_variant_get_child (packed, i, "(&s@ay)", out_refspec, &csum_v);
+
+  const guchar *csum = ostree_checksum_bytes_peek_validate (csum_v, error);
+  if (!csum)
+    return glnx_prefix_error (error, "Packed ref %s", *out_refspec);
+  ostree_checksum_inplace_from_bytes (csum, out_rev);
+
+  return TRUE;
+}
+
+/* Index of the first entry of @packed not sorting before @str */
+static gsize
+packed_refs_lower_bound (GVariant   *packed,
+                         const char *str)
+{
+  gsize imin = 0;
+  gsize imax = g_variant_n_children (packed);
+
+  while (imin < imax)
+    {
+      gsize imid = imin + (imax - imin) / 2;
+      const char *cur;
+
+      g_variant_get_child (packed, imid, "(&s@ay)", &cur, NULL);
+      if (strcmp (cur, str) < 0)
+        imin = imid + 1;
+      else
+        imax = imid;
+    }
+
+  return imin;
+}
+
+/* Look up @remote:@ref (or just @ref without a remote) in the packed
+ * refs; @out_rev is left %NULL if it isn't there.
+ */
+static gboolean
+packed_refs_lookup (OstreeRepo   *self,
+                    const char   *remote,
+                    const char   *ref,
+                    char        **out_rev,
+                    GError      **error)
+{
+  g_autoptr(GVariant) packed = NULL;
+  const char *refspec = remote ? glnx_strjoina (remote, ":", ref) : ref;
+  const char *cur;
+  char rev[OSTREE_SHA256_STRING_LEN+1];
+  int i;
+
+  if (!packed_refs_load (self, &packed, error))
+    return FALSE;
+
+  if (packed && ot_variant_bsearch_str (packed, refspec, &i))
+    {
+      if (!packed_refs_get_entry (packed, i, &cur, rev, error))
+        return FALSE;
+      *out_rev = g_strdup (rev);
+    }
+
+  return TRUE;
+}
+
+/* Like find_ref_in_remotes(), for the packed refs */
+static gboolean
+packed_refs_lookup_in_remotes (OstreeRepo   *self,
+                               const char   *ref,
+                               char        **out_rev,
+                               GError      **error)
+{
+  g_autoptr(GVariant) packed = NULL;
+
+  if (!packed_refs_load (self, &packed, error))
+    return FALSE;
+  if (!packed)
+    return TRUE;
+
+  const gsize n = g_variant_n_children (packed);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *refspec;
+      const char *colon;
+
+      g_variant_get_child (packed, i, "(&s@ay)", &refspec, NULL);
+      colon = strchr (refspec, ':');
+      if (colon && strcmp (colon + 1, ref) == 0)
+        {
+          char rev[OSTREE_SHA256_STRING_LEN+1];
+
+          if (!packed_refs_get_entry (packed, i, &refspec, rev, error))
+            return FALSE;
+          *out_rev = g_strdup (rev);
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Add the packed refs matching @remote and @ref_prefix to @refs, named
+ * the same way as the loose refs are by _ostree_repo_list_refs_internal().
+ */
+static gboolean
+packed_refs_add_to_set (OstreeRepo    *self,
+                        const char    *remote,
+                        const char    *ref_prefix,
+                        gboolean       cut_prefix,
+                        GHashTable    *refs,
+                        GError       **error)
+{
+  g_autoptr(GVariant) packed = NULL;
+  g_autofree char *refspec_prefix = NULL;
+  gsize prefix_len = 0;
+  gsize i = 0;
+
+  if (!packed_refs_load (self, &packed, error))
+    return FALSE;
+  if (!packed)
+    return TRUE;
+
+  if (ref_prefix)
+    {
+      refspec_prefix = remote ? g_strconcat (remote, ":", ref_prefix, NULL) : g_strdup (ref_prefix);
+      prefix_len = strlen (refspec_prefix);
+      i = packed_refs_lower_bound (packed, refspec_prefix);
+    }
+
+  const gsize n = g_variant_n_children (packed);
+  for (; i < n; i++)
+    {
+      const char *refspec;
+      char rev[OSTREE_SHA256_STRING_LEN+1];
+      char *name;
+
+      if (!packed_refs_get_entry (packed, i, &refspec, rev, error))
+        return FALSE;
+
+      if (refspec_prefix)
+        {
+          const char *rest = refspec + prefix_len;
+
+          /* The matching entries are contiguous */
+          if (!g_str_has_prefix (refspec, refspec_prefix))
+            break;
+
+          if (*rest == '\0')
+            name = g_strdup (refspec);
+          else if (*rest != '/')
+            continue;
+          else if (cut_prefix)
+            name = remote ? g_strconcat (remote, ":", rest + 1, NULL) : g_strdup (rest + 1);
+          else
+            name = g_strdup (refspec);
+        }
+      else
+        name = g_strdup (refspec);
+
+      g_hash_table_insert (refs, name, g_strdup (rev));
+    }
+
+  return TRUE;
+}
+
+/* Atomically replace the packed refs with @refs, a map of refspec to
+ * checksum.
+ */
+static gboolean
+packed_refs_write (OstreeRepo    *self,
+                   GHashTable    *refs,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_autoptr(GVariant) packed = NULL;
+  GList *ordered_refs = NULL;
+
+  ordered_refs = g_hash_table_get_keys (refs);
+  ordered_refs = g_list_sort (ordered_refs, (GCompareFunc)strcmp);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (_OSTREE_PACKED_REFS_FORMAT));
+  for (GList *iter = ordered_refs; iter; iter = iter->next)
+    {
+      const char *refspec = iter->data;
+      const char *rev = g_hash_table_lookup (refs, refspec);
+
+      g_variant_builder_add_value (&builder, g_variant_new ("(s@ay)", refspec,
+                                                            ostree_checksum_to_bytes_v (rev)));
+    }
+  g_list_free (ordered_refs);
+  packed = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  return _ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH,
+                                             g_variant_get_data (packed),
+                                             g_variant_get_size (packed),
+                                             cancellable, error);
+}
+
 static gboolean
 find_ref_in_remotes (OstreeRepo         *self,
                      const char         *rev,
@@ -234,6 +455,12 @@ resolve_refspec (OstreeRepo     *self,
 
       if (!ot_openat_ignore_enoent (self->repo_dir_fd, remote_ref, &target_fd, error))
         return FALSE;
+
+      if (target_fd == -1)
+        {
+          if (!packed_refs_lookup (self, remote, ref, &ret_rev, error))
+            return FALSE;
+        }
     }
   else
     {
@@ -242,18 +469,40 @@ resolve_refspec (OstreeRepo     *self,
       if (!ot_openat_ignore_enoent (self->repo_dir_fd, local_ref, &target_fd, error))
         return FALSE;
 
-      if (target_fd == -1 && fallback_remote)
+      if (target_fd == -1)
+        {
+          if (!packed_refs_lookup (self, NULL, ref, &ret_rev, error))
+            return FALSE;
+        }
+
+      if (target_fd == -1 && ret_rev == NULL && fallback_remote)
         {
+          const char *slash = strchr (ref, '/');
+
           local_ref = glnx_strjoina ("refs/remotes/", ref);
 
           if (!ot_openat_ignore_enoent (self->repo_dir_fd, local_ref, &target_fd, error))
             return FALSE;
 
-          if (target_fd == -1)
+          if (target_fd == -1 && slash)
+            {
+              g_autofree char *ref_remote = g_strndup (ref, slash - ref);
+
+              if (!packed_refs_lookup (self, ref_remote, slash + 1, &ret_rev, error))
+                return FALSE;
+            }
+
+          if (target_fd == -1 && ret_rev == NULL)
             {
               if (!find_ref_in_remotes (self, ref, &target_fd, error))
                 return FALSE;
             }
+
+          if (target_fd == -1 && ret_rev == NULL)
+            {
+              if (!packed_refs_lookup_in_remotes (self, ref, &ret_rev, error))
+                return FALSE;
+            }
         }
     }
 
@@ -270,7 +519,7 @@ resolve_refspec (OstreeRepo     *self,
       if (!ostree_validate_checksum_string (ret_rev, error))
         return FALSE;
     }
-  else
+  else if (ret_rev == NULL)
     {
       if (!resolve_refspec_fallback (self, remote, ref, allow_noent, fallback_remote,
                                      &ret_rev, cancellable, error))
@@ -526,6 +775,10 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
       if (!ostree_parse_refspec (refspec_prefix, &remote, &ref_prefix, error))
         return FALSE;
 
+      /* Loose refs override packed ones, so add these first */
+      if (!packed_refs_add_to_set (self, remote, ref_prefix, cut_prefix, ret_all_refs, error))
+        return FALSE;
+
       if (remote)
         {
           prefix_path = glnx_strjoina ("refs/remotes/", remote, "/");
@@ -578,6 +831,9 @@ _ostree_repo_list_refs_internal (OstreeRepo       *self,
       g_autoptr(GString) base_path = g_string_new ("");
       glnx_fd_close int refs_heads_dfd = -1;
 
+      if (!packed_refs_add_to_set (self, NULL, NULL, FALSE, ret_all_refs, error))
+        return FALSE;
+
       if (!glnx_opendirat (self->repo_dir_fd, "refs/heads", TRUE, &refs_heads_dfd, error))
         return FALSE;
 
@@ -740,13 +996,13 @@ ostree_repo_remote_list_refs (OstreeRepo       *self,
   return TRUE;
 }
 
-gboolean
-_ostree_repo_write_ref (OstreeRepo    *self,
-                        const char    *remote,
-                        const char    *ref,
-                        const char    *rev,
-                        GCancellable  *cancellable,
-                        GError       **error)
+static gboolean
+write_loose_ref (OstreeRepo    *self,
+                 const char    *remote,
+                 const char    *ref,
+                 const char    *rev,
+                 GCancellable  *cancellable,
+                 GError       **error)
 {
   glnx_fd_close int dfd = -1;
 
@@ -799,6 +1055,199 @@ _ostree_repo_write_ref (OstreeRepo    *self,
         return FALSE;
     }
 
+  return TRUE;
+}
+
+static char *
+loose_ref_path (const char *refspec)
+{
+  const char *colon = strchr (refspec, ':');
+
+  if (colon)
+    return g_strdup_printf ("refs/remotes/%.*s/%s", (int)(colon - refspec), refspec, colon + 1);
+  else
+    return g_strconcat ("refs/heads/", refspec, NULL);
+}
+
+/* Read the loose file for @refspec; @out_rev is set to %NULL if there
+ * is none.
+ */
+static gboolean
+read_loose_ref (OstreeRepo    *self,
+                const char    *refspec,
+                char         **out_rev,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  g_autofree char *path = loose_ref_path (refspec);
+  g_autoptr(GError) temp_error = NULL;
+  char *rev = glnx_file_get_contents_utf8_at (self->repo_dir_fd, path, NULL,
+                                              cancellable, &temp_error);
+
+  if (!rev)
+    {
+      if (!g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_propagate_error (error, g_steal_pointer (&temp_error));
+          return FALSE;
+        }
+    }
+  else
+    g_strchomp (rev);
+
+  *out_rev = rev;
+  return TRUE;
+}
+
+/* Remove the loose file for @refspec once @rev has been packed, unless
+ * it was rewritten with another value in the meantime.  Callers hold
+ * the packed refs lock, so a concurrent writer will fold its own value
+ * into the packed file once we release it.
+ */
+static gboolean
+unlink_loose_ref_if_unchanged (OstreeRepo    *self,
+                               const char    *refspec,
+                               const char    *rev,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  g_autofree char *path = loose_ref_path (refspec);
+  g_autofree char *loose_rev = NULL;
+
+  if (!read_loose_ref (self, refspec, &loose_rev, cancellable, error))
+    return FALSE;
+  if (!loose_rev || strcmp (loose_rev, rev) != 0)
+    return TRUE;
+
+  if (unlinkat (self->repo_dir_fd, path, 0) < 0 && errno != ENOENT)
+    return glnx_throw_errno_prefix (error, "unlinkat(%s)", path);
+
+  return TRUE;
+}
+
+/* Fold @refs, a map of refspec to checksum (or %NULL to delete), into
+ * the packed refs if the repository has them.  The loose files have
+ * already been written at this point, so the new values are visible
+ * whenever we're interrupted; they're removed once packed.
+ *
+ * Concurrent writers serialize on the packed refs lock.  Under it, the
+ * loose file is authoritative: if another writer replaced it after us
+ * we pack its value instead of ours, and if it is already gone it was
+ * packed by someone who saw a value at least as new.
+ */
+static gboolean
+packed_refs_update (OstreeRepo    *self,
+                    GHashTable    *refs,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(GVariant) packed = NULL;
+  g_autoptr(GHashTable) packed_refs = NULL;
+  g_autoptr(GHashTable) loose_refs = NULL;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  gboolean have_deletions = FALSE;
+
+  g_hash_table_iter_init (&hash_iter, refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      if (value == NULL)
+        have_deletions = TRUE;
+    }
+
+  /* Avoid taking the lock in the common unpacked case; a concurrent
+   * ostree_repo_pack_refs() picks up the loose files we wrote.  That
+   * doesn't hold for deletions: it may have listed a ref before we
+   * unlinked it, and would then pack it again, so those always wait
+   * for it to finish and check again below.
+   */
+  if (!have_deletions)
+    {
+      struct stat stbuf;
+      if (fstatat (self->repo_dir_fd, _OSTREE_PACKED_REFS_PATH, &stbuf, 0) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", _OSTREE_PACKED_REFS_PATH);
+          /* Note early return */
+          return TRUE;
+        }
+    }
+
+  if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PACKED_REFS_LOCK_PATH,
+                            LOCK_EX, &lock, error))
+    return FALSE;
+
+  if (!packed_refs_load (self, &packed, error))
+    return FALSE;
+  /* Note early return */
+  if (!packed)
+    return TRUE;
+
+  packed_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  const gsize n = g_variant_n_children (packed);
+  for (gsize i = 0; i < n; i++)
+    {
+      const char *refspec;
+      char rev[OSTREE_SHA256_STRING_LEN+1];
+
+      if (!packed_refs_get_entry (packed, i, &refspec, rev, error))
+        return FALSE;
+      g_hash_table_insert (packed_refs, g_strdup (refspec), g_strdup (rev));
+    }
+
+  loose_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_iter_init (&hash_iter, refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *refspec = key;
+      g_autofree char *loose_rev = NULL;
+
+      if (!read_loose_ref (self, refspec, &loose_rev, cancellable, error))
+        return FALSE;
+
+      if (loose_rev)
+        {
+          if (!ostree_validate_checksum_string (loose_rev, error))
+            return glnx_prefix_error (error, "Loose ref %s", refspec);
+          g_hash_table_replace (packed_refs, g_strdup (refspec), g_strdup (loose_rev));
+          g_hash_table_insert (loose_refs, g_strdup (refspec), g_steal_pointer (&loose_rev));
+        }
+      else if (value == NULL)
+        g_hash_table_remove (packed_refs, refspec);
+    }
+
+  if (!packed_refs_write (self, packed_refs, cancellable, error))
+    return FALSE;
+
+  g_hash_table_iter_init (&hash_iter, loose_refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      if (!unlink_loose_ref_if_unchanged (self, key, value, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+gboolean
+_ostree_repo_write_ref (OstreeRepo    *self,
+                        const char    *remote,
+                        const char    *ref,
+                        const char    *rev,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_autoptr(GHashTable) refs = g_hash_table_new (g_str_hash, g_str_equal);
+  const char *refspec = remote ? glnx_strjoina (remote, ":", ref) : ref;
+
+  if (!write_loose_ref (self, remote, ref, rev, cancellable, error))
+    return FALSE;
+
+  g_hash_table_insert (refs, (char*)refspec, (char*)rev);
+  if (!packed_refs_update (self, refs, cancellable, error))
+    return FALSE;
+
   if (!_ostree_repo_update_mtime (self, error))
     return FALSE;
 
@@ -825,10 +1274,67 @@ _ostree_repo_update_refs (OstreeRepo        *self,
       if (!ostree_parse_refspec (refspec, &remote, &ref, error))
         return FALSE;
 
-      if (!_ostree_repo_write_ref (self, remote, ref, rev,
-                                   cancellable, error))
+      if (!write_loose_ref (self, remote, ref, rev,
+                            cancellable, error))
+        return FALSE;
+    }
+
+  if (!packed_refs_update (self, refs, cancellable, error))
+    return FALSE;
+
+  if (!_ostree_repo_update_mtime (self, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+/**
+ * ostree_repo_pack_refs:
+ * @self: Repo
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Move all local and remote refs into a single sorted file, replacing
+ * the one file per ref under `refs/heads` and `refs/remotes`.  This
+ * makes listing and resolving refs much cheaper for repositories with
+ * many of them.  Once packed, ref updates keep the file up to date;
+ * loose ref files written by other tools take precedence over it.
+ *
+ * Note that older versions of OSTree do not read packed refs.
+ *
+ * Returns: %TRUE on success, %FALSE on error, and @error will be set
+ * Since: 2017.7
+ */
+gboolean
+ostree_repo_pack_refs (OstreeRepo    *self,
+                       GCancellable  *cancellable,
+                       GError       **error)
+{
+  g_auto(GLnxLockFile) lock = GLNX_LOCK_FILE_INIT;
+  g_autoptr(GHashTable) all_refs = NULL;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  if (!glnx_make_lock_file (self->repo_dir_fd, _OSTREE_PACKED_REFS_LOCK_PATH,
+                            LOCK_EX, &lock, error))
+    return FALSE;
+
+  /* This includes any refs packed before */
+  if (!_ostree_repo_list_refs_internal (self, FALSE, NULL, &all_refs, cancellable, error))
+    return FALSE;
+
+  if (!packed_refs_write (self, all_refs, cancellable, error))
+    return FALSE;
+
+  g_hash_table_iter_init (&hash_iter, all_refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      if (!unlink_loose_ref_if_unchanged (self, key, value, cancellable, error))
         return FALSE;
     }
 
+  if (!_ostree_repo_update_mtime (self, error))
+    return FALSE;
+
   return TRUE;
 }
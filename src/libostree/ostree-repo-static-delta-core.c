@@ -203,6 +203,101 @@ _ostree_repo_static_delta_part_have_all_objects (OstreeRepo             *repo,
   return ret;
 }
 
+/* State shared between the worker threads executing delta parts
+ * for ostree_repo_static_delta_execute_offline().  Parts only write
+ * distinct objects, so they can be applied in any order.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  int parts_dfd;
+  gboolean stats_only;
+  GCancellable *cancellable;
+
+  GMutex lock;
+  OstreeDeltaExecuteStats stats;  /* Protected by lock */
+  GError *error;                  /* Protected by lock; first error wins */
+  gboolean aborted;               /* Protected by lock; queueing failed */
+} DeltaExecuteParallelData;
+
+typedef struct {
+  guint i;
+  GVariant *objects;
+  char *deltapart_path;
+  GBytes *inline_part_bytes;
+  OstreeStaticDeltaOpenFlags open_flags;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+} DeltaPartJob;
+
+static void
+delta_part_job_free (DeltaPartJob *job)
+{
+  g_variant_unref (job->objects);
+  g_free (job->deltapart_path);
+  g_clear_pointer (&job->inline_part_bytes, g_bytes_unref);
+  g_free (job);
+}
+
+static void
+execute_delta_part_in_thread (gpointer data,
+                              gpointer user_data)
+{
+  DeltaPartJob *job = data;
+  DeltaExecuteParallelData *pdata = user_data;
+  OstreeDeltaExecuteStats stats = { { 0, }, };
+  g_autoptr(GInputStream) part_in = NULL;
+  g_autoptr(GVariant) part = NULL;
+  g_autoptr(GError) local_error = NULL;
+  gboolean failed;
+
+  /* Don't bother starting anything new if another part failed */
+  g_mutex_lock (&pdata->lock);
+  failed = pdata->error != NULL || pdata->aborted;
+  g_mutex_unlock (&pdata->lock);
+  if (failed)
+    goto out;
+
+  /* Parts are only opened here, so at most one fd per thread is open */
+  if (job->inline_part_bytes)
+    part_in = g_memory_input_stream_new_from_bytes (job->inline_part_bytes);
+  else
+    {
+      char relpath[16];
+      int part_fd;
+
+      snprintf (relpath, sizeof (relpath), "%u", job->i);
+      part_fd = openat (pdata->parts_dfd, relpath, O_RDONLY | O_CLOEXEC);
+      if (part_fd < 0)
+        {
+          glnx_throw_errno_prefix (&local_error, "Opening deltapart '%s'", job->deltapart_path);
+          goto out;
+        }
+      part_in = g_unix_input_stream_new (part_fd, TRUE);
+    }
+
+  if (!_ostree_static_delta_part_open (part_in, job->inline_part_bytes,
+                                       job->open_flags,
+                                       job->inline_part_bytes ? NULL : job->checksum,
+                                       &part,
+                                       pdata->cancellable, &local_error))
+    goto out;
+
+  if (!_ostree_static_delta_part_execute (pdata->repo, job->objects, part,
+                                          pdata->stats_only, &stats,
+                                          pdata->cancellable, &local_error))
+    {
+      g_prefix_error (&local_error, "Executing delta part %i: ", job->i);
+      goto out;
+    }
+
+ out:
+  g_mutex_lock (&pdata->lock);
+  _ostree_delta_execute_stats_add (&pdata->stats, &stats);
+  if (local_error && !pdata->error)
+    pdata->error = g_steal_pointer (&local_error);
+  g_mutex_unlock (&pdata->lock);
+  delta_part_job_free (job);
+}
+
 /**
  * ostree_repo_static_delta_execute_offline:
  * @self: Repo
@@ -235,6 +330,13 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
   g_autofree char *to_checksum = NULL;
   g_autofree char *from_checksum = NULL;
   g_autofree char *basename = NULL;
+  GThreadPool *pool = NULL;
+  DeltaExecuteParallelData pdata = { 0, };
+
+  pdata.repo = self;
+  pdata.stats_only = skip_validation;
+  pdata.cancellable = cancellable;
+  g_mutex_init (&pdata.lock);
 
   dir_or_file_path = gs_file_get_path_cached (dir_or_file);
 
@@ -341,21 +443,29 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
 
   headers = g_variant_get_child_value (meta, 6);
   n = g_variant_n_children (headers);
+
+  /* Parts are opened (checksummed, decompressed) and executed in
+   * parallel; this thread just validates the headers and queues them.
+   */
+  pdata.parts_dfd = dfd;
+  pool = g_thread_pool_new (execute_delta_part_in_thread, &pdata,
+                            MAX (1, MIN (n, g_get_num_processors ())),
+                            FALSE, error);
+  if (!pool)
+    goto out;
+
   for (i = 0; i < n; i++)
     {
       guint32 version;
       guint64 size;
       guint64 usize;
       const guchar *csum;
-      char checksum[OSTREE_SHA256_STRING_LEN+1];
       gboolean have_all;
-      g_autoptr(GInputStream) part_in = NULL;
       g_autoptr(GVariant) inline_part_data = NULL;
       g_autoptr(GVariant) header = NULL;
       g_autoptr(GVariant) csum_v = NULL;
       g_autoptr(GVariant) objects = NULL;
-      g_autoptr(GVariant) part = NULL;
-      g_autofree char *deltapart_path = NULL;
+      DeltaPartJob *job;
       OstreeStaticDeltaOpenFlags delta_open_flags = 
         skip_validation ? OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM : 0;
 
@@ -382,62 +492,65 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
       csum = ostree_checksum_bytes_peek_validate (csum_v, error);
       if (!csum)
         goto out;
-      ostree_checksum_inplace_from_bytes (csum, checksum);
 
-      deltapart_path =
+      job = g_new0 (DeltaPartJob, 1);
+      job->i = i;
+      job->objects = g_variant_ref (objects);
+      job->open_flags = delta_open_flags;
+      ostree_checksum_inplace_from_bytes (csum, job->checksum);
+
+      job->deltapart_path =
         _ostree_get_relative_static_delta_part_path (from_checksum, to_checksum, i);
 
-      inline_part_data = g_variant_lookup_value (metadata, deltapart_path, G_VARIANT_TYPE("(yay)"));
+      inline_part_data = g_variant_lookup_value (metadata, job->deltapart_path, G_VARIANT_TYPE("(yay)"));
       if (inline_part_data)
         {
-          g_autoptr(GBytes) inline_part_bytes = g_variant_get_data_as_bytes (inline_part_data);
-          part_in = g_memory_input_stream_new_from_bytes (inline_part_bytes);
+          job->inline_part_bytes = g_variant_get_data_as_bytes (inline_part_data);
 
           /* For inline parts, we don't checksum, because it's
            * included with the metadata, so we're not trying to
            * protect against MITM or such.  Non-security related
            * checksums should be done at the underlying storage layer.
            */
-          delta_open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
-
-          if (!_ostree_static_delta_part_open (part_in, inline_part_bytes, 
-                                               delta_open_flags,
-                                               NULL,
-                                               &part,
-                                               cancellable, error))
-            goto out;
-        }
-      else
-        {
-          g_autofree char *relpath = g_strdup_printf ("%u", i); /* TODO avoid malloc here */
-          glnx_fd_close int part_fd = openat (dfd, relpath, O_RDONLY | O_CLOEXEC);
-          if (part_fd < 0)
-            {
-              glnx_set_error_from_errno (error);
-              g_prefix_error (error, "Opening deltapart '%s': ", deltapart_path);
-              goto out;
-            }
-
-          part_in = g_unix_input_stream_new (part_fd, FALSE);
-
-          if (!_ostree_static_delta_part_open (part_in, NULL, 
-                                               delta_open_flags,
-                                               checksum,
-                                               &part,
-                                               cancellable, error))
-            goto out;
+          job->open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
         }
 
-      if (!_ostree_static_delta_part_execute (self, objects, part, skip_validation,
-                                              NULL, cancellable, error))
+      if (!g_thread_pool_push (pool, job, error))
         {
-          g_prefix_error (error, "Executing delta part %i: ", i);
+          delta_part_job_free (job);
           goto out;
         }
     }
 
+  /* Wait for all queued parts */
+  g_thread_pool_free (g_steal_pointer (&pool), FALSE, TRUE);
+  if (pdata.error)
+    {
+      g_propagate_error (error, g_steal_pointer (&pdata.error));
+      goto out;
+    }
+
+  g_debug ("Executed %u delta parts: openspliceclose=%u open=%u write=%u setread=%u "
+           "unsetread=%u close=%u bspatch=%u", n,
+           pdata.stats.n_ops_executed[0], pdata.stats.n_ops_executed[1],
+           pdata.stats.n_ops_executed[2], pdata.stats.n_ops_executed[3],
+           pdata.stats.n_ops_executed[4], pdata.stats.n_ops_executed[5],
+           pdata.stats.n_ops_executed[6]);
+
   ret = TRUE;
  out:
+  /* On early failure, we still need to drain any parts already queued,
+   * but don't start any more of them.
+   */
+  if (pool)
+    {
+      g_mutex_lock (&pdata.lock);
+      pdata.aborted = TRUE;
+      g_mutex_unlock (&pdata.lock);
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  g_clear_error (&pdata.error);
+  g_mutex_clear (&pdata.lock);
   return ret;
 }
 
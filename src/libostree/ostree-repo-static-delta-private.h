@@ -153,10 +153,23 @@ void _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
                                               GAsyncReadyCallback  callback,
                                               gpointer         user_data);
 
+void _ostree_static_delta_part_open_and_execute_async (OstreeRepo      *repo,
+                                                       GVariant        *header,
+                                                       GInputStream    *part_in,
+                                                       OstreeStaticDeltaOpenFlags flags,
+                                                       const char      *expected_checksum,
+                                                       GCancellable    *cancellable,
+                                                       GAsyncReadyCallback  callback,
+                                                       gpointer         user_data);
+
 gboolean _ostree_static_delta_part_execute_finish (OstreeRepo      *repo,
                                                    GAsyncResult    *result,
+                                                   OstreeDeltaExecuteStats *stats,
                                                    GError         **error); 
 
+void _ostree_delta_execute_stats_add (OstreeDeltaExecuteStats       *dest,
+                                      const OstreeDeltaExecuteStats *src);
+
 gboolean
 _ostree_static_delta_parse_checksum_array (GVariant      *array,
                                            guint8       **out_checksums_array,
@@ -289,6 +289,11 @@ typedef struct {
   OstreeRepo *repo;
   GVariant *header;
   GVariant *part;
+  /* If part is NULL, it's opened from these in the worker thread */
+  GInputStream *part_in;
+  OstreeStaticDeltaOpenFlags open_flags;
+  char *expected_checksum;
+  OstreeDeltaExecuteStats stats;
   GCancellable *cancellable;
   GSimpleAsyncResult *result;
 } StaticDeltaPartExecuteAsyncData;
@@ -300,7 +305,9 @@ static_delta_part_execute_async_data_free (gpointer user_data)
 
   g_clear_object (&data->repo);
   g_variant_unref (data->header);
-  g_variant_unref (data->part);
+  g_clear_pointer (&data->part, g_variant_unref);
+  g_clear_object (&data->part_in);
+  g_free (data->expected_checksum);
   g_clear_object (&data->cancellable);
   g_free (data);
 }
@@ -314,14 +321,47 @@ static_delta_part_execute_thread (GSimpleAsyncResult  *res,
   StaticDeltaPartExecuteAsyncData *data;
 
   data = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (data->part == NULL)
+    {
+      g_assert (data->part_in != NULL);
+      if (!_ostree_static_delta_part_open (data->part_in, NULL,
+                                           data->open_flags,
+                                           data->expected_checksum,
+                                           &data->part,
+                                           cancellable, &error))
+        {
+          g_simple_async_result_take_error (res, error);
+          return;
+        }
+      /* Drop the compressed input as soon as it's been unpacked */
+      g_clear_object (&data->part_in);
+    }
+
   if (!_ostree_static_delta_part_execute (data->repo,
                                           data->header,
                                           data->part,
-                                          FALSE, NULL,
+                                          FALSE, &data->stats,
                                           cancellable, &error))
     g_simple_async_result_take_error (res, error);
 }
 
+static void
+static_delta_part_execute_async_start (StaticDeltaPartExecuteAsyncData *asyncdata,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+  asyncdata->result = g_simple_async_result_new ((GObject*) asyncdata->repo,
+                                                 callback, user_data,
+                                                 _ostree_static_delta_part_execute_async);
+
+  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
+                                             static_delta_part_execute_async_data_free);
+  g_simple_async_result_run_in_thread (asyncdata->result, static_delta_part_execute_thread,
+                                       G_PRIORITY_DEFAULT, asyncdata->cancellable);
+  g_object_unref (asyncdata->result);
+}
+
 void
 _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
                                          GVariant        *header,
@@ -338,30 +378,71 @@ _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
   asyncdata->part = g_variant_ref (part);
   asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
 
-  asyncdata->result = g_simple_async_result_new ((GObject*) repo,
-                                                 callback, user_data,
-                                                 _ostree_static_delta_part_execute_async);
+  static_delta_part_execute_async_start (asyncdata, callback, user_data);
+}
 
-  g_simple_async_result_set_op_res_gpointer (asyncdata->result, asyncdata,
-                                             static_delta_part_execute_async_data_free);
-  g_simple_async_result_run_in_thread (asyncdata->result, static_delta_part_execute_thread, G_PRIORITY_DEFAULT, cancellable);
-  g_object_unref (asyncdata->result);
+/* Like _ostree_static_delta_part_execute_async(), but also performs the
+ * checksum verification and decompression of @part_in in the worker
+ * thread.  This way, unpacking a part which just finished downloading
+ * doesn't block the main loop, and overlaps with the transfer of the
+ * remaining parts.  Complete with _ostree_static_delta_part_execute_finish().
+ */
+void
+_ostree_static_delta_part_open_and_execute_async (OstreeRepo      *repo,
+                                                  GVariant        *header,
+                                                  GInputStream    *part_in,
+                                                  OstreeStaticDeltaOpenFlags flags,
+                                                  const char      *expected_checksum,
+                                                  GCancellable    *cancellable,
+                                                  GAsyncReadyCallback  callback,
+                                                  gpointer         user_data)
+{
+  StaticDeltaPartExecuteAsyncData *asyncdata;
+
+  asyncdata = g_new0 (StaticDeltaPartExecuteAsyncData, 1);
+  asyncdata->repo = g_object_ref (repo);
+  asyncdata->header = g_variant_ref (header);
+  asyncdata->part_in = g_object_ref (part_in);
+  asyncdata->open_flags = flags;
+  asyncdata->expected_checksum = g_strdup (expected_checksum);
+  asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+  static_delta_part_execute_async_start (asyncdata, callback, user_data);
 }
 
+/* If @stats is non-%NULL, the counters for the executed part are
+ * added to it.
+ */
 gboolean
 _ostree_static_delta_part_execute_finish (OstreeRepo      *repo,
                                           GAsyncResult    *result,
+                                          OstreeDeltaExecuteStats *stats,
                                           GError         **error) 
 {
   GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  StaticDeltaPartExecuteAsyncData *data;
 
   g_warn_if_fail (g_simple_async_result_get_source_tag (simple) == _ostree_static_delta_part_execute_async);
 
   if (g_simple_async_result_propagate_error (simple, error))
     return FALSE;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  if (stats)
+    _ostree_delta_execute_stats_add (stats, &data->stats);
   return TRUE;
 }
 
+void
+_ostree_delta_execute_stats_add (OstreeDeltaExecuteStats       *dest,
+                                 const OstreeDeltaExecuteStats *src)
+{
+  guint i;
+
+  for (i = 0; i < OSTREE_STATIC_DELTA_N_OPS; i++)
+    dest->n_ops_executed[i] += src->n_ops_executed[i];
+}
+
 static gboolean
 validate_ofs (StaticDeltaExecutionState  *state,
               guint64                     offset,
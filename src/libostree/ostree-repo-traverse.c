@@ -551,3 +551,247 @@ ostree_repo_traverse_commit (OstreeRepo      *repo,
  out:
   return ret;
 }
+
+typedef struct {
+  OstreeRepo             *repo;
+  int                     maxdepth;
+  OstreeRepoWalkTreeFlags flags;
+  OstreeRepoWalkTreeFunc  func;
+  gpointer                user_data;
+  GCancellable           *cancellable;
+
+  GString                *path;
+  GHashTable             *dirmeta_cache; /* checksum -> GVariant */
+} WalkTreeData;
+
+/* Append @name to the path buffer, returning the previous length so
+ * the caller can truncate back to it.
+ */
+static gsize
+walk_tree_push_name (WalkTreeData *data,
+                     const char   *name)
+{
+  gsize len = data->path->len;
+
+  if (len > 1)
+    g_string_append_c (data->path, '/');
+  g_string_append (data->path, name);
+  return len;
+}
+
+static gboolean
+walk_tree_file (WalkTreeData *data,
+                const char   *name,
+                GVariant     *csum_v,
+                guint         depth,
+                GError      **error)
+{
+  OstreeRepoWalkTreeEntry entry = { NULL, };
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  const guchar *csum;
+  gsize len;
+  gboolean ret;
+
+  if (!ot_util_filename_validate (name, error))
+    return FALSE;
+  csum = ostree_checksum_bytes_peek_validate (csum_v, error);
+  if (!csum)
+    return FALSE;
+  ostree_checksum_inplace_from_bytes (csum, checksum);
+
+  entry.name = name;
+  entry.type = G_FILE_TYPE_UNKNOWN;
+  entry.checksum = checksum;
+  entry.depth = depth;
+
+  if (data->flags & (OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES |
+                     OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS))
+    {
+      gboolean want_xattrs = (data->flags & OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS) > 0;
+
+      if (!ostree_repo_load_file (data->repo, checksum, NULL, &file_info,
+                                  want_xattrs ? &xattrs : NULL,
+                                  data->cancellable, error))
+        return FALSE;
+
+      entry.type = g_file_info_get_file_type (file_info);
+      entry.uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+      entry.gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
+      entry.mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+      if (entry.type == G_FILE_TYPE_REGULAR)
+        entry.size = g_file_info_get_size (file_info);
+      else if (entry.type == G_FILE_TYPE_SYMBOLIC_LINK)
+        entry.symlink_target = g_file_info_get_symlink_target (file_info);
+      entry.xattrs = xattrs;
+    }
+
+  len = walk_tree_push_name (data, name);
+  entry.path = data->path->str;
+  ret = data->func (data->repo, &entry, data->user_data, error);
+  g_string_truncate (data->path, len);
+  return ret;
+}
+
+static gboolean
+walk_tree_dir (WalkTreeData *data,
+               const char   *name,
+               const char   *contents_checksum,
+               const char   *meta_checksum,
+               guint         depth,
+               GError      **error)
+{
+  OstreeRepoWalkTreeEntry entry = { NULL, };
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autoptr(GVariant) dirtree = NULL;
+  g_autoptr(GVariant) files = NULL;
+  g_autoptr(GVariant) dirs = NULL;
+  GVariant *dirmeta;
+  guint n;
+
+  if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+    return FALSE;
+
+  dirmeta = g_hash_table_lookup (data->dirmeta_cache, meta_checksum);
+  if (!dirmeta)
+    {
+      if (!ostree_repo_load_variant (data->repo, OSTREE_OBJECT_TYPE_DIR_META,
+                                     meta_checksum, &dirmeta, error))
+        return FALSE;
+      g_hash_table_insert (data->dirmeta_cache, g_strdup (meta_checksum), dirmeta);
+    }
+
+  g_variant_get (dirmeta, "(uuu@a(ayay))", &entry.uid, &entry.gid, &entry.mode,
+                 (data->flags & OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS) ? &xattrs : NULL);
+  entry.uid = GUINT32_FROM_BE (entry.uid);
+  entry.gid = GUINT32_FROM_BE (entry.gid);
+  entry.mode = GUINT32_FROM_BE (entry.mode);
+  entry.xattrs = xattrs;
+  entry.path = data->path->str;
+  entry.name = name;
+  entry.type = G_FILE_TYPE_DIRECTORY;
+  entry.checksum = contents_checksum;
+  entry.meta_checksum = meta_checksum;
+  entry.depth = depth;
+
+  if (!data->func (data->repo, &entry, data->user_data, error))
+    return FALSE;
+
+  if (data->maxdepth >= 0 && depth >= (guint)data->maxdepth)
+    return TRUE;
+
+  if (!ostree_repo_load_variant (data->repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                 contents_checksum, &dirtree, error))
+    return FALSE;
+
+  /* Files come first, then subdirectories, like the on-disk order */
+  files = g_variant_get_child_value (dirtree, 0);
+  n = g_variant_n_children (files);
+  for (guint i = 0; i < n; i++)
+    {
+      const char *child_name;
+      g_autoptr(GVariant) csum_v = NULL;
+
+      g_variant_get_child (files, i, "(&s@ay)", &child_name, &csum_v);
+      if (!walk_tree_file (data, child_name, csum_v, depth + 1, error))
+        return FALSE;
+    }
+
+  dirs = g_variant_get_child_value (dirtree, 1);
+  n = g_variant_n_children (dirs);
+  for (guint i = 0; i < n; i++)
+    {
+      const char *child_name;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      char child_checksum[OSTREE_SHA256_STRING_LEN+1];
+      char child_meta_checksum[OSTREE_SHA256_STRING_LEN+1];
+      const guchar *csum;
+      gsize len;
+      gboolean ok;
+
+      g_variant_get_child (dirs, i, "(&s@ay@ay)", &child_name, &csum_v, &meta_csum_v);
+      if (!ot_util_filename_validate (child_name, error))
+        return FALSE;
+
+      csum = ostree_checksum_bytes_peek_validate (csum_v, error);
+      if (!csum)
+        return FALSE;
+      ostree_checksum_inplace_from_bytes (csum, child_checksum);
+      csum = ostree_checksum_bytes_peek_validate (meta_csum_v, error);
+      if (!csum)
+        return FALSE;
+      ostree_checksum_inplace_from_bytes (csum, child_meta_checksum);
+
+      len = walk_tree_push_name (data, child_name);
+      ok = walk_tree_dir (data, child_name, child_checksum, child_meta_checksum,
+                          depth + 1, error);
+      g_string_truncate (data->path, len);
+      if (!ok)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_repo_walk_tree:
+ * @self: Repo
+ * @contents_checksum: Checksum of the root dirtree object
+ * @meta_checksum: Checksum of the root dirmeta object
+ * @maxdepth: Descend at most this many directory levels below the root, -1 for unlimited
+ * @flags: Flags controlling which information is loaded
+ * @func: (scope call): Called for each entry
+ * @user_data: Data for @func
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Walk the tree rooted at @contents_checksum and @meta_checksum
+ * depth-first, calling @func for the root and then for every entry
+ * below it.  Within a directory, files are visited before
+ * subdirectories, in dirtree order.
+ *
+ * Unlike enumerating an #OstreeRepoFile, this reads the dirtree and
+ * dirmeta objects directly and does not allocate per-entry objects;
+ * dirmeta objects shared between directories are only loaded once.
+ * Content objects are not opened unless
+ * %OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES or
+ * %OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS is given.
+ *
+ * Since: 2017.7
+ */
+gboolean
+ostree_repo_walk_tree (OstreeRepo               *self,
+                       const char               *contents_checksum,
+                       const char               *meta_checksum,
+                       int                       maxdepth,
+                       OstreeRepoWalkTreeFlags   flags,
+                       OstreeRepoWalkTreeFunc    func,
+                       gpointer                  user_data,
+                       GCancellable             *cancellable,
+                       GError                  **error)
+{
+  WalkTreeData data = { NULL, };
+  gboolean ret;
+
+  g_return_val_if_fail (contents_checksum != NULL, FALSE);
+  g_return_val_if_fail (meta_checksum != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  data.repo = self;
+  data.maxdepth = maxdepth;
+  data.flags = flags;
+  data.func = func;
+  data.user_data = user_data;
+  data.cancellable = cancellable;
+  data.path = g_string_new ("/");
+  data.dirmeta_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)g_variant_unref);
+
+  ret = walk_tree_dir (&data, "/", contents_checksum, meta_checksum, 0, error);
+
+  g_string_free (data.path, TRUE);
+  g_hash_table_unref (data.dirmeta_cache);
+  return ret;
+}
@@ -458,9 +458,25 @@ ostree_repo_finalize (GObject *object)
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
   g_clear_error (&self->writable_error);
   g_clear_pointer (&self->object_sizes, (GDestroyNotify) g_hash_table_unref);
-  g_clear_pointer (&self->dirmeta_cache, (GDestroyNotify) g_hash_table_unref);
+  if (self->metadata_cache)
+    {
+      OstreeMetadataCacheStats stats;
+
+      _ostree_metadata_cache_get_stats (self->metadata_cache, &stats);
+      g_debug ("metadata cache: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, "
+               "%u entries using %" G_GUINT64_FORMAT " bytes",
+               stats.hits, stats.misses, stats.n_entries, stats.size);
+      _ostree_metadata_cache_free (self->metadata_cache);
+    }
   g_mutex_clear (&self->cache_lock);
   g_mutex_clear (&self->txn_stats_lock);
+  /* Each queued write holds a reference to us, so the pool is idle.  But
+   * the last reference may be dropped by one of its threads, so don't
+   * wait for them.
+   */
+  if (self->write_pool)
+    g_thread_pool_free (self->write_pool, FALSE, FALSE);
+  g_mutex_clear (&self->write_pool_lock);
 
   g_clear_pointer (&self->remotes, g_hash_table_destroy);
   g_mutex_clear (&self->remotes_lock);
@@ -610,12 +626,16 @@ ostree_repo_init (OstreeRepo *self)
 
   g_mutex_init (&self->cache_lock);
   g_mutex_init (&self->txn_stats_lock);
+  g_mutex_init (&self->write_pool_lock);
 
   self->remotes = g_hash_table_new_full (g_str_hash, g_str_equal,
                                          (GDestroyNotify) NULL,
                                          (GDestroyNotify) ostree_remote_unref);
   g_mutex_init (&self->remotes_lock);
 
+  /* Sized once the config is loaded */
+  self->metadata_cache = _ostree_metadata_cache_new (0);
+
   self->repo_dir_fd = -1;
   self->cache_dir_fd = -1;
   self->tmp_dir_fd = -1;
@@ -1926,6 +1946,46 @@ reload_core_config (OstreeRepo          *self,
     self->tmp_expiry_seconds = g_ascii_strtoull (tmp_expiry_seconds, NULL, 10);
   }
 
+  { g_autofree char *summary_shards_str = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "summary-shards", "0",
+                                            &summary_shards_str, error))
+      return FALSE;
+
+    self->summary_shards = MIN (g_ascii_strtoull (summary_shards_str, NULL, 10), G_MAXUINT16);
+  }
+
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "gpg-cache",
+                                            TRUE, &self->gpg_cache, error))
+    return FALSE;
+
+  { g_autofree char *metadata_cache_size_str = NULL;
+    guint64 metadata_cache_size;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "metadata-cache-size", NULL,
+                                            &metadata_cache_size_str, error))
+      return FALSE;
+
+    if (metadata_cache_size_str)
+      metadata_cache_size = g_ascii_strtoull (metadata_cache_size_str, NULL, 10);
+    else
+      metadata_cache_size = _OSTREE_METADATA_CACHE_DEFAULT_SIZE;
+
+    /* Other threads may be using the cache, so resize it rather than
+     * replacing it.
+     */
+    _ostree_metadata_cache_set_max_size (self->metadata_cache, metadata_cache_size);
+  }
+
+  { g_autofree char *write_threads_str = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "write-threads", "0",
+                                            &write_threads_str, error))
+      return FALSE;
+
+    self->write_threads = MIN (g_ascii_strtoull (write_threads_str, NULL, 10), 256);
+  }
+
   { g_autofree char *compression_level_str = NULL;
 
     /* gzip defaults to 6 */
@@ -2268,20 +2328,25 @@ ostree_repo_get_parent (OstreeRepo  *self)
   return self->parent_repo;
 }
 
+/* Call @func for each loose object in the objects/@prefix directory of
+ * @repo, which is @self or one of its parents.  If @commit_starting_with
+ * is given, only commit objects whose checksum has that prefix are
+ * reported.
+ */
 static gboolean
-list_loose_objects_at (OstreeRepo             *self,
-                       GHashTable             *inout_objects,
-                       int                     dfd,
-                       const char             *prefix,
-                       const char             *commit_starting_with,
-                       GCancellable           *cancellable,
-                       GError                **error)
+foreach_loose_object_at (OstreeRepo                  *self,
+                         OstreeRepo                  *repo,
+                         const char                  *prefix,
+                         OstreeRepoListObjectsFlags   flags,
+                         const char                  *commit_starting_with,
+                         OstreeRepoForeachObjectFunc  func,
+                         gpointer                     user_data,
+                         GCancellable                *cancellable,
+                         GError                     **error)
 {
-  GVariant *key, *value;
-
   g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
   gboolean exists;
-  if (!ot_dfd_iter_init_allow_noent (dfd, prefix, &dfd_iter, &exists, error))
+  if (!ot_dfd_iter_init_allow_noent (repo->objects_dir_fd, prefix, &dfd_iter, &exists, error))
     return FALSE;
   /* Note early return */
   if (!exists)
@@ -2306,9 +2371,9 @@ list_loose_objects_at (OstreeRepo             *self,
         continue;
 
       OstreeObjectType objtype;
-      if ((self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+      if ((repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
            && strcmp (dot, ".filez") == 0) ||
-          ((_ostree_repo_mode_is_bare (self->mode))
+          ((_ostree_repo_mode_is_bare (repo->mode))
            && strcmp (dot, ".file") == 0))
         objtype = OSTREE_OBJECT_TYPE_FILE;
       else if (strcmp (dot, ".dirtree") == 0)
@@ -2343,41 +2408,95 @@ list_loose_objects_at (OstreeRepo             *self,
             continue;
         }
 
-      key = ostree_object_name_serialize (buf, objtype);
-      value = g_variant_new ("(b@as)",
-                             TRUE, g_variant_new_strv (NULL, 0));
-      /* transfer ownership */
-      g_hash_table_replace (inout_objects, g_variant_ref_sink (key),
-                            g_variant_ref_sink (value));
+      guchar csum[OSTREE_SHA256_DIGEST_LEN];
+      OstreeRepoObjectEntry entry = { 0, };
+
+      ostree_checksum_inplace_to_bytes (buf, csum);
+      entry.checksum = buf;
+      entry.csum = csum;
+      entry.objtype = objtype;
+      entry.is_loose = TRUE;
+      entry.repo = repo;
+      entry.dfd = dfd_iter.fd;
+      entry.name = name;
+
+      if (flags & OSTREE_REPO_LIST_OBJECTS_QUERY_STAT)
+        {
+          struct stat stbuf;
+
+          if (TEMP_FAILURE_RETRY (fstatat (dfd_iter.fd, name, &stbuf, AT_SYMLINK_NOFOLLOW)) < 0)
+            {
+              /* Deleted since we read the directory */
+              if (errno == ENOENT)
+                continue;
+              return glnx_throw_errno_prefix (error, "fstatat(%s/%s)", prefix, name);
+            }
+          entry.size = stbuf.st_size;
+          entry.mode = stbuf.st_mode;
+          entry.mtime = stbuf.st_mtime;
+        }
+
+      if (!func (self, &entry, user_data, error))
+        return FALSE;
     }
 
   return TRUE;
 }
 
 static gboolean
-list_loose_objects (OstreeRepo                     *self,
-                    GHashTable                     *inout_objects,
-                    const char                     *commit_starting_with,
-                    GCancellable                   *cancellable,
-                    GError                        **error)
+foreach_loose_object (OstreeRepo                  *self,
+                      OstreeRepo                  *repo,
+                      OstreeRepoListObjectsFlags   flags,
+                      const char                  *commit_starting_with,
+                      OstreeRepoForeachObjectFunc  func,
+                      gpointer                     user_data,
+                      GCancellable                *cancellable,
+                      GError                     **error)
 {
   static const gchar hexchars[] = "0123456789abcdef";
 
+  /* A long enough prefix names a single directory */
+  if (commit_starting_with &&
+      g_ascii_isxdigit (commit_starting_with[0]) &&
+      g_ascii_isxdigit (commit_starting_with[1]))
+    {
+      const char buf[3] = { commit_starting_with[0], commit_starting_with[1], '\0' };
+      return foreach_loose_object_at (self, repo, buf, flags, commit_starting_with,
+                                      func, user_data, cancellable, error);
+    }
+
   for (guint c = 0; c < 256; c++)
     {
       char buf[3];
       buf[0] = hexchars[c >> 4];
       buf[1] = hexchars[c & 0xF];
       buf[2] = '\0';
-      if (!list_loose_objects_at (self, inout_objects, self->objects_dir_fd, buf,
-                                  commit_starting_with,
-                                  cancellable, error))
+      if (!foreach_loose_object_at (self, repo, buf, flags, commit_starting_with,
+                                    func, user_data, cancellable, error))
         return FALSE;
     }
 
   return TRUE;
 }
 
+/* Adds each object to a GHashTable, for ostree_repo_list_objects() */
+static gboolean
+list_objects_add (OstreeRepo                  *repo,
+                  const OstreeRepoObjectEntry *entry,
+                  gpointer                     user_data,
+                  GError                     **error)
+{
+  GHashTable *objects = user_data;
+  GVariant *key = ostree_object_name_serialize (entry->checksum, entry->objtype);
+  GVariant *value = g_variant_new ("(b@as)",
+                                   TRUE, g_variant_new_strv (NULL, 0));
+
+  /* transfer ownership */
+  g_hash_table_replace (objects, g_variant_ref_sink (key),
+                        g_variant_ref_sink (value));
+  return TRUE;
+}
+
 static gboolean
 load_metadata_internal (OstreeRepo       *self,
                         OstreeObjectType  objtype,
@@ -2397,24 +2516,22 @@ load_metadata_internal (OstreeRepo       *self,
 
   g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
 
-  /* Special caching for dirmeta objects, since they're commonly referenced many
-   * times.
+  /* Trees, directory metadata and commits are read over and over when
+   * walking history, so keep the most recently used ones in memory.
    */
-  const gboolean is_dirmeta_cachable =
-    (objtype == OSTREE_OBJECT_TYPE_DIR_META && out_variant && !out_stream);
-  if (is_dirmeta_cachable)
-    {
-      GMutex *lock = &self->cache_lock;
-      g_mutex_lock (lock);
-      GVariant *cache_hit = NULL;
-      /* Look it up, if we have a cache */
-      if (self->dirmeta_cache)
-        cache_hit = g_hash_table_lookup (self->dirmeta_cache, sha256);
-      if (cache_hit)
-        *out_variant = g_variant_ref (cache_hit);
-      g_mutex_unlock (lock);
+  const gboolean is_cachable =
+    (self->metadata_cache != NULL && out_variant && !out_stream && !out_size &&
+     (objtype == OSTREE_OBJECT_TYPE_DIR_TREE ||
+      objtype == OSTREE_OBJECT_TYPE_DIR_META ||
+      objtype == OSTREE_OBJECT_TYPE_COMMIT));
+  if (is_cachable)
+    {
+      GVariant *cache_hit = _ostree_metadata_cache_lookup (self->metadata_cache, objtype, sha256);
       if (cache_hit)
-        return TRUE;
+        {
+          *out_variant = cache_hit;
+          return TRUE;
+        }
     }
 
   _ostree_loose_path (loose_path_buf, sha256, objtype, self->mode);
@@ -2423,11 +2540,16 @@ load_metadata_internal (OstreeRepo       *self,
                                error))
     return FALSE;
 
+  /* Objects only in the staging directory go away if the transaction is
+   * aborted, so don't cache them.
+   */
+  gboolean is_staged = FALSE;
   if (fd < 0 && self->commit_stagedir_fd != -1)
     {
       if (!ot_openat_ignore_enoent (self->commit_stagedir_fd, loose_path_buf, &fd,
                                     error))
         return FALSE;
+      is_staged = (fd != -1);
     }
 
   if (fd != -1)
@@ -2464,14 +2586,8 @@ load_metadata_internal (OstreeRepo       *self,
             }
 
           /* Now, let's put it in the cache */
-          if (is_dirmeta_cachable)
-            {
-              GMutex *lock = &self->cache_lock;
-              g_mutex_lock (lock);
-              if (self->dirmeta_cache)
-                g_hash_table_replace (self->dirmeta_cache, g_strdup (sha256), g_variant_ref (ret_variant));
-              g_mutex_unlock (lock);
-            }
+          if (is_cachable && !is_staged)
+            _ostree_metadata_cache_insert (self->metadata_cache, objtype, sha256, ret_variant);
         }
       else if (out_stream)
         {
@@ -3016,6 +3132,9 @@ ostree_repo_delete_object (OstreeRepo           *self,
         }
     }
 
+  if (self->metadata_cache && OSTREE_OBJECT_TYPE_IS_META (objtype))
+    _ostree_metadata_cache_remove (self->metadata_cache, objtype, sha256);
+
   if (TEMP_FAILURE_RETRY (unlinkat (self->objects_dir_fd, loose_path, 0)) < 0)
     return glnx_throw_errno_prefix (error, "Deleting object %s.%s", sha256, ostree_object_type_to_string (objtype));
 
@@ -3488,16 +3607,57 @@ ostree_repo_list_objects (OstreeRepo                  *self,
                            (GDestroyNotify) g_variant_unref,
                            (GDestroyNotify) g_variant_unref);
 
+  if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
+    flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
+
+  if (!ostree_repo_foreach_object (self, flags, list_objects_add, ret_objects,
+                                   cancellable, error))
+    return FALSE;
+
+  ot_transfer_out_value (out_objects, &ret_objects);
+  return TRUE;
+}
+
+/**
+ * ostree_repo_foreach_object:
+ * @self: Repo
+ * @flags: Flags controlling enumeration
+ * @func: (scope call): Function to call for each object
+ * @user_data: User data for @func
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Call @func for each object in the repository, reading one object
+ * directory at a time.  Unlike ostree_repo_list_objects(), this does not
+ * allocate anything per object, which matters for large repositories.
+ * Objects present in both this repository and its parent are reported
+ * once for each.  @func may delete the object it is passed.
+ *
+ * Returns: %TRUE on success, %FALSE on error, and @error will be set
+ * Since: 2017.7
+ */
+gboolean
+ostree_repo_foreach_object (OstreeRepo                  *self,
+                            OstreeRepoListObjectsFlags   flags,
+                            OstreeRepoForeachObjectFunc  func,
+                            gpointer                     user_data,
+                            GCancellable                *cancellable,
+                            GError                     **error)
+{
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  g_return_val_if_fail (self->inited, FALSE);
+
   if (flags & OSTREE_REPO_LIST_OBJECTS_ALL)
     flags |= (OSTREE_REPO_LIST_OBJECTS_LOOSE | OSTREE_REPO_LIST_OBJECTS_PACKED);
 
   if (flags & OSTREE_REPO_LIST_OBJECTS_LOOSE)
     {
-      if (!list_loose_objects (self, ret_objects, NULL, cancellable, error))
+      if (!foreach_loose_object (self, self, flags, NULL, func, user_data, cancellable, error))
         return FALSE;
       if ((flags & OSTREE_REPO_LIST_OBJECTS_NO_PARENTS) == 0 && self->parent_repo)
         {
-          if (!list_loose_objects (self->parent_repo, ret_objects, NULL, cancellable, error))
+          if (!foreach_loose_object (self, self->parent_repo, flags, NULL, func, user_data,
+                                     cancellable, error))
             return FALSE;
         }
     }
@@ -3507,7 +3667,6 @@ ostree_repo_list_objects (OstreeRepo                  *self,
       /* Nothing for now... */
     }
 
-  ot_transfer_out_value (out_objects, &ret_objects);
   return TRUE;
 }
 
@@ -3540,13 +3699,14 @@ ostree_repo_list_commit_objects_starting_with (OstreeRepo                  *self
                            (GDestroyNotify) g_variant_unref,
                            (GDestroyNotify) g_variant_unref);
 
-  if (!list_loose_objects (self, ret_commits, start, cancellable, error))
+  if (!foreach_loose_object (self, self, 0, start, list_objects_add, ret_commits,
+                             cancellable, error))
     return FALSE;
 
   if (self->parent_repo)
     {
-      if (!list_loose_objects (self->parent_repo, ret_commits, start,
-                               cancellable, error))
+      if (!foreach_loose_object (self, self->parent_repo, 0, start, list_objects_add, ret_commits,
+                                 cancellable, error))
         return FALSE;
     }
 
@@ -4240,6 +4400,26 @@ _ostree_repo_gpg_verify_data_internal (OstreeRepo    *self,
       _ostree_gpg_verifier_add_keyring (verifier, extra_keyring);
     }
 
+  /* Keep the merged keyrings around rather than rebuilding them for
+   * every verification, if we have a cache directory.  It may be one
+   * set with ostree_repo_set_cache_dir() rather than the repo's own,
+   * and GPGME needs a path for it, so resolve the fd.  */
+  if (self->gpg_cache && self->cache_dir_fd != -1)
+    {
+      g_autofree char *fd_path = g_strdup_printf ("/proc/self/fd/%d", self->cache_dir_fd);
+      g_autofree char *cache_dir = glnx_readlinkat_malloc (AT_FDCWD, fd_path, cancellable, NULL);
+
+      if (cache_dir != NULL && g_path_is_absolute (cache_dir))
+        {
+          g_autofree char *home_cache_dir =
+            g_build_filename (cache_dir, _OSTREE_GPG_HOME_CACHE_DIR, NULL);
+          _ostree_gpg_verifier_set_home_cache_dir (verifier, home_cache_dir,
+                                                   self->tmp_expiry_seconds);
+        }
+    }
+
+  /* Results aren't cached: each holds a GPGME context, which can't be
+   * shared between callers on different threads. */
   return _ostree_gpg_verifier_check_signature (verifier,
                                                data,
                                                signatures,
@@ -4540,6 +4720,276 @@ ostree_repo_verify_summary (OstreeRepo    *self,
                                                 error);
 }
 
+guint
+_ostree_summary_shard_for_ref (const char *ref,
+                               guint       n_shards)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  guint8 digest[OSTREE_SHA256_DIGEST_LEN];
+  gsize digest_len = sizeof (digest);
+
+  g_checksum_update (checksum, (const guint8*)ref, strlen (ref));
+  g_checksum_get_digest (checksum, digest, &digest_len);
+
+  return (((guint32)digest[0] << 24) | ((guint32)digest[1] << 16) |
+          ((guint32)digest[2] << 8) | (guint32)digest[3]) % n_shards;
+}
+
+/* Load the cache of delta superblock checksums, as a map from delta
+ * name to a (ttttay) entry.  The cache is purely an optimization, so
+ * any failure just results in an empty cache.
+ */
+static GHashTable *
+load_superblock_csum_cache (OstreeRepo   *self,
+                            GCancellable *cancellable)
+{
+  g_autoptr(GHashTable) ret =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+  g_autoptr(GError) local_error = NULL;
+  glnx_fd_close int fd = -1;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) cache = NULL;
+
+  if (self->cache_dir_fd == -1)
+    return g_steal_pointer (&ret);
+
+  if (!ot_openat_ignore_enoent (self->cache_dir_fd, _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE,
+                                &fd, &local_error))
+    {
+      g_debug ("Failed to open %s: %s", _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE, local_error->message);
+      return g_steal_pointer (&ret);
+    }
+  if (fd == -1)
+    return g_steal_pointer (&ret);
+
+  bytes = glnx_fd_readall_bytes (fd, cancellable, &local_error);
+  if (!bytes)
+    {
+      g_debug ("Failed to read %s: %s", _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE, local_error->message);
+      return g_steal_pointer (&ret);
+    }
+
+  cache = g_variant_ref_sink (g_variant_new_from_bytes (_OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE_FORMAT,
+                                                        bytes, FALSE));
+  for (gsize i = 0, n = g_variant_n_children (cache); i < n; i++)
+    {
+      const char *delta_name;
+      GVariant *entry;
+
+      g_variant_get_child (cache, i, "{&s@(ttttay)}", &delta_name, &entry);
+      g_hash_table_replace (ret, g_strdup (delta_name), entry);
+    }
+
+  return g_steal_pointer (&ret);
+}
+
+/* Return the checksum of the superblock for delta @delta_name (from
+ * @from to @to), reusing the one in @cache if the superblock file is
+ * unchanged since.  The up to date cache entry is added to @new_cache.
+ */
+static gboolean
+get_superblock_checksum (OstreeRepo       *self,
+                         const char       *delta_name,
+                         const char       *from,
+                         const char       *to,
+                         GHashTable       *cache,
+                         GVariantBuilder  *new_cache,
+                         GVariant        **out_csum_v,
+                         gboolean         *out_was_cached,
+                         GCancellable     *cancellable,
+                         GError          **error)
+{
+  g_autofree char *superblock = _ostree_get_relative_static_delta_superblock_path ((from && from[0]) ? from : NULL, to);
+  glnx_fd_close int superblock_file_fd = openat (self->repo_dir_fd, superblock, O_RDONLY | O_CLOEXEC);
+  if (superblock_file_fd == -1)
+    return glnx_throw_errno_prefix (error, "openat(%s)", superblock);
+
+  struct stat stbuf;
+  if (!glnx_fstat (superblock_file_fd, &stbuf, error))
+    return FALSE;
+  const guint64 mtime_ns = (guint64)stbuf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) + stbuf.st_mtim.tv_nsec;
+
+  g_autoptr(GVariant) csum_v = NULL;
+  GVariant *cached = g_hash_table_lookup (cache, delta_name);
+  if (cached)
+    {
+      guint64 dev, ino, size, cached_mtime_ns;
+      g_autoptr(GVariant) cached_csum_v = NULL;
+
+      g_variant_get (cached, "(tttt@ay)", &dev, &ino, &size, &cached_mtime_ns, &cached_csum_v);
+      if (dev == (guint64)stbuf.st_dev && ino == (guint64)stbuf.st_ino &&
+          size == (guint64)stbuf.st_size && cached_mtime_ns == mtime_ns &&
+          g_variant_n_children (cached_csum_v) == OSTREE_SHA256_DIGEST_LEN)
+        csum_v = g_steal_pointer (&cached_csum_v);
+    }
+
+  *out_was_cached = (csum_v != NULL);
+  if (!csum_v)
+    {
+      g_autoptr(GInputStream) in_stream = g_unix_input_stream_new (superblock_file_fd, FALSE);
+      g_autofree guchar *csum = NULL;
+      if (!ot_gio_checksum_stream (in_stream, &csum, cancellable, error))
+        return FALSE;
+
+      csum_v = g_variant_ref_sink (ot_gvariant_new_bytearray (csum, OSTREE_SHA256_DIGEST_LEN));
+    }
+
+  g_variant_builder_add (new_cache, "{s(tttt@ay)}", delta_name,
+                         (guint64)stbuf.st_dev, (guint64)stbuf.st_ino,
+                         (guint64)stbuf.st_size, mtime_ns, csum_v);
+
+  *out_csum_v = g_steal_pointer (&csum_v);
+  return TRUE;
+}
+
+/* Write the sharded form of the summary; see
+ * ostree_repo_regenerate_summary().  @ref_entries are the summary ref
+ * entries sorted by name, @deltas_by_to maps a commit to the static
+ * delta entries (of type {sv}) leading to it, and @metadata is the
+ * summary's additional metadata.
+ */
+static gboolean
+write_summary_shards (OstreeRepo    *self,
+                      guint          n_shards,
+                      GHashTable    *refs,
+                      GPtrArray     *ref_entries,
+                      GHashTable    *deltas_by_to,
+                      GVariant      *metadata,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  g_autoptr(GPtrArray) shard_refs = g_ptr_array_new_with_free_func ((GDestroyNotify)g_ptr_array_unref);
+  g_autoptr(GHashTable) shard_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GVariantBuilder) shard_csums_builder = g_variant_builder_new (G_VARIANT_TYPE ("aay"));
+
+  for (guint i = 0; i < n_shards; i++)
+    g_ptr_array_add (shard_refs, g_ptr_array_new ());
+  for (guint i = 0; i < ref_entries->len; i++)
+    {
+      GVariant *ref_entry = ref_entries->pdata[i];
+      const char *ref;
+
+      g_variant_get_child (ref_entry, 0, "&s", &ref);
+      g_ptr_array_add (shard_refs->pdata[_ostree_summary_shard_for_ref (ref, n_shards)], ref_entry);
+    }
+
+  if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, _OSTREE_SUMMARY_SHARDS_DIR, 0755, cancellable, error))
+    return FALSE;
+
+  for (guint i = 0; i < n_shards; i++)
+    {
+      GPtrArray *entries = shard_refs->pdata[i];
+      g_autoptr(GVariantBuilder) refs_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))"));
+      g_autoptr(GVariantBuilder) deltas_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+      g_auto(GVariantDict) shard_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+      gboolean have_deltas = FALSE;
+
+      g_variant_dict_init (&shard_metadata_builder, NULL);
+
+      for (guint j = 0; j < entries->len; j++)
+        {
+          GVariant *ref_entry = entries->pdata[j];
+          const char *ref;
+          GPtrArray *deltas_to;
+
+          g_variant_builder_add_value (refs_builder, ref_entry);
+
+          g_variant_get_child (ref_entry, 0, "&s", &ref);
+          deltas_to = g_hash_table_lookup (deltas_by_to, g_hash_table_lookup (refs, ref));
+          for (guint k = 0; deltas_to && k < deltas_to->len; k++)
+            {
+              g_variant_builder_add_value (deltas_builder, deltas_to->pdata[k]);
+              have_deltas = TRUE;
+            }
+        }
+
+      /* Several refs in a shard may point to the same commit, but a{sv}
+       * lookups just take the first match, so duplicates are harmless.
+       */
+      if (have_deltas)
+        g_variant_dict_insert_value (&shard_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS,
+                                     g_variant_builder_end (deltas_builder));
+
+      g_autoptr(GVariant) shard = g_variant_ref_sink (g_variant_new ("(@a(s(taya{sv}))@a{sv})",
+                                                                     g_variant_builder_end (refs_builder),
+                                                                     g_variant_dict_end (&shard_metadata_builder)));
+      g_autofree char *shard_checksum =
+        g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                     g_variant_get_data (shard),
+                                     g_variant_get_size (shard));
+      g_autofree char *shard_name = g_strconcat (shard_checksum, ".shard", NULL);
+      g_autofree char *shard_path = g_build_filename (_OSTREE_SUMMARY_SHARDS_DIR, shard_name, NULL);
+      struct stat stbuf;
+
+      g_variant_builder_add_value (shard_csums_builder, ostree_checksum_to_bytes_v (shard_checksum));
+
+      /* Shards are named by content, so an existing one is up to date */
+      if (g_hash_table_contains (shard_names, shard_name))
+        continue;
+      if (fstatat (self->repo_dir_fd, shard_path, &stbuf, 0) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", shard_path);
+
+          if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, shard_path,
+                                                   g_variant_get_data (shard),
+                                                   g_variant_get_size (shard),
+                                                   cancellable, error))
+            return FALSE;
+        }
+      g_hash_table_add (shard_names, g_steal_pointer (&shard_name));
+    }
+
+  {
+    g_auto(GVariantDict) index_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
+    g_autoptr(GVariant) index = NULL;
+
+    /* Everything but the deltas, which live in the shards */
+    g_variant_dict_init (&index_metadata_builder, metadata);
+    g_variant_dict_remove (&index_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS);
+
+    index = g_variant_ref_sink (g_variant_new ("(@a{sv}@aay)",
+                                               g_variant_dict_end (&index_metadata_builder),
+                                               g_variant_builder_end (shard_csums_builder)));
+    if (!_ostree_repo_file_replace_contents (self, self->repo_dir_fd, _OSTREE_SUMMARY_SHARD_INDEX,
+                                             g_variant_get_data (index),
+                                             g_variant_get_size (index),
+                                             cancellable, error))
+      return FALSE;
+  }
+
+  /* Remove shards no longer referenced by the index.  A client which
+   * raced with us and fetched the old index falls back to the classic
+   * summary.
+   */
+  {
+    g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+    if (!glnx_dirfd_iterator_init_at (self->repo_dir_fd, _OSTREE_SUMMARY_SHARDS_DIR, FALSE,
+                                      &dfd_iter, error))
+      return FALSE;
+
+    while (TRUE)
+      {
+        struct dirent *dent;
+
+        if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+          return FALSE;
+        if (dent == NULL)
+          break;
+
+        if (!g_str_has_suffix (dent->d_name, ".shard") ||
+            g_hash_table_contains (shard_names, dent->d_name))
+          continue;
+
+        if (unlinkat (dfd_iter.fd, dent->d_name, 0) < 0 && errno != ENOENT)
+          return glnx_throw_errno_prefix (error, "unlinkat(%s)", dent->d_name);
+      }
+  }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_regenerate_summary:
  * @self: Repo
@@ -4556,6 +5006,13 @@ ostree_repo_verify_summary (OstreeRepo    *self,
  *
  * It is regenerated automatically after a commit if
  * `core/commit-update-summary` is set.
+ *
+ * If `core/summary-shards` is set to a nonzero value N, the refs are
+ * additionally split into N shards by a hash of the ref name, written
+ * to `summaries/CHECKSUM.shard` along with a `summaries/index` listing
+ * them.  Clients pulling a few refs from a repository with many can
+ * then fetch only the shards they need.  Each shard is in the format
+ * of the summary, holding its refs and the static deltas to them.
  */
 gboolean
 ostree_repo_regenerate_summary (OstreeRepo     *self,
@@ -4566,12 +5023,17 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
   g_auto(GVariantDict) additional_metadata_builder = OT_VARIANT_BUILDER_INITIALIZER;
   g_variant_dict_init (&additional_metadata_builder, additional_metadata);
   g_autoptr(GVariantBuilder) refs_builder = g_variant_builder_new (G_VARIANT_TYPE ("a(s(taya{sv}))"));
+  g_autoptr(GHashTable) ref_commits = g_hash_table_new (g_str_hash, g_str_equal);
+  /* Only used for shards */
+  g_autoptr(GPtrArray) ref_entries = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  g_autoptr(GHashTable) deltas_by_to =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+
+  g_autoptr(GHashTable) refs = NULL;
+  if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
+    return FALSE;
 
   {
-    g_autoptr(GHashTable) refs = NULL;
-    if (!ostree_repo_list_refs (self, NULL, &refs, cancellable, error))
-      return FALSE;
-
     g_autoptr(GList) ordered_keys = g_hash_table_get_keys (refs);
     ordered_keys = g_list_sort (ordered_keys, (GCompareFunc)strcmp);
 
@@ -4605,21 +5067,31 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
           g_variant_dict_insert_value (&commit_metadata_builder, OSTREE_COMMIT_TIMESTAMP,
                                        g_variant_new_uint64 (GUINT64_TO_BE (commit_timestamp)));
 
-        g_variant_builder_add_value (refs_builder,
-                                     g_variant_new ("(s(t@ay@a{sv}))", ref,
-                                                    (guint64) g_variant_get_size (commit_obj),
-                                                    ostree_checksum_to_bytes_v (commit),
-                                                    g_variant_dict_end (&commit_metadata_builder)));
+        g_hash_table_add (ref_commits, (char*)commit);
+
+        GVariant *ref_entry = g_variant_new ("(s(t@ay@a{sv}))", ref,
+                                             (guint64) g_variant_get_size (commit_obj),
+                                             ostree_checksum_to_bytes_v (commit),
+                                             g_variant_dict_end (&commit_metadata_builder));
+        g_ptr_array_add (ref_entries, g_variant_ref_sink (ref_entry));
+        g_variant_builder_add_value (refs_builder, ref_entry);
       }
   }
 
   {
     g_autoptr(GPtrArray) delta_names = NULL;
     g_auto(GVariantDict) deltas_builder = OT_VARIANT_BUILDER_INITIALIZER;
+    g_autoptr(GHashTable) superblock_csum_cache = NULL;
+    g_autoptr(GVariantBuilder) new_cache_builder = NULL;
+    guint n_checksummed = 0;
+    const gint64 deltas_start_time = g_get_monotonic_time ();
 
     if (!ostree_repo_list_static_delta_names (self, &delta_names, cancellable, error))
       return FALSE;
 
+    superblock_csum_cache = load_superblock_csum_cache (self, cancellable);
+    new_cache_builder = g_variant_builder_new (_OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE_FORMAT);
+
     g_variant_dict_init (&deltas_builder, NULL);
     for (guint i = 0; i < delta_names->len; i++)
       {
@@ -4628,27 +5100,79 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
         if (!_ostree_parse_delta_name (delta_names->pdata[i], &from, &to, error))
           return FALSE;
 
-        g_autofree char *superblock = _ostree_get_relative_static_delta_superblock_path ((from && from[0]) ? from : NULL, to);
-        glnx_fd_close int superblock_file_fd = openat (self->repo_dir_fd, superblock, O_RDONLY | O_CLOEXEC);
-        if (superblock_file_fd == -1)
-          return glnx_throw_errno (error);
-
-        g_autoptr(GInputStream) in_stream = g_unix_input_stream_new (superblock_file_fd, FALSE);
-        if (!in_stream)
-          return FALSE;
-
-        g_autofree guchar *csum = NULL;
-        if (!ot_gio_checksum_stream (in_stream,
-                                     &csum,
-                                     cancellable,
-                                     error))
+        g_autoptr(GVariant) csum_v = NULL;
+        gboolean was_cached;
+        if (!get_superblock_checksum (self, delta_names->pdata[i], from, to,
+                                      superblock_csum_cache, new_cache_builder, &csum_v, &was_cached,
+                                      cancellable, error))
           return FALSE;
-
-        g_variant_dict_insert_value (&deltas_builder, delta_names->pdata[i], ot_gvariant_new_bytearray (csum, 32));
+        if (!was_cached)
+          n_checksummed++;
+
+        g_variant_dict_insert_value (&deltas_builder, delta_names->pdata[i], csum_v);
+
+        GPtrArray *deltas_to = g_hash_table_lookup (deltas_by_to, to);
+        if (!deltas_to)
+          {
+            deltas_to = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+            g_hash_table_insert (deltas_by_to, g_strdup (to), deltas_to);
+          }
+        g_ptr_array_add (deltas_to, g_variant_ref_sink (g_variant_new ("{sv}", delta_names->pdata[i], csum_v)));
       }
 
     if (delta_names->len > 0)
       g_variant_dict_insert_value (&additional_metadata_builder, OSTREE_SUMMARY_STATIC_DELTAS, g_variant_dict_end (&deltas_builder));
+
+    /* Rewrite the cache if anything changed; this also drops entries
+     * for deltas which were deleted.
+     */
+    if (self->cache_dir_fd != -1 &&
+        (n_checksummed > 0 || g_hash_table_size (superblock_csum_cache) != delta_names->len))
+      {
+        g_autoptr(GVariant) new_cache = g_variant_ref_sink (g_variant_builder_end (new_cache_builder));
+        g_autoptr(GError) local_error = NULL;
+
+        if (!glnx_file_replace_contents_at (self->cache_dir_fd, _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE,
+                                            g_variant_get_data (new_cache),
+                                            g_variant_get_size (new_cache),
+                                            GLNX_FILE_REPLACE_NODATASYNC,
+                                            cancellable, &local_error))
+          g_debug ("Failed to write %s: %s", _OSTREE_DELTA_SUPERBLOCK_CSUM_CACHE, local_error->message);
+      }
+
+    g_debug ("Found %u static deltas (%u superblocks checksummed) in %.3f seconds",
+             delta_names->len, n_checksummed,
+             (g_get_monotonic_time () - deltas_start_time) / (double) G_USEC_PER_SEC);
+  }
+
+  {
+    g_autoptr(GList) ordered_commits = g_hash_table_get_keys (ref_commits);
+    g_autoptr(GVariantBuilder) packs_builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
+    gboolean have_packs = FALSE;
+
+    ordered_commits = g_list_sort (ordered_commits, (GCompareFunc)strcmp);
+
+    /* Only advertise packs whose index has been written */
+    for (GList *iter = ordered_commits; iter; iter = iter->next)
+      {
+        const char *commit = iter->data;
+        g_autofree char *index_path = _ostree_get_relative_object_pack_path (commit, "index");
+        struct stat stbuf;
+
+        if (fstatat (self->repo_dir_fd, index_path, &stbuf, 0) < 0)
+          {
+            if (errno != ENOENT)
+              return glnx_throw_errno_prefix (error, "fstatat(%s)", index_path);
+            continue;
+          }
+
+        g_variant_builder_add (packs_builder, "s", commit);
+        have_packs = TRUE;
+      }
+
+    if (have_packs)
+      g_variant_dict_insert_value (&additional_metadata_builder, OSTREE_SUMMARY_OBJECT_PACKS,
+                                   g_variant_builder_end (packs_builder));
   }
 
   {
@@ -4682,6 +5206,23 @@ ostree_repo_regenerate_summary (OstreeRepo     *self,
         return glnx_throw_errno_prefix (error, "unlinkat");
     }
 
+  if (self->summary_shards > 0)
+    {
+      g_autoptr(GVariant) metadata = g_variant_get_child_value (summary, 1);
+      if (!write_summary_shards (self, self->summary_shards, refs, ref_entries,
+                                 deltas_by_to, metadata, cancellable, error))
+        return FALSE;
+    }
+  else
+    {
+      /* Make sure clients don't use a stale index */
+      if (unlinkat (self->repo_dir_fd, _OSTREE_SUMMARY_SHARD_INDEX, 0) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "unlinkat(%s)", _OSTREE_SUMMARY_SHARD_INDEX);
+        }
+    }
+
   return TRUE;
 }
 
@@ -4844,32 +5385,3 @@ _ostree_repo_allocate_tmpdir (int tmpdir_dfd,
  out:
   return ret;
 }
-
-/* See ostree-repo-private.h for more information about this */
-void
-_ostree_repo_memory_cache_ref_init (OstreeRepoMemoryCacheRef *state,
-                                    OstreeRepo               *repo)
-{
-  state->repo = g_object_ref (repo);
-  GMutex *lock = &repo->cache_lock;
-  g_mutex_lock (lock);
-  repo->dirmeta_cache_refcount++;
-  if (repo->dirmeta_cache == NULL)
-    repo->dirmeta_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
-  g_mutex_unlock (lock);
-
-}
-
-/* See ostree-repo-private.h for more information about this */
-void
-_ostree_repo_memory_cache_ref_destroy (OstreeRepoMemoryCacheRef *state)
-{
-  OstreeRepo *repo = state->repo;
-  GMutex *lock = &repo->cache_lock;
-  g_mutex_lock (lock);
-  repo->dirmeta_cache_refcount--;
-  if (repo->dirmeta_cache_refcount == 0)
-    g_clear_pointer (&repo->dirmeta_cache, (GDestroyNotify) g_hash_table_unref);
-  g_mutex_unlock (lock);
-  g_object_unref (repo);
-}
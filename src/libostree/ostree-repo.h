@@ -430,6 +430,11 @@ gboolean      ostree_repo_list_refs_ext (OstreeRepo                 *self,
                                          GCancellable               *cancellable,
                                          GError                     **error);
 
+_OSTREE_PUBLIC
+gboolean      ostree_repo_pack_refs (OstreeRepo       *self,
+                                     GCancellable     *cancellable,
+                                     GError          **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_repo_remote_list_refs (OstreeRepo       *self,
                                        const char       *remote_name,
@@ -630,7 +635,8 @@ typedef struct {
   guint autocreate_parents : 1;
   guint use_ostree_convention : 1;
   guint callback_with_entry_pathname : 1;
-  guint reserved : 28;
+  guint parallel : 1;
+  guint reserved : 27;
 
   guint unused_uint[8];
   gpointer unused_ptrs[8];
@@ -658,7 +664,8 @@ typedef struct {
 
   guint64 timestamp_secs;
 
-  guint unused_uint[8];
+  guint n_jobs;
+  guint unused_uint[7];
 
   char *path_prefix;
 
@@ -673,6 +680,14 @@ gboolean ostree_repo_export_tree_to_archive (OstreeRepo                *self,
                                              GCancellable             *cancellable,
                                              GError                  **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_export_tree_to_fd (OstreeRepo                     *self,
+                                        OstreeRepoExportArchiveOptions *opts,
+                                        OstreeRepoFile                 *root,
+                                        int                             fd,
+                                        GCancellable                   *cancellable,
+                                        GError                        **error);
+
 _OSTREE_PUBLIC
 gboolean      ostree_repo_write_mtree (OstreeRepo         *self,
                                        OstreeMutableTree  *mtree,
@@ -818,12 +833,14 @@ gboolean       ostree_repo_read_commit (OstreeRepo    *self,
  * @OSTREE_REPO_LIST_OBJECTS_PACKED: List only packed (compacted into blobs) objects
  * @OSTREE_REPO_LIST_OBJECTS_ALL: List all objects
  * @OSTREE_REPO_LIST_OBJECTS_NO_PARENTS: Only list objects in this repo, not parents
+ * @OSTREE_REPO_LIST_OBJECTS_QUERY_STAT: Fill in the stat fields of #OstreeRepoObjectEntry (Since: 2017.7)
  */
 typedef enum {
   OSTREE_REPO_LIST_OBJECTS_LOOSE = (1 << 0),
   OSTREE_REPO_LIST_OBJECTS_PACKED = (1 << 1),
   OSTREE_REPO_LIST_OBJECTS_ALL = (1 << 2),
   OSTREE_REPO_LIST_OBJECTS_NO_PARENTS = (1 << 3),
+  OSTREE_REPO_LIST_OBJECTS_QUERY_STAT = (1 << 4),
 } OstreeRepoListObjectsFlags;
 
 /**
@@ -841,6 +858,62 @@ gboolean ostree_repo_list_objects (OstreeRepo                  *self,
                                    GCancellable                *cancellable,
                                    GError                     **error);
 
+/**
+ * OstreeRepoObjectEntry:
+ * @repo: Repository holding the object; this is a parent repository for
+ *   objects found there
+ * @checksum: Hex checksum
+ * @csum: Binary checksum, %OSTREE_SHA256_DIGEST_LEN bytes
+ * @objtype: Object type
+ * @is_loose: %TRUE if the object is stored as a plain file
+ * @dfd: For loose objects, file descriptor of the objects/XX directory
+ * @name: For loose objects, file name relative to @dfd
+ * @size: Size on disk, only with %OSTREE_REPO_LIST_OBJECTS_QUERY_STAT
+ * @mode: Full st_mode, only with %OSTREE_REPO_LIST_OBJECTS_QUERY_STAT
+ * @mtime: Modification time in seconds, only with %OSTREE_REPO_LIST_OBJECTS_QUERY_STAT
+ *
+ * An entry passed to an #OstreeRepoForeachObjectFunc.  All members are
+ * owned by the enumeration and are only valid for the duration of the
+ * callback.
+ */
+typedef struct {
+  OstreeRepo *repo;
+  const char *checksum;
+  const guchar *csum;
+  OstreeObjectType objtype;
+  gboolean is_loose;
+  int dfd;
+  const char *name;
+  guint64 size;
+  guint32 mode;
+  gint64 mtime;
+
+  /*< private >*/
+  gpointer padding[8];
+} OstreeRepoObjectEntry;
+
+/**
+ * OstreeRepoForeachObjectFunc:
+ * @repo: Repo
+ * @entry: The current object
+ * @user_data: User data
+ * @error: Error
+ *
+ * Returns: %FALSE (with @error set) to abort the enumeration
+ */
+typedef gboolean (*OstreeRepoForeachObjectFunc) (OstreeRepo                  *repo,
+                                                 const OstreeRepoObjectEntry *entry,
+                                                 gpointer                     user_data,
+                                                 GError                     **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_foreach_object (OstreeRepo                  *self,
+                                     OstreeRepoListObjectsFlags   flags,
+                                     OstreeRepoForeachObjectFunc  func,
+                                     gpointer                     user_data,
+                                     GCancellable                *cancellable,
+                                     GError                     **error);
+
 _OSTREE_PUBLIC
 gboolean ostree_repo_list_commit_objects_starting_with ( OstreeRepo                  *self,
                                                          const char                  *start,
@@ -961,6 +1034,82 @@ void ostree_repo_commit_traverse_iter_cleanup (void *p);
 
 #define ostree_cleanup_repo_commit_traverse_iter __attribute__ ((cleanup(ostree_repo_commit_traverse_iter_cleanup)))
 
+/**
+ * OstreeRepoWalkTreeFlags:
+ * @OSTREE_REPO_WALK_TREE_FLAGS_NONE: Only read dirtree and dirmeta objects
+ * @OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES: Also load the header of each content object, filling in type, mode, ownership, size and symlink target for files
+ * @OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS: Fill in extended attributes; for files this implies %OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES
+ */
+typedef enum {
+  OSTREE_REPO_WALK_TREE_FLAGS_NONE = 0,
+  OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES = (1 << 0),
+  OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS = (1 << 1),
+} OstreeRepoWalkTreeFlags;
+
+/**
+ * OstreeRepoWalkTreeEntry:
+ * @path: Path relative to the root of the walk; the root itself is "/"
+ * @name: Last component of @path
+ * @type: %G_FILE_TYPE_DIRECTORY for directories; for files this is
+ *   %G_FILE_TYPE_UNKNOWN unless %OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES is given
+ * @checksum: Dirtree checksum for directories, content checksum for files
+ * @meta_checksum: Dirmeta checksum for directories, %NULL for files
+ * @uid: Owner
+ * @gid: Group
+ * @mode: Full st_mode, including the file type bits
+ * @size: Size of regular files, 0 otherwise
+ * @symlink_target: Target of symbolic links, %NULL otherwise
+ * @xattrs: Extended attributes of type a(ayay), only with %OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS
+ * @depth: Number of directories between the root and this entry; 0 for the root
+ *
+ * An entry passed to an #OstreeRepoWalkTreeFunc.  All members are
+ * owned by the walker and are only valid for the duration of the
+ * callback.  For files, @uid, @gid and @mode are only filled in if
+ * the content object was queried.
+ */
+typedef struct {
+  const char *path;
+  const char *name;
+  GFileType type;
+  const char *checksum;
+  const char *meta_checksum;
+  guint32 uid;
+  guint32 gid;
+  guint32 mode;
+  guint64 size;
+  const char *symlink_target;
+  GVariant *xattrs;
+  guint depth;
+
+  /*< private >*/
+  gpointer padding[8];
+} OstreeRepoWalkTreeEntry;
+
+/**
+ * OstreeRepoWalkTreeFunc:
+ * @repo: Repo
+ * @entry: The current entry
+ * @user_data: User data
+ * @error: Error
+ *
+ * Returns: %FALSE (with @error set) to abort the walk
+ */
+typedef gboolean (*OstreeRepoWalkTreeFunc) (OstreeRepo                    *repo,
+                                            const OstreeRepoWalkTreeEntry *entry,
+                                            gpointer                       user_data,
+                                            GError                       **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_walk_tree (OstreeRepo               *self,
+                                const char               *contents_checksum,
+                                const char               *meta_checksum,
+                                int                       maxdepth,
+                                OstreeRepoWalkTreeFlags   flags,
+                                OstreeRepoWalkTreeFunc    func,
+                                gpointer                  user_data,
+                                GCancellable             *cancellable,
+                                GError                  **error);
+
 /**
  * OstreeRepoPruneFlags:
  * @OSTREE_REPO_PRUNE_FLAGS_NONE: No special options for pruning
@@ -996,7 +1145,8 @@ struct _OstreeRepoPruneOptions {
 
   gboolean unused_bools[6];
   int unused_ints[6];
-  gpointer unused_ptrs[7];
+  OstreeAsyncProgress *progress; /* Since: 2017.7 */
+  gpointer unused_ptrs[6];
 };
 
 typedef struct _OstreeRepoPruneOptions OstreeRepoPruneOptions;
@@ -1138,6 +1288,12 @@ gboolean ostree_repo_regenerate_summary (OstreeRepo     *self,
                                          GCancellable   *cancellable,
                                          GError        **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_generate_object_pack (OstreeRepo     *self,
+                                           const char     *commit,
+                                           GCancellable   *cancellable,
+                                           GError        **error);
+
 
 G_END_DECLS
 
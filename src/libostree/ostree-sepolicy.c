@@ -50,6 +50,7 @@ struct OstreeSePolicy {
 #ifdef HAVE_SELINUX
   GFile *selinux_policy_root;
   struct selabel_handle *selinux_hnd;
+  GMutex selinux_hnd_lock;
   char *selinux_policy_name;
   char *selinux_policy_csum;
 #endif
@@ -88,6 +89,7 @@ ostree_sepolicy_finalize (GObject *object)
       selabel_close (self->selinux_hnd);
       self->selinux_hnd = NULL;
     }
+  g_mutex_clear (&self->selinux_hnd_lock);
 #endif
 
   G_OBJECT_CLASS (ostree_sepolicy_parent_class)->finalize (object);
@@ -398,6 +400,9 @@ ostree_sepolicy_init (OstreeSePolicy *self)
 {
   self->rootfs_dfd = -1;
   self->rootfs_dfd_owned = -1;
+#ifdef HAVE_SELINUX
+  g_mutex_init (&self->selinux_hnd_lock);
+#endif
 }
 
 static void
@@ -514,14 +519,23 @@ ostree_sepolicy_get_label (OstreeSePolicy    *self,
   if (strcmp (relpath, "/proc") == 0)
     relpath = "/mnt";
 
+  /* The handle is not safe to share between threads in all libselinux
+   * versions.
+   */
   char *con = NULL;
+  g_mutex_lock (&self->selinux_hnd_lock);
   int res = selabel_lookup_raw (self->selinux_hnd, &con, relpath, unix_mode);
+  int errsv = errno;
+  g_mutex_unlock (&self->selinux_hnd_lock);
   if (res != 0)
     {
-      if (errno == ENOENT)
+      if (errsv == ENOENT)
         *out_label = NULL;
       else
-        return glnx_throw_errno (error);
+        {
+          errno = errsv;
+          return glnx_throw_errno (error);
+        }
     }
   else
     {
@@ -20,11 +20,33 @@
 
 #include "config.h"
 
+#include <sys/syscall.h>
+
 #include "otutil.h"
 #include "ostree-linuxfsutil.h"
 
 #include "ostree-sysroot-private.h"
 
+/* Stale deployments are renamed into this directory, which is on the
+ * same filesystem, and deleted later by ostree_sysroot_cleanup_trash().
+ */
+#define _OSTREE_SYSROOT_TRASH_DIR "ostree/trash"
+
+/* Keep at most this many deployments in the trash, e.g. across several
+ * upgrades without a reboot; see trim_trash().
+ */
+#define _OSTREE_SYSROOT_TRASH_MAX_ENTRIES 3
+
+/* Exists while the repo has unpruned objects left by a deployment;
+ * the next full cleanup prunes them, see ostree-cleanup-trash.service.
+ */
+#define _OSTREE_SYSROOT_PRUNE_PENDING "ostree/prune-pending"
+
+/* See ioprio_set(2); there's no glibc wrapper or exported header */
+#define _OSTREE_IOPRIO_WHO_PROCESS 1
+#define _OSTREE_IOPRIO_CLASS_IDLE 3
+#define _OSTREE_IOPRIO_CLASS_SHIFT 13
+
 /* @deploydir_dfd: Directory FD for ostree/deploy
  * @osname: Target osname
  * @inout_deployments: All deployments in this subdir will be appended to this array
@@ -245,6 +267,49 @@ cleanup_other_bootversions (OstreeSysroot       *self,
   return ret;
 }
 
+/* Rename @deployment_path out of the way, so it's no longer seen as a
+ * deployment; this is much faster than deleting it.
+ */
+static gboolean
+move_deployment_to_trash (OstreeSysroot       *self,
+                          OstreeDeployment    *deployment,
+                          const char          *deployment_path,
+                          GCancellable        *cancellable,
+                          GError             **error)
+{
+  if (!glnx_shutil_mkdir_p_at (self->sysroot_fd, _OSTREE_SYSROOT_TRASH_DIR, 0700,
+                               cancellable, error))
+    return FALSE;
+
+  for (guint i = 0; i < 100; i++)
+    {
+      g_autofree char *trash_path =
+        g_strdup_printf (_OSTREE_SYSROOT_TRASH_DIR "/%s-%s-XXXXXX",
+                         ostree_deployment_get_osname (deployment),
+                         glnx_basename (deployment_path));
+
+      glnx_gen_temp_name (trash_path);
+      if (renameat (self->sysroot_fd, deployment_path,
+                    self->sysroot_fd, trash_path) == 0)
+        {
+          /* Record when it was moved, for trim_trash() */
+          (void) utimensat (self->sysroot_fd, trash_path, NULL, 0);
+          return TRUE;
+        }
+
+      if (errno == EXDEV)
+        {
+          /* Someone mounted it separately; fall back to deleting it now */
+          return glnx_shutil_rm_rf_at (self->sysroot_fd, deployment_path,
+                                       cancellable, error);
+        }
+      else if (errno != EEXIST && errno != ENOTEMPTY)
+        return glnx_throw_errno_prefix (error, "Moving %s to trash", deployment_path);
+    }
+
+  return glnx_throw (error, "Exhausted attempts to move %s to trash", deployment_path);
+}
+
 static gboolean
 cleanup_old_deployments (OstreeSysroot       *self,
                          GCancellable        *cancellable,
@@ -313,7 +378,8 @@ cleanup_old_deployments (OstreeSysroot       *self,
                                                         cancellable, error))
             goto out;
           
-          if (!glnx_shutil_rm_rf_at (self->sysroot_fd, deployment_path, cancellable, error))
+          if (!move_deployment_to_trash (self, deployment, deployment_path,
+                                         cancellable, error))
             goto out;
           if (!glnx_shutil_rm_rf_at (self->sysroot_fd, origin_relpath, cancellable, error))
             goto out;
@@ -461,6 +527,342 @@ out:
   return ret;
 }
 
+/* Like glnx_dirfd_iterator_next_dent_ensure_dtype(), but skips entries
+ * that a concurrent ostree_sysroot_cleanup_trash() deletes under us.
+ */
+static gboolean
+trash_iterator_next_dent (GLnxDirFdIterator  *dfd_iter,
+                          struct dirent     **out_dent,
+                          GCancellable       *cancellable,
+                          GError            **error)
+{
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat stbuf;
+
+      if (!glnx_dirfd_iterator_next_dent (dfd_iter, &dent, cancellable, error))
+        return FALSE;
+
+      if (dent != NULL && dent->d_type == DT_UNKNOWN)
+        {
+          if (fstatat (dfd_iter->fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+              if (errno == ENOENT)
+                continue;
+              return glnx_throw_errno_prefix (error, "fstatat(%s)", dent->d_name);
+            }
+          dent->d_type = IFTODT (stbuf.st_mode);
+        }
+
+      *out_dent = dent;
+      return TRUE;
+    }
+}
+
+/* A concurrent ostree_sysroot_cleanup_trash() may be deleting the same
+ * tree; whatever either of us misses is picked up by the next call.
+ */
+static gboolean
+trash_rm_rf_at (int            dfd,
+                const char    *path,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  if (!glnx_shutil_rm_rf_at (dfd, path, cancellable, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+typedef struct {
+  int trash_dfd;
+  GCancellable *cancellable;
+  GMutex lock;
+  GError *async_error; /* Protected by lock */
+} TrashData;
+
+static void
+delete_trash_dir_in_thread (gpointer data,
+                            gpointer user_data)
+{
+  g_autofree char *path = data;
+  TrashData *trash = user_data;
+  g_autoptr(GError) local_error = NULL;
+  gboolean aborted;
+  long old_ioprio;
+
+  g_mutex_lock (&trash->lock);
+  aborted = trash->async_error != NULL;
+  g_mutex_unlock (&trash->lock);
+  if (aborted)
+    return;
+
+  /* Stay out of the way of everything else.  Pool threads are shared,
+   * so this only lasts for the one directory.
+   */
+  old_ioprio = syscall (SYS_ioprio_get, _OSTREE_IOPRIO_WHO_PROCESS, 0);
+  (void) syscall (SYS_ioprio_set, _OSTREE_IOPRIO_WHO_PROCESS, 0,
+                  _OSTREE_IOPRIO_CLASS_IDLE << _OSTREE_IOPRIO_CLASS_SHIFT);
+
+  (void) trash_rm_rf_at (trash->trash_dfd, path, trash->cancellable, &local_error);
+
+  if (old_ioprio >= 0)
+    (void) syscall (SYS_ioprio_set, _OSTREE_IOPRIO_WHO_PROCESS, 0, old_ioprio);
+
+  g_mutex_lock (&trash->lock);
+  if (local_error && !trash->async_error)
+    trash->async_error = g_steal_pointer (&local_error);
+  g_mutex_unlock (&trash->lock);
+}
+
+/* Queue the directories @depth levels below @path for deletion, so a
+ * single deployment is spread across the pool.
+ */
+static gboolean
+queue_trash_dirs (GThreadPool   *pool,
+                  int            trash_dfd,
+                  const char    *path,
+                  guint          depth,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  gboolean exists;
+
+  if (!ot_dfd_iter_init_allow_noent (trash_dfd, path, &dfd_iter, &exists, error))
+    return FALSE;
+  /* Note early return; already deleted by a concurrent cleanup */
+  if (!exists)
+    return TRUE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!trash_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (dent->d_type != DT_DIR)
+        continue;
+
+      g_autofree char *child = g_strconcat (path, "/", dent->d_name, NULL);
+      if (depth > 1)
+        {
+          if (!queue_trash_dirs (pool, trash_dfd, child, depth - 1, cancellable, error))
+            return FALSE;
+        }
+      else
+        {
+          /* Can't fail for a pool with non-exclusive threads */
+          (void) g_thread_pool_push (pool, g_steal_pointer (&child), NULL);
+        }
+    }
+
+  return TRUE;
+}
+
+typedef struct {
+  char   *name;
+  time_t  mtime;
+} TrashEntry;
+
+static void
+trash_entry_free (TrashEntry *entry)
+{
+  g_free (entry->name);
+  g_free (entry);
+}
+
+static int
+compare_trash_entries (gconstpointer a,
+                       gconstpointer b)
+{
+  const TrashEntry *entry_a = *(TrashEntry**)a;
+  const TrashEntry *entry_b = *(TrashEntry**)b;
+
+  if (entry_a->mtime < entry_b->mtime)
+    return -1;
+  else if (entry_a->mtime > entry_b->mtime)
+    return 1;
+  return strcmp (entry_a->name, entry_b->name);
+}
+
+/* Delete the deployments moved into the trash longest ago, so that at
+ * most _OSTREE_SYSROOT_TRASH_MAX_ENTRIES are left.  Usually there's
+ * nothing to do; when there is, the caller is waiting, so this is done
+ * directly rather than at idle priority.
+ */
+static gboolean
+trim_trash (OstreeSysroot  *self,
+            GCancellable   *cancellable,
+            GError        **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GPtrArray) entries =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) trash_entry_free);
+  gboolean exists;
+
+  if (!ot_dfd_iter_init_allow_noent (self->sysroot_fd, _OSTREE_SYSROOT_TRASH_DIR,
+                                     &dfd_iter, &exists, error))
+    return FALSE;
+  /* Note early return */
+  if (!exists)
+    return TRUE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat stbuf;
+
+      if (!trash_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+          if (errno == ENOENT)
+            continue;
+          return glnx_throw_errno_prefix (error, "fstatat(%s)", dent->d_name);
+        }
+
+      TrashEntry *entry = g_new0 (TrashEntry, 1);
+      entry->name = g_strdup (dent->d_name);
+      entry->mtime = stbuf.st_mtime;
+      g_ptr_array_add (entries, entry);
+    }
+
+  if (entries->len <= _OSTREE_SYSROOT_TRASH_MAX_ENTRIES)
+    return TRUE;
+
+  g_ptr_array_sort (entries, compare_trash_entries);
+  for (guint i = 0; i < entries->len - _OSTREE_SYSROOT_TRASH_MAX_ENTRIES; i++)
+    {
+      TrashEntry *entry = entries->pdata[i];
+
+      if (!trash_rm_rf_at (dfd_iter.fd, entry->name, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_sysroot_cleanup_trash:
+ * @self: Sysroot
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Delete the deployments that earlier cleanups moved out of the way.
+ * This is done by several threads at idle I/O priority, and may be
+ * interrupted; anything left is deleted by the next call.  Unlike
+ * ostree_sysroot_cleanup(), this does not change any other state.
+ * Concurrent calls, e.g. from another process, are tolerated: entries
+ * that one of them deletes are skipped by the others.
+ *
+ * Since: 2017.7
+ */
+gboolean
+ostree_sysroot_cleanup_trash (OstreeSysroot  *self,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  gboolean ret = FALSE;
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) entry_dirs = g_ptr_array_new (); /* Owned by entries */
+  GThreadPool *pool = NULL;
+  TrashData data = { -1, };
+  gboolean exists;
+
+  g_return_val_if_fail (OSTREE_IS_SYSROOT (self), FALSE);
+  g_return_val_if_fail (self->loaded, FALSE);
+
+  if (!ot_dfd_iter_init_allow_noent (self->sysroot_fd, _OSTREE_SYSROOT_TRASH_DIR,
+                                     &dfd_iter, &exists, error))
+    return FALSE;
+  /* Note early return */
+  if (!exists)
+    return TRUE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!trash_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      char *name = g_strdup (dent->d_name);
+      g_ptr_array_add (entries, name);
+      if (dent->d_type == DT_DIR)
+        g_ptr_array_add (entry_dirs, name);
+    }
+
+  if (entries->len == 0)
+    return TRUE;
+
+  data.trash_dfd = dfd_iter.fd;
+  data.cancellable = cancellable;
+  g_mutex_init (&data.lock);
+
+  /* Deleting is mostly waiting on the disk, so use a few more threads
+   * than CPUs.
+   */
+  pool = g_thread_pool_new (delete_trash_dir_in_thread, &data,
+                            MAX (g_get_num_processors (), 4), FALSE, error);
+  if (!pool)
+    goto out;
+
+  for (guint i = 0; i < entry_dirs->len; i++)
+    {
+      /* e.g. usr/lib, usr/share */
+      if (!queue_trash_dirs (pool, dfd_iter.fd, entry_dirs->pdata[i], 2,
+                             cancellable, error))
+        goto out;
+    }
+
+  /* Wait for all of them */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  pool = NULL;
+
+  if (data.async_error)
+    {
+      g_propagate_error (error, g_steal_pointer (&data.async_error));
+      goto out;
+    }
+
+  /* And whatever is left of each */
+  for (guint i = 0; i < entries->len; i++)
+    {
+      if (!trash_rm_rf_at (dfd_iter.fd, entries->pdata[i], cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  if (data.trash_dfd != -1)
+    {
+      g_clear_error (&data.async_error);
+      g_mutex_clear (&data.lock);
+    }
+  return ret;
+}
+
 /**
  * ostree_sysroot_cleanup:
  * @self: Sysroot
@@ -468,14 +870,17 @@ out:
  * @error: Error
  *
  * Delete any state that resulted from a partially completed
- * transaction, such as incomplete deployments.
+ * transaction, such as incomplete deployments.  This includes
+ * deleting the deployments moved aside by earlier cleanups; see
+ * ostree_sysroot_cleanup_trash().
  */
 gboolean
 ostree_sysroot_cleanup (OstreeSysroot       *self,
                         GCancellable        *cancellable,
                         GError             **error)
 {
-  return _ostree_sysroot_cleanup_internal (self, TRUE, cancellable, error);
+  return _ostree_sysroot_cleanup_internal (self, OSTREE_SYSROOT_CLEANUP_ALL,
+                                           cancellable, error);
 }
 
 /**
@@ -485,19 +890,20 @@ ostree_sysroot_cleanup (OstreeSysroot       *self,
  * @error: Error
  *
  * Like ostree_sysroot_cleanup() in that it cleans up incomplete deployments
- * and old boot versions, but does NOT prune the repository.
+ * and old boot versions, but does NOT prune the repository.  Old
+ * deployments are only moved aside; see ostree_sysroot_cleanup_trash().
  */
 gboolean
 ostree_sysroot_prepare_cleanup (OstreeSysroot  *self,
                                 GCancellable   *cancellable,
                                 GError        **error)
 {
-  return _ostree_sysroot_cleanup_internal (self, FALSE, cancellable, error);
+  return _ostree_sysroot_cleanup_internal (self, 0, cancellable, error);
 }
 
 gboolean
 _ostree_sysroot_cleanup_internal (OstreeSysroot              *self,
-                                  gboolean                    do_prune_repo,
+                                  OstreeSysrootCleanupFlags   flags,
                                   GCancellable               *cancellable,
                                   GError                    **error)
 {
@@ -518,10 +924,31 @@ _ostree_sysroot_cleanup_internal (OstreeSysroot              *self,
                                  cancellable, error))
     return glnx_prefix_error (error, "Generating deployment refs");
 
-  if (do_prune_repo)
+  if (flags & OSTREE_SYSROOT_CLEANUP_PRUNE_REPO)
     {
       if (!prune_repo (repo, cancellable, error))
         return glnx_prefix_error (error, "Pruning repo");
+
+      if (unlinkat (self->sysroot_fd, _OSTREE_SYSROOT_PRUNE_PENDING, 0) < 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat(%s)", _OSTREE_SYSROOT_PRUNE_PENDING);
+    }
+  else if (flags & OSTREE_SYSROOT_CLEANUP_DEFER_PRUNE)
+    {
+      if (!glnx_file_replace_contents_at (self->sysroot_fd, _OSTREE_SYSROOT_PRUNE_PENDING,
+                                          (guint8*)"", 0, GLNX_FILE_REPLACE_NODATASYNC,
+                                          cancellable, error))
+        return FALSE;
+    }
+
+  if (flags & OSTREE_SYSROOT_CLEANUP_TRASH)
+    {
+      if (!ostree_sysroot_cleanup_trash (self, cancellable, error))
+        return glnx_prefix_error (error, "Deleting old deployments");
+    }
+  else
+    {
+      if (!trim_trash (self, cancellable, error))
+        return glnx_prefix_error (error, "Deleting old deployments");
     }
 
   return TRUE;
@@ -33,6 +33,7 @@
 #include "ostree-sepolicy-private.h"
 #include "ostree-deployment-private.h"
 #include "ostree-core-private.h"
+#include "ostree-repo-private.h"
 #include "ostree-linuxfsutil.h"
 #include "otutil.h"
 #include "libglnx.h"
@@ -41,6 +42,20 @@
 #define OSTREE_CONFIGMERGE_ID         "d3863baec13e4449ab0384684a8af3a7"
 #define OSTREE_DEPLOYMENT_COMPLETE_ID "dd440e3e549083b63d0efc7dc15255f1"
 
+/* Indexed by OstreeDeployPhase */
+static const char *const deploy_phase_names[] = {
+  "checkout", "etc-merge", "selinux-relabel", "kernel-install", "bootloader", "sync"
+};
+G_STATIC_ASSERT (G_N_ELEMENTS (deploy_phase_names) == OSTREE_DEPLOY_N_PHASES);
+
+static void
+deploy_phase_add_time (OstreeSysroot     *self,
+                       OstreeDeployPhase  phase,
+                       gint64             start_usec)
+{
+  self->deploy_stats[phase].usec += g_get_monotonic_time () - start_usec;
+}
+
 /*
  * Like symlinkat() but overwrites (atomically) an existing
  * symlink.
@@ -107,6 +122,7 @@ hardlink_or_copy_at (int         src_dfd,
                      int         dest_dfd,
                      const char *dest_subpath,
                      OstreeSysrootDebugFlags flags,
+                     guint64    *out_bytes_copied,
                      GCancellable  *cancellable,
                      GError       **error)
 {
@@ -116,9 +132,15 @@ hardlink_or_copy_at (int         src_dfd,
     {
       if (errno == EMLINK || errno == EXDEV)
         {
-          return glnx_file_copy_at (src_dfd, src_subpath, NULL, dest_dfd, dest_subpath,
-                                    sysroot_flags_to_copy_flags (0, flags),
-                                    cancellable, error);
+          struct stat stbuf;
+          if (fstatat (src_dfd, src_subpath, &stbuf, AT_SYMLINK_NOFOLLOW) != 0)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", src_subpath);
+          if (!glnx_file_copy_at (src_dfd, src_subpath, &stbuf, dest_dfd, dest_subpath,
+                                  sysroot_flags_to_copy_flags (0, flags),
+                                  cancellable, error))
+            return FALSE;
+          *out_bytes_copied += stbuf.st_size;
+          return TRUE;
         }
       else
         {
@@ -491,6 +513,8 @@ merge_configuration_from (OstreeSysroot    *sysroot,
                                 modified->len,
                                 removed->len,
                                 added->len);
+  sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_ETC_MERGE].n_files +=
+    modified->len + removed->len + added->len;
 
   glnx_fd_close int orig_etc_fd = -1;
   if (!glnx_opendirat (merge_deployment_dfd, "usr/etc", TRUE, &orig_etc_fd, error))
@@ -545,11 +569,16 @@ merge_configuration_from (OstreeSysroot    *sysroot,
  *
  * Look up @revision in the repository, and check it out in
  * /ostree/deploy/OS/deploy/${treecsum}.${deployserial}.
+ *
+ * If @reference_deployment is given, files in /usr which are unchanged
+ * from it are hardlinked from its tree, so an upgrade only does work
+ * for the files which changed.
  */
 static gboolean
 checkout_deployment_tree (OstreeSysroot     *sysroot,
                           OstreeRepo        *repo,
                           OstreeDeployment  *deployment,
+                          OstreeDeployment  *reference_deployment,
                           int               *out_deployment_dfd,
                           GCancellable      *cancellable,
                           GError           **error)
@@ -560,6 +589,7 @@ checkout_deployment_tree (OstreeSysroot     *sysroot,
   g_autofree char *checkout_target_name = NULL;
   g_autofree char *osdeploy_path = NULL;
   glnx_fd_close int osdeploy_dfd = -1;
+  glnx_fd_close int reference_dfd = -1;
   int ret_fd;
 
   osdeploy_path = g_strconcat ("ostree/deploy/", ostree_deployment_get_osname (deployment), "/deploy", NULL);
@@ -574,9 +604,38 @@ checkout_deployment_tree (OstreeSysroot     *sysroot,
   if (!glnx_shutil_rm_rf_at (osdeploy_dfd, checkout_target_name, cancellable, error))
     goto out;
 
-  if (!ostree_repo_checkout_at (repo, &checkout_opts, osdeploy_dfd,
-                                checkout_target_name, csum,
-                                cancellable, error))
+  /* Only /usr of a deployment is guaranteed to match its commit; and an
+   * unlocked or mutable deployment may have been modified in place.
+   */
+  if (reference_deployment != NULL &&
+      ostree_deployment_get_unlocked (reference_deployment) == OSTREE_DEPLOYMENT_UNLOCKED_NONE &&
+      !(sysroot->debug_flags & OSTREE_SYSROOT_DEBUG_MUTABLE_DEPLOYMENTS))
+    {
+      g_autofree char *reference_path =
+        ostree_sysroot_get_deployment_dirpath (sysroot, reference_deployment);
+      reference_dfd = openat (sysroot->sysroot_fd, reference_path,
+                              O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC);
+      if (reference_dfd < 0 && errno != ENOENT)
+        {
+          glnx_set_prefix_error_from_errno (error, "openat(%s)", reference_path);
+          goto out;
+        }
+    }
+
+  if (reference_dfd != -1)
+    {
+      static const char *const reference_dirs[] = { "usr", NULL };
+      if (!_ostree_repo_checkout_at_with_reference (repo, &checkout_opts,
+                                                    reference_dfd,
+                                                    ostree_deployment_get_csum (reference_deployment),
+                                                    reference_dirs,
+                                                    osdeploy_dfd, checkout_target_name, csum,
+                                                    cancellable, error))
+        goto out;
+    }
+  else if (!ostree_repo_checkout_at (repo, &checkout_opts, osdeploy_dfd,
+                                     checkout_target_name, csum,
+                                     cancellable, error))
     goto out;
 
   if (!glnx_opendirat (osdeploy_dfd, checkout_target_name, TRUE, &ret_fd, error))
@@ -631,6 +690,7 @@ relabel_one_path (OstreeSysroot  *sysroot,
                                    NULL,
                                    cancellable, error))
     goto out;
+  sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_SELINUX_RELABEL].n_files++;
 
   ret = TRUE;
  out:
@@ -1060,6 +1120,8 @@ full_system_sync (OstreeSysroot     *self,
                   GCancellable      *cancellable,
                   GError           **error)
 {
+  const gint64 start = g_get_monotonic_time ();
+
   if (syncfs (self->sysroot_fd) != 0)
     return glnx_throw_errno (error);
 
@@ -1074,6 +1136,7 @@ full_system_sync (OstreeSysroot     *self,
    */
   sync ();
 
+  deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_SYNC, start);
   return TRUE;
 }
 
@@ -1267,8 +1330,10 @@ install_deployment_kernel (OstreeSysroot   *sysroot,
       if (!hardlink_or_copy_at (tree_boot_dfd, tree_kernel_name,
                                 bootcsum_dfd, dest_kernel_name,
                                 sysroot->debug_flags,
+                                &sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_KERNEL_INSTALL].bytes_copied,
                                 cancellable, error))
         return FALSE;
+      sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_KERNEL_INSTALL].n_files++;
     }
 
   g_autofree char *dest_initramfs_name = NULL;
@@ -1283,8 +1348,10 @@ install_deployment_kernel (OstreeSysroot   *sysroot,
           if (!hardlink_or_copy_at (tree_boot_dfd, tree_initramfs_name,
                                     bootcsum_dfd, dest_initramfs_name,
                                     sysroot->debug_flags,
+                                    &sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_KERNEL_INSTALL].bytes_copied,
                                     cancellable, error))
             return FALSE;
+          sysroot->deploy_stats[OSTREE_DEPLOY_PHASE_KERNEL_INSTALL].n_files++;
         }
     }
 
@@ -1627,6 +1694,11 @@ ostree_sysroot_write_deployments (OstreeSysroot     *self,
  * ostree_sysroot_cleanup() at some point after the transaction, or specify
  * `do_postclean` in @opts.  Skipping the post-transaction cleanup is useful
  * if for example you want to control pruning of the repository.
+ *
+ * The post-transaction cleanup only moves old deployments aside rather
+ * than deleting them, and does not prune the repository, since both can
+ * take a long time.  They are done by the next ostree_sysroot_cleanup(),
+ * which `ostree-cleanup-trash.service` runs in the background at boot.
  */
 gboolean
 ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
@@ -1641,6 +1713,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
   gboolean found_booted_deployment = FALSE;
   gboolean bootloader_is_atomic = FALSE;
   gboolean boot_was_ro_mount = FALSE;
+  gint64 phase_start;
 
   g_assert (self->loaded);
 
@@ -1696,6 +1769,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
 
   if (!requires_new_bootversion)
     {
+      phase_start = g_get_monotonic_time ();
       if (!create_new_bootlinks (self, self->bootversion,
                                  new_deployments,
                                  cancellable, error))
@@ -1703,6 +1777,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
           g_prefix_error (error, "Creating new current bootlinks: ");
           goto out;
         }
+      deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_BOOTLOADER, phase_start);
       
       if (!full_system_sync (self, cancellable, error))
         {
@@ -1710,6 +1785,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
           goto out;
         }
 
+      phase_start = g_get_monotonic_time ();
       if (!swap_bootlinks (self, self->bootversion,
                            new_deployments,
                            cancellable, error))
@@ -1717,6 +1793,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
           g_prefix_error (error, "Swapping current bootlinks: ");
           goto out;
         }
+      deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_BOOTLOADER, phase_start);
       
       bootloader_is_atomic = TRUE;
     }
@@ -1774,6 +1851,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
             }
         }
 
+      phase_start = g_get_monotonic_time ();
       for (i = 0; i < new_deployments->len; i++)
         {
           OstreeDeployment *deployment = new_deployments->pdata[i];
@@ -1785,8 +1863,10 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
               goto out;
             }
         }
+      deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_KERNEL_INSTALL, phase_start);
 
       /* Create and swap bootlinks for *new* version */
+      phase_start = g_get_monotonic_time ();
       if (!create_new_bootlinks (self, new_bootversion,
                                  new_deployments,
                                  cancellable, error))
@@ -1823,6 +1903,7 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
           g_prefix_error (error, "Preparing final bootloader swap: ");
           goto out;
         }
+      deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_BOOTLOADER, phase_start);
 
       if (!full_system_sync (self, cancellable, error))
         {
@@ -1830,19 +1911,48 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
           goto out;
         }
       
+      phase_start = g_get_monotonic_time ();
       if (!swap_bootloader (self, self->bootversion, new_bootversion,
                             cancellable, error))
         {
           g_prefix_error (error, "Final bootloader swap: ");
           goto out;
         }
+      deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_BOOTLOADER, phase_start);
     }
 
-  ot_log_structured_print_id_v (OSTREE_DEPLOYMENT_COMPLETE_ID,
-                                "%s; bootconfig swap: %s deployment count change: %i",
-                                (bootloader_is_atomic ? "Transaction complete" : "Bootloader updated"),
-                                requires_new_bootversion ? "yes" : "no",
-                                new_deployments->len - self->deployments->len);
+  /* This transaction's phase statistics (including any deployments
+   * created since the last one) go into the journal as
+   * OSTREE_<PHASE>_{MSEC,FILES,BYTES} fields.
+   */
+  memcpy (self->last_deploy_stats, self->deploy_stats, sizeof (self->deploy_stats));
+  memset (self->deploy_stats, 0, sizeof (self->deploy_stats));
+  { g_autoptr(GPtrArray) stats_keys = g_ptr_array_new_with_free_func (g_free);
+
+    for (guint phase = 0; phase < OSTREE_DEPLOY_N_PHASES; phase++)
+      {
+        const OstreeDeployPhaseStats *stats = &self->last_deploy_stats[phase];
+        g_autofree char *name = g_ascii_strup (deploy_phase_names[phase], -1);
+        g_strdelimit (name, "-", '_');
+
+        g_ptr_array_add (stats_keys, g_strdup_printf ("OSTREE_%s_MSEC=%" G_GUINT64_FORMAT,
+                                                      name, stats->usec / 1000));
+        if (stats->n_files > 0)
+          g_ptr_array_add (stats_keys, g_strdup_printf ("OSTREE_%s_FILES=%" G_GUINT64_FORMAT,
+                                                        name, stats->n_files));
+        if (stats->bytes_copied > 0)
+          g_ptr_array_add (stats_keys, g_strdup_printf ("OSTREE_%s_BYTES=%" G_GUINT64_FORMAT,
+                                                        name, stats->bytes_copied));
+      }
+    g_ptr_array_add (stats_keys, NULL);
+
+    ot_log_structured_print_id_with_keys (OSTREE_DEPLOYMENT_COMPLETE_ID,
+                                          (const char *const *)stats_keys->pdata,
+                                          "%s; bootconfig swap: %s deployment count change: %i",
+                                          (bootloader_is_atomic ? "Transaction complete" : "Bootloader updated"),
+                                          requires_new_bootversion ? "yes" : "no",
+                                          new_deployments->len - self->deployments->len);
+  }
 
   if (!_ostree_sysroot_bump_mtime (self, error))
     goto out;
@@ -1857,11 +1967,14 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
   if (!cleanup_legacy_current_symlinks (self, cancellable, error))
     goto out;
 
-  /* And finally, cleanup of any leftover data.
+  /* And finally, cleanup of any leftover data.  Deleting the
+   * deployments that this transaction made stale and pruning the repo
+   * are left for later.
    */
   if (opts->do_postclean)
     {
-      if (!ostree_sysroot_cleanup (self, cancellable, error))
+      if (!_ostree_sysroot_cleanup_internal (self, OSTREE_SYSROOT_CLEANUP_DEFER_PRUNE,
+                                             cancellable, error))
         {
           g_prefix_error (error, "Performing final cleanup: ");
           goto out;
@@ -1885,6 +1998,46 @@ ostree_sysroot_write_deployments_with_options (OstreeSysroot     *self,
   return ret;
 }
 
+/**
+ * ostree_sysroot_get_deploy_stats:
+ * @self: Sysroot
+ *
+ * Get timing and I/O statistics for the most recent
+ * ostree_sysroot_write_deployments() transaction, including any
+ * ostree_sysroot_deploy_tree() calls since the one before it.  The
+ * result maps each phase name (`checkout`, `etc-merge`,
+ * `selinux-relabel`, `kernel-install`, `bootloader` and `sync`) to an
+ * `a{st}` dictionary with the keys `usec` (wall-clock time spent),
+ * `files` (files processed, where counted) and `bytes-copied`.
+ *
+ * The same data is attached to the deployment completion message in
+ * the systemd journal.
+ *
+ * Returns: (transfer full): An `a{sv}` dictionary
+ * Since: 2017.7
+ */
+GVariant *
+ostree_sysroot_get_deploy_stats (OstreeSysroot *self)
+{
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  for (guint phase = 0; phase < OSTREE_DEPLOY_N_PHASES; phase++)
+    {
+      const OstreeDeployPhaseStats *stats = &self->last_deploy_stats[phase];
+      g_auto(GVariantBuilder) phase_builder = OT_VARIANT_BUILDER_INITIALIZER;
+
+      g_variant_builder_init (&phase_builder, G_VARIANT_TYPE ("a{st}"));
+      g_variant_builder_add (&phase_builder, "{st}", "usec", stats->usec);
+      g_variant_builder_add (&phase_builder, "{st}", "files", stats->n_files);
+      g_variant_builder_add (&phase_builder, "{st}", "bytes-copied", stats->bytes_copied);
+      g_variant_builder_add (&builder, "{sv}", deploy_phase_names[phase],
+                             g_variant_builder_end (&phase_builder));
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 static gboolean
 allocate_deployserial (OstreeSysroot           *self,
                        const char              *osname,
@@ -1973,13 +2126,15 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
   ostree_deployment_set_origin (new_deployment, origin);
 
   /* Check out the userspace tree onto the filesystem */
+  gint64 phase_start = g_get_monotonic_time ();
   glnx_fd_close int deployment_dfd = -1;
-  if (!checkout_deployment_tree (self, repo, new_deployment, &deployment_dfd,
-                                 cancellable, error))
+  if (!checkout_deployment_tree (self, repo, new_deployment, merge_deployment,
+                                 &deployment_dfd, cancellable, error))
     {
       g_prefix_error (error, "Checking out tree: ");
       return FALSE;
     }
+  deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_CHECKOUT, phase_start);
 
   glnx_fd_close int tree_boot_dfd = -1;
   g_autofree char *tree_kernel_path = NULL;
@@ -2009,6 +2164,7 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
   ostree_deployment_set_bootconfig (new_deployment, bootconfig);
 
   glnx_unref_object OstreeSePolicy *sepolicy = NULL;
+  phase_start = g_get_monotonic_time ();
   if (!merge_configuration (self, repo, merge_deployment, new_deployment,
                             deployment_dfd,
                             &sepolicy,
@@ -2017,10 +2173,13 @@ ostree_sysroot_deploy_tree (OstreeSysroot     *self,
       g_prefix_error (error, "During /etc merge: ");
       return FALSE;
     }
+  deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_ETC_MERGE, phase_start);
 
+  phase_start = g_get_monotonic_time ();
   if (!selinux_relabel_var_if_needed (self, sepolicy, os_deploy_dfd,
                                       cancellable, error))
     return FALSE;
+  deploy_phase_add_time (self, OSTREE_DEPLOY_PHASE_SELINUX_RELABEL, phase_start);
 
   if (!(self->debug_flags & OSTREE_SYSROOT_DEBUG_MUTABLE_DEPLOYMENTS))
     {
@@ -36,6 +36,25 @@ typedef enum {
 
 } OstreeSysrootDebugFlags;
 
+/* Phases of deploying and writing deployments which we time; see
+ * ostree_sysroot_get_deploy_stats().
+ */
+typedef enum {
+  OSTREE_DEPLOY_PHASE_CHECKOUT,
+  OSTREE_DEPLOY_PHASE_ETC_MERGE,
+  OSTREE_DEPLOY_PHASE_SELINUX_RELABEL,
+  OSTREE_DEPLOY_PHASE_KERNEL_INSTALL,
+  OSTREE_DEPLOY_PHASE_BOOTLOADER,
+  OSTREE_DEPLOY_PHASE_SYNC,
+  OSTREE_DEPLOY_N_PHASES
+} OstreeDeployPhase;
+
+typedef struct {
+  guint64 usec;
+  guint64 n_files;
+  guint64 bytes_copied;
+} OstreeDeployPhaseStats;
+
 /**
  * OstreeSysroot:
  * Internal struct
@@ -60,6 +79,12 @@ struct OstreeSysroot {
   gboolean repo_opened;
 
   OstreeSysrootDebugFlags debug_flags;
+
+  /* Accumulated since the last ostree_sysroot_write_deployments(), and
+   * the totals of that last transaction.
+   */
+  OstreeDeployPhaseStats deploy_stats[OSTREE_DEPLOY_N_PHASES];
+  OstreeDeployPhaseStats last_deploy_stats[OSTREE_DEPLOY_N_PHASES];
 };
 
 #define OSTREE_SYSROOT_LOCKFILE "ostree/lock"
@@ -111,8 +136,16 @@ gboolean _ostree_sysroot_query_bootloader (OstreeSysroot     *sysroot,
 gboolean _ostree_sysroot_bump_mtime (OstreeSysroot *sysroot,
                                      GError       **error);
 
+typedef enum {
+  OSTREE_SYSROOT_CLEANUP_PRUNE_REPO = 1 << 0,
+  OSTREE_SYSROOT_CLEANUP_TRASH      = 1 << 1,
+  /* Without PRUNE_REPO, record that the repo needs pruning later */
+  OSTREE_SYSROOT_CLEANUP_DEFER_PRUNE = 1 << 2,
+  OSTREE_SYSROOT_CLEANUP_ALL        = 0xffff
+} OstreeSysrootCleanupFlags;
+
 gboolean _ostree_sysroot_cleanup_internal (OstreeSysroot *sysroot,
-                                           gboolean       prune_repo,
+                                           OstreeSysrootCleanupFlags flags,
                                            GCancellable  *cancellable,
                                            GError       **error);
 
@@ -161,3 +161,34 @@ ot_log_structured_print_id_v (const char *message_id,
 
   ot_log_structured_print (msg, (const char *const *)keys);
 }
+
+/**
+ * ot_log_structured_print_id_with_keys:
+ * @message_id: A unique MESSAGE_ID
+ * @keys: (array zero-terminated=1) (element-type utf8): Additional KEY=VALUE structured data
+ * @format: A format string
+ *
+ * Like ot_log_structured_print_id_v(), but also attaches @keys.
+ */
+void
+ot_log_structured_print_id_with_keys (const char        *message_id,
+                                      const char *const *keys,
+                                      const char        *format,
+                                      ...)
+{
+  g_autoptr(GPtrArray) all_keys = g_ptr_array_new ();
+  g_autofree char *key0 = g_strconcat ("MESSAGE_ID=", message_id, NULL);
+  g_autofree char *msg = NULL;
+  va_list args;
+
+  g_ptr_array_add (all_keys, key0);
+  for (const char *const *iter = keys; iter && *iter; iter++)
+    g_ptr_array_add (all_keys, (char*)*iter);
+  g_ptr_array_add (all_keys, NULL);
+
+  va_start (args, format);
+  msg = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  ot_log_structured_print (msg, (const char *const *)all_keys->pdata);
+}
@@ -28,4 +28,9 @@ void ot_log_structured_print_id_v (const char *message_id,
                                    const char *format,
                                    ...) G_GNUC_PRINTF(2, 3);
 
+void ot_log_structured_print_id_with_keys (const char        *message_id,
+                                           const char *const *keys,
+                                           const char        *format,
+                                           ...) G_GNUC_PRINTF(3, 4);
+
 G_END_DECLS
@@ -262,3 +262,143 @@ ot_variant_bsearch_str (GVariant   *array,
   *out_pos = imid;
   return FALSE;
 }
+
+static void
+append_json_string (GString    *out,
+                    const char *str)
+{
+  g_string_append_c (out, '"');
+  for (const char *p = str; *p; p++)
+    {
+      const guchar c = *p;
+      if (c == '"' || c == '\\')
+        {
+          g_string_append_c (out, '\\');
+          g_string_append_c (out, c);
+        }
+      else if (c == '\n')
+        g_string_append (out, "\\n");
+      else if (c == '\t')
+        g_string_append (out, "\\t");
+      else if (c < 0x20)
+        g_string_append_printf (out, "\\u%04x", c);
+      else
+        g_string_append_c (out, c);
+    }
+  g_string_append_c (out, '"');
+}
+
+static void
+append_json_value (GString  *out,
+                   GVariant *variant)
+{
+  switch (g_variant_classify (variant))
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+      g_string_append (out, g_variant_get_boolean (variant) ? "true" : "false");
+      break;
+    case G_VARIANT_CLASS_BYTE:
+      g_string_append_printf (out, "%u", (guint)g_variant_get_byte (variant));
+      break;
+    case G_VARIANT_CLASS_INT16:
+      g_string_append_printf (out, "%d", (int)g_variant_get_int16 (variant));
+      break;
+    case G_VARIANT_CLASS_UINT16:
+      g_string_append_printf (out, "%u", (guint)g_variant_get_uint16 (variant));
+      break;
+    case G_VARIANT_CLASS_INT32:
+      g_string_append_printf (out, "%d", g_variant_get_int32 (variant));
+      break;
+    case G_VARIANT_CLASS_UINT32:
+      g_string_append_printf (out, "%u", g_variant_get_uint32 (variant));
+      break;
+    case G_VARIANT_CLASS_INT64:
+      g_string_append_printf (out, "%" G_GINT64_FORMAT, g_variant_get_int64 (variant));
+      break;
+    case G_VARIANT_CLASS_UINT64:
+      g_string_append_printf (out, "%" G_GUINT64_FORMAT, g_variant_get_uint64 (variant));
+      break;
+    case G_VARIANT_CLASS_DOUBLE:
+      {
+        char buf[G_ASCII_DTOSTR_BUF_SIZE];
+        g_string_append (out, g_ascii_dtostr (buf, sizeof (buf), g_variant_get_double (variant)));
+      }
+      break;
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+      append_json_string (out, g_variant_get_string (variant, NULL));
+      break;
+    case G_VARIANT_CLASS_VARIANT:
+      {
+        g_autoptr(GVariant) child = g_variant_get_variant (variant);
+        append_json_value (out, child);
+      }
+      break;
+    case G_VARIANT_CLASS_MAYBE:
+      {
+        g_autoptr(GVariant) child = g_variant_get_maybe (variant);
+        if (child)
+          append_json_value (out, child);
+        else
+          g_string_append (out, "null");
+      }
+      break;
+    case G_VARIANT_CLASS_ARRAY:
+    case G_VARIANT_CLASS_TUPLE:
+      {
+        const GVariantType *type = g_variant_get_type (variant);
+        const gboolean is_object =
+          g_variant_type_is_array (type) &&
+          g_variant_type_is_dict_entry (g_variant_type_element (type)) &&
+          g_variant_type_equal (g_variant_type_key (g_variant_type_element (type)),
+                                G_VARIANT_TYPE_STRING);
+        const gsize n = g_variant_n_children (variant);
+
+        g_string_append_c (out, is_object ? '{' : '[');
+        for (gsize i = 0; i < n; i++)
+          {
+            g_autoptr(GVariant) child = g_variant_get_child_value (variant, i);
+            if (i > 0)
+              g_string_append_c (out, ',');
+            if (is_object)
+              {
+                g_autoptr(GVariant) key = g_variant_get_child_value (child, 0);
+                g_autoptr(GVariant) value = g_variant_get_child_value (child, 1);
+                append_json_string (out, g_variant_get_string (key, NULL));
+                g_string_append_c (out, ':');
+                append_json_value (out, value);
+              }
+            else
+              append_json_value (out, child);
+          }
+        g_string_append_c (out, is_object ? '}' : ']');
+      }
+      break;
+    default:
+      /* Dict entries outside of a string-keyed dict, handles */
+      {
+        g_autofree char *str = g_variant_print (variant, FALSE);
+        append_json_string (out, str);
+      }
+      break;
+    }
+}
+
+/**
+ * ot_variant_to_json:
+ * @variant: A #GVariant
+ *
+ * Serialize @variant as JSON, for machine-readable reports.  String
+ * keyed dictionaries become objects, other containers become arrays
+ * and variants are unwrapped.
+ *
+ * Returns: (transfer full): A JSON document
+ */
+char *
+ot_variant_to_json (GVariant *variant)
+{
+  GString *out = g_string_new ("");
+  append_json_value (out, variant);
+  return g_string_free (out, FALSE);
+}
@@ -66,4 +66,7 @@ ot_variant_bsearch_str (GVariant   *array,
                         const char *str,
                         int        *out_pos);
 
+char *
+ot_variant_to_json (GVariant *variant);
+
 G_END_DECLS
@@ -32,14 +32,17 @@
 #include <locale.h>
 #include <err.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/prctl.h>
 #include <signal.h>
+#include <poll.h>
 
 static char *opt_port_file = NULL;
 static char *opt_log = NULL;
 static gboolean opt_daemonize;
 static gboolean opt_autoexit;
 static gboolean opt_force_ranges;
+static gboolean opt_disable_ranges;
 static int opt_random_500s_percentage;
 /* We have a strong upper bound for any unlikely
  * cases involving repeated random 500s. */
@@ -47,6 +50,7 @@ static int opt_random_500s_max = 100;
 static gint opt_port = 0;
 static gchar **opt_expected_cookies;
 static gchar **opt_expected_headers;
+static int opt_threads;
 
 static guint emitted_random_500s_count = 0;
 
@@ -62,17 +66,22 @@ static GOptionEntry options[] = {
   { "port", 'P', 0, G_OPTION_ARG_INT, &opt_port, "Use the specified TCP port", "PORT" },
   { "port-file", 'p', 0, G_OPTION_ARG_FILENAME, &opt_port_file, "Write port number to PATH (- for standard output)", "PATH" },
   { "force-range-requests", 0, 0, G_OPTION_ARG_NONE, &opt_force_ranges, "Force range requests by only serving half of files", NULL },
+  { "disable-range-requests", 0, 0, G_OPTION_ARG_NONE, &opt_disable_ranges, "Ignore Range headers, always serving whole files", NULL },
   { "random-500s", 0, 0, G_OPTION_ARG_INT, &opt_random_500s_percentage, "Generate random HTTP 500 errors approximately for PERCENTAGE requests", "PERCENTAGE" },
   { "random-500s-max", 0, 0, G_OPTION_ARG_INT, &opt_random_500s_max, "Limit HTTP 500 errors to MAX (default 100)", "MAX" },
   { "log-file", 0, 0, G_OPTION_ARG_FILENAME, &opt_log, "Put logs here (use - for stdout)", "PATH" },
   { "expected-cookies", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_expected_cookies, "Expect given cookies in the http request", "KEY=VALUE" },
   { "expected-header", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_expected_headers, "Expect given headers in the http request", "KEY=VALUE" },
+  { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Serve files from N threads using sendfile(), for benchmarking", "N" },
   { NULL }
 };
 
 static void
 httpd_log (OtTrivialHttpd *httpd, const gchar *format, ...) __attribute__ ((format(printf, 2, 3)));
 
+/* Serializes writes to the log in --threads mode */
+G_LOCK_DEFINE_STATIC (log);
+
 static void
 httpd_log (OtTrivialHttpd *httpd, const gchar *format, ...)
 {
@@ -94,7 +103,9 @@ httpd_log (OtTrivialHttpd *httpd, const gchar *format, ...)
   g_string_append_vprintf (str, format, args);
   va_end (args);
 
+  G_LOCK (log);
   g_output_stream_write_all (httpd->log, str->str, str->len, &written, NULL, NULL);
+  G_UNLOCK (log);
 }
 
 static int
@@ -176,6 +187,25 @@ is_safe_to_access (struct stat *stbuf)
   return TRUE;
 }
 
+/* Whether any segment of @path is "..", which could escape the root */
+static gboolean
+path_has_dotdot_segment (const char *path)
+{
+  const char *p = path;
+
+  while (TRUE)
+    {
+      const char *slash = strchr (p, '/');
+      gsize len = slash ? (gsize)(slash - p) : strlen (p);
+
+      if (len == 2 && p[0] == '.' && p[1] == '.')
+        return TRUE;
+      if (!slash)
+        return FALSE;
+      p = slash + 1;
+    }
+}
+
 static void
 close_socket (SoupMessage *msg, gpointer user_data)
 {
@@ -206,6 +236,12 @@ do_get (OtTrivialHttpd    *self,
 
   httpd_log (self, "serving %s\n", path);
 
+  /* Simulate a server without range support; libsoup would otherwise
+   * handle the header for us.
+   */
+  if (opt_disable_ranges)
+    soup_message_headers_remove (msg->request_headers, "Range");
+
   if (opt_expected_cookies)
     {
       GSList *cookies = soup_cookies_from_request (msg);
@@ -271,7 +307,7 @@ do_get (OtTrivialHttpd    *self,
         }
     }
 
-  if (strstr (path, "../") != NULL)
+  if (path_has_dotdot_segment (path))
     {
       soup_message_set_status (msg, SOUP_STATUS_FORBIDDEN);
       goto out;
@@ -442,12 +478,29 @@ do_get (OtTrivialHttpd    *self,
   return;
 }
 
+static void
+on_message_finished (SoupMessage *msg,
+                     gpointer     user_data)
+{
+  OtTrivialHttpd *self = user_data;
+  gint64 *start_time = g_object_get_data (G_OBJECT (msg), "ostree-httpd-start-time");
+
+  httpd_log (self, "  finished %s in %.3f ms\n", soup_message_get_uri (msg)->path,
+             (g_get_monotonic_time () - *start_time) / 1000.0);
+}
+
 static void
 httpd_callback (SoupServer *server, SoupMessage *msg,
                 const char *path, GHashTable *query,
                 SoupClientContext *context, gpointer data)
 {
   OtTrivialHttpd *self = data;
+  gint64 *start_time = g_new (gint64, 1);
+
+  /* Log the latency including sending the response */
+  *start_time = g_get_monotonic_time ();
+  g_object_set_data_full (G_OBJECT (msg), "ostree-httpd-start-time", start_time, g_free);
+  g_signal_connect (msg, "finished", G_CALLBACK (on_message_finished), self);
 
   if (msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD)
     do_get (self, server, msg, path, context);
@@ -455,6 +508,508 @@ httpd_callback (SoupServer *server, SoupMessage *msg,
     soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
 }
 
+/* With --threads, we don't use libsoup; this is a minimal HTTP/1.1
+ * server intended for load testing pulls.  Each connection is handled
+ * in a thread of a GThreadedSocketService, and file contents are sent
+ * with sendfile().  It supports GET and HEAD, keepalive, and single
+ * and multiple byte ranges, but none of the options for simulating
+ * misbehaving servers other than --disable-range-requests.
+ */
+
+/* Close connections which are idle for this long */
+#define THREADED_IDLE_TIMEOUT_SECS 60
+#define MULTIPART_BOUNDARY "ostree-httpd-byteranges"
+
+typedef struct {
+  guint64 start;
+  guint64 end;   /* Inclusive */
+} ByteRange;
+
+static gboolean
+wait_writable (int sockfd)
+{
+  struct pollfd pfd = { .fd = sockfd, .events = POLLOUT };
+  int r;
+
+  do
+    r = poll (&pfd, 1, THREADED_IDLE_TIMEOUT_SECS * 1000);
+  while (r == -1 && errno == EINTR);
+  return r > 0;
+}
+
+/* The socket is non-blocking, as GSocket always sets that */
+static gboolean
+send_all (int          sockfd,
+          const char  *buf,
+          gsize        len,
+          int          flags)
+{
+  while (len > 0)
+    {
+      ssize_t r = send (sockfd, buf, len, flags | MSG_NOSIGNAL);
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN && wait_writable (sockfd))
+            continue;
+          return FALSE;
+        }
+      buf += r;
+      len -= r;
+    }
+  return TRUE;
+}
+
+static gboolean
+sendfile_all (int      sockfd,
+              int      fd,
+              off_t    offset,
+              guint64  len)
+{
+  while (len > 0)
+    {
+      ssize_t r = sendfile (sockfd, fd, &offset, MIN (len, G_MAXINT32));
+      if (r < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN && wait_writable (sockfd))
+            continue;
+          return FALSE;
+        }
+      /* The file was truncated underneath us */
+      if (r == 0)
+        return FALSE;
+      len -= r;
+    }
+  return TRUE;
+}
+
+/* Parse a Range header as described in RFC 7233.  Returns FALSE if the
+ * header should be ignored; otherwise @ranges is filled in with the
+ * satisfiable ranges, which may be none.
+ */
+static gboolean
+parse_ranges (const char *header,
+              guint64     size,
+              GArray     *ranges)
+{
+  g_auto(GStrv) specs = NULL;
+
+  if (!g_str_has_prefix (header, "bytes="))
+    return FALSE;
+
+  specs = g_strsplit (header + strlen ("bytes="), ",", -1);
+  for (char **iter = specs; *iter; iter++)
+    {
+      char *spec = g_strstrip (*iter);
+      char *dash = strchr (spec, '-');
+      char *endp;
+      ByteRange range;
+
+      if (!dash)
+        return FALSE;
+
+      if (dash == spec)
+        {
+          /* A suffix range, i.e. the last N bytes */
+          guint64 n = g_ascii_strtoull (dash + 1, &endp, 10);
+          if (dash[1] == '\0' || *endp != '\0')
+            return FALSE;
+          if (n == 0 || size == 0)
+            continue;
+          range.start = n >= size ? 0 : size - n;
+          range.end = size - 1;
+        }
+      else
+        {
+          range.start = g_ascii_strtoull (spec, &endp, 10);
+          if (endp != dash)
+            return FALSE;
+          if (dash[1] == '\0')
+            range.end = G_MAXUINT64;
+          else
+            {
+              range.end = g_ascii_strtoull (dash + 1, &endp, 10);
+              if (*endp != '\0' || range.end < range.start)
+                return FALSE;
+            }
+          if (range.start >= size)
+            continue;
+          range.end = MIN (range.end, size - 1);
+        }
+
+      g_array_append_val (ranges, range);
+    }
+
+  return TRUE;
+}
+
+static void
+append_response_start (GString    *headers,
+                       guint       status,
+                       gboolean    keepalive,
+                       guint64     content_length)
+{
+  g_string_append_printf (headers, "HTTP/1.1 %u %s\r\n", status, soup_status_get_phrase (status));
+  g_string_append (headers, "Server: ostree-httpd\r\n");
+  g_string_append_printf (headers, "Connection: %s\r\n", keepalive ? "keep-alive" : "close");
+  g_string_append_printf (headers, "Content-Length: %" G_GUINT64_FORMAT "\r\n", content_length);
+}
+
+/* Responses other than file contents */
+static gboolean
+send_simple_response (int          sockfd,
+                      guint        status,
+                      gboolean     keepalive,
+                      gboolean     is_head,
+                      const char  *extra_headers,
+                      GString     *body,
+                      guint64     *out_bytes)
+{
+  g_autoptr(GString) response = g_string_new (NULL);
+  gsize body_len = body ? body->len : 0;
+
+  append_response_start (response, status, keepalive, body_len);
+  if (body)
+    g_string_append (response, "Content-Type: text/html\r\n");
+  if (extra_headers)
+    g_string_append (response, extra_headers);
+  g_string_append (response, "\r\n");
+  if (body && !is_head)
+    g_string_append_len (response, body->str, body->len);
+
+  *out_bytes = response->len;
+  return send_all (sockfd, response->str, response->len, 0);
+}
+
+static gboolean
+send_file_response (int          sockfd,
+                    int          fd,
+                    guint64      size,
+                    const char  *range_header,
+                    gboolean     keepalive,
+                    gboolean     is_head,
+                    guint       *out_status,
+                    guint64     *out_bytes)
+{
+  g_autoptr(GArray) ranges = g_array_new (FALSE, FALSE, sizeof (ByteRange));
+  g_autoptr(GString) headers = g_string_new (NULL);
+  g_autoptr(GPtrArray) part_headers = NULL;
+  guint64 content_length;
+
+  *out_bytes = 0;
+
+  if (range_header && parse_ranges (range_header, size, ranges))
+    {
+      if (ranges->len == 0)
+        {
+          g_autofree char *content_range =
+            g_strdup_printf ("Content-Range: bytes */%" G_GUINT64_FORMAT "\r\n", size);
+          *out_status = SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE;
+          return send_simple_response (sockfd, *out_status, keepalive, is_head,
+                                       content_range, NULL, out_bytes);
+        }
+    }
+  else
+    g_array_set_size (ranges, 0);
+
+  if (ranges->len == 0)
+    {
+      *out_status = SOUP_STATUS_OK;
+      append_response_start (headers, *out_status, keepalive, size);
+    }
+  else if (ranges->len == 1)
+    {
+      ByteRange *range = &g_array_index (ranges, ByteRange, 0);
+
+      *out_status = SOUP_STATUS_PARTIAL_CONTENT;
+      append_response_start (headers, *out_status, keepalive,
+                             range->end - range->start + 1);
+      g_string_append_printf (headers, "Content-Range: bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\r\n",
+                              range->start, range->end, size);
+    }
+  else
+    {
+      /* multipart/byteranges; the length has to include all of the
+       * part headers, so format them up front.
+       */
+      *out_status = SOUP_STATUS_PARTIAL_CONTENT;
+      part_headers = g_ptr_array_new_with_free_func (g_free);
+      content_length = strlen ("\r\n--" MULTIPART_BOUNDARY "--\r\n");
+      for (guint i = 0; i < ranges->len; i++)
+        {
+          ByteRange *range = &g_array_index (ranges, ByteRange, i);
+          char *part = g_strdup_printf ("\r\n--" MULTIPART_BOUNDARY "\r\n"
+                                        "Content-Type: application/octet-stream\r\n"
+                                        "Content-Range: bytes %" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\r\n"
+                                        "\r\n",
+                                        range->start, range->end, size);
+          content_length += strlen (part) + (range->end - range->start + 1);
+          g_ptr_array_add (part_headers, part);
+        }
+      append_response_start (headers, *out_status, keepalive, content_length);
+      g_string_append (headers, "Content-Type: multipart/byteranges; boundary=" MULTIPART_BOUNDARY "\r\n");
+    }
+
+  if (!opt_disable_ranges)
+    g_string_append (headers, "Accept-Ranges: bytes\r\n");
+  g_string_append (headers, "\r\n");
+
+  /* MSG_MORE lets the headers go out in the same packet as the data */
+  if (!send_all (sockfd, headers->str, headers->len, is_head ? 0 : MSG_MORE))
+    return FALSE;
+  *out_bytes += headers->len;
+  if (is_head)
+    return TRUE;
+
+  if (ranges->len == 0)
+    {
+      if (!sendfile_all (sockfd, fd, 0, size))
+        return FALSE;
+      *out_bytes += size;
+    }
+  else if (ranges->len == 1)
+    {
+      ByteRange *range = &g_array_index (ranges, ByteRange, 0);
+      guint64 len = range->end - range->start + 1;
+
+      if (!sendfile_all (sockfd, fd, range->start, len))
+        return FALSE;
+      *out_bytes += len;
+    }
+  else
+    {
+      const char *trailer = "\r\n--" MULTIPART_BOUNDARY "--\r\n";
+
+      for (guint i = 0; i < ranges->len; i++)
+        {
+          ByteRange *range = &g_array_index (ranges, ByteRange, i);
+          const char *part = part_headers->pdata[i];
+          guint64 len = range->end - range->start + 1;
+
+          if (!send_all (sockfd, part, strlen (part), MSG_MORE))
+            return FALSE;
+          if (!sendfile_all (sockfd, fd, range->start, len))
+            return FALSE;
+          *out_bytes += strlen (part) + len;
+        }
+
+      if (!send_all (sockfd, trailer, strlen (trailer), 0))
+        return FALSE;
+      *out_bytes += strlen (trailer);
+    }
+
+  return TRUE;
+}
+
+/* Read and answer one request.  Returns FALSE if the connection should
+ * be closed.
+ */
+static gboolean
+threaded_serve_request (OtTrivialHttpd   *self,
+                        GDataInputStream *in,
+                        int               sockfd)
+{
+  g_autofree char *request_line = NULL;
+  g_auto(GStrv) request = NULL;
+  g_autofree char *range_header = NULL;
+  g_autofree char *path = NULL;
+  const char *relpath;
+  gboolean keepalive;
+  gboolean has_body = FALSE;
+  gboolean is_head = FALSE;
+  gboolean sent;
+  gint64 start_time;
+  guint status;
+  guint64 bytes = 0;
+  struct stat stbuf;
+  int r;
+
+  /* NULL here is EOF, the idle timeout, or an error */
+  request_line = g_data_input_stream_read_line (in, NULL, NULL, NULL);
+  if (!request_line)
+    return FALSE;
+  start_time = g_get_monotonic_time ();
+
+  request = g_strsplit (request_line, " ", 3);
+  if (g_strv_length (request) != 3 || !g_str_has_prefix (request[2], "HTTP/1."))
+    {
+      (void) send_simple_response (sockfd, SOUP_STATUS_BAD_REQUEST, FALSE, FALSE,
+                                   NULL, NULL, &bytes);
+      return FALSE;
+    }
+  keepalive = strcmp (request[2], "HTTP/1.0") != 0;
+
+  while (TRUE)
+    {
+      g_autofree char *line = g_data_input_stream_read_line (in, NULL, NULL, NULL);
+      char *colon;
+      const char *value;
+
+      if (!line)
+        return FALSE;
+      if (!*line)
+        break;
+
+      colon = strchr (line, ':');
+      if (!colon)
+        continue;
+      *colon = '\0';
+      value = g_strstrip (colon + 1);
+
+      if (g_ascii_strcasecmp (line, "Connection") == 0)
+        {
+          if (g_ascii_strcasecmp (value, "close") == 0)
+            keepalive = FALSE;
+          else if (g_ascii_strcasecmp (value, "keep-alive") == 0)
+            keepalive = TRUE;
+        }
+      else if (g_ascii_strcasecmp (line, "Range") == 0)
+        {
+          if (!opt_disable_ranges)
+            {
+              g_free (range_header);
+              range_header = g_strdup (value);
+            }
+        }
+      else if (g_ascii_strcasecmp (line, "Transfer-Encoding") == 0 ||
+               (g_ascii_strcasecmp (line, "Content-Length") == 0 && strcmp (value, "0") != 0))
+        has_body = TRUE;
+    }
+
+  /* We never read request bodies, so we can't reuse the connection */
+  if (has_body)
+    keepalive = FALSE;
+
+  {
+    const char *target = request[1];
+    const char *query = strchr (target, '?');
+
+    if (target[0] == '/')
+      path = g_uri_unescape_segment (target, query, NULL);
+  }
+
+  if (strcmp (request[0], "HEAD") == 0)
+    is_head = TRUE;
+  else if (strcmp (request[0], "GET") != 0)
+    {
+      status = SOUP_STATUS_NOT_IMPLEMENTED;
+      sent = send_simple_response (sockfd, status, keepalive, FALSE, NULL, NULL, &bytes);
+      goto out;
+    }
+
+  if (!path)
+    {
+      status = SOUP_STATUS_BAD_REQUEST;
+      sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, NULL, &bytes);
+      goto out;
+    }
+
+  if (path_has_dotdot_segment (path))
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, NULL, &bytes);
+      goto out;
+    }
+
+  relpath = path;
+  while (relpath[0] == '/')
+    relpath++;
+  if (!*relpath)
+    relpath = "./";
+
+  do
+    r = fstatat (self->root_dfd, relpath, &stbuf, 0);
+  while (r == -1 && errno == EINTR);
+  if (r == -1)
+    {
+      if (errno == EPERM)
+        status = SOUP_STATUS_FORBIDDEN;
+      else if (errno == ENOENT)
+        status = SOUP_STATUS_NOT_FOUND;
+      else
+        status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+      sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, NULL, &bytes);
+      goto out;
+    }
+
+  if (!is_safe_to_access (&stbuf))
+    {
+      status = SOUP_STATUS_FORBIDDEN;
+      sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, NULL, &bytes);
+      goto out;
+    }
+
+  if (S_ISDIR (stbuf.st_mode))
+    {
+      if (!g_str_has_suffix (path, "/"))
+        {
+          g_autofree char *location = g_strdup_printf ("Location: %s/\r\n", request[1]);
+
+          status = SOUP_STATUS_MOVED_PERMANENTLY;
+          sent = send_simple_response (sockfd, status, keepalive, is_head, location, NULL, &bytes);
+        }
+      else
+        {
+          g_autofree char *index_path = g_strconcat (relpath, "/index.html", NULL);
+          glnx_fd_close int fd = openat (self->root_dfd, index_path, O_RDONLY | O_CLOEXEC);
+
+          if (fd != -1 && fstat (fd, &stbuf) == 0 && is_safe_to_access (&stbuf) && S_ISREG (stbuf.st_mode))
+            sent = send_file_response (sockfd, fd, stbuf.st_size, range_header,
+                                       keepalive, is_head, &status, &bytes);
+          else
+            {
+              g_autoptr(GString) listing = get_directory_listing (self->root_dfd, relpath);
+
+              status = SOUP_STATUS_OK;
+              sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, listing, &bytes);
+            }
+        }
+    }
+  else
+    {
+      glnx_fd_close int fd = openat (self->root_dfd, relpath, O_RDONLY | O_CLOEXEC);
+
+      if (fd == -1 || fstat (fd, &stbuf) == -1 || !S_ISREG (stbuf.st_mode))
+        {
+          status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+          sent = send_simple_response (sockfd, status, keepalive, is_head, NULL, NULL, &bytes);
+        }
+      else
+        sent = send_file_response (sockfd, fd, stbuf.st_size, range_header,
+                                   keepalive, is_head, &status, &bytes);
+    }
+
+ out:
+  httpd_log (self, "serving %s - %s %u %s, %" G_GUINT64_FORMAT " bytes in %.3f ms%s\n",
+             path ? path : request[1], request[0], status, soup_status_get_phrase (status),
+             bytes, (g_get_monotonic_time () - start_time) / 1000.0,
+             sent ? "" : " (failed)");
+  return sent && keepalive;
+}
+
+static gboolean
+on_threaded_connection (GThreadedSocketService *service,
+                        GSocketConnection      *connection,
+                        GObject                *source_object,
+                        gpointer                user_data)
+{
+  OtTrivialHttpd *self = user_data;
+  GSocket *socket = g_socket_connection_get_socket (connection);
+  GInputStream *base_in = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+  g_autoptr(GDataInputStream) in = g_data_input_stream_new (base_in);
+
+  g_data_input_stream_set_newline_type (in, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  g_socket_set_timeout (socket, THREADED_IDLE_TIMEOUT_SECS);
+
+  while (threaded_serve_request (self, in, g_socket_get_fd (socket)))
+    ;
+
+  return TRUE;
+}
+
 static void
 on_dir_changed (GFileMonitor  *mon,
                 GFile *file,
@@ -480,7 +1035,9 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
   OtTrivialHttpd appstruct = { 0, };
   OtTrivialHttpd *app = &appstruct;
   glnx_unref_object SoupServer *server = NULL;
+  g_autoptr(GSocketService) service = NULL;
   g_autoptr(GFileMonitor) dirmon = NULL;
+  guint port = 0;
 
   context = g_option_context_new ("[DIR] - Simple webserver");
   g_option_context_add_main_entries (context, options, NULL);
@@ -505,6 +1062,20 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
       goto out;
     }
 
+  if (opt_threads < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid --threads=%d", opt_threads);
+      goto out;
+    }
+  if (opt_threads > 0 &&
+      (opt_force_ranges || opt_random_500s_percentage > 0 ||
+       opt_expected_cookies || opt_expected_headers))
+    {
+      ot_util_usage_error (context, "--threads cannot be combined with --force-range-requests, --random-500s, --expected-cookies or --expected-header", error);
+      goto out;
+    }
+
   if (opt_log)
     {
       GOutputStream *stream = NULL;
@@ -536,39 +1107,68 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
       app->log = stream;
     }
 
+  if (opt_threads > 0)
+    {
+      service = g_threaded_socket_service_new (opt_threads);
+      if (opt_port)
+        {
+          if (!g_socket_listener_add_inet_port ((GSocketListener*)service, opt_port, NULL, error))
+            goto out;
+          port = opt_port;
+        }
+      else
+        {
+          port = g_socket_listener_add_any_inet_port ((GSocketListener*)service, NULL, error);
+          if (port == 0)
+            goto out;
+        }
+      g_signal_connect (service, "run", G_CALLBACK (on_threaded_connection), app);
+      /* We write to sockets directly */
+      signal (SIGPIPE, SIG_IGN);
+    }
+  else
+    {
 #if SOUP_CHECK_VERSION(2, 48, 0)
-  server = soup_server_new (SOUP_SERVER_SERVER_HEADER, "ostree-httpd ", NULL);
-  if (!soup_server_listen_all (server, opt_port, 0, error))
-    goto out;
+      server = soup_server_new (SOUP_SERVER_SERVER_HEADER, "ostree-httpd ", NULL);
+      if (!soup_server_listen_all (server, opt_port, 0, error))
+        goto out;
 #else
-  server = soup_server_new (SOUP_SERVER_PORT, opt_port,
-                            SOUP_SERVER_SERVER_HEADER, "ostree-httpd ",
-                            NULL);
+      server = soup_server_new (SOUP_SERVER_PORT, opt_port,
+                                SOUP_SERVER_SERVER_HEADER, "ostree-httpd ",
+                                NULL);
 #endif
 
-  soup_server_add_handler (server, NULL, httpd_callback, app, NULL);
-  if (opt_port_file)
-    {
-      g_autofree char *portstr = NULL;
+      soup_server_add_handler (server, NULL, httpd_callback, app, NULL);
+      if (opt_port_file)
+        {
 #if SOUP_CHECK_VERSION(2, 48, 0)
-      GSList *listeners = soup_server_get_listeners (server);
-      g_autoptr(GSocket) listener = NULL;
-      g_autoptr(GSocketAddress) addr = NULL;
-      
-      g_assert (listeners);
-      listener = g_object_ref (listeners->data);
-      g_slist_free (listeners);
-      listeners = NULL;
-      addr = g_socket_get_local_address (listener, error);
-      if (!addr)
-        goto out;
+          GSList *listeners = soup_server_get_listeners (server);
+          g_autoptr(GSocket) listener = NULL;
+          g_autoptr(GSocketAddress) addr = NULL;
+
+          g_assert (listeners);
+          listener = g_object_ref (listeners->data);
+          g_slist_free (listeners);
+          listeners = NULL;
+          addr = g_socket_get_local_address (listener, error);
+          if (!addr)
+            goto out;
 
-      g_assert (G_IS_INET_SOCKET_ADDRESS (addr));
-      
-      portstr = g_strdup_printf ("%u\n", g_inet_socket_address_get_port ((GInetSocketAddress*)addr));
+          g_assert (G_IS_INET_SOCKET_ADDRESS (addr));
+
+          port = g_inet_socket_address_get_port ((GInetSocketAddress*)addr);
 #else
-      portstr = g_strdup_printf ("%u\n", soup_server_get_port (server));
+          port = soup_server_get_port (server);
+#endif
+        }
+#if !SOUP_CHECK_VERSION(2, 48, 0)
+      soup_server_run_async (server);
 #endif
+    }
+
+  if (opt_port_file)
+    {
+      g_autofree char *portstr = g_strdup_printf ("%u\n", port);
 
       if (g_strcmp0 ("-", opt_port_file) == 0)
         {
@@ -578,10 +1178,7 @@ run (int argc, char **argv, GCancellable *cancellable, GError **error)
       else if (!g_file_set_contents (opt_port_file, portstr, strlen (portstr), error))
         goto out;
     }
-#if !SOUP_CHECK_VERSION(2, 48, 0)
-  soup_server_run_async (server);
-#endif
-  
+
   if (opt_daemonize)
     {
       pid_t pid = fork();
@@ -29,7 +29,10 @@
 
 #include <glib/gi18n.h>
 
+static gboolean opt_trash;
+
 static GOptionEntry options[] = {
+  { "trash", 0, 0, G_OPTION_ARG_NONE, &opt_trash, "Only delete deployments moved aside by earlier cleanups", NULL },
   { NULL }
 };
 
@@ -50,7 +53,12 @@ ot_admin_builtin_cleanup (int argc, char **argv, GCancellable *cancellable, GErr
   if (!ostree_sysroot_load (sysroot, cancellable, error))
     goto out;
 
-  if (!ostree_sysroot_cleanup (sysroot, cancellable, error))
+  if (opt_trash)
+    {
+      if (!ostree_sysroot_cleanup_trash (sysroot, cancellable, error))
+        goto out;
+    }
+  else if (!ostree_sysroot_cleanup (sysroot, cancellable, error))
     goto out;
 
   ret = TRUE;
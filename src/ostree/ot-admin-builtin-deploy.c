@@ -38,6 +38,7 @@ static char **opt_kernel_argv_append;
 static gboolean opt_kernel_proc_cmdline;
 static char *opt_osname;
 static char *opt_origin_path;
+static char *opt_stats_json;
 
 static GOptionEntry options[] = {
   { "os", 0, 0, G_OPTION_ARG_STRING, &opt_osname, "Use a different operating system root than the current one", "OSNAME" },
@@ -46,6 +47,7 @@ static GOptionEntry options[] = {
   { "karg-proc-cmdline", 0, 0, G_OPTION_ARG_NONE, &opt_kernel_proc_cmdline, "Import current /proc/cmdline", NULL },
   { "karg", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_kernel_argv, "Set kernel argument, like root=/dev/sda1; this overrides any earlier argument with the same name", "NAME=VALUE" },
   { "karg-append", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_kernel_argv_append, "Append kernel argument; useful with e.g. console= that can be used multiple times", "NAME=VALUE" },
+  { "stats-json", 0, 0, G_OPTION_ARG_FILENAME, &opt_stats_json, "Write per-phase timing statistics as JSON to PATH (- for stdout)", "PATH" },
   { NULL }
 };
 
@@ -169,6 +171,12 @@ ot_admin_builtin_deploy (int argc, char **argv, GCancellable *cancellable, GErro
                                                cancellable, error))
     goto out;
 
+  if (opt_stats_json)
+    {
+      if (!ot_admin_write_deploy_stats (sysroot, opt_stats_json, error))
+        goto out;
+    }
+
   ret = TRUE;
  out:
   return ret;
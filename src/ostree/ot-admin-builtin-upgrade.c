@@ -38,6 +38,7 @@ static gboolean opt_pull_only;
 static gboolean opt_deploy_only;
 static char *opt_osname;
 static char *opt_override_commit;
+static char *opt_stats_json;
 
 static GOptionEntry options[] = {
   { "os", 0, 0, G_OPTION_ARG_STRING, &opt_osname, "Use a different operating system root than the current one", "OSNAME" },
@@ -46,6 +47,7 @@ static GOptionEntry options[] = {
   { "override-commit", 0, 0, G_OPTION_ARG_STRING, &opt_override_commit, "Deploy CHECKSUM instead of the latest tree", "CHECKSUM" },
   { "pull-only", 0, 0, G_OPTION_ARG_NONE, &opt_pull_only, "Do not create a deployment, just download", NULL },
   { "deploy-only", 0, 0, G_OPTION_ARG_NONE, &opt_deploy_only, "Do not pull, only deploy", NULL },
+  { "stats-json", 0, 0, G_OPTION_ARG_FILENAME, &opt_stats_json, "Write per-phase deployment timing statistics as JSON to PATH (- for stdout)", "PATH" },
   { NULL }
 };
 
@@ -164,6 +166,12 @@ ot_admin_builtin_upgrade (int argc, char **argv, GCancellable *cancellable, GErr
         {
           if (!ostree_sysroot_upgrader_deploy (upgrader, cancellable, error))
             goto out;
+
+          if (opt_stats_json)
+            {
+              if (!ot_admin_write_deploy_stats (sysroot, opt_stats_json, error))
+                goto out;
+            }
         }
 
       if (opt_reboot)
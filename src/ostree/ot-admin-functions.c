@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include "libglnx.h"
+#include "ot-main.h"
 #include "ot-admin-functions.h"
 #include "otutil.h"
 #include "ostree.h"
@@ -161,3 +162,16 @@ ot_admin_execve_reboot (OstreeSysroot *sysroot, GError **error)
 
   return TRUE;
 }
+
+/* Write the phase statistics of the last deployment transaction as JSON
+ * to @path, or standard output for "-".
+ */
+gboolean
+ot_admin_write_deploy_stats (OstreeSysroot *sysroot,
+                             const char    *path,
+                             GError       **error)
+{
+  g_autoptr(GVariant) stats = ostree_sysroot_get_deploy_stats (sysroot);
+
+  return ot_write_variant_as_json (stats, path, error);
+}
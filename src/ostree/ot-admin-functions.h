@@ -49,4 +49,9 @@ gboolean
 ot_admin_execve_reboot (OstreeSysroot *sysroot,
                         GError **error);
 
+gboolean
+ot_admin_write_deploy_stats (OstreeSysroot *sysroot,
+                             const char    *path,
+                             GError       **error);
+
 G_END_DECLS
@@ -29,6 +29,9 @@
 #include "otutil.h"
 #include "ot-tool-util.h"
 #include "parse-datetime.h"
+#ifdef HAVE_LIBARCHIVE
+#include "ostree-libarchive-private.h"
+#endif
 
 static char *opt_subject;
 static char *opt_body;
@@ -328,6 +331,47 @@ parse_keyvalue_strings (char             **strings,
   return ret;
 }
 
+/* Like ostree_repo_write_archive_to_mtree(), but file contents are
+ * hashed and written on several threads while the archive is read.
+ */
+static gboolean
+write_tar_to_mtree (OstreeRepo                *repo,
+                    GFile                     *archive,
+                    OstreeMutableTree         *mtree,
+                    OstreeRepoCommitModifier  *modifier,
+                    GCancellable              *cancellable,
+                    GError                   **error)
+{
+#ifdef HAVE_LIBARCHIVE
+  ot_cleanup_read_archive struct archive *a = archive_read_new ();
+  OstreeRepoImportArchiveOptions opts = { 0, };
+
+#ifdef HAVE_ARCHIVE_READ_SUPPORT_FILTER_ALL
+  archive_read_support_filter_all (a);
+#else
+  archive_read_support_compression_all (a);
+#endif
+  archive_read_support_format_all (a);
+  if (archive_read_open_filename (a, gs_file_get_path_cached (archive), 8192) != ARCHIVE_OK)
+    return glnx_throw (error, "%s", archive_error_string (a));
+
+  opts.autocreate_parents = !!opt_tar_autocreate_parents;
+  opts.parallel = TRUE;
+
+  if (!ostree_repo_import_archive_to_mtree (repo, &opts, a, mtree, modifier, cancellable, error))
+    return FALSE;
+
+  if (archive_read_close (a) != ARCHIVE_OK)
+    return glnx_throw (error, "%s", archive_error_string (a));
+
+  return TRUE;
+#else
+  return ostree_repo_write_archive_to_mtree (repo, archive, mtree, modifier,
+                                             opt_tar_autocreate_parents,
+                                             cancellable, error);
+#endif
+}
+
 gboolean
 ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
@@ -502,9 +546,8 @@ ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError
           else if (strcmp (tree_type, "tar") == 0)
             {
               object_to_commit = g_file_new_for_path (tree);
-              if (!ostree_repo_write_archive_to_mtree (repo, object_to_commit, mtree, modifier,
-                                                       opt_tar_autocreate_parents,
-                                                       cancellable, error))
+              if (!write_tar_to_mtree (repo, object_to_commit, mtree, modifier,
+                                       cancellable, error))
                 goto out;
             }
           else if (strcmp (tree_type, "ref") == 0)
@@ -24,109 +24,61 @@
 #include "ot-builtins.h"
 #include "ostree.h"
 #include "ostree-repo-file.h"
-#include "ostree-libarchive-private.h"
 #include "otutil.h"
 
-#ifdef HAVE_LIBARCHIVE
-#include <archive.h>
-#include <archive_entry.h>
-#endif
-
 static char *opt_output_path;
 static char *opt_subpath;
 static char *opt_prefix;
 static gboolean opt_no_xattrs;
+static int opt_jobs = 1;
 
 static GOptionEntry options[] = {
   { "no-xattrs", 0, 0, G_OPTION_ARG_NONE, &opt_no_xattrs, "Skip output of extended attributes", NULL },
   { "subpath", 0, 0, G_OPTION_ARG_FILENAME, &opt_subpath, "Checkout sub-directory PATH", "PATH" },
   { "prefix", 0, 0, G_OPTION_ARG_FILENAME, &opt_prefix, "Add PATH as prefix to archive pathnames", "PATH" },
   { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_path, "Output to PATH ", "PATH" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &opt_jobs, "Load and decompress file content using N threads (default 1)", "N" },
   { NULL }
 };
 
-#ifdef HAVE_LIBARCHIVE
-
-static void
-propagate_libarchive_error (GError      **error,
-                            struct archive *a)
-{
-  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-               "%s", archive_error_string (a));
-}
-
-#endif
-
 gboolean
 ostree_builtin_export (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
   g_autoptr(GOptionContext) context = NULL;
   glnx_unref_object OstreeRepo *repo = NULL;
-  gboolean ret = FALSE;
   const char *rev;
   g_autoptr(GFile) root = NULL;
   g_autoptr(GFile) subtree = NULL;
   g_autofree char *commit = NULL;
   g_autoptr(GVariant) commit_data = NULL;
-  ot_cleanup_write_archive struct archive *a = NULL;
+  glnx_fd_close int output_fd = -1;
+  int fd;
   OstreeRepoExportArchiveOptions opts = { 0, };
 
   context = g_option_context_new ("COMMIT - Stream COMMIT to stdout in tar format");
 
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
-    goto out;
-
-#ifdef HAVE_LIBARCHIVE  
+    return FALSE;
 
   if (argc <= 1)
     {
       ot_util_usage_error (context, "A COMMIT argument is required", error);
-      goto out;
+      return FALSE;
     }
   rev = argv[1];
 
-  a = archive_write_new ();
-  /* Yes, this is hardcoded for now.  There is
-   * archive_write_set_format_filter_by_ext() but it's fairly magic.
-   * Many programs have support now for GNU tar, so should be a good
-   * default.  I also don't want to lock us into everything libarchive
-   * supports.
-   */
-  if (archive_write_set_format_gnutar (a) != ARCHIVE_OK)
-    {
-      propagate_libarchive_error (error, a);
-      goto out;
-    }
-  if (archive_write_add_filter_none (a) != ARCHIVE_OK)
-    {
-      propagate_libarchive_error (error, a);
-      goto out;
-    }
-  if (opt_output_path)
-    {
-      if (archive_write_open_filename (a, opt_output_path) != ARCHIVE_OK)
-        {
-          propagate_libarchive_error (error, a);
-          goto out;
-        }
-    }
-  else
-    {
-      if (archive_write_open_FILE (a, stdout) != ARCHIVE_OK)
-        {
-          propagate_libarchive_error (error, a);
-          goto out;
-        }
-    }
+  if (opt_jobs < 1)
+    return glnx_throw (error, "Invalid --jobs value %d", opt_jobs);
 
   if (opt_no_xattrs)
     opts.disable_xattrs = TRUE;
+  opts.n_jobs = opt_jobs;
 
   if (!ostree_repo_read_commit (repo, rev, &root, &commit, cancellable, error))
-    goto out;
+    return FALSE;
 
   if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, commit, &commit_data, error))
-    goto out;
+    return FALSE;
 
   opts.timestamp_secs = ostree_commit_get_timestamp (commit_data);
 
@@ -137,23 +89,19 @@ ostree_builtin_export (int argc, char **argv, GCancellable *cancellable, GError
 
   opts.path_prefix = opt_prefix;
 
-  if (!ostree_repo_export_tree_to_archive (repo, &opts, (OstreeRepoFile*)subtree, a,
-                                           cancellable, error))
-    goto out;
-
-  if (archive_write_close (a) != ARCHIVE_OK)
+  if (opt_output_path)
     {
-      propagate_libarchive_error (error, a);
-      goto out;
+      output_fd = open (opt_output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (output_fd < 0)
+        return glnx_throw_errno_prefix (error, "open(%s)", opt_output_path);
+      fd = output_fd;
     }
+  else
+    fd = STDOUT_FILENO;
+
+  if (!ostree_repo_export_tree_to_fd (repo, &opts, (OstreeRepoFile*)subtree, fd,
+                                      cancellable, error))
+    return FALSE;
 
-#else
-  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
-               "This version of ostree is not compiled with libarchive support");
-  goto out;
-#endif  
-  
-  ret = TRUE;
- out:
-  return ret;
+  return TRUE;
 }
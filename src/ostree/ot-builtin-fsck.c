@@ -236,6 +236,66 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
   return ret;
 }
 
+typedef struct {
+  GHashTable *commits;
+  GPtrArray *tombstones;
+  guint n_partial;
+  GHashTable *seen; /* Set<checksum>; a commit may be in a parent repo too */
+} FsckCommitsData;
+
+static gboolean
+fsck_collect_commit (OstreeRepo                  *repo,
+                     const OstreeRepoObjectEntry *entry,
+                     gpointer                     user_data,
+                     GError                     **error)
+{
+  FsckCommitsData *data = user_data;
+  const char *checksum = entry->checksum;
+  OstreeRepoCommitState commitstate = 0;
+  g_autoptr(GVariant) commit = NULL;
+
+  if (entry->objtype != OSTREE_OBJECT_TYPE_COMMIT)
+    return TRUE;
+  if (g_hash_table_contains (data->seen, checksum))
+    return TRUE;
+  g_hash_table_add (data->seen, g_strdup (checksum));
+
+  if (!ostree_repo_load_commit (repo, checksum, &commit, &commitstate, error))
+    return FALSE;
+
+  if (opt_add_tombstones)
+    {
+      GError *local_error = NULL;
+      g_autofree char *parent = ostree_commit_get_parent (commit);
+      if (parent)
+        {
+          g_autoptr(GVariant) parent_commit = NULL;
+          if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, parent,
+                                         &parent_commit, &local_error))
+            {
+              if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+                {
+                  g_ptr_array_add (data->tombstones, g_strdup (checksum));
+                  g_clear_error (&local_error);
+                }
+              else
+                {
+                  g_propagate_error (error, local_error);
+                  return FALSE;
+                }
+            }
+        }
+    }
+
+  if (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL)
+    data->n_partial++;
+  else
+    g_hash_table_add (data->commits,
+                      g_variant_ref_sink (ostree_object_name_serialize (checksum, entry->objtype)));
+
+  return TRUE;
+}
+
 gboolean
 ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
@@ -247,7 +307,6 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
   gboolean found_corruption = FALSE;
   guint n_partial = 0;
   g_autoptr(GHashTable) all_refs = NULL;
-  g_autoptr(GHashTable) objects = NULL;
   g_autoptr(GHashTable) commits = NULL;
   g_autoptr(GPtrArray) tombstones = NULL;
   context = g_option_context_new ("- Check the repository for consistency");
@@ -279,65 +338,19 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
   if (!opt_quiet)
     g_print ("Enumerating objects...\n");
 
-  if (!ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
-                                 &objects, cancellable, error))
-    goto out;
-
   commits = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
                                    (GDestroyNotify)g_variant_unref, NULL);
-  
-  g_hash_table_iter_init (&hash_iter, objects);
 
   if (opt_add_tombstones)
     tombstones = g_ptr_array_new_with_free_func (g_free);
 
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
-      OstreeRepoCommitState commitstate = 0;
-      g_autoptr(GVariant) commit = NULL;
-
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-
-      if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
-        {
-          if (!ostree_repo_load_commit (repo, checksum, &commit, &commitstate, error))
-            goto out;
-
-          if (opt_add_tombstones)
-            {
-              GError *local_error = NULL;
-              g_autofree char *parent = ostree_commit_get_parent (commit);
-              if (parent)
-                {
-                  g_autoptr(GVariant) parent_commit = NULL;
-                  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, parent,
-                                                 &parent_commit, &local_error))
-                    {
-                      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-                        {
-                          g_ptr_array_add (tombstones, g_strdup (checksum));
-                          g_clear_error (&local_error);
-                        }
-                      else
-                        {
-                          g_propagate_error (error, local_error);
-                          goto out;
-                        }
-                    }
-                }
-            }
-
-          if (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL)
-            n_partial++;
-          else
-            g_hash_table_add (commits, g_variant_ref (serialized_key));
-        }
-    }
-
-  g_clear_pointer (&objects, (GDestroyNotify) g_hash_table_unref);
+  { g_autoptr(GHashTable) seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    FsckCommitsData data = { commits, tombstones, 0, seen };
+    if (!ostree_repo_foreach_object (repo, OSTREE_REPO_LIST_OBJECTS_ALL,
+                                     fsck_collect_commit, &data, cancellable, error))
+      goto out;
+    n_partial = data.n_partial;
+  }
 
   if (!opt_quiet)
     g_print ("Verifying content integrity of %u commit objects...\n",
@@ -44,21 +44,14 @@ static GOptionEntry options[] = {
 };
 
 static void
-print_one_file_text (GFile     *f,
-                     GFileInfo *file_info)
+print_one_file_text (const char                    *path,
+                     const OstreeRepoWalkTreeEntry *entry)
 {
   g_autoptr(GString) buf = g_string_new ("");
   char type_c;
-  guint32 mode;
-  guint32 type;
-
-  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)f, NULL))
-    g_assert_not_reached ();
 
   type_c = '?';
-  mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
-  type = g_file_info_get_file_type (file_info);
-  switch (type)
+  switch (entry->type)
     {
     case G_FILE_TYPE_REGULAR:
       type_c = '-';
@@ -70,9 +63,9 @@ print_one_file_text (GFile     *f,
       type_c = 'l';
       break;
     case G_FILE_TYPE_SPECIAL:
-      if (S_ISCHR(mode))
+      if (S_ISCHR(entry->mode))
         type_c = 'c';
-      else if (S_ISBLK(mode))
+      else if (S_ISBLK(entry->mode))
         type_c = 'b';
       break;
     case G_FILE_TYPE_UNKNOWN:
@@ -83,115 +76,99 @@ print_one_file_text (GFile     *f,
     }
   g_string_append_c (buf, type_c);
   g_string_append_printf (buf, "0%04o %u %u %6" G_GUINT64_FORMAT " ",
-                          mode & ~S_IFMT,
-                          g_file_info_get_attribute_uint32 (file_info, "unix::uid"),
-                          g_file_info_get_attribute_uint32 (file_info, "unix::gid"),
-                          g_file_info_get_attribute_uint64 (file_info, "standard::size"));
-  
+                          entry->mode & ~S_IFMT, entry->uid, entry->gid, entry->size);
+
   if (opt_checksum)
     {
-      if (type == G_FILE_TYPE_DIRECTORY)
-        g_string_append_printf (buf, "%s ", ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)f));
-      g_string_append_printf (buf, "%s ", ostree_repo_file_get_checksum ((OstreeRepoFile*)f));
+      g_string_append_printf (buf, "%s ", entry->checksum);
+      if (entry->type == G_FILE_TYPE_DIRECTORY)
+        g_string_append_printf (buf, "%s ", entry->meta_checksum);
     }
 
   if (opt_xattrs)
     {
-      GVariant *xattrs;
-      char *formatted;
+      g_autofree char *formatted = g_variant_print (entry->xattrs, TRUE);
 
-      if (!ostree_repo_file_get_xattrs ((OstreeRepoFile*)f, &xattrs, NULL, NULL))
-        g_assert_not_reached ();
-      
-      formatted = g_variant_print (xattrs, TRUE);
       g_string_append (buf, "{ ");
       g_string_append (buf, formatted);
       g_string_append (buf, " } ");
-      g_free (formatted);
-      g_variant_unref (xattrs);
     }
 
-  g_string_append (buf, gs_file_get_path_cached (f));
+  g_string_append (buf, path);
+
+  if (entry->type == G_FILE_TYPE_SYMBOLIC_LINK)
+    g_string_append_printf (buf, " -> %s", entry->symlink_target);
 
-  if (type == G_FILE_TYPE_SYMBOLIC_LINK)
-    g_string_append_printf (buf, " -> %s", g_file_info_get_attribute_byte_string (file_info, "standard::symlink-target"));
-      
   g_print ("%s\n", buf->str);
 }
 
 static void
-print_one_file_binary (GFile     *f,
-                       GFileInfo *file_info)
+print_one_file_binary (const char *path)
 {
-  const char *path;
-
-  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)f, NULL))
-    g_assert_not_reached ();
-
-  path = gs_file_get_path_cached (f);
-
   fwrite (path, 1, strlen (path), stdout);
   fwrite ("\0", 1, 1, stdout);
 }
 
 static void
-print_one_file (GFile     *f,
-                GFileInfo *file_info)
+print_one_file (const char                    *path,
+                const OstreeRepoWalkTreeEntry *entry)
 {
   if (opt_nul_filenames_only)
-    print_one_file_binary (f, file_info);
+    print_one_file_binary (path);
   else
-    print_one_file_text (f, file_info);
+    print_one_file_text (path, entry);
 }
 
+typedef struct {
+  const char *prefix;
+  GString    *path;
+} PrintDirectoryData;
+
 static gboolean
-print_directory_recurse (GFile    *f,
-                         int       depth,
-                         GError  **error)
+print_directory_entry (OstreeRepo                    *repo,
+                       const OstreeRepoWalkTreeEntry *entry,
+                       gpointer                       user_data,
+                       GError                       **error)
 {
-  gboolean ret = FALSE;
-  g_autoptr(GFileEnumerator) dir_enum = NULL;
-  g_autoptr(GFile) child = NULL;
-  g_autoptr(GFileInfo) child_info = NULL;
-  GError *temp_error = NULL;
-
-  if (depth > 0)
-    depth--;
-  else if (depth == 0)
+  PrintDirectoryData *data = user_data;
+
+  /* The directory itself was already printed by the caller */
+  if (entry->depth == 0)
     return TRUE;
-  else
-    g_assert (depth == -1);
 
-  dir_enum = g_file_enumerate_children (f, OSTREE_GIO_FAST_QUERYINFO, 
-                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                        NULL, 
-                                        error);
-  if (!dir_enum)
-    goto out;
-  
-  while ((child_info = g_file_enumerator_next_file (dir_enum, NULL, &temp_error)) != NULL)
-    {
-      g_clear_object (&child);
-      child = g_file_get_child (f, g_file_info_get_name (child_info));
+  g_string_assign (data->path, data->prefix);
+  g_string_append (data->path, entry->path);
+  print_one_file (data->path->str, entry);
+  return TRUE;
+}
 
-      print_one_file (child, child_info);
+static gboolean
+print_directory_recurse (OstreeRepo     *repo,
+                         OstreeRepoFile *f,
+                         int             depth,
+                         GCancellable   *cancellable,
+                         GError        **error)
+{
+  PrintDirectoryData data;
+  OstreeRepoWalkTreeFlags flags = OSTREE_REPO_WALK_TREE_FLAGS_NONE;
+  const char *path = gs_file_get_path_cached ((GFile*)f);
+  gboolean ret;
 
-      if (g_file_info_get_file_type (child_info) == G_FILE_TYPE_DIRECTORY)
-        {
-          if (!print_directory_recurse (child, depth, error))
-            goto out;
-        }
+  /* Walk paths start with a slash, so avoid doubling it at the root */
+  data.prefix = strcmp (path, "/") == 0 ? "" : path;
+  data.path = g_string_new ("");
 
-      g_clear_object (&child_info);
-    }
-  if (temp_error)
-    {
-      g_propagate_error (error, temp_error);
-      goto out;
-    }
+  if (opt_xattrs)
+    flags |= OSTREE_REPO_WALK_TREE_FLAGS_QUERY_XATTRS;
+  else if (!opt_nul_filenames_only)
+    flags |= OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES;
 
-  ret = TRUE;
- out:
+  ret = ostree_repo_walk_tree (repo,
+                               ostree_repo_file_tree_get_contents_checksum (f),
+                               ostree_repo_file_tree_get_metadata_checksum (f),
+                               depth, flags, print_directory_entry, &data,
+                               cancellable, error);
+  g_string_free (data.path, TRUE);
   return ret;
 }
 
@@ -202,9 +179,11 @@ print_one_argument (OstreeRepo   *repo,
                     GCancellable *cancellable,
                     GError      **error)
 {
-  gboolean ret = FALSE;
   g_autoptr(GFile) f = NULL;
   g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  OstreeRepoWalkTreeEntry entry = { NULL, };
+  const char *path;
 
   f = g_file_resolve_relative_path (root, arg);
   
@@ -212,27 +191,48 @@ print_one_argument (OstreeRepo   *repo,
                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                  cancellable, error);
   if (!file_info)
-    goto out;
-  
-  print_one_file (f, file_info);
+    return FALSE;
+
+  path = gs_file_get_path_cached (f);
+  entry.path = path;
+  entry.name = g_file_info_get_name (file_info);
+  entry.type = g_file_info_get_file_type (file_info);
+  entry.uid = g_file_info_get_attribute_uint32 (file_info, "unix::uid");
+  entry.gid = g_file_info_get_attribute_uint32 (file_info, "unix::gid");
+  entry.mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+  entry.size = g_file_info_get_attribute_uint64 (file_info, "standard::size");
+  entry.symlink_target = g_file_info_get_attribute_byte_string (file_info, "standard::symlink-target");
+  if (entry.type == G_FILE_TYPE_DIRECTORY)
+    {
+      entry.checksum = ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)f);
+      entry.meta_checksum = ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)f);
+    }
+  else
+    entry.checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)f);
+  if (opt_xattrs)
+    {
+      if (!ostree_repo_file_get_xattrs ((OstreeRepoFile*)f, &xattrs, cancellable, error))
+        return FALSE;
+      entry.xattrs = xattrs;
+    }
+
+  print_one_file (path, &entry);
       
-  if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+  if (entry.type == G_FILE_TYPE_DIRECTORY)
     {
       if (opt_recursive)
         {
-          if (!print_directory_recurse (f, -1, error))
-            goto out;
+          if (!print_directory_recurse (repo, (OstreeRepoFile*)f, -1, cancellable, error))
+            return FALSE;
         }
       else if (!opt_dironly)
         {
-          if (!print_directory_recurse (f, 1, error))
-            goto out;
+          if (!print_directory_recurse (repo, (OstreeRepoFile*)f, 1, cancellable, error))
+            return FALSE;
         }
     }
   
-  ret = TRUE;
- out:
-  return ret;
+  return TRUE;
 }
 
 gboolean
@@ -41,6 +41,7 @@ static char* opt_cache_dir;
 static int opt_depth = 0;
 static int opt_frequency = 0;
 static char* opt_url;
+static char* opt_stats_json;
 
 static GOptionEntry options[] = {
    { "commit-metadata-only", 0, 0, G_OPTION_ARG_NONE, &opt_commit_only, "Fetch only the commit metadata", NULL },
@@ -57,9 +58,34 @@ static GOptionEntry options[] = {
    { "url", 0, 0, G_OPTION_ARG_STRING, &opt_url, "Pull objects from this URL instead of the one from the remote config", NULL },
    { "http-header", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_http_headers, "Add NAME=VALUE as HTTP header to all requests", "NAME=VALUE" },
    { "update-frequency", 0, 0, G_OPTION_ARG_INT, &opt_frequency, "Sets the update frequency, in milliseconds (0=1000ms) (default: 0)", "FREQUENCY" },
+   { "stats-json", 0, 0, G_OPTION_ARG_FILENAME, &opt_stats_json, "Write transfer statistics and request timings as JSON to PATH (- for stdout)", "PATH" },
    { NULL }
  };
 
+/* Collect the counters and per-request timings of a finished pull */
+static GVariant *
+pull_stats_from_progress (OstreeAsyncProgress *progress)
+{
+  static const char *const keys[] = { "fetched", "requested", "metadata-fetched",
+                                      "fetched-delta-parts", "bytes-transferred",
+                                      "timings", "max-write-queue-depth" };
+  g_auto(GVariantBuilder) builder = OT_VARIANT_BUILDER_INITIALIZER;
+  guint64 start_time = ostree_async_progress_get_uint64 (progress, "start-time");
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+  for (guint i = 0; i < G_N_ELEMENTS (keys); i++)
+    {
+      g_autoptr(GVariant) value = ostree_async_progress_get_variant (progress, keys[i]);
+      if (value)
+        g_variant_builder_add (&builder, "{sv}", keys[i], value);
+    }
+  if (start_time > 0)
+    g_variant_builder_add (&builder, "{sv}", "elapsed-usec",
+                           g_variant_new_uint64 (g_get_monotonic_time () - start_time));
+
+  return g_variant_builder_end (&builder);
+}
+
 static void
 gpg_verify_result_cb (OstreeRepo *repo,
                       const char *checksum,
@@ -308,6 +334,10 @@ ostree_builtin_pull (int argc, char **argv, GCancellable *cancellable, GError **
         progress = ostree_async_progress_new_and_connect (dry_run_console_progress_changed, NULL);
       }
 
+    /* The statistics are gathered through the progress keys */
+    if (opt_stats_json && !progress)
+      progress = ostree_async_progress_new ();
+
     if (console.is_tty)
       {
         signal_handler_id = g_signal_connect (repo, "gpg-verify-result",
@@ -321,6 +351,13 @@ ostree_builtin_pull (int argc, char **argv, GCancellable *cancellable, GError **
                                         progress, cancellable, error))
       goto out;
 
+    if (opt_stats_json)
+      {
+        g_autoptr(GVariant) stats = g_variant_ref_sink (pull_stats_from_progress (progress));
+        if (!ot_write_variant_as_json (stats, opt_stats_json, error))
+          goto out;
+      }
+
     if (progress)
       ostree_async_progress_finish (progress);
 
@@ -29,11 +29,13 @@
 static gboolean opt_delete;
 static gboolean opt_list;
 static char *opt_create;
+static gboolean opt_pack;
 
 static GOptionEntry options[] = {
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Delete refs which match PREFIX, rather than listing them", NULL },
   { "list", 0, 0, G_OPTION_ARG_NONE, &opt_list, "Do not remove the prefix from the refs", NULL },
   { "create", 0, 0, G_OPTION_ARG_STRING, &opt_create, "Create a new ref for an existing commit", "NEWREF" },
+  { "pack", 0, 0, G_OPTION_ARG_NONE, &opt_pack, "Move all refs into a single packed file", NULL },
   { NULL }
 };
 
@@ -139,7 +141,19 @@ ostree_builtin_refs (int argc, char **argv, GCancellable *cancellable, GError **
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     goto out;
 
-  if (argc >= 2)
+  if (opt_pack)
+    {
+      if (argc > 1 || opt_delete || opt_create)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--pack takes no other arguments");
+          goto out;
+        }
+
+      if (!ostree_repo_pack_refs (repo, cancellable, error))
+        goto out;
+    }
+  else if (argc >= 2)
     {
       if (opt_create && argc > 2)
         {
@@ -27,7 +27,7 @@
 #include "ostree.h"
 #include "otutil.h"
 
-static gboolean opt_update, opt_view, opt_raw;
+static gboolean opt_update, opt_view, opt_raw, opt_generate_packs;
 static char **opt_key_ids;
 static char *opt_gpg_homedir;
 
@@ -35,11 +35,64 @@ static GOptionEntry options[] = {
   { "update", 'u', 0, G_OPTION_ARG_NONE, &opt_update, "Update the summary", NULL },
   { "view", 'v', 0, G_OPTION_ARG_NONE, &opt_view, "View the local summary file", NULL },
   { "raw", 0, 0, G_OPTION_ARG_NONE, &opt_raw, "View the raw bytes of the summary file", NULL },
+  { "generate-packs", 0, 0, G_OPTION_ARG_NONE, &opt_generate_packs, "Generate object packs for refs which don't have one (archive-z2 only)", NULL },
   { "gpg-sign", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_key_ids, "GPG Key ID to sign the summary with", "KEY-ID"},
   { "gpg-homedir", 0, 0, G_OPTION_ARG_FILENAME, &opt_gpg_homedir, "GPG Homedir to use when looking for keyrings", "HOMEDIR"},
   { NULL }
 };
 
+static gboolean
+generate_missing_packs (OstreeRepo    *repo,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  g_autoptr(GHashTable) refs = NULL;
+  GHashTableIter hashiter;
+  gpointer hashkey, hashvalue;
+
+  if (!ostree_repo_list_refs (repo, NULL, &refs, cancellable, error))
+    return FALSE;
+
+  g_hash_table_iter_init (&hashiter, refs);
+  while (g_hash_table_iter_next (&hashiter, &hashkey, &hashvalue))
+    {
+      const char *ref = hashkey;
+      const char *commit = hashvalue;
+      g_autofree char *remotename = NULL;
+      g_autofree char *index_path = NULL;
+      struct stat stbuf;
+
+      if (!ostree_parse_refspec (ref, &remotename, NULL, error))
+        return FALSE;
+      /* Remote refs aren't in the summary */
+      if (remotename != NULL)
+        continue;
+
+      /* The layout written by ostree_repo_generate_object_pack() */
+      index_path = g_strconcat ("packs/", commit, ".index", NULL);
+      if (fstatat (ostree_repo_get_dfd (repo), index_path, &stbuf, 0) == 0)
+        continue;
+      else if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "fstatat(%s)", index_path);
+
+      if (!ostree_repo_generate_object_pack (repo, commit, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Print the time taken by a step, and reset @start_time for the next one */
+static void
+print_elapsed (const char *what,
+               gint64     *start_time)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_print ("%s in %.3f seconds\n", what, (now - *start_time) / (double) G_USEC_PER_SEC);
+  *start_time = now;
+}
+
 gboolean
 ostree_builtin_summary (int argc, char **argv, GCancellable *cancellable, GError **error)
 {
@@ -58,8 +111,18 @@ ostree_builtin_summary (int argc, char **argv, GCancellable *cancellable, GError
       if (!ostree_ensure_repo_writable (repo, error))
         goto out;
 
+      gint64 start_time = g_get_monotonic_time ();
+
+      if (opt_generate_packs)
+        {
+          if (!generate_missing_packs (repo, cancellable, error))
+            goto out;
+          print_elapsed ("Generated object packs", &start_time);
+        }
+
       if (!ostree_repo_regenerate_summary (repo, NULL, cancellable, error))
         goto out;
+      print_elapsed ("Regenerated summary", &start_time);
 
       if (opt_key_ids)
         {
@@ -69,6 +132,7 @@ ostree_builtin_summary (int argc, char **argv, GCancellable *cancellable, GError
                                                       cancellable,
                                                       error))
             goto out;
+          print_elapsed ("Signed summary", &start_time);
         }
     }
   else if (opt_view)
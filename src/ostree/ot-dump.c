@@ -291,6 +291,11 @@ ot_dump_summary_bytes (GBytes          *summary_bytes,
           pretty_key = "Static Deltas";
           value_str = g_variant_print (value, FALSE);
         }
+      else if (g_strcmp0 (key, OSTREE_SUMMARY_OBJECT_PACKS) == 0)
+        {
+          pretty_key = "Object Packs";
+          value_str = g_variant_print (value, FALSE);
+        }
       else if (g_strcmp0 (key, OSTREE_SUMMARY_LAST_MODIFIED) == 0)
         {
           pretty_key = "Last-Modified";
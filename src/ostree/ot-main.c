@@ -419,3 +419,27 @@ ot_enable_tombstone_commits (OstreeRepo *repo, GError **error)
 
   return TRUE;
 }
+
+/* Write @variant as JSON to @path, or standard output for "-"; used
+ * by the --stats-json options.
+ */
+gboolean
+ot_write_variant_as_json (GVariant   *variant,
+                          const char *path,
+                          GError    **error)
+{
+  g_autofree char *json = ot_variant_to_json (variant);
+  g_autofree char *contents = g_strconcat (json, "\n", NULL);
+
+  if (strcmp (path, "-") == 0)
+    {
+      g_print ("%s", contents);
+      return TRUE;
+    }
+
+  if (!glnx_file_replace_contents_at (AT_FDCWD, path, (guint8*)contents, strlen (contents),
+                                      GLNX_FILE_REPLACE_NODATASYNC, NULL, error))
+    return glnx_prefix_error (error, "Writing %s", path);
+
+  return TRUE;
+}
@@ -65,3 +65,5 @@ gboolean ostree_ensure_repo_writable (OstreeRepo *repo, GError **error);
 void ostree_print_gpg_verify_result (OstreeGpgVerifyResult *result);
 
 gboolean ot_enable_tombstone_commits (OstreeRepo *repo, GError **error);
+
+gboolean ot_write_variant_as_json (GVariant *variant, const char *path, GError **error);
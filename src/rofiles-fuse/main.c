@@ -39,6 +39,12 @@
 
 // Global to store our read-write path
 static int basefd = -1;
+static gboolean opt_copyup;
+
+/* Serializes copyup, so that concurrent writers to the same file all
+ * end up using the same copy.
+ */
+G_LOCK_DEFINE_STATIC (copyup);
 
 static inline const char *
 ENSURE_RELPATH (const char *path)
@@ -66,6 +72,15 @@ callback_getattr (const char *path, struct stat *st_data)
   return 0;
 }
 
+static int
+callback_fgetattr (const char *path, struct stat *st_data,
+                   struct fuse_file_info *finfo)
+{
+  if (fstat (finfo->fh, st_data) == -1)
+    return -errno;
+  return 0;
+}
+
 static int
 callback_readlink (const char *path, char *buf, size_t size)
 {
@@ -84,31 +99,41 @@ callback_readlink (const char *path, char *buf, size_t size)
 }
 
 static int
-callback_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
-                  off_t offset, struct fuse_file_info *fi)
+callback_opendir (const char *path, struct fuse_file_info *finfo)
 {
   DIR *dp;
-  struct dirent *de;
   int dfd;
 
   path = ENSURE_RELPATH (path);
 
-  if (!*path)
-    {
-      dfd = fcntl (basefd, F_DUPFD_CLOEXEC, 3);
-      lseek (dfd, 0, SEEK_SET);
-    }
-  else
-    {
-      dfd = openat (basefd, path, O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC | O_NOCTTY);
-      if (dfd == -1)
-        return -errno;
-    }
+  dfd = openat (basefd, path, O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC | O_NOCTTY);
+  if (dfd == -1)
+    return -errno;
 
   /* Transfers ownership of fd */
   dp = fdopendir (dfd);
   if (dp == NULL)
-    return -errno;
+    {
+      int errsv = errno;
+      (void) close (dfd);
+      return -errsv;
+    }
+
+  finfo->fh = (uint64_t) (uintptr_t) dp;
+  return 0;
+}
+
+static int
+callback_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
+                  off_t offset, struct fuse_file_info *finfo)
+{
+  DIR *dp = (DIR*) (uintptr_t) finfo->fh;
+  struct dirent *de;
+
+  /* We don't pass offsets to the filler, so libfuse expects the whole
+   * directory each time.
+   */
+  rewinddir (dp);
 
   while ((de = readdir (dp)) != NULL)
     {
@@ -120,7 +145,13 @@ callback_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
         break;
     }
 
-  (void) closedir (dp);
+  return 0;
+}
+
+static int
+callback_releasedir (const char *path, struct fuse_file_info *finfo)
+{
+  (void) closedir ((DIR*) (uintptr_t) finfo->fh);
   return 0;
 }
 
@@ -202,6 +233,101 @@ stbuf_is_regfile_hardlinked (struct stat *stbuf)
   return S_ISREG (stbuf->st_mode) && stbuf->st_nlink > 1;
 }
 
+static int
+gioerror_to_errno (GIOErrorEnum e)
+{
+  switch (e)
+    {
+    case G_IO_ERROR_NOT_FOUND:
+      return ENOENT;
+    case G_IO_ERROR_EXISTS:
+      return EEXIST;
+    case G_IO_ERROR_NO_SPACE:
+      return ENOSPC;
+    case G_IO_ERROR_PERMISSION_DENIED:
+      return EACCES;
+    case G_IO_ERROR_NOT_SUPPORTED:
+      return ENOTSUP;
+    case G_IO_ERROR_READ_ONLY:
+      return EROFS;
+    default:
+      return EIO;
+    }
+}
+
+static int
+error_to_errno (GError *error)
+{
+  if (error->domain == G_IO_ERROR)
+    return gioerror_to_errno (error->code);
+  return EIO;
+}
+
+/* Break the hardlink at @path by replacing it with a copy, using a
+ * reflink if the filesystem supports it.  The copy keeps the
+ * ownership, mode and xattrs of the original.
+ */
+static int
+copyup (const char *path)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  g_autofree char *dirpath = g_path_get_dirname (path);
+  g_autofree char *tmp_path = NULL;
+  glnx_fd_close int src_fd = -1;
+  glnx_fd_close int tmp_fd = -1;
+  struct stat stbuf;
+  int r = 0;
+
+  G_LOCK (copyup);
+
+  src_fd = openat (basefd, path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (src_fd == -1)
+    {
+      /* Don't try to copy up through symlinks */
+      r = (errno == ELOOP) ? -EROFS : -errno;
+      goto out;
+    }
+  if (fstat (src_fd, &stbuf) == -1)
+    {
+      r = -errno;
+      goto out;
+    }
+  /* Another writer may have already done it */
+  if (!stbuf_is_regfile_hardlinked (&stbuf))
+    goto out;
+
+  if (!glnx_open_tmpfile_linkable_at (basefd, dirpath, O_WRONLY | O_CLOEXEC,
+                                      &tmp_fd, &tmp_path, &local_error))
+    goto out_error;
+  if (glnx_regfile_copy_bytes (src_fd, tmp_fd, stbuf.st_size, TRUE) < 0)
+    {
+      r = -errno;
+      goto out;
+    }
+  if (fchown (tmp_fd, stbuf.st_uid, stbuf.st_gid) == -1 ||
+      fchmod (tmp_fd, stbuf.st_mode & 07777) == -1)
+    {
+      r = -errno;
+      goto out;
+    }
+  if (!glnx_fd_get_all_xattrs (src_fd, &xattrs, NULL, &local_error))
+    goto out_error;
+  if (!glnx_fd_set_all_xattrs (tmp_fd, xattrs, NULL, &local_error))
+    goto out_error;
+
+  if (!glnx_link_tmpfile_at (basefd, GLNX_LINK_TMPFILE_REPLACE, tmp_fd, tmp_path,
+                             basefd, path, &local_error))
+    goto out_error;
+
+ out:
+  G_UNLOCK (copyup);
+  return r;
+ out_error:
+  G_UNLOCK (copyup);
+  return -error_to_errno (local_error);
+}
+
 static int
 can_write (const char *path)
 {
@@ -214,7 +340,11 @@ can_write (const char *path)
         return -errno;
     }
   if (stbuf_is_regfile_hardlinked (&stbuf))
-    return -EROFS;
+    {
+      if (opt_copyup)
+        return copyup (path);
+      return -EROFS;
+    }
   return 0;
 }
 
@@ -262,6 +392,15 @@ callback_truncate (const char *path, off_t size)
   return 0;
 }
 
+static int
+callback_ftruncate (const char *path, off_t size, struct fuse_file_info *finfo)
+{
+  /* Hardlinks were checked when the file was opened for writing */
+  if (ftruncate (finfo->fh, size) == -1)
+    return -errno;
+  return 0;
+}
+
 static int
 callback_utime (const char *path, struct utimbuf *buf)
 {
@@ -312,8 +451,20 @@ do_open (const char *path, mode_t mode, struct fuse_file_info *finfo)
 
       if (stbuf_is_regfile_hardlinked (&stbuf))
         {
+          int r;
+
           (void) close (fd);
-          return -EROFS;
+          if (!opt_copyup)
+            return -EROFS;
+
+          r = copyup (path);
+          if (r != 0)
+            return r;
+
+          /* Now open the copy */
+          fd = openat (basefd, path, finfo->flags & ~O_TRUNC, mode);
+          if (fd == -1)
+            return -errno;
         }
 
       /* Handle O_TRUNC here only after verifying hardlink state */
@@ -471,9 +622,18 @@ callback_removexattr (const char *path, const char *name)
 }
 
 struct fuse_operations callback_oper = {
+  /* Operations on open files only use the fd, so libfuse doesn't need
+   * to compute their path.
+   */
+  .flag_nullpath_ok = 1,
+  .flag_nopath = 1,
+
   .getattr = callback_getattr,
+  .fgetattr = callback_fgetattr,
   .readlink = callback_readlink,
+  .opendir = callback_opendir,
   .readdir = callback_readdir,
+  .releasedir = callback_releasedir,
   .mknod = callback_mknod,
   .mkdir = callback_mkdir,
   .symlink = callback_symlink,
@@ -484,6 +644,7 @@ struct fuse_operations callback_oper = {
   .chmod = callback_chmod,
   .chown = callback_chown,
   .truncate = callback_truncate,
+  .ftruncate = callback_ftruncate,
   .utime = callback_utime,
   .create = callback_create,
   .open = callback_open,
@@ -506,6 +667,7 @@ struct fuse_operations callback_oper = {
 enum {
   KEY_HELP,
   KEY_VERSION,
+  KEY_COPYUP,
 };
 
 static void
@@ -518,6 +680,10 @@ usage (const char *progname)
            "\n"
            "general options:\n"
            "   -o opt,[opt...]     mount options\n"
+           "   -o attr_timeout=T,entry_timeout=T\n"
+           "                       cache attributes and lookups for T seconds (default: 1.0)\n"
+           "   -s                  handle requests in a single thread\n"
+           "   --copyup            Copy hardlinked files on first write, rather than returning EROFS\n"
            "   -h  --help          print help\n"
            "\n", progname);
 }
@@ -550,6 +716,9 @@ rofs_parse_opt (void *data, const char *arg, int key,
     case KEY_HELP:
       usage (outargs->argv[0]);
       exit (EXIT_SUCCESS);
+    case KEY_COPYUP:
+      opt_copyup = TRUE;
+      return 0;
     default:
       fprintf (stderr, "see `%s -h' for usage\n", outargs->argv[0]);
       exit (EXIT_FAILURE);
@@ -562,6 +731,7 @@ static struct fuse_opt rofs_opts[] = {
   FUSE_OPT_KEY ("--help", KEY_HELP),
   FUSE_OPT_KEY ("-V", KEY_VERSION),
   FUSE_OPT_KEY ("--version", KEY_VERSION),
+  FUSE_OPT_KEY ("--copyup", KEY_COPYUP),
   FUSE_OPT_END
 };
 
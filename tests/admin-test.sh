@@ -174,6 +174,27 @@ assert_file_has_content reftest.txt testos:buildmaster/x86_64-runtime
 
 echo "ok upgrade"
 
+# The upgrade above reused unchanged files of the previous deployment;
+# verify the result matches a fresh checkout, down to the hardlinks.
+${CMD_PREFIX} ostree --repo=sysroot/ostree/repo checkout ${newrev} fresh-checkout
+for d in sysroot/ostree/deploy/testos/deploy/${newrev}.0 fresh-checkout; do
+    (cd ${d}/usr && find . -printf '%P %y %m %U %G %l\n' && find . -type f -printf '%P %i\n') | sort > ${d##*/}-usr.txt
+done
+diff -u fresh-checkout-usr.txt ${newrev}.0-usr.txt
+diff -r sysroot/ostree/deploy/testos/deploy/${newrev}.0/usr fresh-checkout/usr
+rm -rf fresh-checkout
+
+echo "ok incremental deploy"
+
+${CMD_PREFIX} ostree admin deploy --retain --os=testos --stats-json=deploy-stats.json testos:testos/buildmaster/x86_64-runtime
+for phase in checkout etc-merge selinux-relabel kernel-install bootloader sync; do
+    assert_file_has_content deploy-stats.json "\"${phase}\":{\"usec\":[0-9]*,"
+done
+${CMD_PREFIX} ostree admin undeploy 0
+validate_bootloader
+
+echo "ok deploy stats"
+
 originfile=$(${CMD_PREFIX} ostree admin --print-current-dir).origin
 cp ${originfile} saved-origin
 ${CMD_PREFIX} ostree admin set-origin --index=0 bacon --set=gpg-verify=false http://tasty.com
@@ -19,7 +19,7 @@
 
 set -euo pipefail
 
-echo "1..$((69 + ${extra_basic_tests:-0}))"
+echo "1..$((70 + ${extra_basic_tests:-0}))"
 
 $CMD_PREFIX ostree --version > version.yaml
 python -c 'import yaml; yaml.safe_load(open("version.yaml"))'
@@ -524,6 +524,16 @@ cd ${test_tmpdir}
 $OSTREE ls test2
 echo "ok ls with no argument"
 
+cd ${test_tmpdir}
+$OSTREE ls -R test2 > ls.txt
+assert_file_has_content ls.txt '^d0.* /baz/deeper$'
+assert_file_has_content ls.txt '^-0.* 3 /baz/deeper/ohyeah$'
+assert_file_has_content ls.txt '^l00777 .* /baz/alink -> nonexistent$'
+$OSTREE ls test2 /baz > ls.txt
+assert_file_has_content ls.txt ' /baz/deeper$'
+assert_not_file_has_content ls.txt 'ohyeah'
+echo "ok ls -R"
+
 cd ${test_tmpdir}
 if $OSTREE ls test2 /baz/cow/notadir 2>errmsg; then
     assert_not_reached
@@ -35,7 +35,7 @@ function verify_initial_contents() {
     assert_file_has_content baz/cow '^moo$'
 }
 
-echo "1..25"
+echo "1..26"
 
 # Try both syntaxes
 repo_init --no-gpg-verify
@@ -48,6 +48,16 @@ cd ${test_tmpdir}
 verify_initial_contents
 echo "ok pull contents"
 
+cd ${test_tmpdir}
+repo_init --no-gpg-verify
+${CMD_PREFIX} ostree --repo=repo pull --stats-json=pull-stats.json origin main
+assert_file_has_content pull-stats.json '"bytes-transferred"'
+assert_file_has_content pull-stats.json '"metadata":{.*"ttfb":{"count":[1-9]'
+assert_file_has_content pull-stats.json '"content":{.*"write":{.*"buckets":\['
+assert_file_has_content pull-stats.json '"content":{.*"write-queue":{"count":[1-9]'
+assert_file_has_content pull-stats.json '"max-write-queue-depth":'
+echo "ok pull stats json"
+
 cd ${test_tmpdir}
 mkdir mirrorrepo
 ostree_repo_init mirrorrepo --mode=archive-z2
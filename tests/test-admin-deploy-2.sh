@@ -24,7 +24,7 @@ set -euo pipefail
 # Exports OSTREE_SYSROOT so --sysroot not needed.
 setup_os_repository "archive-z2" "syslinux"
 
-echo "1..3"
+echo "1..4"
 
 ${CMD_PREFIX} ostree --repo=sysroot/ostree/repo pull-local --remote=testos testos-repo testos/buildmaster/x86_64-runtime
 rev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
@@ -61,3 +61,15 @@ assert_has_dir sysroot/boot/ostree/testos-${bootcsum}
 assert_file_has_content sysroot/ostree/deploy/testos/deploy/${newrev}.0/etc/os-release 'NAME=TestOS'
 
 echo "ok manual cleanup"
+
+# The merge deployment only speeds up the checkout; deploying must
+# still work when its commit is gone, e.g. pruned
+rm sysroot/ostree/repo/objects/${newrev:0:2}/${newrev:2}.commit
+os_repository_new_commit "2" "2"
+${CMD_PREFIX} ostree pull --repo=sysroot/ostree/repo testos testos/buildmaster/x86_64-runtime
+${CMD_PREFIX} ostree admin deploy --os=testos testos:testos/buildmaster/x86_64-runtime
+latestrev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
+assert_not_streq ${newrev} ${latestrev}
+assert_file_has_content sysroot/ostree/deploy/testos/deploy/${latestrev}.0/usr/bin/content-iteration 'content iteration 2'
+
+echo "ok deploy with missing merge deployment commit"
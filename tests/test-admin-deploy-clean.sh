@@ -24,7 +24,7 @@ set -euo pipefail
 # Exports OSTREE_SYSROOT so --sysroot not needed.
 setup_os_repository "archive-z2" "syslinux"
 
-echo "1..1"
+echo "1..3"
 
 ${CMD_PREFIX} ostree --repo=sysroot/ostree/repo pull-local --remote=testos testos-repo testos/buildmaster/x86_64-runtime
 rev=$(${CMD_PREFIX} ostree --repo=sysroot/ostree/repo rev-parse testos/buildmaster/x86_64-runtime)
@@ -35,3 +35,43 @@ ${CMD_PREFIX} ostree --repo=sysroot/ostree/repo refs > refs.txt
 assert_not_file_has_content refs.txt '^ostree/'
 
 echo "ok deploy + undeploy repo prune"
+
+# The third deployment pushes out the first, which a deploy only moves
+# to the trash
+for i in 1 2 3; do
+    ${CMD_PREFIX} ostree admin deploy --os=testos testos:testos/buildmaster/x86_64-runtime
+done
+assert_not_has_dir sysroot/ostree/deploy/testos/deploy/${rev}.0
+assert_has_dir sysroot/ostree/deploy/testos/deploy/${rev}.2
+ls sysroot/ostree/trash | wc -l > trashcount
+assert_file_has_content trashcount "^1$"
+${CMD_PREFIX} ostree admin cleanup --trash
+ls sysroot/ostree/trash | wc -l > trashcount
+assert_file_has_content trashcount "^0$"
+
+# A full cleanup also empties it
+${CMD_PREFIX} ostree admin undeploy 1
+ls sysroot/ostree/trash | wc -l > trashcount
+assert_file_has_content trashcount "^0$"
+assert_has_dir sysroot/ostree/deploy/testos/deploy/${rev}.2
+${CMD_PREFIX} ostree admin status
+
+echo "ok deploy cleanup trash"
+
+# Repeated deploys without emptying the trash don't let it grow
+# beyond a few entries
+for i in 1 2 3 4 5 6; do
+    ${CMD_PREFIX} ostree admin deploy --os=testos testos:testos/buildmaster/x86_64-runtime
+    test $(ls sysroot/ostree/trash | wc -l) -le 3
+done
+ls sysroot/ostree/trash | wc -l > trashcount
+assert_file_has_content trashcount "^3$"
+
+# Deploying leaves the prune for later, and a full cleanup does it
+assert_has_file sysroot/ostree/prune-pending
+${CMD_PREFIX} ostree admin cleanup
+assert_not_has_file sysroot/ostree/prune-pending
+ls sysroot/ostree/trash | wc -l > trashcount
+assert_file_has_content trashcount "^0$"
+
+echo "ok deploy trash does not accumulate, deferred prune"
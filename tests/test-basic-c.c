@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <gio/gio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "libglnx.h"
 #include "libostreetest.h"
@@ -218,6 +220,321 @@ test_object_writes (gconstpointer data)
   }
 }
 
+static void
+test_lazy_mtree (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) root = NULL;
+  g_autoptr(GFile) written = NULL;
+  g_autoptr(GFile) cow2 = NULL;
+  g_autofree char *commit = NULL;
+  g_autofree char *cow_checksum = NULL;
+  g_autofree char *orig_contents = NULL;
+  glnx_unref_object OstreeMutableTree *mtree = ostree_mutable_tree_new ();
+  glnx_unref_object OstreeMutableTree *baz = NULL;
+  glnx_unref_object OstreeMutableTree *another = NULL;
+
+  g_assert (ostree_repo_read_commit (repo, "test2", &root, &commit, NULL, &error));
+  g_assert_no_error (error);
+  orig_contents = g_strdup (ostree_repo_file_tree_get_contents_checksum (OSTREE_REPO_FILE (root)));
+
+  g_assert (ostree_repo_prepare_transaction (repo, NULL, NULL, &error));
+  g_assert_no_error (error);
+
+  /* Nothing is loaded, so the existing dirtree is reused as is */
+  g_assert (ostree_repo_write_directory_to_mtree (repo, root, mtree, NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (ostree_mutable_tree_get_contents_checksum (mtree), ==, orig_contents);
+
+  /* Add a file to baz/; its untouched siblings stay lazy */
+  g_assert (ostree_mutable_tree_ensure_dir (mtree, "baz", &baz, &error));
+  g_assert (ostree_mutable_tree_lookup (baz, "cow", &cow_checksum, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (ostree_mutable_tree_replace_file (baz, "cow2", cow_checksum, &error));
+  g_assert_no_error (error);
+  g_assert_null (ostree_mutable_tree_get_contents_checksum (mtree));
+  g_assert (ostree_mutable_tree_lookup (baz, "another", NULL, &another, &error));
+  g_assert_no_error (error);
+  g_assert_nonnull (ostree_mutable_tree_get_contents_checksum (another));
+
+  g_assert (ostree_repo_write_mtree (repo, mtree, &written, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (ostree_repo_file_tree_get_contents_checksum (OSTREE_REPO_FILE (written)), !=, orig_contents);
+  g_assert (ostree_repo_commit_transaction (repo, NULL, NULL, &error));
+  g_assert_no_error (error);
+
+  cow2 = g_file_resolve_relative_path (written, "baz/cow2");
+  g_assert (g_file_query_exists (cow2, NULL));
+}
+
+static gboolean
+walk_tree_collect (OstreeRepo                    *repo,
+                   const OstreeRepoWalkTreeEntry *entry,
+                   gpointer                       user_data,
+                   GError                       **error)
+{
+  GHashTable *seen = user_data;
+  g_autofree char *desc = NULL;
+
+  switch (entry->type)
+    {
+    case G_FILE_TYPE_DIRECTORY:
+      g_assert_nonnull (entry->meta_checksum);
+      g_assert (S_ISDIR (entry->mode));
+      desc = g_strdup_printf ("d %u", entry->depth);
+      break;
+    case G_FILE_TYPE_REGULAR:
+      g_assert (S_ISREG (entry->mode));
+      desc = g_strdup_printf ("- %u %" G_GUINT64_FORMAT, entry->depth, entry->size);
+      break;
+    case G_FILE_TYPE_SYMBOLIC_LINK:
+      desc = g_strdup_printf ("l %s", entry->symlink_target);
+      break;
+    case G_FILE_TYPE_UNKNOWN:
+      g_assert_null (entry->meta_checksum);
+      desc = g_strdup_printf ("? %u", entry->depth);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+  g_assert (ostree_validate_checksum_string (entry->checksum, NULL));
+  g_assert (g_str_has_suffix (entry->path, entry->name));
+
+  g_hash_table_insert (seen, g_strdup (entry->path), g_steal_pointer (&desc));
+  return TRUE;
+}
+
+static void
+test_walk_tree (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) root = NULL;
+  g_autoptr(GHashTable) seen = NULL;
+  const char *contents;
+  const char *meta;
+
+  g_assert (ostree_repo_read_commit (repo, "test2", &root, NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (ostree_repo_file_ensure_resolved (OSTREE_REPO_FILE (root), &error));
+  g_assert_no_error (error);
+  contents = ostree_repo_file_tree_get_contents_checksum (OSTREE_REPO_FILE (root));
+  meta = ostree_repo_file_tree_get_metadata_checksum (OSTREE_REPO_FILE (root));
+
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_assert (ostree_repo_walk_tree (repo, contents, meta, -1,
+                                   OSTREE_REPO_WALK_TREE_FLAGS_QUERY_FILES,
+                                   walk_tree_collect, seen, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/"), ==, "d 0");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz/deeper"), ==, "d 2");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz/cow"), ==, "- 2 4");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz/cowro"), ==, "- 2 6");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz/deeper/ohyeahx"), ==, "- 3 4");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz/alink"), ==, "l nonexistent");
+
+  /* Without querying files, only dirtree and dirmeta objects are read */
+  g_hash_table_remove_all (seen);
+  g_assert (ostree_repo_walk_tree (repo, contents, meta, 1,
+                                   OSTREE_REPO_WALK_TREE_FLAGS_NONE,
+                                   walk_tree_collect, seen, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/baz"), ==, "d 1");
+  g_assert_cmpstr (g_hash_table_lookup (seen, "/firstfile"), ==, "? 1");
+  g_assert_null (g_hash_table_lookup (seen, "/baz/cow"));
+}
+
+typedef struct {
+  GHashTable *objects; /* Set<GVariant> */
+  OstreeRepo *parent;
+  guint n_in_parent;
+} ForeachObjectData;
+
+static gboolean
+foreach_object_collect (OstreeRepo                  *repo,
+                        const OstreeRepoObjectEntry *entry,
+                        gpointer                     user_data,
+                        GError                     **error)
+{
+  ForeachObjectData *data = user_data;
+  g_autofree char *checksum = ostree_checksum_from_bytes (entry->csum);
+  struct stat stbuf;
+  guint64 storage_size;
+
+  g_assert_cmpstr (entry->checksum, ==, checksum);
+  g_assert (entry->is_loose);
+  g_assert (entry->repo == repo || entry->repo == data->parent);
+  if (entry->repo != repo)
+    data->n_in_parent++;
+
+  g_assert_cmpint (fstatat (entry->dfd, entry->name, &stbuf, AT_SYMLINK_NOFOLLOW), ==, 0);
+  g_assert_cmpuint (entry->size, ==, stbuf.st_size);
+  g_assert_cmpuint (entry->mode, ==, stbuf.st_mode);
+  g_assert_cmpint (entry->mtime, ==, stbuf.st_mtime);
+  g_assert (ostree_repo_query_object_storage_size (entry->repo, entry->objtype, entry->checksum,
+                                                   &storage_size, NULL, error));
+  g_assert_cmpuint (entry->size, ==, storage_size);
+
+  g_hash_table_add (data->objects, ostree_object_name_serialize (entry->checksum, entry->objtype));
+  return TRUE;
+}
+
+/* Enumerate @repo and check we see the same objects as listing them */
+static void
+assert_foreach_object_matches_list (OstreeRepo                 *repo,
+                                    OstreeRepo                 *parent,
+                                    OstreeRepoListObjectsFlags  flags,
+                                    guint                       expected_in_parent)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GHashTable) listed = NULL;
+  ForeachObjectData data = { 0, };
+  GHashTableIter iter;
+  gpointer key;
+
+  data.objects = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                        (GDestroyNotify) g_variant_unref, NULL);
+  data.parent = parent;
+  g_assert (ostree_repo_foreach_object (repo, flags | OSTREE_REPO_LIST_OBJECTS_QUERY_STAT,
+                                        foreach_object_collect, &data, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (data.n_in_parent, ==, expected_in_parent);
+
+  g_assert (ostree_repo_list_objects (repo, flags, &listed, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (data.objects), ==, g_hash_table_size (listed));
+  g_hash_table_iter_init (&iter, listed);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_assert (g_hash_table_contains (data.objects, key));
+
+  g_hash_table_unref (data.objects);
+}
+
+static void
+test_foreach_object (gconstpointer data)
+{
+  OstreeRepo *repo = OSTREE_REPO (data);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) child_path = g_file_new_for_path ("childrepo");
+  glnx_unref_object OstreeRepo *child = NULL;
+  g_autoptr(GHashTable) parent_objects = NULL;
+  g_autoptr(GHashTable) child_objects = NULL;
+
+  assert_foreach_object_matches_list (repo, NULL, OSTREE_REPO_LIST_OBJECTS_ALL, 0);
+
+  /* A repo whose only new content is one file; everything else is in the parent */
+  g_assert (ot_test_run_libtest ("rm -rf childrepo childrepo-files && "
+                                 "mkdir -p childrepo-files && echo child > childrepo-files/childfile && "
+                                 "${CMD_PREFIX} ostree --repo=childrepo init --mode=archive-z2 && "
+                                 "${CMD_PREFIX} ostree --repo=childrepo config set core.parent $(pwd)/repo && "
+                                 "${CMD_PREFIX} ostree --repo=childrepo commit -b child --tree=dir=childrepo-files",
+                                 &error));
+  g_assert_no_error (error);
+  child = ostree_repo_new (child_path);
+  g_assert (ostree_repo_open (child, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (ostree_repo_get_parent (child) != NULL);
+
+  g_assert (ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_ALL, &parent_objects, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (ostree_repo_list_objects (child, OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS,
+                                      &child_objects, NULL, &error));
+  g_assert_no_error (error);
+  /* At least the commit, dirtree and file object are new */
+  g_assert_cmpuint (g_hash_table_size (child_objects), >=, 3);
+
+  assert_foreach_object_matches_list (child, ostree_repo_get_parent (child),
+                                      OSTREE_REPO_LIST_OBJECTS_ALL | OSTREE_REPO_LIST_OBJECTS_NO_PARENTS, 0);
+  assert_foreach_object_matches_list (child, ostree_repo_get_parent (child),
+                                      OSTREE_REPO_LIST_OBJECTS_ALL,
+                                      g_hash_table_size (parent_objects));
+}
+
+static void
+test_prune_progress (gconstpointer data)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) repo_path = g_file_new_for_path ("prunerepo");
+  glnx_unref_object OstreeRepo *repo = NULL;
+  glnx_unref_object OstreeAsyncProgress *progress = ostree_async_progress_new ();
+  g_autoptr(GHashTable) refs = NULL;
+  g_autoptr(GHashTable) objects = NULL;
+  g_autoptr(GHashTable) reachable = ostree_repo_traverse_new_reachable ();
+  g_autoptr(GHashTable) prefixes = g_hash_table_new (NULL, NULL);
+  OstreeRepoPruneOptions opts = { 0, };
+  GHashTableIter iter;
+  gpointer key;
+  guint expected_pruned = 0;
+  guint64 expected_bytes = 0;
+  gint n_total, n_pruned;
+  guint64 freed_bytes;
+
+  /* Work on a copy, since this deletes everything */
+  g_assert (ot_test_run_libtest ("rm -rf prunerepo && cp -a repo prunerepo", &error));
+  g_assert_no_error (error);
+  repo = ostree_repo_new (repo_path);
+  g_assert (ostree_repo_open (repo, NULL, &error));
+  g_assert_no_error (error);
+
+  g_assert (ostree_repo_list_refs (repo, NULL, &refs, NULL, &error));
+  g_assert_no_error (error);
+  g_hash_table_iter_init (&iter, refs);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_autofree char *remote = NULL;
+      g_autofree char *ref = NULL;
+
+      g_assert (ostree_parse_refspec (key, &remote, &ref, &error));
+      g_assert_no_error (error);
+      g_assert (ostree_repo_set_ref_immediate (repo, remote, ref, NULL, NULL, &error));
+      g_assert_no_error (error);
+    }
+
+  /* What deleting the objects one by one would free */
+  g_assert (ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_LOOSE,
+                                      &objects, NULL, &error));
+  g_assert_no_error (error);
+  g_hash_table_iter_init (&iter, objects);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+      guint64 size;
+
+      ostree_object_name_deserialize (key, &checksum, &objtype);
+      g_assert (ostree_repo_query_object_storage_size (repo, objtype, checksum, &size,
+                                                       NULL, &error));
+      g_assert_no_error (error);
+      expected_pruned++;
+      expected_bytes += size;
+      g_hash_table_add (prefixes, GUINT_TO_POINTER (g_ascii_xdigit_value (checksum[0]) << 4 |
+                                                    g_ascii_xdigit_value (checksum[1])));
+    }
+  /* Make sure this covers several shards */
+  g_assert_cmpuint (g_hash_table_size (prefixes), >, 1);
+
+  opts.flags = OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY;
+  opts.reachable = reachable;
+  opts.progress = progress;
+  g_assert (ostree_repo_prune_from_reachable (repo, &opts, &n_total, &n_pruned, &freed_bytes,
+                                              NULL, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpint (n_total, ==, expected_pruned);
+  g_assert_cmpint (n_pruned, ==, expected_pruned);
+  g_assert_cmpuint (freed_bytes, ==, expected_bytes);
+  g_assert_cmpuint (ostree_async_progress_get_uint (progress, "unreachable-objects"), ==, expected_pruned);
+  g_assert_cmpuint (ostree_async_progress_get_uint (progress, "pruned-objects"), ==, expected_pruned);
+  g_assert_cmpuint (ostree_async_progress_get_uint64 (progress, "pruned-bytes"), ==, expected_bytes);
+
+  g_clear_pointer (&objects, g_hash_table_unref);
+  g_assert (ostree_repo_list_objects (repo, OSTREE_REPO_LIST_OBJECTS_LOOSE,
+                                      &objects, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_hash_table_size (objects), ==, 0);
+}
+
 int main (int argc, char **argv)
 {
   g_autoptr(GError) error = NULL;
@@ -232,6 +549,10 @@ int main (int argc, char **argv)
   g_test_add_data_func ("/repo-not-system", repo, test_repo_is_not_system);
   g_test_add_data_func ("/raw-file-to-archive-z2-stream", repo, test_raw_file_to_archive_z2_stream);
   g_test_add_data_func ("/objectwrites", repo, test_object_writes);
+  g_test_add_data_func ("/lazy-mtree", repo, test_lazy_mtree);
+  g_test_add_data_func ("/walk-tree", repo, test_walk_tree);
+  g_test_add_data_func ("/foreach-object", repo, test_foreach_object);
+  g_test_add_data_func ("/prune-progress", repo, test_prune_progress);
 
   return g_test_run();
  out:
@@ -26,7 +26,7 @@ skip_without_user_xattrs
 bindatafiles="bash true ostree"
 morebindatafiles="false ls"
 
-echo '1..12'
+echo '1..13'
 
 mkdir repo
 ostree_repo_init repo --mode=archive-z2
@@ -261,3 +261,17 @@ fi
 assert_file_has_content err.txt "Invalid rev 'GARBAGE'"
 
 echo 'ok handle bad delta name'
+
+${CMD_PREFIX} ostree --repo=repo summary -u > summary-out.txt
+assert_file_has_content summary-out.txt "Regenerated summary in"
+assert_has_file repo/tmp/cache/delta-superblock-checksums
+# Regenerating a delta must not reuse the cached superblock checksum
+${CMD_PREFIX} ostree --repo=repo static-delta generate --inline --from=test --to=otherbranch
+${CMD_PREFIX} ostree --repo=repo summary -u
+rm -rf repo2
+mkdir repo2 && ostree_repo_init repo2 --mode=bare-user
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo test
+${CMD_PREFIX} ostree --repo=repo2 pull-local --require-static-deltas repo otherbranch
+${CMD_PREFIX} ostree --repo=repo2 fsck
+
+echo 'ok summary superblock checksum cache'
@@ -23,7 +23,7 @@ set -euo pipefail
 
 setup_test_repository "archive-z2"
 
-echo '1..5'
+echo '1..9'
 
 $OSTREE checkout test2 test2-co
 $OSTREE commit --no-xattrs -b test2-noxattrs -s "test2 without xattrs" --tree=dir=test2-co
@@ -68,6 +68,66 @@ echo 'ok export --prefix --subpath gnutar diff (no xattrs)'
 
 rm test2.tar test2-subpath.tar diff.txt t t2 t3 t4 -rf
 
+cd ${test_tmpdir}
+${OSTREE} 'export' test2-noxattrs -o test2.tar
+${OSTREE} 'export' --jobs=4 test2-noxattrs -o test2-jobs.tar
+cmp test2.tar test2-jobs.tar
+rm test2-jobs.tar
+
+echo 'ok export --jobs'
+
+cd ${test_tmpdir}
+longname=$(printf 'x%.0s' $(seq 150))
+mkdir -p longnames/${longname}
+echo "long name content" > longnames/${longname}/${longname}
+ln -s ${longname}/${longname} longnames/longlink
+$OSTREE commit --no-xattrs -b test2-longnames -s "long names" --tree=dir=longnames
+${OSTREE} 'export' test2-longnames -o test2-longnames.tar
+mkdir t
+(cd t && tar xf ../test2-longnames.tar)
+${CMD_PREFIX} ostree --repo=repo diff --no-xattrs test2-longnames ./t > diff.txt
+assert_file_empty diff.txt
+rm longnames test2-longnames.tar diff.txt t -rf
+
+echo 'ok export long names'
+
+cd ${test_tmpdir}
+touch test-xattrs
+if setfattr -n user.testvalue -v somevalue test-xattrs 2>/dev/null; then
+    mkdir repo-bare-user
+    ${CMD_PREFIX} ostree --repo=repo-bare-user init --mode=bare-user
+    ${CMD_PREFIX} ostree --repo=repo-bare-user pull-local repo test2-noxattrs
+    ${CMD_PREFIX} ostree --repo=repo-bare-user export test2-noxattrs -o test2-bare-user.tar
+    cmp test2.tar test2-bare-user.tar
+    rm repo-bare-user test2-bare-user.tar -rf
+    echo 'ok export from bare-user repo'
+else
+    echo 'ok export from bare-user repo # SKIP this test requires xattr support'
+fi
+rm test2.tar test-xattrs -f
+
+cd ${test_tmpdir}
+mkdir xattrs-src
+echo "xattr content" > xattrs-src/file
+if setfattr -n user.testvalue -v somevalue xattrs-src/file 2>/dev/null; then
+    $OSTREE commit -b test2-xattrs -s "with xattrs" --tree=dir=xattrs-src
+    ${OSTREE} 'export' test2-xattrs -o test2-xattrs.tar
+    mkdir t
+    (cd t && tar --xattrs --xattrs-include='user.*' -xf ../test2-xattrs.tar)
+    getfattr -n user.testvalue --only-values t/file > v
+    assert_file_has_content v somevalue
+    ${OSTREE} 'export' --no-xattrs test2-xattrs -o test2-xattrs-skipped.tar
+    mkdir t2
+    (cd t2 && tar --xattrs --xattrs-include='user.*' -xf ../test2-xattrs-skipped.tar)
+    getfattr -d t2/file > attrs
+    assert_not_file_has_content attrs testvalue
+    rm test2-xattrs.tar test2-xattrs-skipped.tar t t2 v attrs -rf
+    echo 'ok export xattrs'
+else
+    echo 'ok export xattrs # SKIP this test requires xattr support'
+fi
+rm xattrs-src -rf
+
 cd ${test_tmpdir}
 ${OSTREE} 'export' test2 -o test2.tar
 ${OSTREE} commit -b test2-from-tar -s 'Import from tar' --tree=tar=test2.tar
@@ -27,7 +27,7 @@ if ! has_gpgme; then
     exit 0
 fi
 
-echo "1..1"
+echo "1..2"
 
 setup_test_repository "archive-z2"
 
@@ -43,6 +43,22 @@ assert_file_has_content test2-show 'Found 1 signature'
 ${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test2 | grep -o 'Found [[:digit:]] signature' > test2-show
 assert_file_has_content test2-show 'Found 1 signature'
 
+# The merged keyrings are kept in the repo cache and reused
+ls repo/tmp/cache/gpg > gpg-homes.txt
+assert_file_has_content gpg-homes.txt '^[0-9a-f]\{64\}$'
+assert_not_file_has_content gpg-homes.txt '^tmp-'
+${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test2 | grep -o 'Found [[:digit:]] signature' > test2-show
+assert_file_has_content test2-show 'Found 1 signature'
+ls repo/tmp/cache/gpg > gpg-homes-2.txt
+cmp gpg-homes.txt gpg-homes-2.txt
+${OSTREE} config set core.gpg-cache false
+rm repo/tmp/cache/gpg -rf
+${OSTREE} show --gpg-homedir=${TEST_GPG_KEYHOME} test2 | grep -o 'Found [[:digit:]] signature' > test2-show
+assert_file_has_content test2-show 'Found 1 signature'
+assert_not_has_dir repo/tmp/cache/gpg
+${OSTREE} config set core.gpg-cache true
+echo "ok gpg keyring cache"
+
 # Now sign a commit with 3 different keys
 cd ${test_tmpdir}
 ${OSTREE} commit -b test2 -s "A GPG signed commit" -m "Signed commit body" --gpg-sign=${TEST_GPG_KEYID_1} --gpg-sign=${TEST_GPG_KEYID_2} --gpg-sign=${TEST_GPG_KEYID_3} --gpg-homedir=${TEST_GPG_KEYHOME} --tree=dir=files
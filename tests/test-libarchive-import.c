@@ -354,6 +354,62 @@ test_libarchive_ostree_convention (gconstpointer data)
   g_assert_no_error (error);
 }
 
+static char *
+get_ref_contents_checksum (OstreeRepo  *repo,
+                           const char  *ref,
+                           GError     **error)
+{
+  g_autoptr(GFile) root = NULL;
+
+  if (!ostree_repo_read_commit (repo, ref, &root, NULL, NULL, error))
+    return NULL;
+
+  return g_strdup (ostree_repo_file_tree_get_contents_checksum (OSTREE_REPO_FILE (root)));
+}
+
+static void
+test_libarchive_parallel (gconstpointer data)
+{
+  TestData *td = (void*)data;
+  GError *error = NULL;
+  ot_cleanup_read_archive struct archive *a = archive_read_new ();
+  ot_cleanup_read_archive struct archive *a_parallel = archive_read_new ();
+  OstreeRepoImportArchiveOptions opts = { 0, };
+  g_autofree char *sequential_csum = NULL;
+  g_autofree char *parallel_csum = NULL;
+
+  if (skip_if_no_xattr (td))
+    goto out;
+
+  opts.autocreate_parents = TRUE;
+  opts.use_ostree_convention = TRUE;
+  opts.ignore_unsupported_content = TRUE;
+
+  test_archive_setup (td->fd, a);
+  if (!import_write_and_ref (td->repo, &opts, a, "bar", NULL, &error))
+    goto out;
+  sequential_csum = get_ref_contents_checksum (td->repo, "bar", &error);
+  if (!sequential_csum)
+    goto out;
+
+  opts.parallel = TRUE;
+
+  test_archive_setup (td->fd, a_parallel);
+  if (!import_write_and_ref (td->repo, &opts, a_parallel, "bar", NULL, &error))
+    goto out;
+  parallel_csum = get_ref_contents_checksum (td->repo, "bar", &error);
+  if (!parallel_csum)
+    goto out;
+
+  g_assert_cmpstr (sequential_csum, ==, parallel_csum);
+
+  if (!check_ostree_convention (error))
+    goto out;
+
+ out:
+  g_assert_no_error (error);
+}
+
 static GVariant*
 xattr_cb (OstreeRepo  *repo,
           const char  *path,
@@ -555,6 +611,7 @@ int main (int argc, char **argv)
   g_test_add_data_func ("/libarchive/error-device-file", &td, test_libarchive_error_device_file);
   g_test_add_data_func ("/libarchive/ignore-device-file", &td, test_libarchive_ignore_device_file);
   g_test_add_data_func ("/libarchive/ostree-convention", &td, test_libarchive_ostree_convention);
+  g_test_add_data_func ("/libarchive/parallel", &td, test_libarchive_parallel);
   g_test_add_data_func ("/libarchive/xattr-callback", &td, test_libarchive_xattr_callback);
   g_test_add_data_func ("/libarchive/no-use-entry-pathname", &td, test_libarchive_no_use_entry_pathname);
   g_test_add_data_func ("/libarchive/use-entry-pathname", &td, test_libarchive_use_entry_pathname);
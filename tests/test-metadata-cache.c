@@ -0,0 +1,146 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "libglnx.h"
+
+#include "ostree-metadata-cache.h"
+
+#define ENTRY_DATA_SIZE 1000
+
+static char *
+make_checksum (guint i)
+{
+  g_autofree char *data = g_strdup_printf ("%u", i);
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256, data, -1);
+}
+
+static GVariant *
+make_variant (void)
+{
+  static guint8 data[ENTRY_DATA_SIZE];
+  return g_variant_ref_sink (g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data,
+                                                        sizeof (data), 1));
+}
+
+static void
+insert_one (OstreeMetadataCache *cache,
+            OstreeObjectType     objtype,
+            guint                i)
+{
+  g_autofree char *checksum = make_checksum (i);
+  g_autoptr(GVariant) v = make_variant ();
+  _ostree_metadata_cache_insert (cache, objtype, checksum, v);
+}
+
+static gboolean
+lookup_one (OstreeMetadataCache *cache,
+            OstreeObjectType     objtype,
+            guint                i)
+{
+  g_autofree char *checksum = make_checksum (i);
+  g_autoptr(GVariant) v = _ostree_metadata_cache_lookup (cache, objtype, checksum);
+  return v != NULL;
+}
+
+static void
+test_lru_eviction (void)
+{
+  /* Room for a bit more than 10 entries, including overhead */
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (10 * (ENTRY_DATA_SIZE + 100));
+  OstreeMetadataCacheStats stats;
+
+  for (guint i = 0; i < 20; i++)
+    {
+      insert_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, i);
+      /* Keep the first entry hot */
+      g_assert (lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 0));
+    }
+
+  _ostree_metadata_cache_get_stats (cache, &stats);
+  g_assert_cmpuint (stats.hits, ==, 20);
+  g_assert_cmpuint (stats.misses, ==, 0);
+  g_assert_cmpuint (stats.n_entries, <=, 10);
+  g_assert_cmpuint (stats.size, <=, 10 * (ENTRY_DATA_SIZE + 100));
+
+  g_assert (lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 0));
+  g_assert (lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 19));
+  g_assert (!lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 1));
+  /* The object type is part of the key */
+  g_assert (!lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_META, 19));
+
+  _ostree_metadata_cache_get_stats (cache, &stats);
+  g_assert_cmpuint (stats.hits, ==, 22);
+  g_assert_cmpuint (stats.misses, ==, 2);
+
+  _ostree_metadata_cache_free (cache);
+}
+
+static void
+test_remove (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (1024 * 1024);
+  OstreeMetadataCacheStats stats;
+
+  insert_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 1);
+  insert_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 2);
+  /* Inserting again replaces rather than duplicates */
+  insert_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 2);
+  _ostree_metadata_cache_get_stats (cache, &stats);
+  g_assert_cmpuint (stats.n_entries, ==, 2);
+
+  {
+    g_autofree char *checksum = make_checksum (1);
+    _ostree_metadata_cache_remove (cache, OSTREE_OBJECT_TYPE_COMMIT, checksum);
+  }
+  g_assert (!lookup_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 1));
+  g_assert (lookup_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 2));
+
+  _ostree_metadata_cache_clear (cache);
+  _ostree_metadata_cache_get_stats (cache, &stats);
+  g_assert_cmpuint (stats.n_entries, ==, 0);
+  g_assert_cmpuint (stats.size, ==, 0);
+  g_assert (!lookup_one (cache, OSTREE_OBJECT_TYPE_COMMIT, 2));
+
+  _ostree_metadata_cache_free (cache);
+}
+
+static void
+test_oversized (void)
+{
+  OstreeMetadataCache *cache = _ostree_metadata_cache_new (ENTRY_DATA_SIZE);
+
+  /* A single object larger than a fraction of the cache is not kept */
+  insert_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 1);
+  g_assert (!lookup_one (cache, OSTREE_OBJECT_TYPE_DIR_TREE, 1));
+
+  _ostree_metadata_cache_free (cache);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/metadata-cache/lru-eviction", test_lru_eviction);
+  g_test_add_func ("/metadata-cache/remove", test_remove);
+  g_test_add_func ("/metadata-cache/oversized", test_oversized);
+  return g_test_run ();
+}
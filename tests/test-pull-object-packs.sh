@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo "1..4"
+
+setup_fake_remote_repo1 "archive-z2"
+srvrepo=${test_tmpdir}/ostree-srv/gnomerepo
+rev=$(${CMD_PREFIX} ostree --repo=${srvrepo} rev-parse main)
+
+${CMD_PREFIX} ostree --repo=${srvrepo} summary -u --generate-packs
+assert_has_file ${srvrepo}/packs/${rev}.pack
+assert_has_file ${srvrepo}/packs/${rev}.index
+${CMD_PREFIX} ostree --repo=${srvrepo} summary --view > summary.txt
+assert_file_has_content_literal summary.txt "Object Packs (ostree.object-packs): ['${rev}']"
+echo "ok generate packs"
+
+cd ${test_tmpdir}
+rm repo -rf
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+assert_file_has_content httpd/httpd.log "packs/${rev}.pack"
+assert_not_file_has_content httpd/httpd.log '\.filez$'
+${CMD_PREFIX} ostree --repo=repo checkout origin:main checkout-origin-main
+assert_file_has_content checkout-origin-main/baz/cow moo
+echo "ok pull with object pack"
+
+# Without range support, we should fall back to fetching loose objects
+mkdir ${test_tmpdir}/httpd-noranges
+cd ${test_tmpdir}/httpd-noranges
+ln -s ${test_tmpdir}/ostree-srv ostree
+${OSTREE_HTTPD} --autoexit --log-file $(pwd)/httpd.log --daemonize -p ${test_tmpdir}/httpd-noranges-port --disable-range-requests
+port=$(cat ${test_tmpdir}/httpd-noranges-port)
+cd ${test_tmpdir}
+rm repo -rf
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin http://127.0.0.1:${port}/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+assert_file_has_content httpd-noranges/httpd.log '\.filez$'
+echo "ok pull with object pack fallback"
+
+# The threaded server handles Range requests itself
+mkdir ${test_tmpdir}/httpd-threaded
+cd ${test_tmpdir}/httpd-threaded
+ln -s ${test_tmpdir}/ostree-srv ostree
+${OSTREE_HTTPD} --autoexit --log-file $(pwd)/httpd.log --daemonize -p ${test_tmpdir}/httpd-threaded-port --threads=4
+port=$(cat ${test_tmpdir}/httpd-threaded-port)
+cd ${test_tmpdir}
+rm repo -rf
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin http://127.0.0.1:${port}/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+assert_file_has_content httpd-threaded/httpd.log "packs/${rev}.pack - GET 206 Partial Content"
+assert_not_file_has_content httpd-threaded/httpd.log '\.filez - '
+echo "ok pull with object pack from threaded httpd"
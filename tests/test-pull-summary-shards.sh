@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+. $(dirname $0)/libtest.sh
+
+echo "1..4"
+
+setup_fake_remote_repo1 "archive-z2"
+srvrepo=${test_tmpdir}/ostree-srv/gnomerepo
+for x in $(seq 10); do
+    ${CMD_PREFIX} ostree --repo=${srvrepo} commit -b other${x} --tree=dir=${test_tmpdir}/ostree-srv/gnomerepo-files
+done
+${CMD_PREFIX} ostree --repo=${srvrepo} config set core.summary-shards 4
+${CMD_PREFIX} ostree --repo=${srvrepo} static-delta generate main
+${CMD_PREFIX} ostree --repo=${srvrepo} summary -u
+assert_has_file ${srvrepo}/summary
+assert_has_file ${srvrepo}/summaries/index
+n_shards=$(ls ${srvrepo}/summaries/*.shard | wc -l)
+test ${n_shards} -le 4
+echo "ok generate summary shards"
+
+cd ${test_tmpdir}
+rm repo -rf
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull --require-static-deltas origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+assert_file_has_content httpd/httpd.log 'summaries/index'
+assert_file_has_content httpd/httpd.log '\.shard'
+assert_not_file_has_content httpd/httpd.log 'gnomerepo/summary'
+${CMD_PREFIX} ostree --repo=repo checkout origin:main checkout-origin-main
+assert_file_has_content checkout-origin-main/baz/cow moo
+echo "ok pull with summary shards"
+
+# The summary may be regenerated between fetching the index and a
+# shard; simulate that with shards which are gone or changed, and check
+# we fall back to the full summary
+for mangle in rm corrupt; do
+    ${CMD_PREFIX} ostree --repo=${srvrepo} summary -u
+    for shard in ${srvrepo}/summaries/*.shard; do
+        if test ${mangle} = rm; then
+            rm ${shard}
+        else
+            echo garbage > ${shard}
+        fi
+    done
+    rm repo -rf
+    ostree_repo_init repo
+    ${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+    ${CMD_PREFIX} ostree --repo=repo pull origin main
+    ${CMD_PREFIX} ostree --repo=repo fsck
+    assert_file_has_content httpd/httpd.log 'gnomerepo/summary'
+done
+echo "ok pull with out of date summary shards"
+
+# Disabling sharding removes the index, and clients use the summary again
+${CMD_PREFIX} ostree --repo=${srvrepo} config set core.summary-shards 0
+${CMD_PREFIX} ostree --repo=${srvrepo} summary -u
+assert_not_has_file ${srvrepo}/summaries/index
+rm repo -rf
+ostree_repo_init repo
+${CMD_PREFIX} ostree --repo=repo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+${CMD_PREFIX} ostree --repo=repo pull --require-static-deltas origin main
+${CMD_PREFIX} ostree --repo=repo fsck
+echo "ok pull without summary shards"
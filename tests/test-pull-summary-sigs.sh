@@ -100,11 +100,22 @@ assert_not_has_file repo/tmp/cache/summaries/origin.sig
 assert_has_file cachedir/summaries/origin
 assert_has_file cachedir/summaries/origin.sig
 
+# Merged GPG keyrings go to the custom cache dir too
+assert_has_dir cachedir/gpg
+assert_not_has_dir repo/tmp/cache/gpg
+
 rm cachedir/summaries/origin
 ${OSTREE} --repo=repo pull --cache-dir=cachedir origin main
 assert_not_has_file repo/tmp/cache/summaries/origin
 assert_has_file cachedir/summaries/origin
 
+# Verification still works if the keyring cache can't be used
+rm cachedir/gpg -rf
+touch cachedir/gpg
+rm cachedir/summaries/origin
+${OSTREE} --repo=repo pull --cache-dir=cachedir origin main
+assert_has_file cachedir/summaries/origin
+
 echo "ok pull with signed summary and cachedir"
 
 cd ${test_tmpdir}
@@ -23,7 +23,7 @@ set -euo pipefail
 
 setup_fake_remote_repo1 "archive-z2"
 
-echo '1..1'
+echo '1..3'
 
 cd ${test_tmpdir}
 mkdir repo
@@ -117,3 +117,55 @@ ${CMD_PREFIX} ostree --repo=repo refs | wc -l > refscount.create6
 assert_file_has_content refscount.create6 "^11$"
 
 echo "ok refs"
+
+${CMD_PREFIX} ostree --repo=repo refs | sort > refs.loose
+${CMD_PREFIX} ostree --repo=repo rev-parse local1 > local1.rev
+${CMD_PREFIX} ostree --repo=repo refs --pack
+assert_has_file repo/refs/packed
+assert_not_has_file repo/refs/heads/local1
+assert_not_has_file repo/refs/remotes/origin/remote1
+${CMD_PREFIX} ostree --repo=repo refs | sort > refs.packed
+cmp refs.loose refs.packed
+${CMD_PREFIX} ostree --repo=repo rev-parse local1 > local1.packed.rev
+cmp local1.rev local1.packed.rev
+${CMD_PREFIX} ostree --repo=repo rev-parse origin:remote1
+${CMD_PREFIX} ostree --repo=repo rev-parse origin/remote1
+${CMD_PREFIX} ostree --repo=repo refs --list origin:remote1 > refs
+assert_file_has_content refs "^origin:remote1$"
+${CMD_PREFIX} ostree --repo=repo refs --list origin > refs
+assert_file_has_content refs "^origin/remote1$"
+
+# Updates go into the packed file
+${CMD_PREFIX} ostree --repo=repo commit --branch=local2 -m local2 -s local2 tree
+assert_not_has_file repo/refs/heads/local2
+${CMD_PREFIX} ostree --repo=repo rev-parse local2
+${CMD_PREFIX} ostree --repo=repo refs --delete local1
+if ${CMD_PREFIX} ostree --repo=repo rev-parse local1 2>/dev/null; then
+    assert_not_reached "deleted packed ref still resolves"
+fi
+${CMD_PREFIX} ostree --repo=repo refs | wc -l > refscount.packed
+assert_file_has_content refscount.packed "^11$"
+
+# Loose refs take precedence
+${CMD_PREFIX} ostree --repo=repo rev-parse ctest > ctest.rev
+cp ctest.rev repo/refs/heads/local2
+${CMD_PREFIX} ostree --repo=repo rev-parse local2 > local2.rev
+cmp ctest.rev local2.rev
+
+echo "ok packed refs"
+
+# Concurrent writers all end up in the packed file
+pids=
+for i in $(seq 16); do
+    ${CMD_PREFIX} ostree --repo=repo refs local2 --create=concurrent/$i &
+    pids="$pids $!"
+done
+for pid in $pids; do
+    wait $pid
+done
+${CMD_PREFIX} ostree --repo=repo refs --list concurrent | wc -l > refscount.concurrent
+assert_file_has_content refscount.concurrent "^16$"
+find repo/refs/heads -type f -path '*concurrent*' > loose.concurrent
+test ! -s loose.concurrent
+
+echo "ok concurrent packed ref updates"
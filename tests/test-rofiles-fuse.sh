@@ -26,7 +26,7 @@ skip_without_user_xattrs
 
 setup_test_repository "bare-user"
 
-echo "1..6"
+echo "1..7"
 
 mkdir mnt
 
@@ -81,3 +81,17 @@ fi
 assert_file_has_content err.txt "Unable to do hardlink checkout across devices"
 
 echo "ok checkout copy fallback"
+
+fusermount -u ${test_tmpdir}/mnt
+rofiles-fuse --copyup checkout-test2 mnt
+echo "copyup content" > mnt/firstfile
+assert_file_has_content mnt/firstfile "copyup content"
+assert_file_has_content checkout-test2/firstfile "copyup content"
+echo "more copyup content" >> mnt/firstfile
+assert_file_has_content checkout-test2/firstfile "more copyup content"
+${CMD_PREFIX} ostree --repo=repo cat test2 /firstfile > firstfile-orig.txt
+assert_file_has_content firstfile-orig.txt first
+assert_not_file_has_content firstfile-orig.txt copyup
+${CMD_PREFIX} ostree --repo=repo fsck
+
+echo "ok copyup"